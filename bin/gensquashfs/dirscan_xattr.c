@@ -6,105 +6,126 @@
  */
 #include "mkfs.h"
 
-#ifdef HAVE_SYS_XATTR_H
-static char *get_full_path(const char *prefix, tree_node_t *node)
-{
-	char *path = NULL, *new = NULL;
-	size_t path_len, prefix_len;
-	int ret;
+/*
+  The tree is walked once, in the sorted order of the tree, so the xattr table
+  does not depend on the order in which the directories were read. The path
+  of the current node is built up incrementally, behind the path of the input
+  directory. The part after it is the absolute path in the image, used for
+  the SELinux lookup.
+ */
+typedef struct {
+	sqfs_xattr_writer_t *xwr;
+	void *selinux_handle;
+	bool scan_xattr;
+
+	char *path;
+	size_t path_len;
+	size_t path_max;
+
+	/* length of the input directory in front of the node path */
+	size_t prefix_len;
 
-	path = fstree_get_path(node);
-	if (path == NULL)
-		goto fail;
+	char *keys;
+	size_t keys_max;
 
-	ret = canonicalize_name(path);
-	assert(ret == 0);
+	char *value;
+	size_t value_max;
+} xattr_scan_t;
 
-	path_len = strlen(path);
-	prefix_len = strlen(prefix);
+static int grow_buffer(char **buffer, size_t *max, size_t size)
+{
+	char *new;
+
+	if (size <= *max)
+		return 0;
+
+	new = realloc(*buffer, size);
+	if (new == NULL)
+		return -1;
 
-	while (prefix_len > 0 && prefix[prefix_len - 1] == '/')
-		--prefix_len;
+	*buffer = new;
+	*max = size;
+	return 0;
+}
 
-	if (prefix_len > 0) {
-		new = realloc(path, path_len + prefix_len + 2);
-		if (new == NULL)
-			goto fail;
+static int path_push(xattr_scan_t *scan, const char *name, size_t *old_len)
+{
+	size_t len = strlen(name), new_len;
+	/* the root is "/", everything else is "/a/b" without a trailing slash */
+	bool sep = (scan->path_len - scan->prefix_len) > 1;
 
-		path = new;
+	*old_len = scan->path_len;
+	new_len = scan->path_len + len + (sep ? 1 : 0);
 
-		memmove(path + prefix_len + 1, path, path_len + 1);
-		memcpy(path, prefix, prefix_len);
-		path[prefix_len] = '/';
+	if (grow_buffer(&scan->path, &scan->path_max, new_len + 1)) {
+		perror("building node path");
+		return -1;
 	}
 
-	return path;
-fail:
-	perror("getting full path for xattr scan");
-	free(path);
-	return NULL;
+	if (sep)
+		scan->path[scan->path_len++] = '/';
+
+	memcpy(scan->path + scan->path_len, name, len + 1);
+	scan->path_len = new_len;
+	return 0;
+}
+
+static void path_pop(xattr_scan_t *scan, size_t old_len)
+{
+	scan->path_len = old_len;
+	scan->path[old_len] = '\0';
 }
 
-static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
+#ifdef HAVE_SYS_XATTR_H
+static int xattr_from_path(xattr_scan_t *scan)
 {
-	char *key, *value = NULL, *buffer = NULL;
+	const char *name = scan->path;
 	ssize_t buflen, vallen, keylen;
+	char *key;
 	int ret;
 
-	buflen = llistxattr(path, NULL, 0);
-	if (buflen < 0) {
-		fprintf(stderr, "llistxattr %s: %s", path, strerror(errno));
-		return -1;
-	}
+	buflen = llistxattr(name, NULL, 0);
+	if (buflen < 0)
+		goto fail_list;
 
 	if (buflen == 0)
 		return 0;
 
-	buffer = malloc(buflen);
-	if (buffer == NULL) {
+	if (grow_buffer(&scan->keys, &scan->keys_max, buflen)) {
 		perror("xattr name buffer");
 		return -1;
 	}
 
-	buflen = llistxattr(path, buffer, buflen);
-	if (buflen == -1) {
-		fprintf(stderr, "llistxattr %s: %s", path, strerror(errno));
-		goto fail;
-	}
+	buflen = llistxattr(name, scan->keys, scan->keys_max);
+	if (buflen == -1)
+		goto fail_list;
 
-	key = buffer;
+	key = scan->keys;
 	while (buflen > 0) {
-		vallen = lgetxattr(path, key, NULL, 0);
-		if (vallen == -1) {
-			fprintf(stderr, "lgetxattr %s: %s",
-				path, strerror(errno));
-			goto fail;
-		}
+		vallen = lgetxattr(name, key, NULL, 0);
+		if (vallen == -1)
+			goto fail_get;
 
 		if (vallen > 0) {
-			value = calloc(1, vallen);
-			if (value == NULL) {
+			if (grow_buffer(&scan->value, &scan->value_max,
+					vallen)) {
 				perror("allocating xattr value buffer");
-				goto fail;
+				return -1;
 			}
 
-			vallen = lgetxattr(path, key, value, vallen);
-			if (vallen == -1) {
-				fprintf(stderr, "lgetxattr %s: %s\n",
-					path, strerror(errno));
-				goto fail;
-			}
+			vallen = lgetxattr(name, key, scan->value,
+					   scan->value_max);
+			if (vallen == -1)
+				goto fail_get;
 
-			ret = sqfs_xattr_writer_add(xwr, key, value, vallen);
+			ret = sqfs_xattr_writer_add(scan->xwr, key,
+						    scan->value, vallen);
 			if (ret) {
-				sqfs_perror(path,
+				sqfs_perror(name,
 					    "storing xattr key-value pairs",
 					    ret);
-				goto fail;
+				return -1;
 			}
-
-			free(value);
-			value = NULL;
 		}
 
 		keylen = strlen(key) + 1;
@@ -112,76 +133,59 @@ static int xattr_from_path(sqfs_xattr_writer_t *xwr, const char *path)
 		key += keylen;
 	}
 
-	free(buffer);
 	return 0;
-fail:
-	free(value);
-	free(buffer);
+fail_list:
+	fprintf(stderr, "llistxattr %s: %s\n", name, strerror(errno));
+	return -1;
+fail_get:
+	fprintf(stderr, "lgetxattr %s: %s\n", name, strerror(errno));
 	return -1;
 }
 #endif
 
-static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
-			  sqfs_xattr_writer_t *xwr, bool scan_xattr,
-			  tree_node_t *node)
+static int xattr_xcan_dfs(xattr_scan_t *scan, tree_node_t *node)
 {
-	char *path;
+	const char *path = scan->path + scan->prefix_len;
+	tree_node_t *it;
+	size_t old_len;
 	int ret;
 
-	ret = sqfs_xattr_writer_begin(xwr, 0);
+	ret = sqfs_xattr_writer_begin(scan->xwr, 0);
 	if (ret) {
-		sqfs_perror(node->name, "recoding xattr key-value pairs\n",
-			    ret);
+		sqfs_perror(path, "recoding xattr key-value pairs", ret);
 		return -1;
 	}
 
 #ifdef HAVE_SYS_XATTR_H
-	if (scan_xattr) {
-		path = get_full_path(path_prefix, node);
-		if (path == NULL)
-			return -1;
-
-		ret = xattr_from_path(xwr, path);
-		free(path);
-
-		if (ret)
-			return -1;
-	}
-#else
-	(void)path_prefix;
+	if (scan->scan_xattr && xattr_from_path(scan))
+		return -1;
 #endif
 
-	if (selinux_handle != NULL) {
-		path = fstree_get_path(node);
-		if (path == NULL) {
-			perror("reconstructing absolute path");
+	if (scan->selinux_handle != NULL) {
+		if (selinux_relable_node(scan->selinux_handle, scan->xwr,
+					 node, path)) {
 			return -1;
 		}
-
-		ret = selinux_relable_node(selinux_handle, xwr, node, path);
-		free(path);
-
-		if (ret)
-			return -1;
 	}
 
-	if (sqfs_xattr_writer_end(xwr, &node->xattr_idx)) {
-		sqfs_perror(node->name, "completing xattr key-value pairs",
-			    ret);
+	ret = sqfs_xattr_writer_end(scan->xwr, &node->xattr_idx);
+	if (ret) {
+		sqfs_perror(path, "completing xattr key-value pairs", ret);
 		return -1;
 	}
 
-	if (S_ISDIR(node->mode)) {
-		node = node->data.dir.children;
+	if (!S_ISDIR(node->mode))
+		return 0;
 
-		while (node != NULL) {
-			if (xattr_xcan_dfs(path_prefix, selinux_handle, xwr,
-					   scan_xattr, node)) {
-				return -1;
-			}
+	for (it = node->data.dir.children; it != NULL; it = it->next) {
+		if (path_push(scan, it->name, &old_len))
+			return -1;
 
-			node = node->next;
-		}
+		ret = xattr_xcan_dfs(scan, it);
+		path_pop(scan, old_len);
+
+		if (ret)
+			return -1;
 	}
 
 	return 0;
@@ -190,11 +194,42 @@ static int xattr_xcan_dfs(const char *path_prefix, void *selinux_handle,
 int xattrs_from_dir(fstree_t *fs, const char *path, void *selinux_handle,
 		    sqfs_xattr_writer_t *xwr, bool scan_xattr)
 {
+	xattr_scan_t scan;
+	int ret;
+
 	if (xwr == NULL)
 		return 0;
 
 	if (selinux_handle == NULL && !scan_xattr)
 		return 0;
 
-	return xattr_xcan_dfs(path, selinux_handle, xwr, scan_xattr, fs->root);
+	memset(&scan, 0, sizeof(scan));
+	scan.xwr = xwr;
+	scan.selinux_handle = selinux_handle;
+	scan.scan_xattr = scan_xattr;
+
+	/* only the extended attributes are read from the input directory */
+	if (!scan_xattr) {
+		path = "";
+	} else if (path == NULL) {
+		path = ".";
+	}
+
+	scan.prefix_len = strlen(path);
+
+	if (grow_buffer(&scan.path, &scan.path_max, scan.prefix_len + 64)) {
+		perror("building node path");
+		return -1;
+	}
+
+	memcpy(scan.path, path, scan.prefix_len);
+	strcpy(scan.path + scan.prefix_len, "/");
+	scan.path_len = scan.prefix_len + 1;
+
+	ret = xattr_xcan_dfs(&scan, fs->root);
+
+	free(scan.path);
+	free(scan.keys);
+	free(scan.value);
+	return ret;
 }
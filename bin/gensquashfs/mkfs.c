@@ -6,10 +6,81 @@
  */
 #include "mkfs.h"
 
-static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
-		      options_t *opt)
+static char *get_node_path(file_info_t *fi)
 {
-	sqfs_u64 filesize;
+	tree_node_t *node = container_of(fi, tree_node_t, data.file);
+	char *path;
+	int ret;
+
+	path = fstree_get_path(node);
+	if (path == NULL) {
+		perror("reconstructing file path");
+		return NULL;
+	}
+
+	ret = canonicalize_name(path);
+	assert(ret == 0);
+	return path;
+}
+
+static int get_total_size(fstree_t *fs, sqfs_u64 *out)
+{
+	char *node_path = NULL;
+	const char *path;
+	sqfs_file_t *file;
+	file_info_t *fi;
+
+	*out = 0;
+
+	for (fi = fs->files; fi != NULL; fi = fi->next) {
+		path = fi->input_file;
+
+		if (path == NULL) {
+			node_path = get_node_path(fi);
+			if (node_path == NULL)
+				return -1;
+			path = node_path;
+		}
+
+		file = sqfs_open_file(path, SQFS_FILE_OPEN_READ_ONLY);
+		if (file == NULL) {
+			perror(path);
+			free(node_path);
+			return -1;
+		}
+
+		*out += file->get_size(file);
+		sqfs_destroy(file);
+		free(node_path);
+		node_path = NULL;
+	}
+
+	return 0;
+}
+
+/* spread the input that is left over the time left until the deadline */
+static void update_target_rate(sqfs_block_processor_t *data,
+			       const options_t *opt, sqfs_u64 start,
+			       sqfs_u64 bytes_left)
+{
+	sqfs_u64 now = get_time_ns(), ms_left = 0, rate;
+	sqfs_u64 end = start + (sqfs_u64)opt->deadline * 1000000000UL;
+
+	if (now < end)
+		ms_left = (end - now) / 1000000UL;
+
+	/* when running late, simply go as fast as possible */
+	rate = 0xFFFFFFFFFFFFFFFFUL;
+	if (ms_left > 0)
+		rate = (bytes_left * 1000UL) / ms_left;
+
+	sqfs_block_processor_set_target_rate(data, rate);
+}
+
+static int pack_files(sqfs_block_processor_t *data, sqfs_reference_t *ref,
+		      fstree_t *fs, options_t *opt)
+{
+	sqfs_u64 filesize, group, start = 0, bytes_left = 0;
 	sqfs_file_t *file;
 	tree_node_t *node;
 	const char *path;
@@ -23,25 +94,25 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 		return -1;
 	}
 
-	for (fi = fs->files; fi != NULL; fi = fi->next) {
-		if (fi->input_file == NULL) {
-			node = container_of(fi, tree_node_t, data.file);
+	if (opt->deadline > 0) {
+		start = get_time_ns();
 
-			node_path = fstree_get_path(node);
-			if (node_path == NULL) {
-				perror("reconstructing file path");
-				return -1;
-			}
+		if (get_total_size(fs, &bytes_left))
+			return -1;
+	}
 
-			ret = canonicalize_name(node_path);
-			assert(ret == 0);
+	for (fi = fs->files; fi != NULL; fi = fi->next) {
+		node = container_of(fi, tree_node_t, data.file);
+		node_path = NULL;
 
-			path = node_path;
-		} else {
-			node_path = NULL;
-			path = fi->input_file;
+		if (fi->input_file == NULL || ref != NULL) {
+			node_path = get_node_path(fi);
+			if (node_path == NULL)
+				return -1;
 		}
 
+		path = fi->input_file == NULL ? node_path : fi->input_file;
+
 		if (!opt->cfg.quiet)
 			printf("packing %s\n", path);
 
@@ -58,7 +129,23 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 		if (opt->no_tail_packing && filesize > opt->cfg.block_size)
 			flags |= SQFS_BLK_DONT_FRAGMENT;
 
-		ret = write_data_from_file(path, data, &fi->inode, file, flags);
+		if (opt->deadline > 0) {
+			update_target_rate(data, opt, start, bytes_left);
+			bytes_left -= filesize < bytes_left ? filesize :
+				bytes_left;
+		}
+
+		if (ref != NULL)
+			sqfs_reference_begin_file(ref, node_path);
+
+		/* only identifies the directory, the packing order is not
+		   affected by the value */
+		group = 0;
+		if (opt->cfg.group_fragments)
+			group = (sqfs_u64)(uintptr_t)node->parent;
+
+		ret = write_data_from_file(path, data, ref, &fi->inode, file,
+					   flags, group);
 		sqfs_destroy(file);
 		free(node_path);
 
@@ -69,47 +156,6 @@ static int pack_files(sqfs_block_processor_t *data, fstree_t *fs,
 	return 0;
 }
 
-static int relabel_tree_dfs(const char *filename, sqfs_xattr_writer_t *xwr,
-			    tree_node_t *n, void *selinux_handle)
-{
-	char *path = fstree_get_path(n);
-	int ret;
-
-	if (path == NULL) {
-		perror("getting absolute node path for SELinux relabeling");
-		return -1;
-	}
-
-	ret = sqfs_xattr_writer_begin(xwr, 0);
-	if (ret) {
-		sqfs_perror(filename, "recording xattr key-value pairs", ret);
-		return -1;
-	}
-
-	if (selinux_relable_node(selinux_handle, xwr, n, path)) {
-		free(path);
-		return -1;
-	}
-
-	ret = sqfs_xattr_writer_end(xwr, &n->xattr_idx);
-	if (ret) {
-		sqfs_perror(filename, "flushing completed key-value pairs",
-			    ret);
-		return -1;
-	}
-
-	free(path);
-
-	if (S_ISDIR(n->mode)) {
-		for (n = n->data.dir.children; n != NULL; n = n->next) {
-			if (relabel_tree_dfs(filename, xwr, n, selinux_handle))
-				return -1;
-		}
-	}
-
-	return 0;
-}
-
 static int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
 		       void *selinux_handle)
 {
@@ -118,8 +164,7 @@ static int read_fstree(fstree_t *fs, options_t *opt, sqfs_xattr_writer_t *xwr,
 	ret = fstree_from_file(fs, opt->infile, opt->packdir);
 
 	if (ret == 0 && selinux_handle != NULL)
-		ret = relabel_tree_dfs(opt->cfg.filename, xwr,
-				       fs->root, selinux_handle);
+		ret = xattrs_from_dir(fs, NULL, selinux_handle, xwr, false);
 
 	return ret;
 }
@@ -191,7 +236,7 @@ int main(int argc, char **argv)
 			goto out;
 	}
 
-	if (pack_files(sqfs.data, &sqfs.fs, &opt))
+	if (pack_files(sqfs.data, sqfs.ref, &sqfs.fs, &opt))
 		goto out;
 
 	if (sqfs_writer_finish(&sqfs, &opt.cfg))
@@ -11,6 +11,7 @@
 
 #include "common.h"
 #include "fstree.h"
+#include "util.h"
 
 #ifdef HAVE_SYS_XATTR_H
 #include <sys/xattr.h>
@@ -56,6 +57,9 @@ typedef struct {
 	bool force_gid;
 
 	bool scan_xattr;
+
+	/* seconds for packing the file data, 0 if there is no deadline */
+	unsigned long deadline;
 } options_t;
 
 void process_command_line(options_t *opt, int argc, char **argv);
@@ -8,6 +8,15 @@
 
 enum {
 	ALL_ROOT_OPTION = 1,
+	PROBE_THRESHOLD_OPTION,
+	MIN_GAIN_OPTION,
+	REFERENCE_OPTION,
+	TRACE_OPTION,
+	MEM_LIMIT_OPTION,
+	EARLY_DEDUP_OPTION,
+	GROUP_FRAGMENTS_OPTION,
+	TARGET_RATE_OPTION,
+	DEADLINE_OPTION,
 };
 
 static struct option long_opts[] = {
@@ -23,6 +32,15 @@ static struct option long_opts[] = {
 	{ "pack-dir", required_argument, NULL, 'D' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "mem-limit", required_argument, NULL, MEM_LIMIT_OPTION },
+	{ "probe-threshold", required_argument, NULL, PROBE_THRESHOLD_OPTION },
+	{ "min-gain", required_argument, NULL, MIN_GAIN_OPTION },
+	{ "early-dedup", no_argument, NULL, EARLY_DEDUP_OPTION },
+	{ "reference", required_argument, NULL, REFERENCE_OPTION },
+	{ "trace", required_argument, NULL, TRACE_OPTION },
+	{ "group-fragments", optional_argument, NULL, GROUP_FRAGMENTS_OPTION },
+	{ "target-rate", required_argument, NULL, TARGET_RATE_OPTION },
+	{ "deadline", required_argument, NULL, DEADLINE_OPTION },
 	{ "keep-time", no_argument, NULL, 'k' },
 #ifdef HAVE_SYS_XATTR_H
 	{ "keep-xattr", no_argument, NULL, 'x' },
@@ -78,6 +96,25 @@ static const char *help_string =
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --mem-limit <size>          Pre-allocate this much memory for data blocks\n"
+"                              in flight and derive the queue backlog from\n"
+"                              it, instead of using --queue-backlog.\n"
+"  --probe-threshold <bits>    Entropy in bits per byte (0 to 8) from which\n"
+"                              on a data block is considered incompressible\n"
+"                              and stored as is, without trying to compress\n"
+"                              it. %.2f skips compressed and encrypted\n"
+"                              data, but can miss repeats far apart.\n"
+"                              Defaults to 0, i.e. compress every block.\n"
+"  --min-gain <percent>        Store data blocks uncompressed if compressing\n"
+"                              them saves less than this percentage.\n"
+"                              Defaults to 0.\n"
+"  --reference <image>         A previously built image with the same\n"
+"                              compressor and block size. Data blocks of\n"
+"                              files that are unchanged are copied from it\n"
+"                              instead of compressing them again.\n"
+"  --trace <file>              Record what happens to every data block and\n"
+"                              write a timeline in the Chrome trace event\n"
+"                              format to the given file.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -98,10 +135,27 @@ static const char *help_string =
 "                              this value, no matter what the pack file or\n"
 "                              directory entries actually specify.\n"
 "  --all-root                  A short hand for `--set-uid 0 --set-gid 0`.\n"
-"\n"
+"\n";
+
+static const char *help_string_more =
 "  --sort-file, -S <file>      Specify a \"sort file\" that can be used to\n"
 "                              micro manage the order of files during packing\n"
 "                              and behaviour (compression, fragmentation, ..)\n"
+"  --group-fragments[=<size>]  Collect up to <size> bytes of tail ends (64\n"
+"                              times the block size by default) and pack\n"
+"                              the tail ends of files from the same\n"
+"                              directory next to each other.\n"
+"  --early-dedup               Recognize files that are identical to one\n"
+"                              packed before by the SHA-256 digests of their\n"
+"                              blocks, and do not compress them at all.\n"
+"                              Hashing every block limits the throughput.\n"
+"  --target-rate <size>        Pick the compression level for each block,\n"
+"                              up to the configured one, so that at least\n"
+"                              <size> bytes of input per second can be\n"
+"                              compressed. Supported for gzip, xz and zstd.\n"
+"                              The output is not reproducible.\n"
+"  --deadline <seconds>        Like --target-rate, but derive the rate from\n"
+"                              the input left to pack and the time left.\n"
 "\n"
 #ifdef WITH_SELINUX
 "  --selinux, -s <file>        Specify an SELinux label file to get context\n"
@@ -210,7 +264,10 @@ const char *sort_details =
 void process_command_line(options_t *opt, int argc, char **argv)
 {
 	bool have_compressor;
+	double threshold;
+	size_t size;
 	int i, ret;
+	char *end;
 
 	memset(opt, 0, sizeof(*opt));
 	sqfs_writer_cfg_init(&opt->cfg);
@@ -270,6 +327,68 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		case 'Q':
 			opt->cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case MEM_LIMIT_OPTION:
+			if (parse_size("Memory limit", &opt->cfg.mem_limit,
+				       optarg, 0)) {
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case PROBE_THRESHOLD_OPTION:
+			threshold = strtod(optarg, &end);
+			if (end == optarg || *end != '\0' ||
+			    threshold < 0.0 || threshold > 8.0) {
+				fprintf(stderr, "Invalid probe threshold '%s', "
+					"expected a number from 0 to 8.\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			opt->cfg.probe_threshold = threshold * 1000.0;
+			break;
+		case MIN_GAIN_OPTION:
+			opt->cfg.min_gain = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' ||
+			    opt->cfg.min_gain >= 100) {
+				fprintf(stderr, "Invalid minimum gain '%s', "
+					"expected a percentage below 100.\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case EARLY_DEDUP_OPTION:
+			opt->cfg.early_dedup = true;
+			break;
+		case REFERENCE_OPTION:
+			opt->cfg.reference = optarg;
+			break;
+		case TRACE_OPTION:
+			opt->cfg.trace_file = optarg;
+			break;
+		case TARGET_RATE_OPTION:
+			if (parse_size("Target rate", &size, optarg, 0))
+				exit(EXIT_FAILURE);
+
+			opt->cfg.target_rate = size;
+			opt->cfg.adaptive_level = true;
+			break;
+		case DEADLINE_OPTION:
+			opt->deadline = strtoul(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || opt->deadline == 0) {
+				fprintf(stderr, "Invalid deadline '%s', "
+					"expected a number of seconds.\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			opt->cfg.adaptive_level = true;
+			break;
+		case GROUP_FRAGMENTS_OPTION:
+			opt->cfg.group_fragments = true;
+
+			if (optarg != NULL &&
+			    parse_size("Fragment buffer size",
+				       &opt->cfg.frag_defer_limit, optarg, 0)) {
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'B':
 			if (parse_size("Device block size",
 				       &opt->cfg.devblksize, optarg, 0)) {
@@ -328,7 +447,9 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			break;
 		case 'h':
 			printf(help_string,
+			       SQFS_WRITER_TYPICAL_PROBE_THRESHOLD / 1000.0,
 			       SQFS_DEFAULT_BLOCK_SIZE, SQFS_DEVBLK_SIZE);
+			fputs(help_string_more, stdout);
 			fputs(help_details, stdout);
 			fputs(sort_details, stdout);
 			compressor_print_available();
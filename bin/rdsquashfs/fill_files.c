@@ -15,11 +15,11 @@ static struct file_ent {
 static size_t num_files = 0, max_files = 0;
 static size_t block_size = 0;
 
-static int compare_files(const void *l, const void *r)
+static int compare_location(const struct file_ent *lhs,
+			    const struct file_ent *rhs)
 {
 	sqfs_u32 lhs_frag_idx, lhs_frag_off, rhs_frag_idx, rhs_frag_off;
 	sqfs_u64 lhs_size, rhs_size, lhs_start, rhs_start;
-	const struct file_ent *lhs = l, *rhs = r;
 
 	sqfs_inode_get_frag_location(lhs->inode, &lhs_frag_idx, &lhs_frag_off);
 	sqfs_inode_get_file_block_start(lhs->inode, &lhs_start);
@@ -34,8 +34,8 @@ static int compare_files(const void *l, const void *r)
 	   and the others are ordered by start block. */
 	if ((lhs_size % block_size) && (lhs_frag_off < block_size) &&
 	    (lhs_frag_idx != 0xFFFFFFFF)) {
-		if ((rhs_size % block_size) && (rhs_frag_off < block_size) &&
-		    (rhs_frag_idx != 0xFFFFFFFF))
+		if (!((rhs_size % block_size) && (rhs_frag_off < block_size) &&
+		      (rhs_frag_idx != 0xFFFFFFFF)))
 			return -1;
 
 		if (lhs_frag_idx < rhs_frag_idx)
@@ -62,6 +62,15 @@ order_by_start:
 	return lhs_start < rhs_start ? -1 : lhs_start > rhs_start ? 1 : 0;
 }
 
+static int compare_files(const void *l, const void *r)
+{
+	const struct file_ent *lhs = l, *rhs = r;
+	int ret = compare_location(lhs, rhs);
+
+	/* files with the same data end up next to each other */
+	return ret != 0 ? ret : inode_data_compare(lhs->inode, rhs->inode);
+}
+
 static int add_file(const sqfs_tree_node_t *node)
 {
 	struct file_ent *new;
@@ -133,11 +142,25 @@ static int gen_file_list_dfs(const sqfs_tree_node_t *n)
 	return 0;
 }
 
+static bool has_same_data(size_t i, size_t prev)
+{
+	sqfs_u64 size;
+
+	if (i == prev)
+		return false;
+
+	sqfs_inode_get_file_size(files[i].inode, &size);
+	if (size == 0)
+		return false;
+
+	return inode_data_compare(files[i].inode, files[prev].inode) == 0;
+}
+
 static int fill_files(sqfs_data_reader_t *data, int flags)
 {
 	int ret, openflags;
+	size_t i, prev = 0;
 	ostream_t *fp;
-	size_t i;
 
 	openflags = OSTREAM_OPEN_OVERWRITE;
 
@@ -145,6 +168,18 @@ static int fill_files(sqfs_data_reader_t *data, int flags)
 		openflags |= OSTREAM_OPEN_SPARSE;
 
 	for (i = 0; i < num_files; ++i) {
+		/* copy files that share their data from the last one unpacked,
+		   instead of uncompressing the same data over and over again */
+		if (has_same_data(i, prev) &&
+		    clone_file(files[prev].path, files[i].path,
+			       openflags) == 0) {
+			if (!(flags & UNPACK_QUIET))
+				printf("unpacking %s\n", files[i].path);
+			continue;
+		}
+
+		prev = i;
+
 		fp = ostream_open_file(files[i].path, openflags);
 		if (fp == NULL)
 			return -1;
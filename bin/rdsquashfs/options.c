@@ -24,6 +24,9 @@ static struct option long_opts[] = {
 #endif
 	{ "set-times", no_argument, NULL, 'T' },
 	{ "describe", no_argument, NULL, 'd' },
+	{ "verify", no_argument, NULL, 'v' },
+	{ "num-jobs", required_argument, NULL, 'j' },
+	{ "max-errors", required_argument, NULL, 'e' },
 	{ "chmod", no_argument, NULL, 'C' },
 	{ "chown", no_argument, NULL, 'O' },
 	{ "quiet", no_argument, NULL, 'q' },
@@ -33,7 +36,7 @@ static struct option long_opts[] = {
 };
 
 static const char *short_opts =
-	"l:c:u:p:x:s:DSFLCOEZTj:dqhV"
+	"l:c:u:p:x:s:DSFLCOEZTj:e:dvqhV"
 #ifdef HAVE_SYS_XATTR_H
 	"X"
 #endif
@@ -58,6 +61,9 @@ static const char *help_string =
 "                            the inode coresponding to a path, including\n"
 "                            SquashFS specific internals.\n"
 "  --describe, -d            Produce a file listing from the image.\n"
+"  --verify, -v              Check the entire image for consistency. All meta\n"
+"                            data is decoded and every data and fragment\n"
+"                            block is read and uncompressed.\n"
 "\n"
 "  --unpack-root, -p <path>  If used with --unpack-path, this is where the\n"
 "                            data unpacked to. If used with --describe, this\n"
@@ -84,6 +90,13 @@ static const char *help_string =
 "                            UID/GID set in the squashfs image.\n"
 "  --quiet, -q               Do not print out progress while unpacking.\n"
 "\n"
+"  --num-jobs, -j <count>    Maximum number of threads to use for reading\n"
+"                            the tree, for --verify and for setting file\n"
+"                            attributes when unpacking. The default is the\n"
+"                            number of available CPU cores.\n"
+"  --max-errors, -e <count>  Report at most this many errors when verifying\n"
+"                            an image. The default is 10.\n"
+"\n"
 "  --help, -h                Print help text and exit.\n"
 "  --version, -V             Print version information and exit.\n"
 "\n";
@@ -111,6 +124,8 @@ static char *get_path(char *old, const char *arg)
 
 void process_command_line(options_t *opt, int argc, char **argv)
 {
+	char *end;
+	long value;
 	int i;
 
 	opt->op = OP_NONE;
@@ -119,6 +134,8 @@ void process_command_line(options_t *opt, int argc, char **argv)
 	opt->cmdpath = NULL;
 	opt->unpack_root = NULL;
 	opt->image_name = NULL;
+	opt->num_jobs = os_get_num_jobs();
+	opt->max_errors = 10;
 
 	for (;;) {
 		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
@@ -167,6 +184,24 @@ void process_command_line(options_t *opt, int argc, char **argv)
 			free(opt->cmdpath);
 			opt->cmdpath = NULL;
 			break;
+		case 'v':
+			opt->op = OP_VERIFY;
+			free(opt->cmdpath);
+			opt->cmdpath = NULL;
+			break;
+		case 'j':
+			value = strtol(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || value < 1) {
+				fprintf(stderr, "Invalid number of jobs '%s', "
+					"expected a number of at least 1.\n",
+					optarg);
+				goto fail_arg;
+			}
+			opt->num_jobs = value;
+			break;
+		case 'e':
+			opt->max_errors = strtol(optarg, NULL, 0);
+			break;
 		case 'x':
 			opt->op = OP_RDATTR;
 			opt->cmdpath = get_path(opt->cmdpath, optarg);
@@ -212,6 +247,10 @@ void process_command_line(options_t *opt, int argc, char **argv)
 		opt->rdtree_flags |= SQFS_TREE_NO_RECURSE;
 	}
 
+	/* every inode has to be visited */
+	if (opt->op == OP_VERIFY)
+		opt->rdtree_flags = 0;
+
 	if (optind >= argc) {
 		fputs("Missing image argument\n", stderr);
 		goto fail_arg;
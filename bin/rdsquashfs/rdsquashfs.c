@@ -135,7 +135,7 @@ int main(int argc, char **argv)
 	}
 
 	if (!(super.flags & SQFS_FLAG_NO_XATTRS)) {
-		xattr = sqfs_xattr_reader_create(0);
+		xattr = sqfs_xattr_reader_create(SQFS_XATTR_READER_BLOCK_CACHE);
 		if (xattr == NULL) {
 			sqfs_perror(opt.image_name, "creating xattr reader",
 				    SQFS_ERROR_ALLOC);
@@ -163,7 +163,8 @@ int main(int argc, char **argv)
 		goto out_id;
 	}
 
-	dirrd = sqfs_dir_reader_create(&super, cmp, file, 0);
+	dirrd = sqfs_dir_reader_create(&super, cmp, file,
+				       SQFS_DIR_READER_BLOCK_CACHE);
 	if (dirrd == NULL) {
 		sqfs_perror(opt.image_name, "creating dir reader",
 			    SQFS_ERROR_ALLOC);
@@ -183,6 +184,17 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
+	/* walking the entire tree touches every meta data block anyway */
+	if ((opt.cmdpath == NULL || opt.cmdpath[0] == '\0') &&
+	    !(opt.rdtree_flags & SQFS_TREE_NO_RECURSE)) {
+		ret = sqfs_dir_reader_preload(dirrd, opt.num_jobs);
+		if (ret) {
+			sqfs_perror(opt.image_name, "preloading inode and "
+				    "directory table", ret);
+			goto out_data;
+		}
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(dirrd, idtbl, opt.cmdpath,
 						 opt.rdtree_flags, &n);
 	if (ret) {
@@ -240,8 +252,10 @@ int main(int argc, char **argv)
 		if (fill_unpacked_files(super.block_size, n, data, opt.flags))
 			goto out;
 
-		if (update_tree_attribs(xattr, n, opt.flags))
+		if (update_tree_attribs(&super, file, cmp, xattr, n,
+					opt.flags, opt.num_jobs)) {
 			goto out;
+		}
 		break;
 	case OP_DESCRIBE:
 		if (describe_tree(n, opt.unpack_root))
@@ -251,6 +265,10 @@ int main(int argc, char **argv)
 		if (dump_xattrs(xattr, n->inode))
 			goto out;
 		break;
+	case OP_VERIFY:
+		if (verify_image(&opt, &super, file, cmp, dirrd, xattr, n))
+			goto out;
+		break;
 	default:
 		break;
 	}
@@ -10,6 +10,9 @@
 #include "config.h"
 #include "common.h"
 #include "fstree.h"
+#include "threadpool.h"
+#include "array.h"
+#include "util.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -21,6 +24,8 @@
 #if defined(__APPLE__) && defined(__MACH__)
 #define lsetxattr(path, name, value, size, flags) \
 	setxattr(path, name, value, size, 0, flags | XATTR_NOFOLLOW)
+#define fsetxattr(fd, name, value, size, flags) \
+	fsetxattr(fd, name, value, size, 0, flags)
 #endif
 #endif
 #include <string.h>
@@ -49,6 +54,7 @@ enum {
 	OP_DESCRIBE,
 	OP_RDATTR,
 	OP_STAT,
+	OP_VERIFY,
 };
 
 typedef struct {
@@ -58,6 +64,8 @@ typedef struct {
 	char *cmdpath;
 	const char *unpack_root;
 	const char *image_name;
+	size_t num_jobs;
+	size_t max_errors;
 } options_t;
 
 void list_files(const sqfs_tree_node_t *node);
@@ -66,14 +74,21 @@ int stat_file(const sqfs_tree_node_t *node);
 
 int restore_fstree(sqfs_tree_node_t *root, int flags);
 
-int update_tree_attribs(sqfs_xattr_reader_t *xattr,
-			const sqfs_tree_node_t *root, int flags);
+int update_tree_attribs(const sqfs_super_t *super, sqfs_file_t *file,
+			sqfs_compressor_t *cmp, sqfs_xattr_reader_t *xattr,
+			const sqfs_tree_node_t *root, int flags,
+			size_t num_jobs);
 
 int fill_unpacked_files(size_t blk_sz, const sqfs_tree_node_t *root,
 			sqfs_data_reader_t *data, int flags);
 
 int describe_tree(const sqfs_tree_node_t *root, const char *unpack_root);
 
+int verify_image(const options_t *opt, const sqfs_super_t *super,
+		 sqfs_file_t *file, sqfs_compressor_t *cmp,
+		 sqfs_dir_reader_t *dirrd, sqfs_xattr_reader_t *xattr,
+		 const sqfs_tree_node_t *root);
+
 int dump_xattrs(sqfs_xattr_reader_t *xattr, const sqfs_inode_generic_t *inode);
 
 void process_command_line(options_t *opt, int argc, char **argv);
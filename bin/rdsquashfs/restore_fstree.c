@@ -45,33 +45,240 @@ fail:
 	free(wpath);
 	return -1;
 }
+
+static int create_node_dfs(const sqfs_tree_node_t *n, int flags)
+{
+	const sqfs_tree_node_t *c;
+	char *name;
+	int ret;
+
+	if (!is_filename_sane((const char *)n->name, true)) {
+		fprintf(stderr, "Found an entry named '%s', skipping.\n",
+			n->name);
+		return 0;
+	}
+
+	name = sqfs_tree_node_get_path(n);
+	if (name == NULL) {
+		fprintf(stderr, "Constructing full path for '%s': %s\n",
+			(const char *)n->name, strerror(errno));
+		return -1;
+	}
+
+	ret = canonicalize_name(name);
+	assert(ret == 0);
+
+	if (!(flags & UNPACK_QUIET))
+		printf("creating %s\n", name);
+
+	ret = create_node(n, name, flags);
+	free(name);
+	if (ret)
+		return -1;
+
+	if (S_ISDIR(n->inode->base.mode)) {
+		for (c = n->children; c != NULL; c = c->next) {
+			if (create_node_dfs(c, flags))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int set_attribs(const sqfs_tree_node_t *n, int flags)
+{
+	const sqfs_tree_node_t *c;
+	char *path;
+	int ret;
+
+	if (!is_filename_sane((const char *)n->name, true))
+		return 0;
+
+	if (S_ISDIR(n->inode->base.mode)) {
+		for (c = n->children; c != NULL; c = c->next) {
+			if (set_attribs(c, flags))
+				return -1;
+		}
+	}
+
+	path = sqfs_tree_node_get_path(n);
+	if (path == NULL) {
+		fprintf(stderr, "Reconstructing full path: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	ret = canonicalize_name(path);
+	assert(ret == 0);
+
+	if (flags & UNPACK_CHOWN) {
+		if (fchownat(AT_FDCWD, path, n->uid, n->gid,
+			     AT_SYMLINK_NOFOLLOW)) {
+			fprintf(stderr, "chown %s: %s\n",
+				path, strerror(errno));
+			goto fail;
+		}
+	}
+
+	if (flags & UNPACK_CHMOD && !S_ISLNK(n->inode->base.mode)) {
+		if (fchmodat(AT_FDCWD, path,
+			     n->inode->base.mode & ~S_IFMT, 0)) {
+			fprintf(stderr, "chmod %s: %s\n",
+				path, strerror(errno));
+			goto fail;
+		}
+	}
+
+	free(path);
+	return 0;
+fail:
+	free(path);
+	return -1;
+}
+
+int restore_fstree(sqfs_tree_node_t *root, int flags)
+{
+	sqfs_tree_node_t *n, *old_parent;
+
+	/* make sure fstree_get_path() stops at this node */
+	old_parent = root->parent;
+	root->parent = NULL;
+
+	if (S_ISDIR(root->inode->base.mode)) {
+		for (n = root->children; n != NULL; n = n->next) {
+			if (create_node_dfs(n, flags))
+				return -1;
+		}
+	} else {
+		if (create_node_dfs(root, flags))
+			return -1;
+	}
+
+	root->parent = old_parent;
+	return 0;
+}
+
+int update_tree_attribs(const sqfs_super_t *super, sqfs_file_t *file,
+			sqfs_compressor_t *cmp, sqfs_xattr_reader_t *xattr,
+			const sqfs_tree_node_t *root, int flags,
+			size_t num_jobs)
+{
+	const sqfs_tree_node_t *n;
+	(void)super; (void)file; (void)cmp; (void)xattr; (void)num_jobs;
+
+	if ((flags & (UNPACK_CHOWN | UNPACK_CHMOD |
+		      UNPACK_SET_TIMES | UNPACK_SET_XATTR)) == 0) {
+		return 0;
+	}
+
+	if (S_ISDIR(root->inode->base.mode)) {
+		for (n = root->children; n != NULL; n = n->next) {
+			if (set_attribs(n, flags))
+				return -1;
+		}
+	} else {
+		if (set_attribs(root, flags))
+			return -1;
+	}
+
+	return 0;
+}
 #else
-static int create_node(const sqfs_tree_node_t *n, const char *name, int flags)
+/*
+  The tree is restored relative to open directory file descriptors, so the
+  *at() functions only have to resolve the name of a single entry instead of
+  walking the full path from the unpack root for every node.
+ */
+#define ATTRIB_JOB_SIZE (256)
+
+typedef struct {
+	char *buffer;
+	size_t used;
+	size_t size;
+} path_buf_t;
+
+typedef struct {
+	/* directory path relative to the unpack root, "" for the root */
+	char *dir_path;
+
+	/* the first of count non-directory entries in the directory */
+	const sqfs_tree_node_t *first;
+	size_t count;
+
+	int flags;
+	int status;
+} attrib_job_t;
+
+static int path_push(path_buf_t *path, const char *name, size_t *old_used)
+{
+	size_t len = strlen(name), need;
+	char *new;
+
+	*old_used = path->used;
+	need = path->used + len + 2;
+
+	if (need > path->size) {
+		new = realloc(path->buffer, need * 2);
+		if (new == NULL) {
+			perror("assembling file path");
+			return -1;
+		}
+
+		path->buffer = new;
+		path->size = need * 2;
+	}
+
+	if (path->used > 0)
+		path->buffer[path->used++] = '/';
+
+	memcpy(path->buffer + path->used, name, len + 1);
+	path->used += len;
+	return 0;
+}
+
+static void path_pop(path_buf_t *path, size_t old_used)
 {
+	path->used = old_used;
+	path->buffer[old_used] = '\0';
+}
+
+static void print_error(const char *what, const char *dir_path,
+			const sqfs_tree_node_t *n)
+{
+	fprintf(stderr, "%s %s%s%s: %s\n", what, dir_path,
+		dir_path[0] == '\0' ? "" : "/", (const char *)n->name,
+		strerror(errno));
+}
+
+static int create_node(const sqfs_tree_node_t *n, int dirfd, const char *path,
+		       int flags)
+{
+	const char *name = (const char *)n->name;
 	sqfs_u32 devno;
 	int fd, mode;
 
 	switch (n->inode->base.mode & S_IFMT) {
 	case S_IFDIR:
-		if (mkdir(name, 0755) && errno != EEXIST) {
+		if (mkdirat(dirfd, name, 0755) && errno != EEXIST) {
 			fprintf(stderr, "mkdir %s: %s\n",
-				name, strerror(errno));
+				path, strerror(errno));
 			return -1;
 		}
 		break;
 	case S_IFLNK:
-		if (symlink((const char *)n->inode->extra, name)) {
+		if (symlinkat((const char *)n->inode->extra, dirfd, name)) {
 			fprintf(stderr, "ln -s %s %s: %s\n",
-				(const char *)n->inode->extra, name,
+				(const char *)n->inode->extra, path,
 				strerror(errno));
 			return -1;
 		}
 		break;
 	case S_IFSOCK:
 	case S_IFIFO:
-		if (mknod(name, (n->inode->base.mode & S_IFMT) | 0700, 0)) {
+		if (mknodat(dirfd, name,
+			    (n->inode->base.mode & S_IFMT) | 0700, 0)) {
 			fprintf(stderr, "creating %s: %s\n",
-				name, strerror(errno));
+				path, strerror(errno));
 			return -1;
 		}
 		break;
@@ -84,9 +291,9 @@ static int create_node(const sqfs_tree_node_t *n, const char *name, int flags)
 			devno = n->inode->data.dev.devno;
 		}
 
-		if (mknod(name, n->inode->base.mode & S_IFMT, devno)) {
+		if (mknodat(dirfd, name, n->inode->base.mode & S_IFMT, devno)) {
 			fprintf(stderr, "creating device %s: %s\n",
-				name, strerror(errno));
+				path, strerror(errno));
 			return -1;
 		}
 		break;
@@ -97,11 +304,12 @@ static int create_node(const sqfs_tree_node_t *n, const char *name, int flags)
 			mode = 0644;
 		}
 
-		fd = open(name, O_WRONLY | O_CREAT | O_EXCL, mode);
+		fd = openat(dirfd, name,
+			    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
 
 		if (fd < 0) {
 			fprintf(stderr, "creating %s: %s\n",
-				name, strerror(errno));
+				path, strerror(errno));
 			return -1;
 		}
 
@@ -113,13 +321,13 @@ static int create_node(const sqfs_tree_node_t *n, const char *name, int flags)
 
 	return 0;
 }
-#endif
 
-static int create_node_dfs(const sqfs_tree_node_t *n, int flags)
+static int create_node_dfs(const sqfs_tree_node_t *n, int dirfd,
+			   path_buf_t *path, int flags)
 {
 	const sqfs_tree_node_t *c;
-	char *name;
-	int ret;
+	size_t old_used;
+	int fd;
 
 	if (!is_filename_sane((const char *)n->name, true)) {
 		fprintf(stderr, "Found an entry named '%s', skipping.\n",
@@ -127,40 +335,48 @@ static int create_node_dfs(const sqfs_tree_node_t *n, int flags)
 		return 0;
 	}
 
-	name = sqfs_tree_node_get_path(n);
-	if (name == NULL) {
-		fprintf(stderr, "Constructing full path for '%s': %s\n",
-			(const char *)n->name, strerror(errno));
+	if (path_push(path, (const char *)n->name, &old_used))
 		return -1;
-	}
-
-	ret = canonicalize_name(name);
-	assert(ret == 0);
 
 	if (!(flags & UNPACK_QUIET))
-		printf("creating %s\n", name);
+		printf("creating %s\n", path->buffer);
 
-	ret = create_node(n, name, flags);
-	free(name);
-	if (ret)
-		return -1;
+	if (create_node(n, dirfd, path->buffer, flags))
+		goto fail;
+
+	if (S_ISDIR(n->inode->base.mode) && n->children != NULL) {
+		fd = openat(dirfd, (const char *)n->name,
+			    O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror(path->buffer);
+			goto fail;
+		}
 
-	if (S_ISDIR(n->inode->base.mode)) {
 		for (c = n->children; c != NULL; c = c->next) {
-			if (create_node_dfs(c, flags))
-				return -1;
+			if (create_node_dfs(c, fd, path, flags)) {
+				close(fd);
+				goto fail;
+			}
 		}
+
+		close(fd);
 	}
+
+	path_pop(path, old_used);
 	return 0;
+fail:
+	path_pop(path, old_used);
+	return -1;
 }
 
 #ifdef HAVE_SYS_XATTR_H
-static int set_xattr(const char *path, sqfs_xattr_reader_t *xattr,
+static int set_xattr(sqfs_xattr_reader_t *xattr, int fd, const char *dir_path,
 		     const sqfs_tree_node_t *n)
 {
 	sqfs_xattr_value_t *value;
 	sqfs_xattr_entry_t *key;
 	sqfs_xattr_id_t desc;
+	char *path = NULL;
 	sqfs_u32 index;
 	size_t i;
 	int ret;
@@ -180,70 +396,79 @@ static int set_xattr(const char *path, sqfs_xattr_reader_t *xattr,
 		return -1;
 	}
 
+	/* there is no lsetxattrat(), so other nodes need the full path */
+	if (fd < 0) {
+		path = malloc(strlen(dir_path) +
+			      strlen((const char *)n->name) + 2);
+		if (path == NULL) {
+			perror("assembling file path");
+			return -1;
+		}
+
+		sprintf(path, "%s%s%s", dir_path,
+			dir_path[0] == '\0' ? "" : "/", (const char *)n->name);
+	}
+
 	for (i = 0; i < desc.count; ++i) {
 		if (sqfs_xattr_reader_read_key(xattr, &key)) {
 			fputs("Error reading xattr key\n", stderr);
-			return -1;
+			goto fail;
 		}
 
 		if (sqfs_xattr_reader_read_value(xattr, key, &value)) {
 			fputs("Error reading xattr value\n", stderr);
 			sqfs_free(key);
-			return -1;
+			goto fail;
+		}
+
+		if (fd >= 0) {
+			ret = fsetxattr(fd, (const char *)key->key,
+					value->value, value->size, 0);
+		} else {
+			ret = lsetxattr(path, (const char *)key->key,
+					value->value, value->size, 0);
 		}
 
-		ret = lsetxattr(path, (const char *)key->key,
-				value->value, value->size, 0);
 		if (ret) {
-			fprintf(stderr, "setting xattr '%s' on %s: %s\n",
-				key->key, path, strerror(errno));
+			fprintf(stderr, "setting xattr '%s' on %s%s%s: %s\n",
+				key->key, dir_path,
+				dir_path[0] == '\0' ? "" : "/",
+				(const char *)n->name, strerror(errno));
 		}
 
 		sqfs_free(key);
 		sqfs_free(value);
 		if (ret)
-			return -1;
+			goto fail;
 	}
 
+	free(path);
 	return 0;
+fail:
+	free(path);
+	return -1;
 }
 #endif
 
-static int set_attribs(sqfs_xattr_reader_t *xattr,
-		       const sqfs_tree_node_t *n, int flags)
+/*
+  Set the attributes of the node n inside the directory dirfd. If the node
+  itself is already open, fd refers to it, otherwise it is -1.
+ */
+static int set_attribs(sqfs_xattr_reader_t *xattr, int dirfd, int fd,
+		       const char *dir_path, const sqfs_tree_node_t *n,
+		       int flags)
 {
-	const sqfs_tree_node_t *c;
-	char *path;
-	int ret;
-
-	if (!is_filename_sane((const char *)n->name, true))
-		return 0;
-
-	if (S_ISDIR(n->inode->base.mode)) {
-		for (c = n->children; c != NULL; c = c->next) {
-			if (set_attribs(xattr, c, flags))
-				return -1;
-		}
-	}
-
-	path = sqfs_tree_node_get_path(n);
-	if (path == NULL) {
-		fprintf(stderr, "Reconstructing full path: %s\n",
-			strerror(errno));
-		return -1;
-	}
-
-	ret = canonicalize_name(path);
-	assert(ret == 0);
+	const char *name = (const char *)n->name;
 
 #ifdef HAVE_SYS_XATTR_H
 	if ((flags & UNPACK_SET_XATTR) && xattr != NULL) {
-		if (set_xattr(path, xattr, n))
-			goto fail;
+		if (set_xattr(xattr, fd, dir_path, n))
+			return -1;
 	}
+#else
+	(void)xattr; (void)fd;
 #endif
 
-#ifndef _WIN32
 	if (flags & UNPACK_SET_TIMES) {
 		struct timespec times[2];
 
@@ -251,79 +476,349 @@ static int set_attribs(sqfs_xattr_reader_t *xattr,
 		times[0].tv_sec = n->inode->base.mod_time;
 		times[1].tv_sec = n->inode->base.mod_time;
 
-		if (utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW)) {
-			fprintf(stderr, "setting timestamp on %s: %s\n",
-				path, strerror(errno));
-			goto fail;
+		if (utimensat(dirfd, name, times, AT_SYMLINK_NOFOLLOW)) {
+			print_error("setting timestamp on", dir_path, n);
+			return -1;
 		}
 	}
-#endif
+
 	if (flags & UNPACK_CHOWN) {
-		if (fchownat(AT_FDCWD, path, n->uid, n->gid,
+		if (fchownat(dirfd, name, n->uid, n->gid,
 			     AT_SYMLINK_NOFOLLOW)) {
-			fprintf(stderr, "chown %s: %s\n",
-				path, strerror(errno));
-			goto fail;
+			print_error("chown", dir_path, n);
+			return -1;
 		}
 	}
 
 	if (flags & UNPACK_CHMOD && !S_ISLNK(n->inode->base.mode)) {
-		if (fchmodat(AT_FDCWD, path,
-			     n->inode->base.mode & ~S_IFMT, 0)) {
-			fprintf(stderr, "chmod %s: %s\n",
-				path, strerror(errno));
-			goto fail;
+		if (fchmodat(dirfd, name, n->inode->base.mode & ~S_IFMT, 0)) {
+			print_error("chmod", dir_path, n);
+			return -1;
 		}
 	}
 
-	free(path);
 	return 0;
-fail:
-	free(path);
-	return -1;
 }
 
-int restore_fstree(sqfs_tree_node_t *root, int flags)
+static int add_job(array_t *jobs, const char *dir_path,
+		   const sqfs_tree_node_t *first, size_t count, int flags)
 {
-	sqfs_tree_node_t *n, *old_parent;
+	attrib_job_t job;
 
-	/* make sure fstree_get_path() stops at this node */
-	old_parent = root->parent;
-	root->parent = NULL;
+	memset(&job, 0, sizeof(job));
+	job.dir_path = strdup(dir_path);
+	job.first = first;
+	job.count = count;
+	job.flags = flags;
 
-	if (S_ISDIR(root->inode->base.mode)) {
-		for (n = root->children; n != NULL; n = n->next) {
-			if (create_node_dfs(n, flags))
+	if (job.dir_path == NULL || array_append(jobs, &job)) {
+		perror("recording attribute jobs");
+		free(job.dir_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+  Split the non-directory entries of every directory into chunks that can
+  be processed independently by the worker threads.
+ */
+static int gen_jobs_dfs(array_t *jobs, path_buf_t *path,
+			const sqfs_tree_node_t *dir, int flags)
+{
+	const sqfs_tree_node_t *n, *first = NULL;
+	size_t count = 0, old_used;
+	int ret;
+
+	for (n = dir->children; n != NULL; n = n->next) {
+		if (!is_filename_sane((const char *)n->name, true))
+			continue;
+
+		if (S_ISDIR(n->inode->base.mode)) {
+			if (path_push(path, (const char *)n->name, &old_used))
+				return -1;
+
+			ret = gen_jobs_dfs(jobs, path, n, flags);
+			path_pop(path, old_used);
+
+			if (ret)
 				return -1;
+			continue;
+		}
+
+		if (first == NULL)
+			first = n;
+
+		if (++count == ATTRIB_JOB_SIZE) {
+			if (add_job(jobs, path->buffer, first, count, flags))
+				return -1;
+
+			first = NULL;
+			count = 0;
 		}
-	} else {
-		if (create_node_dfs(root, flags))
-			return -1;
 	}
 
-	root->parent = old_parent;
+	if (count > 0)
+		return add_job(jobs, path->buffer, first, count, flags);
+
 	return 0;
 }
 
-int update_tree_attribs(sqfs_xattr_reader_t *xattr,
-			const sqfs_tree_node_t *root, int flags)
+typedef struct {
+	const sqfs_super_t *super;
+	sqfs_file_t *file;
+	sqfs_compressor_t *cmp;
+	sqfs_xattr_reader_t *xattr;
+} attrib_src_t;
+
+typedef struct {
+	sqfs_compressor_t *cmp;
+	sqfs_xattr_reader_t *xattr;
+} attrib_worker_t;
+
+static int attrib_worker(void *user, void *work_item)
 {
+	attrib_worker_t *worker = user;
+	attrib_job_t *job = work_item;
 	const sqfs_tree_node_t *n;
-
-	if ((flags & (UNPACK_CHOWN | UNPACK_CHMOD |
-		      UNPACK_SET_TIMES | UNPACK_SET_XATTR)) == 0) {
+	size_t i = 0;
+	int dirfd;
+
+	dirfd = open(job->dir_path[0] == '\0' ? "." : job->dir_path,
+		     O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (dirfd < 0) {
+		perror(job->dir_path[0] == '\0' ? "." : job->dir_path);
+		job->status = -1;
 		return 0;
 	}
 
-	if (S_ISDIR(root->inode->base.mode)) {
-		for (n = root->children; n != NULL; n = n->next) {
-			if (set_attribs(xattr, n, flags))
-				return -1;
+	for (n = job->first; n != NULL && i < job->count; n = n->next) {
+		if (!is_filename_sane((const char *)n->name, true) ||
+		    S_ISDIR(n->inode->base.mode)) {
+			continue;
 		}
-	} else {
-		if (set_attribs(xattr, root, flags))
+
+		++i;
+
+		if (set_attribs(worker->xattr, dirfd, -1, job->dir_path, n,
+				job->flags)) {
+			job->status = -1;
+			break;
+		}
+	}
+
+	close(dirfd);
+
+	/* Errors are reported through the job. A failing worker would stop
+	   the pool and leave the remaining items in the queue forever. */
+	return 0;
+}
+
+/*
+  The xattr reader has a read position and decompresses blocks, which keeps
+  state in the compressor, so every worker needs its own copy of both.
+ */
+static int worker_init(attrib_worker_t *worker, const attrib_src_t *src)
+{
+	int ret;
+
+	worker->cmp = sqfs_copy(src->cmp);
+	if (worker->cmp == NULL)
+		goto fail_alloc;
+
+	worker->xattr = sqfs_xattr_reader_create(SQFS_XATTR_READER_BLOCK_CACHE);
+	if (worker->xattr == NULL)
+		goto fail_alloc;
+
+	ret = sqfs_xattr_reader_load(worker->xattr, src->super, src->file,
+				     worker->cmp);
+	if (ret) {
+		sqfs_perror(NULL, "loading xattr table", ret);
+		return -1;
+	}
+
+	return 0;
+fail_alloc:
+	sqfs_perror(NULL, "creating xattr reader", SQFS_ERROR_ALLOC);
+	return -1;
+}
+
+static int run_jobs(array_t *jobs, const attrib_src_t *src, int flags,
+		    size_t num_jobs)
+{
+	attrib_worker_t *workers = NULL;
+	size_t i, num_workers;
+	attrib_job_t *job;
+	thread_pool_t *pool;
+	int ret = -1;
+
+	pool = thread_pool_create(num_jobs, attrib_worker);
+	if (pool == NULL) {
+		fputs("Error creating thread pool\n", stderr);
+		return -1;
+	}
+
+	num_workers = pool->get_worker_count(pool);
+
+	workers = calloc(num_workers, sizeof(workers[0]));
+	if (workers == NULL) {
+		perror("creating attribute workers");
+		goto out;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		if ((flags & UNPACK_SET_XATTR) && src->xattr != NULL) {
+			if (worker_init(workers + i, src))
+				goto out;
+		}
+
+		pool->set_worker_ptr(pool, i, workers + i);
+	}
+
+	for (i = 0; i < jobs->used; ++i) {
+		if (pool->submit(pool, array_get(jobs, i))) {
+			fputs("Error submitting attribute jobs\n", stderr);
+			goto out;
+		}
+	}
+
+	ret = 0;
+
+	while ((job = pool->dequeue(pool)) != NULL) {
+		if (job->status != 0)
+			ret = -1;
+	}
+out:
+	pool->destroy(pool);
+
+	if (workers != NULL) {
+		for (i = 0; i < num_workers; ++i) {
+			if (workers[i].xattr != NULL)
+				sqfs_destroy(workers[i].xattr);
+			if (workers[i].cmp != NULL)
+				sqfs_destroy(workers[i].cmp);
+		}
+		free(workers);
+	}
+	return ret;
+}
+
+/*
+  Directories are done last and after their contents, so neither changing
+  the contents nor a restrictive mode interfere with their attributes.
+ */
+static int dir_attribs_dfs(sqfs_xattr_reader_t *xattr, int dirfd,
+			   path_buf_t *path, const sqfs_tree_node_t *dir,
+			   int flags)
+{
+	const sqfs_tree_node_t *n;
+	size_t old_used;
+	int fd, ret;
+
+	for (n = dir->children; n != NULL; n = n->next) {
+		if (!is_filename_sane((const char *)n->name, true) ||
+		    !S_ISDIR(n->inode->base.mode)) {
+			continue;
+		}
+
+		fd = openat(dirfd, (const char *)n->name,
+			    O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			print_error("opening", path->buffer, n);
+			return -1;
+		}
+
+		if (path_push(path, (const char *)n->name, &old_used)) {
+			close(fd);
+			return -1;
+		}
+
+		ret = dir_attribs_dfs(xattr, fd, path, n, flags);
+		path_pop(path, old_used);
+
+		if (ret == 0) {
+			ret = set_attribs(xattr, dirfd, fd, path->buffer,
+					  n, flags);
+		}
+
+		close(fd);
+		if (ret)
 			return -1;
 	}
 
 	return 0;
 }
+
+int restore_fstree(sqfs_tree_node_t *root, int flags)
+{
+	path_buf_t path = { NULL, 0, 0 };
+	sqfs_tree_node_t *n;
+	int ret = 0;
+
+	if (S_ISDIR(root->inode->base.mode)) {
+		for (n = root->children; n != NULL && ret == 0; n = n->next)
+			ret = create_node_dfs(n, AT_FDCWD, &path, flags);
+	} else {
+		ret = create_node_dfs(root, AT_FDCWD, &path, flags);
+	}
+
+	free(path.buffer);
+	return ret;
+}
+
+int update_tree_attribs(const sqfs_super_t *super, sqfs_file_t *file,
+			sqfs_compressor_t *cmp, sqfs_xattr_reader_t *xattr,
+			const sqfs_tree_node_t *root, int flags,
+			size_t num_jobs)
+{
+	attrib_src_t src = { super, file, cmp, xattr };
+	path_buf_t path = { NULL, 0, 0 };
+	attrib_job_t *job;
+	array_t jobs;
+	size_t i;
+	int ret;
+
+	if ((flags & (UNPACK_CHOWN | UNPACK_CHMOD |
+		      UNPACK_SET_TIMES | UNPACK_SET_XATTR)) == 0) {
+		return 0;
+	}
+
+	if (!S_ISDIR(root->inode->base.mode)) {
+		if (!is_filename_sane((const char *)root->name, true))
+			return 0;
+
+		return set_attribs(xattr, AT_FDCWD, -1, "", root, flags);
+	}
+
+	if (array_init(&jobs, sizeof(attrib_job_t), 0)) {
+		perror("recording attribute jobs");
+		return -1;
+	}
+
+	path.buffer = strdup("");
+	if (path.buffer == NULL) {
+		perror("assembling file path");
+		ret = -1;
+		goto out;
+	}
+	path.size = 1;
+
+	ret = gen_jobs_dfs(&jobs, &path, root, flags);
+
+	if (ret == 0 && jobs.used > 0)
+		ret = run_jobs(&jobs, &src, flags, num_jobs);
+
+	if (ret == 0)
+		ret = dir_attribs_dfs(xattr, AT_FDCWD, &path, root, flags);
+out:
+	for (i = 0; i < jobs.used; ++i) {
+		job = array_get(&jobs, i);
+		free(job->dir_path);
+	}
+
+	array_cleanup(&jobs);
+	free(path.buffer);
+	return ret;
+}
+#endif
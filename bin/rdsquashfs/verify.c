@@ -0,0 +1,873 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * verify.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "rdsquashfs.h"
+
+#include <stdarg.h>
+
+/* upper bound for the amount of on-disk data a single job reads */
+#define JOB_MAX_BYTES (8 * 1024 * 1024)
+
+/* unpacked size of a fragment block that could not be read */
+#define FRAG_SIZE_UNKNOWN (0xFFFFFFFF)
+
+/*
+  The tree and all meta data are checked serially, while walking the already
+  unpacked hierarchy. Reading and uncompressing the data blocks is split up
+  into jobs that cover a contiguous range of blocks of a single file, or a
+  range of fragment blocks. The jobs are processed in the order of their
+  location on disk, by a thread pool, and results are collected in the same
+  order, so errors are always reported in the same sequence.
+ */
+typedef struct {
+	/* NULL if this job covers a range of fragment blocks */
+	const sqfs_tree_node_t *node;
+
+	/* on-disk location of the first block */
+	sqfs_u64 location;
+
+	/* index of the first block in the file or fragment table */
+	sqfs_u32 first;
+	sqfs_u32 count;
+
+	/* results, filled in by the worker */
+	sqfs_u64 raw_bytes;
+	sqfs_u64 bytes;
+	sqfs_u32 num_bad;
+	sqfs_u32 bad_index;
+	const char *error;
+	int err;
+} verify_job_t;
+
+typedef struct {
+	const sqfs_super_t *super;
+	sqfs_file_t *file;
+	sqfs_dir_reader_t *dirrd;
+	sqfs_xattr_reader_t *xattr;
+	const char *image_name;
+
+	sqfs_frag_table_t *frag;
+	sqfs_u32 num_frags;
+	sqfs_u32 *frag_sizes;
+
+	/* one bit per inode number, to check hard linked inodes only once */
+	sqfs_u8 *inode_seen;
+
+	/* const sqfs_tree_node_t pointers to all regular files */
+	array_t files;
+	array_t jobs;
+
+	size_t num_errors;
+	size_t num_shown;
+	size_t max_errors;
+
+	size_t num_inodes;
+	size_t num_blocks;
+	size_t num_frag_blocks;
+	sqfs_u64 raw_bytes;
+	sqfs_u64 bytes;
+} verify_t;
+
+typedef struct {
+	verify_t *vfy;
+	sqfs_compressor_t *cmp;
+
+	sqfs_u8 *in;
+	size_t in_max;
+	sqfs_u8 *out;
+} verify_worker_t;
+
+static void report(verify_t *vfy, const sqfs_tree_node_t *n, int err,
+		   const char *fmt, ...) PRINTF_ATTRIB(4, 5);
+
+static void report(verify_t *vfy, const sqfs_tree_node_t *n, int err,
+		   const char *fmt, ...)
+{
+	const char *name = vfy->image_name;
+	char *path = NULL, msg[256];
+	va_list ap;
+
+	vfy->num_errors += 1;
+	if (vfy->num_shown >= vfy->max_errors)
+		return;
+
+	vfy->num_shown += 1;
+
+	if (n != NULL) {
+		path = sqfs_tree_node_get_path(n);
+		if (path != NULL)
+			name = path;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	if (err != 0) {
+		sqfs_perror(name, msg, err);
+	} else {
+		fprintf(stderr, "%s: %s.\n", name, msg);
+	}
+
+	free(path);
+}
+
+static int add_job(verify_t *vfy, const sqfs_tree_node_t *n,
+		   sqfs_u64 location, sqfs_u32 first, sqfs_u32 count)
+{
+	verify_job_t job;
+
+	memset(&job, 0, sizeof(job));
+	job.node = n;
+	job.location = location;
+	job.first = first;
+	job.count = count;
+
+	if (array_append(&vfy->jobs, &job)) {
+		perror("creating verification jobs");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static bool data_in_bounds(const verify_t *vfy, sqfs_u64 location,
+			   sqfs_u64 size)
+{
+	/* data and fragment blocks are stored before the inode table */
+	return location >= sizeof(sqfs_super_t) &&
+		location <= vfy->super->inode_table_start &&
+		size <= (vfy->super->inode_table_start - location);
+}
+
+static int check_xattr(verify_t *vfy, const sqfs_tree_node_t *n)
+{
+	sqfs_xattr_value_t *value;
+	sqfs_xattr_entry_t *key;
+	sqfs_xattr_id_t desc;
+	sqfs_u32 i, index;
+	int ret;
+
+	sqfs_inode_get_xattr_index(n->inode, &index);
+	if (index == 0xFFFFFFFF)
+		return 0;
+
+	if (vfy->xattr == NULL) {
+		report(vfy, n, 0, "xattr index set, but image has no xattrs");
+		return 0;
+	}
+
+	ret = sqfs_xattr_reader_get_desc(vfy->xattr, index, &desc);
+	if (ret) {
+		report(vfy, n, ret, "resolving xattr index %u", index);
+		return 0;
+	}
+
+	ret = sqfs_xattr_reader_seek_kv(vfy->xattr, &desc);
+	if (ret) {
+		report(vfy, n, ret, "locating xattr key-value pairs");
+		return 0;
+	}
+
+	for (i = 0; i < desc.count; ++i) {
+		ret = sqfs_xattr_reader_read_key(vfy->xattr, &key);
+		if (ret) {
+			report(vfy, n, ret, "reading xattr key %u", i);
+			return 0;
+		}
+
+		ret = sqfs_xattr_reader_read_value(vfy->xattr, key, &value);
+		sqfs_free(key);
+		if (ret) {
+			report(vfy, n, ret, "reading xattr value %u", i);
+			return 0;
+		}
+
+		sqfs_free(value);
+	}
+
+	return 0;
+}
+
+static int check_export(verify_t *vfy, const sqfs_tree_node_t *n)
+{
+	sqfs_inode_generic_t *inode;
+	int ret;
+
+	if (!(vfy->super->flags & SQFS_FLAG_EXPORTABLE))
+		return 0;
+
+	ret = sqfs_dir_reader_get_inode_by_number(vfy->dirrd,
+						  n->inode->base.inode_number,
+						  &inode);
+	if (ret) {
+		report(vfy, n, ret, "looking up inode %u in export table",
+		       n->inode->base.inode_number);
+		return 0;
+	}
+
+	if (memcmp(&inode->base, &n->inode->base, sizeof(inode->base)) != 0) {
+		report(vfy, n, 0, "export table entry for inode %u points "
+		       "to a different inode", n->inode->base.inode_number);
+	}
+
+	sqfs_free(inode);
+	return 0;
+}
+
+/* check the block list of a file, returns true if the data can be read */
+static bool check_blocks(verify_t *vfy, const sqfs_tree_node_t *n)
+{
+	sqfs_u32 frag_idx, frag_off, size;
+	sqfs_u64 file_size, start, total;
+	size_t i, count;
+	bool ok = true;
+
+	sqfs_inode_get_file_size(n->inode, &file_size);
+	sqfs_inode_get_file_block_start(n->inode, &start);
+	sqfs_inode_get_frag_location(n->inode, &frag_idx, &frag_off);
+	count = sqfs_inode_get_file_block_count(n->inode);
+
+	for (i = 0, total = 0; i < count; ++i) {
+		size = SQFS_ON_DISK_BLOCK_SIZE(n->inode->extra[i]);
+
+		if (size > vfy->super->block_size) {
+			report(vfy, n, 0, "block " PRI_SZ " has on-disk size "
+			       "%u, larger than the block size", i, size);
+			ok = false;
+		}
+
+		total += size;
+	}
+
+	if (total > 0 && !data_in_bounds(vfy, start, total)) {
+		report(vfy, n, 0, "blocks at " PRI_U64 " with a total "
+		       "size of " PRI_U64 " are outside the data area",
+		       start, total);
+		ok = false;
+	}
+
+	if (frag_idx != 0xFFFFFFFF) {
+		if (frag_idx >= vfy->num_frags) {
+			report(vfy, n, 0, "fragment index %u is out of "
+			       "bounds, image has %u fragment blocks",
+			       frag_idx, vfy->num_frags);
+			ok = false;
+		}
+
+		size = file_size % vfy->super->block_size;
+
+		if (frag_off >= vfy->super->block_size ||
+		    size > (vfy->super->block_size - frag_off)) {
+			report(vfy, n, 0, "fragment of size %u at offset %u "
+			       "exceeds the block size", size, frag_off);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+static int gen_data_jobs(verify_t *vfy, const sqfs_tree_node_t *n)
+{
+	sqfs_u64 start, location, size;
+	size_t i, first, count;
+
+	sqfs_inode_get_file_block_start(n->inode, &start);
+	count = sqfs_inode_get_file_block_count(n->inode);
+
+	location = start;
+	first = 0;
+	size = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (i > first &&
+		    (size + SQFS_ON_DISK_BLOCK_SIZE(n->inode->extra[i])) >
+		    JOB_MAX_BYTES) {
+			if (add_job(vfy, n, location, first, i - first))
+				return -1;
+
+			location += size;
+			first = i;
+			size = 0;
+		}
+
+		size += SQFS_ON_DISK_BLOCK_SIZE(n->inode->extra[i]);
+	}
+
+	if (count > first)
+		return add_job(vfy, n, location, first, count - first);
+
+	return 0;
+}
+
+static int gen_frag_jobs(verify_t *vfy)
+{
+	sqfs_u32 i, first = 0, size;
+	sqfs_u64 location = 0, total = 0;
+	sqfs_fragment_t frag;
+	int ret;
+
+	for (i = 0; i < vfy->num_frags; ++i) {
+		ret = sqfs_frag_table_lookup(vfy->frag, i, &frag);
+		if (ret) {
+			sqfs_perror(vfy->image_name, "reading fragment table",
+				    ret);
+			return -1;
+		}
+
+		size = SQFS_ON_DISK_BLOCK_SIZE(frag.size);
+
+		if (size > vfy->super->block_size) {
+			report(vfy, NULL, 0, "fragment block %u has on-disk "
+			       "size %u, larger than the block size", i, size);
+			frag.size = 0;
+		} else if (!data_in_bounds(vfy, frag.start_offset, size)) {
+			report(vfy, NULL, 0, "fragment block %u at " PRI_U64
+			       " is outside the data area",
+			       i, frag.start_offset);
+			frag.size = 0;
+		}
+
+		/* end the current job at a gap or a broken entry */
+		if (i > first && (SQFS_IS_SPARSE_BLOCK(frag.size) ||
+				  frag.start_offset != location + total ||
+				  (total + size) > JOB_MAX_BYTES)) {
+			if (add_job(vfy, NULL, location, first, i - first))
+				return -1;
+			first = i;
+		}
+
+		if (SQFS_IS_SPARSE_BLOCK(frag.size)) {
+			first = i + 1;
+			continue;
+		}
+
+		if (i == first) {
+			location = frag.start_offset;
+			total = 0;
+		}
+
+		total += size;
+	}
+
+	if (vfy->num_frags > first)
+		return add_job(vfy, NULL, location, first,
+			       vfy->num_frags - first);
+
+	return 0;
+}
+
+static int walk_tree(verify_t *vfy, const sqfs_tree_node_t *n)
+{
+	sqfs_u32 inum = n->inode->base.inode_number;
+	const sqfs_tree_node_t *it;
+	sqfs_u8 mask = 1 << ((inum - 1) % 8);
+
+	if (inum == 0 || inum > vfy->super->inode_count) {
+		report(vfy, n, 0, "inode number %u is out of bounds, image "
+		       "has %u inodes", inum, vfy->super->inode_count);
+	} else if (!(vfy->inode_seen[(inum - 1) / 8] & mask)) {
+		vfy->inode_seen[(inum - 1) / 8] |= mask;
+		vfy->num_inodes += 1;
+
+		if (check_export(vfy, n) || check_xattr(vfy, n))
+			return -1;
+
+		if (S_ISREG(n->inode->base.mode) && check_blocks(vfy, n)) {
+			if (array_append(&vfy->files, &n)) {
+				perror("collecting regular files");
+				return -1;
+			}
+		}
+	}
+
+	for (it = n->children; it != NULL; it = it->next) {
+		if (walk_tree(vfy, it))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*****************************************************************************/
+
+static int compare_files_by_location(const void *a, const void *b)
+{
+	const sqfs_tree_node_t *lhs = *((const sqfs_tree_node_t *const *)a);
+	const sqfs_tree_node_t *rhs = *((const sqfs_tree_node_t *const *)b);
+	sqfs_u64 lhs_start, rhs_start;
+
+	sqfs_inode_get_file_block_start(lhs->inode, &lhs_start);
+	sqfs_inode_get_file_block_start(rhs->inode, &rhs_start);
+
+	if (lhs_start != rhs_start)
+		return lhs_start < rhs_start ? -1 : 1;
+
+	return inode_data_compare(lhs->inode, rhs->inode);
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+	const verify_job_t *lhs = a, *rhs = b;
+
+	if (lhs->location != rhs->location)
+		return lhs->location < rhs->location ? -1 : 1;
+
+	/* fragment blocks first, then by block and inode number */
+	if (lhs->node == NULL || rhs->node == NULL)
+		return lhs->node == NULL ? (rhs->node == NULL ? 0 : -1) : 1;
+
+	if (lhs->first != rhs->first)
+		return lhs->first < rhs->first ? -1 : 1;
+
+	if (lhs->node->inode->base.inode_number !=
+	    rhs->node->inode->base.inode_number) {
+		return lhs->node->inode->base.inode_number <
+			rhs->node->inode->base.inode_number ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* files with identical block lists only need to be checked once */
+static int gen_jobs(verify_t *vfy)
+{
+	const sqfs_tree_node_t **files = vfy->files.data;
+	size_t i;
+
+	array_sort_range(&vfy->files, 0, vfy->files.used,
+			 compare_files_by_location);
+
+	for (i = 0; i < vfy->files.used; ++i) {
+		if (i > 0 && inode_data_compare(files[i - 1]->inode,
+						files[i]->inode) == 0) {
+			continue;
+		}
+
+		if (gen_data_jobs(vfy, files[i]))
+			return -1;
+	}
+
+	if (gen_frag_jobs(vfy))
+		return -1;
+
+	array_sort_range(&vfy->jobs, 0, vfy->jobs.used, compare_jobs);
+	return 0;
+}
+
+/*****************************************************************************/
+
+/* only the first problem of a job is kept, the others are counted */
+static void job_fail(verify_job_t *job, sqfs_u32 index, int err,
+		     const char *what)
+{
+	if (job->error == NULL) {
+		job->bad_index = index;
+		job->err = err;
+		job->error = what;
+	}
+
+	job->num_bad += 1;
+}
+
+static int unpack(verify_worker_t *w, const sqfs_u8 *in, sqfs_u32 size,
+		  size_t *out_sz)
+{
+	sqfs_u32 on_disk = SQFS_ON_DISK_BLOCK_SIZE(size);
+	sqfs_s32 ret;
+
+	if (!SQFS_IS_BLOCK_COMPRESSED(size)) {
+		*out_sz = on_disk;
+		return 0;
+	}
+
+	ret = w->cmp->do_block(w->cmp, in, on_disk, w->out,
+			       w->vfy->super->block_size);
+	if (ret <= 0)
+		return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
+
+	*out_sz = ret;
+	return 0;
+}
+
+static int read_data(verify_worker_t *w, sqfs_u64 location, size_t size)
+{
+	sqfs_u8 *new;
+
+	if (size > w->in_max) {
+		new = realloc(w->in, size);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		w->in = new;
+		w->in_max = size;
+	}
+
+	return w->vfy->file->read_at(w->vfy->file, location, w->in, size);
+}
+
+static void verify_data_blocks(verify_worker_t *w, verify_job_t *job)
+{
+	const sqfs_inode_generic_t *inode = job->node->inode;
+	sqfs_u32 index, block_size = w->vfy->super->block_size;
+	sqfs_u64 file_size, offset, expect;
+	size_t i, size, total = 0;
+	const sqfs_u32 *blocks;
+	int ret;
+
+	sqfs_inode_get_file_size(inode, &file_size);
+	blocks = inode->extra + job->first;
+
+	for (i = 0; i < job->count; ++i)
+		total += SQFS_ON_DISK_BLOCK_SIZE(blocks[i]);
+
+	job->raw_bytes = total;
+
+	if (total > 0) {
+		ret = read_data(w, job->location, total);
+		if (ret) {
+			job_fail(job, job->first, ret, "reading");
+			job->num_bad = job->count;
+			return;
+		}
+	}
+
+	for (i = 0, offset = 0; i < job->count; ++i) {
+		index = job->first + i;
+
+		expect = file_size - (sqfs_u64)index * block_size;
+		if (expect > block_size)
+			expect = block_size;
+
+		job->bytes += expect;
+
+		if (SQFS_IS_SPARSE_BLOCK(blocks[i]))
+			continue;
+
+		ret = unpack(w, w->in + offset, blocks[i], &size);
+		offset += SQFS_ON_DISK_BLOCK_SIZE(blocks[i]);
+
+		if (ret) {
+			job_fail(job, index, ret, "uncompressing");
+		} else if (size != expect) {
+			job_fail(job, index, 0,
+				 SQFS_IS_BLOCK_COMPRESSED(blocks[i]) ?
+				 "uncompressed size does not match file size" :
+				 "on-disk size does not match file size");
+		}
+	}
+}
+
+static void verify_frag_blocks(verify_worker_t *w, verify_job_t *job)
+{
+	sqfs_u64 offset = 0;
+	sqfs_fragment_t frag;
+	sqfs_u32 i, index;
+	size_t size;
+	int ret;
+
+	for (i = 0; i < job->count; ++i) {
+		sqfs_frag_table_lookup(w->vfy->frag, job->first + i, &frag);
+		job->raw_bytes += SQFS_ON_DISK_BLOCK_SIZE(frag.size);
+	}
+
+	ret = read_data(w, job->location, job->raw_bytes);
+	if (ret) {
+		job_fail(job, job->first, ret, "reading");
+		job->num_bad = job->count;
+		return;
+	}
+
+	for (i = 0; i < job->count; ++i) {
+		index = job->first + i;
+
+		sqfs_frag_table_lookup(w->vfy->frag, index, &frag);
+
+		ret = unpack(w, w->in + offset, frag.size, &size);
+		offset += SQFS_ON_DISK_BLOCK_SIZE(frag.size);
+
+		if (ret) {
+			job_fail(job, index, ret, "uncompressing");
+			continue;
+		}
+
+		/* each job writes to a disjoint range of the size array */
+		w->vfy->frag_sizes[index] = size;
+		job->bytes += size;
+	}
+}
+
+static int verify_worker(void *user, void *work_item)
+{
+	verify_worker_t *w = user;
+	verify_job_t *job = work_item;
+
+	if (job->node == NULL) {
+		verify_frag_blocks(w, job);
+	} else {
+		verify_data_blocks(w, job);
+	}
+
+	/* Errors are reported through the job. A failing worker would stop
+	   the pool and leave the remaining items in the queue forever. */
+	return 0;
+}
+
+static void job_done(verify_t *vfy, const verify_job_t *job)
+{
+	if (job->node == NULL) {
+		vfy->num_frag_blocks += job->count;
+	} else {
+		vfy->num_blocks += job->count;
+	}
+
+	vfy->raw_bytes += job->raw_bytes;
+	vfy->bytes += job->bytes;
+
+	if (job->error == NULL)
+		return;
+
+	if (job->node == NULL) {
+		report(vfy, NULL, job->err, "fragment block %u: %s",
+		       job->bad_index, job->error);
+	} else {
+		report(vfy, job->node, job->err, "block %u: %s",
+		       job->bad_index, job->error);
+	}
+
+	/* the other damaged blocks of the same job are only counted */
+	vfy->num_errors += job->num_bad - 1;
+}
+
+static int run_jobs(verify_t *vfy, sqfs_compressor_t *cmp, size_t num_jobs)
+{
+	size_t i, num_workers, in_flight = 0;
+	verify_worker_t *workers = NULL;
+	thread_pool_t *pool;
+	verify_job_t *job;
+	int ret = -1;
+
+	pool = thread_pool_create(num_jobs, verify_worker);
+	if (pool == NULL) {
+		fputs("Error creating thread pool\n", stderr);
+		return -1;
+	}
+
+	num_workers = pool->get_worker_count(pool);
+
+	workers = calloc(num_workers, sizeof(workers[0]));
+	if (workers == NULL) {
+		perror("creating verification workers");
+		goto out;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		workers[i].vfy = vfy;
+		workers[i].cmp = sqfs_copy(cmp);
+		workers[i].out = malloc(vfy->super->block_size);
+
+		if (workers[i].cmp == NULL || workers[i].out == NULL) {
+			perror("creating verification workers");
+			goto out;
+		}
+
+		pool->set_worker_ptr(pool, i, workers + i);
+	}
+
+	/* keep the queue short, every job holds up to JOB_MAX_BYTES */
+	for (i = 0; i < vfy->jobs.used; ++i) {
+		if (in_flight >= 4 * num_workers) {
+			job_done(vfy, pool->dequeue(pool));
+			--in_flight;
+		}
+
+		if (pool->submit(pool, array_get(&vfy->jobs, i))) {
+			fputs("Error submitting verification jobs\n", stderr);
+			goto out;
+		}
+
+		++in_flight;
+	}
+
+	while ((job = pool->dequeue(pool)) != NULL)
+		job_done(vfy, job);
+
+	ret = 0;
+out:
+	pool->destroy(pool);
+
+	if (workers != NULL) {
+		for (i = 0; i < num_workers; ++i) {
+			if (workers[i].cmp != NULL)
+				sqfs_destroy(workers[i].cmp);
+			free(workers[i].in);
+			free(workers[i].out);
+		}
+		free(workers);
+	}
+	return ret;
+}
+
+/*****************************************************************************/
+
+/* the tail end of each file must fit into its unpacked fragment block */
+static void check_tail_ends(verify_t *vfy)
+{
+	const sqfs_tree_node_t **files = vfy->files.data;
+	sqfs_u32 frag_idx, frag_off, size;
+	sqfs_u64 file_size;
+	size_t i;
+
+	for (i = 0; i < vfy->files.used; ++i) {
+		sqfs_inode_get_frag_location(files[i]->inode,
+					     &frag_idx, &frag_off);
+
+		if (frag_idx == 0xFFFFFFFF || frag_idx >= vfy->num_frags)
+			continue;
+
+		if (vfy->frag_sizes[frag_idx] == FRAG_SIZE_UNKNOWN) {
+			report(vfy, files[i], 0, "tail end is stored in "
+			       "damaged fragment block %u", frag_idx);
+			continue;
+		}
+
+		sqfs_inode_get_file_size(files[i]->inode, &file_size);
+		size = file_size % vfy->super->block_size;
+
+		if (frag_off > vfy->frag_sizes[frag_idx] ||
+		    size > (vfy->frag_sizes[frag_idx] - frag_off)) {
+			report(vfy, files[i], 0, "fragment of size %u at "
+			       "offset %u exceeds fragment block %u, which "
+			       "has a size of %u", size, frag_off, frag_idx,
+			       vfy->frag_sizes[frag_idx]);
+		}
+	}
+}
+
+static int check_super(verify_t *vfy)
+{
+	sqfs_u64 size = vfy->file->get_size(vfy->file);
+
+	if (vfy->super->bytes_used > size) {
+		report(vfy, NULL, 0, "image is truncated, " PRI_U64 " bytes "
+		       "used, but only " PRI_U64 " available",
+		       vfy->super->bytes_used, size);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void print_summary(verify_t *vfy, sqfs_u64 time_ns)
+{
+	char raw[32], unpacked[32];
+	double secs, rate;
+
+	secs = (double)time_ns / 1000000000.0;
+	rate = secs > 0.0 ? ((double)vfy->raw_bytes / (1024.0 * 1024.0)) / secs
+		: 0.0;
+
+	print_size(vfy->raw_bytes, raw, false);
+	print_size(vfy->bytes, unpacked, false);
+
+	printf("Inodes checked: " PRI_SZ "\n", vfy->num_inodes);
+	printf("Regular files checked: " PRI_SZ "\n", vfy->files.used);
+	printf("Data blocks unpacked: " PRI_SZ "\n", vfy->num_blocks);
+	printf("Fragment blocks unpacked: " PRI_SZ "\n", vfy->num_frag_blocks);
+	printf("Data read: %s, unpacked: %s\n", raw, unpacked);
+	printf("Time: %.2f seconds, %.1f MiB/s\n", secs, rate);
+
+	if (vfy->num_errors > vfy->num_shown) {
+		printf("Errors found: " PRI_SZ " (" PRI_SZ " not shown)\n",
+		       vfy->num_errors, vfy->num_errors - vfy->num_shown);
+	} else {
+		printf("Errors found: " PRI_SZ "\n", vfy->num_errors);
+	}
+}
+
+int verify_image(const options_t *opt, const sqfs_super_t *super,
+		 sqfs_file_t *file, sqfs_compressor_t *cmp,
+		 sqfs_dir_reader_t *dirrd, sqfs_xattr_reader_t *xattr,
+		 const sqfs_tree_node_t *root)
+{
+	sqfs_u64 start = get_time_ns();
+	verify_t vfy;
+	int ret = -1;
+	sqfs_u32 i;
+
+	memset(&vfy, 0, sizeof(vfy));
+	vfy.super = super;
+	vfy.file = file;
+	vfy.dirrd = dirrd;
+	vfy.xattr = xattr;
+	vfy.image_name = opt->image_name;
+	vfy.max_errors = opt->max_errors;
+
+	if (check_super(&vfy))
+		goto out_summary;
+
+	if (array_init(&vfy.files, sizeof(const sqfs_tree_node_t *), 0) ||
+	    array_init(&vfy.jobs, sizeof(verify_job_t), 0)) {
+		perror("initializing verification");
+		goto out;
+	}
+
+	vfy.frag = sqfs_frag_table_create(0);
+	if (vfy.frag == NULL) {
+		sqfs_perror(opt->image_name, "creating fragment table",
+			    SQFS_ERROR_ALLOC);
+		goto out;
+	}
+
+	ret = sqfs_frag_table_read(vfy.frag, file, super, cmp);
+	if (ret) {
+		sqfs_perror(opt->image_name, "loading fragment table", ret);
+		ret = -1;
+		goto out;
+	}
+
+	vfy.num_frags = sqfs_frag_table_get_size(vfy.frag);
+	vfy.frag_sizes = alloc_array(sizeof(vfy.frag_sizes[0]),
+				     vfy.num_frags + 1);
+	vfy.inode_seen = calloc(super->inode_count / 8 + 1, 1);
+	ret = -1;
+
+	if (vfy.frag_sizes == NULL || vfy.inode_seen == NULL) {
+		perror("initializing verification");
+		goto out;
+	}
+
+	for (i = 0; i < vfy.num_frags; ++i)
+		vfy.frag_sizes[i] = FRAG_SIZE_UNKNOWN;
+
+	if (walk_tree(&vfy, root) || gen_jobs(&vfy))
+		goto out;
+
+	if (run_jobs(&vfy, cmp, opt->num_jobs))
+		goto out;
+
+	check_tail_ends(&vfy);
+
+	if (vfy.num_inodes != super->inode_count) {
+		report(&vfy, NULL, 0, PRI_SZ " inodes reachable from the "
+		       "root, but the super block counts %u", vfy.num_inodes,
+		       super->inode_count);
+	}
+out_summary:
+	print_summary(&vfy, get_time_ns() - start);
+	ret = vfy.num_errors > 0 ? -1 : 0;
+out:
+	if (vfy.frag != NULL)
+		sqfs_destroy(vfy.frag);
+	array_cleanup(&vfy.files);
+	array_cleanup(&vfy.jobs);
+	free(vfy.frag_sizes);
+	free(vfy.inode_seen);
+	return ret;
+}
@@ -100,6 +100,7 @@ static sqfs_tree_node_t *tree_merge(sqfs_tree_node_t *lhs,
 	it = (lhs->children != NULL ? lhs->children : rhs->children);
 	*next_ptr = it;
 
+	rhs->children = NULL;
 	sqfs_dir_tree_destroy(rhs);
 	lhs->children = head;
 	return lhs;
@@ -183,7 +184,8 @@ int main(int argc, char **argv)
 		goto out_data;
 	}
 
-	dr = sqfs_dir_reader_create(&super, cmp, file, 0);
+	dr = sqfs_dir_reader_create(&super, cmp, file,
+				    SQFS_DIR_READER_BLOCK_CACHE);
 	if (dr == NULL) {
 		sqfs_perror(filename, "creating dir reader",
 			    SQFS_ERROR_ALLOC);
@@ -191,7 +193,7 @@ int main(int argc, char **argv)
 	}
 
 	if (!no_xattr && !(super.flags & SQFS_FLAG_NO_XATTRS)) {
-		xr = sqfs_xattr_reader_create(0);
+		xr = sqfs_xattr_reader_create(SQFS_XATTR_READER_BLOCK_CACHE);
 		if (xr == NULL) {
 			sqfs_perror(filename, "creating xattr reader",
 				    SQFS_ERROR_ALLOC);
@@ -206,6 +208,13 @@ int main(int argc, char **argv)
 	}
 
 	if (num_subdirs == 0) {
+		ret = sqfs_dir_reader_preload(dr, os_get_num_jobs());
+		if (ret) {
+			sqfs_perror(filename, "preloading inode and "
+				    "directory table", ret);
+			goto out;
+		}
+
 		ret = sqfs_dir_reader_get_full_hierarchy(dr, idtbl, NULL,
 							 0, &root);
 		if (ret) {
@@ -9,6 +9,25 @@
 static unsigned char old_buf[MAX_WINDOW_SIZE];
 static unsigned char new_buf[MAX_WINDOW_SIZE];
 
+/* the data readers and buffers used by one thread to compare files */
+typedef struct {
+	sqfs_data_reader_t *old_data;
+	sqfs_data_reader_t *new_data;
+	unsigned char *old_buf;
+	unsigned char *new_buf;
+
+	/* private compressors for the data readers of worker threads */
+	sqfs_compressor_t *old_cmp;
+	sqfs_compressor_t *new_cmp;
+} file_reader_t;
+
+typedef struct {
+	const sqfs_inode_generic_t *old;
+	const sqfs_inode_generic_t *new;
+	char *path;
+	int status;
+} compare_job_t;
+
 static int read_blob(const char *prefix, const char *path,
 		     sqfs_data_reader_t *rd, const sqfs_inode_generic_t *inode,
 		     void *buffer, sqfs_u64 offset, size_t size)
@@ -27,46 +46,407 @@ static int read_blob(const char *prefix, const char *path,
 	return 0;
 }
 
-int compare_files(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
-		  const sqfs_inode_generic_t *new, const char *path)
+static int read_raw(const char *prefix, const char *path, sqfs_file_t *file,
+		    void *buffer, sqfs_u64 offset, size_t size)
+{
+	int ret = file->read_at(file, offset, buffer, size);
+
+	if (ret) {
+		sqfs_perror(prefix, path, ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+  If both images use the same compressor and block size, equal on-disk block
+  sizes and equal raw bytes imply equal contents. Figure out how many bytes
+  of the two files can be verified like this, without uncompressing anything.
+ */
+static int compare_blocks_raw(sqfsdiff_t *sd, file_reader_t *rd,
+			      const sqfs_inode_generic_t *old,
+			      const sqfs_inode_generic_t *new,
+			      const char *path, sqfs_u64 filesz,
+			      sqfs_u64 *verified)
+{
+	sqfs_u32 old_frag, new_frag, old_frag_off, new_frag_off;
+	size_t i, j, count, run, blk_size;
+	sqfs_u64 old_loc, new_loc;
+	bool by_location;
+
+	*verified = 0;
+
+	if (sd->sqfs_old.super.compression_id !=
+	    sd->sqfs_new.super.compression_id) {
+		return 0;
+	}
+
+	if (sd->sqfs_old.super.block_size != sd->sqfs_new.super.block_size)
+		return 0;
+
+	count = sqfs_inode_get_file_block_count(old);
+	if (count != sqfs_inode_get_file_block_count(new))
+		return 0;
+
+	sqfs_inode_get_file_block_start(old, &old_loc);
+	sqfs_inode_get_file_block_start(new, &new_loc);
+
+	by_location = (sd->compare_flags & COMPARE_BY_LOCATION) &&
+		old_loc == new_loc;
+
+	for (i = 0; i < count; i = j) {
+		/* gather a run of equally sized blocks that fits the window */
+		run = 0;
+
+		for (j = i; j < count; ++j) {
+			if (old->extra[j] != new->extra[j])
+				break;
+
+			blk_size = SQFS_ON_DISK_BLOCK_SIZE(old->extra[j]);
+			if ((run + blk_size) > MAX_WINDOW_SIZE)
+				break;
+
+			run += blk_size;
+		}
+
+		if (j == i)
+			break;
+
+		if (!by_location && run > 0) {
+			if (read_raw(sd->old_path, path, sd->sqfs_old.file,
+				     rd->old_buf, old_loc, run)) {
+				return -1;
+			}
+
+			if (read_raw(sd->new_path, path, sd->sqfs_new.file,
+				     rd->new_buf, new_loc, run)) {
+				return -1;
+			}
+
+			if (memcmp(rd->old_buf, rd->new_buf, run) != 0) {
+				/* narrow it down to the first differing block */
+				for (run = 0; i < j; ++i) {
+					blk_size = SQFS_ON_DISK_BLOCK_SIZE(
+							old->extra[i]);
+
+					if (memcmp(rd->old_buf + run,
+						   rd->new_buf + run,
+						   blk_size) != 0) {
+						break;
+					}
+
+					run += blk_size;
+				}
+				break;
+			}
+		}
+
+		old_loc += run;
+		new_loc += run;
+	}
+
+	*verified = (sqfs_u64)i * sd->sqfs_old.super.block_size;
+
+	if (i < count)
+		return 0;
+
+	if (*verified >= filesz) {
+		*verified = filesz;
+		return 0;
+	}
+
+	/* the tail end lives in a fragment block shared with other files */
+	if (sd->compare_flags & COMPARE_BY_LOCATION) {
+		sqfs_inode_get_frag_location(old, &old_frag, &old_frag_off);
+		sqfs_inode_get_frag_location(new, &new_frag, &new_frag_off);
+
+		if (old_frag != 0xFFFFFFFF && old_frag == new_frag &&
+		    old_frag_off == new_frag_off) {
+			*verified = filesz;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns 0 if the contents are equal, > 0 if not, < 0 on failure. */
+static int compare_contents(sqfsdiff_t *sd, file_reader_t *rd,
+			    const sqfs_inode_generic_t *old,
+			    const sqfs_inode_generic_t *new, const char *path)
 {
 	sqfs_u64 offset, diff, oldsz, newsz;
-	int status = 0, ret;
+	int ret;
 
 	sqfs_inode_get_file_size(old, &oldsz);
 	sqfs_inode_get_file_size(new, &newsz);
 
 	if (oldsz != newsz)
-		goto out_different;
+		return 1;
 
 	if (sd->compare_flags & COMPARE_NO_CONTENTS)
 		return 0;
 
-	for (offset = 0; offset < oldsz; offset += diff) {
+	if (compare_blocks_raw(sd, rd, old, new, path, oldsz, &offset))
+		return -1;
+
+	for (; offset < oldsz; offset += diff) {
 		diff = oldsz - offset;
 
 		if (diff > MAX_WINDOW_SIZE)
 			diff = MAX_WINDOW_SIZE;
 
 		ret = read_blob(sd->old_path, path,
-				sd->sqfs_old.data, old, old_buf, offset, diff);
+				rd->old_data, old, rd->old_buf, offset, diff);
 		if (ret)
 			return -1;
 
 		ret = read_blob(sd->new_path, path,
-				sd->sqfs_new.data, new, new_buf, offset, diff);
+				rd->new_data, new, rd->new_buf, offset, diff);
 		if (ret)
 			return -1;
 
-		if (memcmp(old_buf, new_buf, diff) != 0)
-			goto out_different;
+		if (memcmp(rd->old_buf, rd->new_buf, diff) != 0)
+			return 1;
 	}
 
-	return status;
-out_different:
-	if (sd->compare_flags & COMPARE_EXTRACT_FILES) {
+	return 0;
+}
+
+static int defer_compare(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
+			 const sqfs_inode_generic_t *new, const char *path)
+{
+	compare_job_t job;
+
+	if (sd->jobs == NULL) {
+		sd->jobs = calloc(1, sizeof(*sd->jobs));
+
+		if (sd->jobs == NULL ||
+		    array_init(sd->jobs, sizeof(compare_job_t), 0)) {
+			free(sd->jobs);
+			sd->jobs = NULL;
+			goto fail;
+		}
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.old = old;
+	job.new = new;
+	job.path = strdup(path);
+
+	if (job.path == NULL || array_append(sd->jobs, &job)) {
+		free(job.path);
+		goto fail;
+	}
+
+	return 0;
+fail:
+	perror(path);
+	return -1;
+}
+
+int compare_files(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
+		  const sqfs_inode_generic_t *new, const char *path)
+{
+	file_reader_t rd;
+	int ret;
+
+	if (sd->num_jobs > 1)
+		return defer_compare(sd, old, new, path);
+
+	memset(&rd, 0, sizeof(rd));
+	rd.old_data = sd->sqfs_old.data;
+	rd.new_data = sd->sqfs_new.data;
+	rd.old_buf = old_buf;
+	rd.new_buf = new_buf;
+
+	ret = compare_contents(sd, &rd, old, new, path);
+
+	if (ret > 0 && (sd->compare_flags & COMPARE_EXTRACT_FILES)) {
 		if (extract_files(sd, old, new, path))
 			return -1;
 	}
-	return 1;
+
+	return ret;
+}
+
+/*****************************************************************************/
+
+static void reader_cleanup(file_reader_t *rd)
+{
+	sqfs_destroy(rd->old_data);
+	sqfs_destroy(rd->new_data);
+	sqfs_destroy(rd->old_cmp);
+	sqfs_destroy(rd->new_cmp);
+	free(rd->old_buf);
+	free(rd->new_buf);
+	memset(rd, 0, sizeof(*rd));
+}
+
+static int reader_create(sqfs_state_t *state, sqfs_compressor_t **cmp,
+			 sqfs_data_reader_t **data, const char *path)
+{
+	int ret;
+
+	/* compressors keep state between blocks, so they cannot be shared */
+	*cmp = sqfs_copy(state->cmp);
+	if (*cmp == NULL)
+		goto fail_alloc;
+
+	*data = sqfs_data_reader_create(state->file, state->super.block_size,
+					*cmp, 0);
+	if (*data == NULL)
+		goto fail_alloc;
+
+	ret = sqfs_data_reader_load_fragment_table(*data, &state->super);
+	if (ret) {
+		sqfs_perror(path, "loading fragment table", ret);
+		return -1;
+	}
+
+	return 0;
+fail_alloc:
+	sqfs_perror(path, "creating data reader", SQFS_ERROR_ALLOC);
+	return -1;
+}
+
+static int reader_init(sqfsdiff_t *sd, file_reader_t *rd)
+{
+	memset(rd, 0, sizeof(*rd));
+
+	if (reader_create(&sd->sqfs_old, &rd->old_cmp, &rd->old_data,
+			  sd->old_path)) {
+		return -1;
+	}
+
+	if (reader_create(&sd->sqfs_new, &rd->new_cmp, &rd->new_data,
+			  sd->new_path)) {
+		return -1;
+	}
+
+	rd->old_buf = malloc(MAX_WINDOW_SIZE);
+	rd->new_buf = malloc(MAX_WINDOW_SIZE);
+
+	if (rd->old_buf == NULL || rd->new_buf == NULL) {
+		perror("allocating file compare buffers");
+		return -1;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	sqfsdiff_t *sd;
+	file_reader_t rd;
+} compare_worker_t;
+
+static int compare_worker(void *user, void *work_item)
+{
+	compare_worker_t *worker = user;
+	compare_job_t *job = work_item;
+
+	job->status = compare_contents(worker->sd, &worker->rd,
+				       job->old, job->new, job->path);
+
+	/* Errors are reported through the job. A failing worker would stop
+	   the pool and leave the remaining items in the queue forever. */
+	return 0;
+}
+
+static int run_jobs(sqfsdiff_t *sd)
+{
+	compare_worker_t *workers = NULL;
+	size_t i, num_workers = 0;
+	int ret = -1, status = 0;
+	thread_pool_t *pool;
+	compare_job_t *job;
+
+	pool = thread_pool_create(sd->num_jobs, compare_worker);
+	if (pool == NULL) {
+		fputs("Error creating thread pool\n", stderr);
+		return -1;
+	}
+
+	num_workers = pool->get_worker_count(pool);
+
+	workers = alloc_array(sizeof(workers[0]), num_workers);
+	if (workers == NULL) {
+		perror("creating file compare workers");
+		goto out;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		workers[i].sd = sd;
+
+		if (reader_init(sd, &workers[i].rd)) {
+			num_workers = i + 1;
+			goto out;
+		}
+
+		pool->set_worker_ptr(pool, i, workers + i);
+	}
+
+	for (i = 0; i < sd->jobs->used; ++i) {
+		if (pool->submit(pool, array_get(sd->jobs, i))) {
+			fputs("Error submitting file compare jobs\n", stderr);
+			goto out;
+		}
+	}
+
+	/* completed jobs come out in the order they were submitted */
+	while ((job = pool->dequeue(pool)) != NULL) {
+		if (status < 0)
+			continue;
+
+		if (job->status < 0) {
+			status = -1;
+			continue;
+		}
+
+		if (job->status == 0)
+			continue;
+
+		fprintf(stdout, "regular file %s differs\n", job->path);
+		status = 1;
+
+		if (sd->compare_flags & COMPARE_EXTRACT_FILES) {
+			if (extract_files(sd, job->old, job->new, job->path))
+				status = -1;
+		}
+	}
+
+	ret = status;
+out:
+	pool->destroy(pool);
+
+	if (workers != NULL) {
+		for (i = 0; i < num_workers; ++i)
+			reader_cleanup(&workers[i].rd);
+	}
+
+	free(workers);
+	return ret;
+}
+
+int compare_deferred_files(sqfsdiff_t *sd, bool run)
+{
+	compare_job_t *job;
+	size_t i;
+	int ret = 0;
+
+	if (sd->jobs == NULL)
+		return 0;
+
+	if (run && sd->jobs->used > 0)
+		ret = run_jobs(sd);
+
+	for (i = 0; i < sd->jobs->used; ++i) {
+		job = array_get(sd->jobs, i);
+		free(job->path);
+	}
+
+	array_cleanup(sd->jobs);
+	free(sd->jobs);
+	sd->jobs = NULL;
+	return ret;
 }
@@ -6,11 +6,64 @@
  */
 #include "sqfsdiff.h"
 
-static int extract(sqfs_data_reader_t *data, const sqfs_inode_generic_t *inode,
-		   const char *prefix, const char *path, size_t block_size)
+static bool inode_data_equals(void *user, const void *a, const void *b)
 {
+	(void)user;
+	return inode_data_compare(a, b) == 0;
+}
+
+static void free_path(struct hash_entry *ent)
+{
+	free(ent->data);
+}
+
+void extract_cleanup(sqfs_state_t *state)
+{
+	if (state->extracted != NULL)
+		hash_table_destroy(state->extracted, free_path);
+
+	state->extracted = NULL;
+}
+
+/*
+  Files that share the same data blocks and fragment are copied from the
+  first one extracted, instead of uncompressing the data again.
+ */
+static int remember(sqfs_state_t *state, const sqfs_inode_generic_t *inode,
+		    sqfs_u32 hash, const char *path)
+{
+	char *copy;
+
+	if (state->extracted == NULL) {
+		state->extracted = hash_table_create(NULL, inode_data_equals);
+		if (state->extracted == NULL)
+			goto fail;
+	}
+
+	copy = strdup(path);
+	if (copy == NULL)
+		goto fail;
+
+	if (hash_table_insert_pre_hashed(state->extracted, hash,
+					 inode, copy) == NULL) {
+		free(copy);
+		goto fail;
+	}
+
+	return 0;
+fail:
+	perror(path);
+	return -1;
+}
+
+static int extract(sqfs_state_t *state, const sqfs_inode_generic_t *inode,
+		   const char *prefix, const char *path)
+{
+	struct hash_entry *ent = NULL;
 	char *ptr, *temp;
 	ostream_t *fp;
+	sqfs_u64 size;
+	sqfs_u32 hash;
 
 	temp = alloca(strlen(prefix) + strlen(path) + 2);
 	sprintf(temp, "%s/%s", prefix, path);
@@ -21,6 +74,19 @@ static int extract(sqfs_data_reader_t *data, const sqfs_inode_generic_t *inode,
 		return -1;
 	*ptr = '/';
 
+	sqfs_inode_get_file_size(inode, &size);
+	hash = inode_data_hash(inode);
+
+	if (size > 0 && state->extracted != NULL) {
+		ent = hash_table_search_pre_hashed(state->extracted,
+						   hash, inode);
+
+		if (ent != NULL &&
+		    clone_file(ent->data, temp, OSTREAM_OPEN_SPARSE) == 0) {
+			return 0;
+		}
+	}
+
 	fp = ostream_open_file(temp, OSTREAM_OPEN_OVERWRITE |
 			       OSTREAM_OPEN_SPARSE);
 	if (fp == NULL) {
@@ -28,13 +94,18 @@ static int extract(sqfs_data_reader_t *data, const sqfs_inode_generic_t *inode,
 		return -1;
 	}
 
-	if (sqfs_data_reader_dump(path, data, inode, fp, block_size)) {
+	if (sqfs_data_reader_dump(path, state->data, inode, fp,
+				  state->super.block_size)) {
 		sqfs_destroy(fp);
 		return -1;
 	}
 
 	ostream_flush(fp);
 	sqfs_destroy(fp);
+
+	if (size > 0 && ent == NULL)
+		return remember(state, inode, hash, temp);
+
 	return 0;
 }
 
@@ -43,14 +114,12 @@ int extract_files(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
 		  const char *path)
 {
 	if (old != NULL) {
-		if (extract(sd->sqfs_old.data, old, "old",
-			    path, sd->sqfs_old.super.block_size))
+		if (extract(&sd->sqfs_old, old, "old", path))
 			return -1;
 	}
 
 	if (new != NULL) {
-		if (extract(sd->sqfs_new.data, new, "new",
-			    path, sd->sqfs_new.super.block_size))
+		if (extract(&sd->sqfs_new, new, "new", path))
 			return -1;
 	}
 
@@ -16,12 +16,14 @@ static struct option long_opts[] = {
 	{ "inode-num", no_argument, NULL, 'I' },
 	{ "super", no_argument, NULL, 'S' },
 	{ "extract", required_argument, NULL, 'e' },
+	{ "same-image", no_argument, NULL, 'L' },
+	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "help", no_argument, NULL, 'h' },
 	{ "version", no_argument, NULL, 'V' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "a:b:OPCTISe:hV";
+static const char *short_opts = "a:b:OPCTISe:Lj:hV";
 
 static const char *usagestr =
 "Usage: sqfsdiff [OPTIONS...] --old,-a <first> --new,-b <second>\n"
@@ -56,6 +58,17 @@ static const char *usagestr =
 "                              directory. Contents of the first filesystem\n"
 "                              end up in a subdirectory 'old' and of the\n"
 "                              second filesystem in a subdirectory 'new'.\n"
+"  --same-image, -L            Both filesystems share the same data area,\n"
+"                              e.g. they are the same image, or one was\n"
+"                              created from the other by appending to it.\n"
+"                              Files with data stored at the same location\n"
+"                              are considered equal without reading them.\n"
+"  --num-jobs, -j <count>      Maximum number of threads to use, both for\n"
+"                              reading the trees and for comparing file\n"
+"                              contents. With more than one, differing file\n"
+"                              contents are reported after all other\n"
+"                              differences, but in the same order.\n"
+"                              Defaults to 1.\n"
 "\n"
 "  --help, -h                  Print help text and exit.\n"
 "  --version, -V               Print version information and exit.\n"
@@ -63,8 +76,12 @@ static const char *usagestr =
 
 void process_options(sqfsdiff_t *sd, int argc, char **argv)
 {
+	char *end;
+	long value;
 	int i;
 
+	sd->num_jobs = 1;
+
 	for (;;) {
 		i = getopt_long(argc, argv, short_opts, long_opts, NULL);
 		if (i == -1)
@@ -99,6 +116,19 @@ void process_options(sqfsdiff_t *sd, int argc, char **argv)
 			sd->compare_flags |= COMPARE_EXTRACT_FILES;
 			sd->extract_dir = optarg;
 			break;
+		case 'L':
+			sd->compare_flags |= COMPARE_BY_LOCATION;
+			break;
+		case 'j':
+			value = strtol(optarg, &end, 0);
+			if (end == optarg || *end != '\0' || value < 1) {
+				fprintf(stderr, "Invalid number of jobs '%s', "
+					"expected a number of at least 1.\n",
+					optarg);
+				goto fail_arg;
+			}
+			sd->num_jobs = value;
+			break;
 		case 'h':
 			fputs(usagestr, stdout);
 			exit(0);
@@ -6,7 +6,7 @@
  */
 #include "sqfsdiff.h"
 
-static int open_sfqs(sqfs_state_t *state, const char *path)
+static int open_sfqs(sqfs_state_t *state, const char *path, size_t num_jobs)
 {
 	int ret;
 
@@ -67,13 +67,20 @@ static int open_sfqs(sqfs_state_t *state, const char *path)
 	}
 
 	state->dr = sqfs_dir_reader_create(&state->super, state->cmp,
-					   state->file, 0);
+					   state->file,
+					   SQFS_DIR_READER_BLOCK_CACHE);
 	if (state->dr == NULL) {
 		sqfs_perror(path, "creating directory reader",
 			    SQFS_ERROR_ALLOC);
 		goto fail_id;
 	}
 
+	ret = sqfs_dir_reader_preload(state->dr, num_jobs);
+	if (ret) {
+		sqfs_perror(path, "preloading inode and directory table", ret);
+		goto fail_dr;
+	}
+
 	ret = sqfs_dir_reader_get_full_hierarchy(state->dr, state->idtbl,
 						 NULL, 0, &state->root);
 	if (ret) {
@@ -113,6 +120,7 @@ fail_file:
 
 static void close_sfqs(sqfs_state_t *state)
 {
+	extract_cleanup(state);
 	sqfs_destroy(state->data);
 	sqfs_dir_tree_destroy(state->root);
 	sqfs_destroy(state->dr);
@@ -134,10 +142,10 @@ int main(int argc, char **argv)
 			return 2;
 	}
 
-	if (open_sfqs(&sd.sqfs_old, sd.old_path))
+	if (open_sfqs(&sd.sqfs_old, sd.old_path, sd.num_jobs))
 		return 2;
 
-	if (open_sfqs(&sd.sqfs_new, sd.new_path)) {
+	if (open_sfqs(&sd.sqfs_new, sd.new_path, sd.num_jobs)) {
 		status = 2;
 		goto out_sqfs_old;
 	}
@@ -151,6 +159,14 @@ int main(int argc, char **argv)
 	}
 
 	ret = node_compare(&sd, sd.sqfs_old.root, sd.sqfs_new.root);
+
+	status = compare_deferred_files(&sd, ret >= 0);
+	if (status < 0) {
+		ret = -1;
+	} else if (status > 0 && ret == 0) {
+		ret = 1;
+	}
+
 	if (ret != 0)
 		goto out;
 
@@ -10,6 +10,10 @@
 #include "config.h"
 #include "common.h"
 #include "fstree.h"
+#include "hash_table.h"
+#include "threadpool.h"
+#include "array.h"
+#include "util.h"
 
 #include <stdlib.h>
 #include <getopt.h>
@@ -30,6 +34,9 @@ typedef struct {
 
 	sqfs_compressor_config_t options;
 	bool have_options;
+
+	/* data location of extracted files -> path of the extracted file */
+	struct hash_table *extracted;
 } sqfs_state_t;
 
 typedef struct {
@@ -40,6 +47,10 @@ typedef struct {
 	sqfs_state_t sqfs_new;
 	bool compare_super;
 	const char *extract_dir;
+	size_t num_jobs;
+
+	/* file comparisons deferred to a thread pool if num_jobs > 1 */
+	array_t *jobs;
 } sqfsdiff_t;
 
 enum {
@@ -49,6 +60,7 @@ enum {
 	COMPARE_TIMESTAMP = 0x08,
 	COMPARE_INODE_NUM = 0x10,
 	COMPARE_EXTRACT_FILES = 0x20,
+	COMPARE_BY_LOCATION = 0x40,
 };
 
 int compare_dir_entries(sqfsdiff_t *sd, sqfs_tree_node_t *old,
@@ -59,6 +71,15 @@ char *node_path(const sqfs_tree_node_t *n);
 int compare_files(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
 		  const sqfs_inode_generic_t *new, const char *path);
 
+/*
+  Run the file comparisons collected while walking the trees, if the compare
+  was done with more than one job. Differences are reported and extracted in
+  the order in which the files were encountered.
+
+  Returns 0 if all files are equal, > 0 if not, < 0 on failure.
+ */
+int compare_deferred_files(sqfsdiff_t *sd, bool run);
+
 int node_compare(sqfsdiff_t *sd, sqfs_tree_node_t *a, sqfs_tree_node_t *b);
 
 int compare_super_blocks(const sqfs_super_t *a, const sqfs_super_t *b);
@@ -67,6 +88,8 @@ int extract_files(sqfsdiff_t *sd, const sqfs_inode_generic_t *old,
 		  const sqfs_inode_generic_t *new,
 		  const char *path);
 
+void extract_cleanup(sqfs_state_t *state);
+
 void process_options(sqfsdiff_t *sd, int argc, char **argv);
 
 #endif /* DIFFTOOL_H */
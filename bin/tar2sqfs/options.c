@@ -6,6 +6,15 @@
  */
 #include "tar2sqfs.h"
 
+enum {
+	PROBE_THRESHOLD_OPTION = 1,
+	MIN_GAIN_OPTION,
+	REFERENCE_OPTION,
+	TRACE_OPTION,
+	MEM_LIMIT_OPTION,
+	EARLY_DEDUP_OPTION,
+};
+
 static struct option long_opts[] = {
 	{ "root-becomes", required_argument, NULL, 'r' },
 	{ "compressor", required_argument, NULL, 'c' },
@@ -14,6 +23,12 @@ static struct option long_opts[] = {
 	{ "defaults", required_argument, NULL, 'd' },
 	{ "num-jobs", required_argument, NULL, 'j' },
 	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "mem-limit", required_argument, NULL, MEM_LIMIT_OPTION },
+	{ "probe-threshold", required_argument, NULL, PROBE_THRESHOLD_OPTION },
+	{ "min-gain", required_argument, NULL, MIN_GAIN_OPTION },
+	{ "early-dedup", no_argument, NULL, EARLY_DEDUP_OPTION },
+	{ "reference", required_argument, NULL, REFERENCE_OPTION },
+	{ "trace", required_argument, NULL, TRACE_OPTION },
 	{ "comp-extra", required_argument, NULL, 'X' },
 	{ "no-skip", no_argument, NULL, 's' },
 	{ "no-xattr", no_argument, NULL, 'x' },
@@ -58,6 +73,25 @@ static const char *usagestr =
 "                              worker queue before the packer starts waiting\n"
 "                              for the block processors to catch up.\n"
 "                              Defaults to 10 times the number of jobs.\n"
+"  --mem-limit <size>          Pre-allocate this much memory for data blocks\n"
+"                              in flight and derive the queue backlog from\n"
+"                              it, instead of using --queue-backlog.\n"
+"  --probe-threshold <bits>    Entropy in bits per byte (0 to 8) from which\n"
+"                              on a data block is considered incompressible\n"
+"                              and stored as is, without trying to compress\n"
+"                              it. %.2f skips compressed and encrypted\n"
+"                              data, but can miss repeats far apart.\n"
+"                              Defaults to 0, i.e. compress every block.\n"
+"  --min-gain <percent>        Store data blocks uncompressed if compressing\n"
+"                              them saves less than this percentage.\n"
+"                              Defaults to 0.\n"
+"  --reference <image>         A previously built image with the same\n"
+"                              compressor and block size. Data blocks of\n"
+"                              files that are unchanged are copied from it\n"
+"                              instead of compressing them again.\n"
+"  --trace <file>              Record what happens to every data block and\n"
+"                              write a timeline in the Chrome trace event\n"
+"                              format to the given file.\n"
 "  --block-size, -b <size>     Block size to use for Squashfs image.\n"
 "                              Defaults to %u.\n"
 "  --dev-block-size, -B <size> Device block size to padd the image to.\n"
@@ -70,6 +104,13 @@ static const char *usagestr =
 "                                 gid=<value>    0 if not set.\n"
 "                                 mode=<value>   0755 if not set.\n"
 "                                 mtime=<value>  0 if not set.\n"
+"\n";
+
+static const char *usagestr_more =
+"  --early-dedup               Recognize files that are identical to one\n"
+"                              packed before by the SHA-256 digests of their\n"
+"                              blocks, and do not compress them at all.\n"
+"                              Hashing every block limits the throughput.\n"
 "\n"
 "  --no-skip, -s               Abort if a tar record cannot be read instead\n"
 "                              of skipping it.\n"
@@ -115,7 +156,9 @@ static void input_compressor_print_available(void)
 void process_args(int argc, char **argv)
 {
 	bool have_compressor;
+	double threshold;
 	int i, ret;
+	char *end;
 
 	sqfs_writer_cfg_init(&cfg);
 
@@ -174,6 +217,42 @@ void process_args(int argc, char **argv)
 		case 'Q':
 			cfg.max_backlog = strtol(optarg, NULL, 0);
 			break;
+		case MEM_LIMIT_OPTION:
+			if (parse_size("Memory limit", &cfg.mem_limit,
+				       optarg, 0)) {
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case PROBE_THRESHOLD_OPTION:
+			threshold = strtod(optarg, &end);
+			if (end == optarg || *end != '\0' ||
+			    threshold < 0.0 || threshold > 8.0) {
+				fprintf(stderr, "Invalid probe threshold '%s', "
+					"expected a number from 0 to 8.\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			cfg.probe_threshold = threshold * 1000.0;
+			break;
+		case MIN_GAIN_OPTION:
+			cfg.min_gain = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' ||
+			    cfg.min_gain >= 100) {
+				fprintf(stderr, "Invalid minimum gain '%s', "
+					"expected a percentage below 100.\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case EARLY_DEDUP_OPTION:
+			cfg.early_dedup = true;
+			break;
+		case REFERENCE_OPTION:
+			cfg.reference = optarg;
+			break;
+		case TRACE_OPTION:
+			cfg.trace_file = optarg;
+			break;
 		case 'X':
 			cfg.comp_extra = optarg;
 			break;
@@ -215,8 +294,10 @@ void process_args(int argc, char **argv)
 			cfg.quiet = true;
 			break;
 		case 'h':
-			printf(usagestr, SQFS_DEFAULT_BLOCK_SIZE,
-			       SQFS_DEVBLK_SIZE);
+			printf(usagestr,
+			       SQFS_WRITER_TYPICAL_PROBE_THRESHOLD / 1000.0,
+			       SQFS_DEFAULT_BLOCK_SIZE, SQFS_DEVBLK_SIZE);
+			fputs(usagestr_more, stdout);
 			compressor_print_available();
 			input_compressor_print_available();
 			exit(EXIT_SUCCESS);
@@ -19,8 +19,23 @@ static int write_file(istream_t *input_file, sqfs_writer_t *sqfs,
 	if (no_tail_pack && filesize > cfg.block_size)
 		flags |= SQFS_BLK_DONT_FRAGMENT;
 
-	out = data_writer_ostream_create(hdr->name, sqfs->data, &fi->inode,
-					 flags);
+	if (sqfs->ref != NULL) {
+		char *path = fstree_get_path(container_of(fi, tree_node_t,
+							  data.file));
+
+		if (path == NULL) {
+			perror(hdr->name);
+			return -1;
+		}
+
+		if (canonicalize_name(path) == 0)
+			sqfs_reference_begin_file(sqfs->ref, path);
+
+		free(path);
+	}
+
+	out = data_writer_ostream_create(hdr->name, sqfs->data, sqfs->ref,
+					 &fi->inode, flags);
 
 	if (out == NULL)
 		return -1;
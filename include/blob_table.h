@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * blob_table.h
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef BLOB_TABLE_H
+#define BLOB_TABLE_H
+
+#include "sqfs/predef.h"
+#include "array.h"
+#include "hash_table.h"
+
+/* Key used for the hash table, pointing to the bucket payload. */
+typedef struct {
+	const void *data;
+	size_t size;
+} blob_key_t;
+
+typedef struct {
+	blob_key_t key;
+	size_t index;
+	size_t refcount;
+	sqfs_u8 data[];
+} blob_bucket_t;
+
+/* Same as str_table_t, but works on arbitrary binary blobs of a given size
+   instead of null-terminated strings. Each unique blob is stored exactly
+   once, in its raw form, and assigned an incremental, unique ID. */
+typedef struct {
+	/* an array that resolves index to bucket pointer */
+	array_t bucket_ptrs;
+
+	/* hash table with the blob buckets attached */
+	struct hash_table *ht;
+
+	/* the next ID we are going to allocate */
+	size_t next_index;
+} blob_table_t;
+
+/* the number of blobs currently stored in the table */
+static SQFS_INLINE size_t blob_table_count(const blob_table_t *table)
+{
+	return table->next_index;
+}
+
+SQFS_INTERNAL int blob_table_init(blob_table_t *table);
+
+SQFS_INTERNAL void blob_table_cleanup(blob_table_t *table);
+
+SQFS_INTERNAL int blob_table_copy(blob_table_t *dst, const blob_table_t *src);
+
+/* Resolve a blob to an incremental, unique ID. */
+SQFS_INTERNAL int blob_table_get_index(blob_table_t *table, const void *data,
+				       size_t size, size_t *idx);
+
+/* Resolve a unique ID to the blob it represents. Returns NULL if the
+   ID is unknown, i.e. out of bounds. The size is returned via `size`. */
+SQFS_INTERNAL const void *blob_table_get_blob(const blob_table_t *table,
+					      size_t index, size_t *size);
+
+SQFS_INTERNAL void blob_table_add_ref(blob_table_t *table, size_t index);
+
+SQFS_INTERNAL void blob_table_del_ref(blob_table_t *table, size_t index);
+
+SQFS_INTERNAL
+size_t blob_table_get_ref_count(const blob_table_t *table, size_t index);
+
+#endif /* BLOB_TABLE_H */
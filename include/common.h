@@ -42,8 +42,8 @@ int sqfs_data_reader_dump(const char *name, sqfs_data_reader_t *data,
 			  ostream_t *fp, size_t block_size);
 
 int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
-			 sqfs_inode_generic_t **inode,
-			 sqfs_file_t *file, int flags);
+			 sqfs_reference_t *ref, sqfs_inode_generic_t **inode,
+			 sqfs_file_t *file, int flags, sqfs_u64 group);
 
 void sqfs_perror(const char *file, const char *action, int error_code);
 
@@ -75,8 +75,35 @@ int parse_size(const char *what, size_t *out, const char *str,
 
 void print_size(sqfs_u64 size, char *buffer, bool round_to_int);
 
+/* Number of configured processors, i.e. a sensible default for worker
+   threads, or 1 if it cannot be determined. */
+size_t os_get_num_jobs(void);
+
+/*
+  Compare the data locations of two file inodes. Returns 0 if both refer to
+  the exact same blocks and fragment, i.e. have the same content, otherwise
+  the result can be used to sort inodes by their data location.
+ */
+int inode_data_compare(const sqfs_inode_generic_t *lhs,
+		       const sqfs_inode_generic_t *rhs);
+
+/* A hash over the data location of a file inode, see inode_data_compare */
+sqfs_u32 inode_data_hash(const sqfs_inode_generic_t *inode);
+
+/*
+  Create or overwrite the file dst with the contents of the file src, sharing
+  the data through a reflink or copying it inside the kernel where possible.
+  The flags are OSTREAM_OPEN_* flags, OSTREAM_OPEN_SPARSE turns zero chunks
+  into holes if the data has to be copied manually.
+
+  Returns 0 on success. Does not print anything on failure, the caller is
+  expected to fall back to producing the data some other way.
+ */
+int clone_file(const char *src, const char *dst, int flags);
+
 ostream_t *data_writer_ostream_create(const char *filename,
 				      sqfs_block_processor_t *proc,
+				      sqfs_reference_t *ref,
 				      sqfs_inode_generic_t **inode,
 				      int flags);
 
@@ -51,6 +51,10 @@ typedef struct istream_t {
 
 	sqfs_u8 *buffer;
 
+	/* assembles lines that do not fit into the buffer */
+	char *line_scratch;
+	size_t line_scratch_size;
+
 	int (*precache)(struct istream_t *strm);
 
 	const char *(*get_filename)(struct istream_t *strm);
@@ -300,6 +304,27 @@ SQFS_INTERNAL int ostream_printf(ostream_t *strm, const char *fmt, ...)
 SQFS_INTERNAL int istream_get_line(istream_t *strm, char **out,
 				   size_t *line_num, int flags);
 
+/**
+ * @brief Read a line of text from an input stream without copying it
+ *
+ * @memberof istream_t
+ *
+ * This works exactly like @ref istream_get_line, except that the line is not
+ * allocated. The returned pointer points into the internal buffer of the
+ * stream and is only valid until the next read from the stream or until the
+ * stream is destroyed. The caller may modify the line in place.
+ *
+ * @param strm A pointer to an input stream.
+ * @param out Returns a pointer to a line on success.
+ * @param line_num This is incremented if lines are skipped.
+ * @param flags A combination of flags controling the functions behaviour.
+ *
+ * @return Zero on success, a negative value on error, a positive value if
+ *         end-of-file was reached without reading any data.
+ */
+SQFS_INTERNAL int istream_get_line_inplace(istream_t *strm, char **out,
+					   size_t *line_num, int flags);
+
 /**
  * @brief Read data from an input stream
  *
@@ -75,6 +75,9 @@ struct dir_info_t {
 	/* Linked list head for children in the directory */
 	tree_node_t *children;
 
+	/* Last entry in the children list, for appending sorted input */
+	tree_node_t *children_tail;
+
 	/* Set to true for implicitly generated directories.  */
 	bool created_implicitly;
 
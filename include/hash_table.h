@@ -76,6 +76,8 @@ SQFS_INTERNAL struct hash_entry *
 hash_table_search_pre_hashed(struct hash_table *ht, sqfs_u32 hash,
                              const void *key);
 
+SQFS_INTERNAL void hash_table_clear(struct hash_table *ht);
+
 SQFS_INTERNAL struct hash_entry *hash_table_next_entry(struct hash_table *ht,
 						       struct hash_entry *entry);
 
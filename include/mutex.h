@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * mutex.h
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "sqfs/predef.h"
+
+/*
+  Minimal mutex wrapper for library internal state that is shared between
+  objects that may be used from different threads (e.g. caches shared by an
+  object and its copies). If the library is built without thread support,
+  the locking functions are no-ops.
+ */
+#if defined(_WIN32) || defined(__WINDOWS__)
+#include "w32threadwrap.h"
+#elif defined(NO_THREAD_IMPL)
+typedef int pthread_mutex_t;
+
+static SQFS_INLINE int pthread_mutex_init(pthread_mutex_t *mutex,
+					  const void *attr)
+{
+	(void)attr;
+	*mutex = 0;
+	return 0;
+}
+
+static SQFS_INLINE int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	(void)mutex;
+	return 0;
+}
+
+static SQFS_INLINE int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	(void)mutex;
+	return 0;
+}
+
+static SQFS_INLINE int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+	(void)mutex;
+	return 0;
+}
+#else
+#include <pthread.h>
+#endif
+
+#endif /* MUTEX_H */
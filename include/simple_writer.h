@@ -22,6 +22,11 @@
 
 #include "fstree.h"
 
+typedef struct sqfs_reference_t sqfs_reference_t;
+
+/* the most compression levels to choose from with adaptive levels */
+#define SQFS_WRITER_MAX_LEVELS (6)
+
 typedef struct {
 	const char *filename;
 	sqfs_block_writer_t *blkwr;
@@ -37,23 +42,52 @@ typedef struct {
 	sqfs_super_t super;
 	fstree_t fs;
 	sqfs_xattr_writer_t *xwr;
+	sqfs_reference_t *ref;
+
+	/* the levels used with adaptive_level, fastest first */
+	sqfs_u32 levels[SQFS_WRITER_MAX_LEVELS];
+	size_t num_levels;
 } sqfs_writer_t;
 
+/*
+  Thousandths of a bit per byte, see sqfs_block_processor_desc_t. The probe is
+  off by default, this is the value suggested for turning it on.
+ */
+#define SQFS_WRITER_TYPICAL_PROBE_THRESHOLD (7950)
+
 typedef struct {
 	const char *filename;
+	const char *reference;
+	const char *trace_file;
 	char *fs_defaults;
 	char *comp_extra;
 	size_t block_size;
 	size_t devblksize;
 	size_t max_backlog;
+	size_t mem_limit;
 	size_t num_jobs;
 
+	/* see SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, 0 for the default size */
+	size_t frag_defer_limit;
+
+	/* see sqfs_block_processor_desc_t */
+	sqfs_u32 probe_threshold;
+	sqfs_u32 min_gain;
+	sqfs_u64 target_rate;
+
 	int outmode;
 	SQFS_COMPRESSOR comp_id;
 
 	bool exportable;
 	bool no_xattr;
 	bool quiet;
+	bool group_fragments;
+
+	/* see SQFS_BLOCK_PROCESSOR_EARLY_DEDUP */
+	bool early_dedup;
+
+	/* pick the level per block, see SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL */
+	bool adaptive_level;
 } sqfs_writer_cfg_t;
 
 #ifdef __cplusplus
@@ -81,6 +115,44 @@ void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status);
  */
 int sqfs_serialize_fstree(const char *filename, sqfs_writer_t *wr);
 
+/*
+  Write the events recorded by a block processor created with the
+  SQFS_BLOCK_PROCESSOR_TRACE flag to a file, in the Chrome trace event
+  JSON format. Returns 0 on success, prints error messages to stderr
+  on failure.
+ */
+int sqfs_writer_write_trace(const sqfs_block_processor_t *proc,
+			    const char *filename);
+
+/*
+  Load the file list of an existing image, so that data blocks of files
+  that did not change can be copied over instead of compressing them again.
+
+  If the image uses a different compressor or block size, a warning is
+  printed and NULL is returned through `out`. Returns 0 on success. Prints
+  error messages to stderr on failure.
+ */
+int sqfs_reference_open(sqfs_reference_t **out, const char *filename,
+			const sqfs_compressor_t *cmp);
+
+void sqfs_reference_destroy(sqfs_reference_t *ref);
+
+/*
+  Look up the file with the given canonical path in the reference image.
+  The following file data is compared against the blocks of that file. The
+  reference can be NULL, in which case all functions simply pass the data
+  through to the block processor.
+ */
+void sqfs_reference_begin_file(sqfs_reference_t *ref, const char *path);
+
+/* Use instead of sqfs_block_processor_append. Returns an SQFS_ERROR code. */
+int sqfs_reference_append(sqfs_reference_t *ref, sqfs_block_processor_t *proc,
+			  const void *data, size_t size);
+
+/* Call before sqfs_block_processor_end_file. */
+int sqfs_reference_end_file(sqfs_reference_t *ref,
+			    sqfs_block_processor_t *proc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,6 +47,158 @@
  * This object is not copyable, i.e. @ref sqfs_copy will always return NULL.
  */
 
+/**
+ * @enum SQFS_BLOCK_PROCESSOR_FLAGS
+ *
+ * @brief Flags that can be set in @ref sqfs_block_processor_desc_t::flags.
+ */
+typedef enum {
+	/**
+	 * @brief Detect duplicate files before compressing them.
+	 *
+	 * While data is appended to a file, a SHA-256 digest of every raw
+	 * block is computed. If a file turns out to be identical to a
+	 * previously written one, its data is not compressed at all and the
+	 * inode simply receives the block list and fragment location of the
+	 * original.
+	 *
+	 * Only files of at least one full block are considered; smaller
+	 * ones are still handled by the fragment deduplication. Since the
+	 * inode pointers of previously written files are kept for
+	 * comparison, they must stay valid for the entire life time of the
+	 * block processor.
+	 */
+	SQFS_BLOCK_PROCESSOR_EARLY_DEDUP = 0x01,
+
+	/**
+	 * @brief Record a time line of what happens to every block.
+	 *
+	 * The events can be retrieved through
+	 * @ref sqfs_block_processor_get_trace. Every thread records into
+	 * its own buffer, so no locking is required, but the buffers grow
+	 * with the number of blocks processed.
+	 */
+	SQFS_BLOCK_PROCESSOR_TRACE = 0x02,
+
+	/**
+	 * @brief Collect tail-end fragments and pack them grouped.
+	 *
+	 * Instead of adding tail-ends to the current fragment block in the
+	 * order the files are written, they are buffered (up to
+	 * @ref sqfs_block_processor_desc_t::frag_defer_limit bytes) and
+	 * then packed, so that the tail-ends of files with the same group
+	 * (see @ref sqfs_block_processor_set_fragment_group) end up next to
+	 * each other. Groups are packed in the order in which they first
+	 * appeared, and files within a group in the order they were
+	 * written, so the result is still deterministic.
+	 *
+	 * The fragment locations of buffered files are only set once the
+	 * buffer is flushed, at the latest in
+	 * @ref sqfs_block_processor_sync.
+	 */
+	SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS = 0x04,
+
+	/**
+	 * @brief Pick the compression level for each block.
+	 *
+	 * Instead of compressing every block with the same compressor, each
+	 * block is compressed with one of
+	 * @ref sqfs_block_processor_desc_t::level_cmp. The strongest one is
+	 * picked for which the measured time the workers spend compressing
+	 * suggests that they can keep up with
+	 * @ref sqfs_block_processor_desc_t::target_rate.
+	 *
+	 * Since the choice depends on timing, the resulting blocks can differ
+	 * from one run to the next.
+	 */
+	SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL = 0x08,
+
+	SQFS_BLOCK_PROCESSOR_ALL_FLAGS = 0x0F,
+} SQFS_BLOCK_PROCESSOR_FLAGS;
+
+/**
+ * @enum SQFS_TRACE_EVENT
+ *
+ * @brief Types of events in a @ref sqfs_block_processor_trace_event_t.
+ */
+typedef enum {
+	/**
+	 * @brief The main thread handed a block to the workers.
+	 *
+	 * This event has no duration.
+	 */
+	SQFS_TRACE_EVENT_SUBMIT = 0,
+
+	/**
+	 * @brief A worker thread processed a block.
+	 */
+	SQFS_TRACE_EVENT_PROCESS = 1,
+
+	/**
+	 * @brief The main thread waited for a worker to complete a block.
+	 */
+	SQFS_TRACE_EVENT_WAIT = 2,
+
+	/**
+	 * @brief A completed block waited for the blocks before it to be
+	 *        completed, so they can be written in order.
+	 *
+	 * These events can overlap with each other.
+	 */
+	SQFS_TRACE_EVENT_REORDER = 3,
+
+	/**
+	 * @brief The main thread deduplicated a tail-end fragment and
+	 *        added it to a fragment block.
+	 */
+	SQFS_TRACE_EVENT_FRAGMENT = 4,
+
+	/**
+	 * @brief The main thread handed a block to the block writer.
+	 */
+	SQFS_TRACE_EVENT_WRITE = 5,
+} SQFS_TRACE_EVENT;
+
+/**
+ * @struct sqfs_block_processor_trace_event_t
+ *
+ * @brief An event recorded by a block processor with
+ *        @ref SQFS_BLOCK_PROCESSOR_TRACE set.
+ */
+struct sqfs_block_processor_trace_event_t {
+	/**
+	 * @brief Nanoseconds since the block processor was created.
+	 */
+	sqfs_u64 start;
+
+	/**
+	 * @brief Duration of the event in nanoseconds.
+	 */
+	sqfs_u64 duration;
+
+	/**
+	 * @brief An @ref SQFS_TRACE_EVENT value.
+	 */
+	sqfs_u32 type;
+
+	/**
+	 * @brief A number identifying the block, assigned when it
+	 *        is handed to the workers.
+	 */
+	sqfs_u32 block;
+
+	/**
+	 * @brief The size of the block in bytes when the event occured.
+	 */
+	sqfs_u32 size;
+
+	/**
+	 * @brief The @ref SQFS_BLK_FLAGS of the block, including flags set
+	 *        while processing it, like @ref SQFS_BLK_IS_COMPRESSED.
+	 */
+	sqfs_u32 flags;
+};
+
 /**
  * @struct sqfs_block_processor_stats_t
  *
@@ -108,6 +260,114 @@ struct sqfs_block_processor_stats_t {
 	 * eliminated by deduplication.
 	 */
 	sqfs_u64 actual_frag_count;
+
+	/**
+	 * @brief Number of blocks stored uncompressed without even trying
+	 *        to compress them, because the incompressibility probe
+	 *        predicted that they would not shrink.
+	 *
+	 * See @ref sqfs_block_processor_desc_t::probe_threshold.
+	 */
+	sqfs_u64 probe_skip_count;
+
+	/**
+	 * @brief Number of blocks that were compressed, but stored
+	 *        uncompressed anyway, because the space saved was
+	 *        below the configured minimum gain.
+	 *
+	 * See @ref sqfs_block_processor_desc_t::min_gain.
+	 */
+	sqfs_u64 low_gain_count;
+
+	/**
+	 * @brief Number of files that were found to be duplicates before
+	 *        compressing them.
+	 *
+	 * See @ref SQFS_BLOCK_PROCESSOR_EARLY_DEDUP.
+	 */
+	sqfs_u64 early_dedup_file_count;
+
+	/**
+	 * @brief Number of input bytes that were not compressed, because
+	 *        they belong to a file that was found to be a duplicate.
+	 */
+	sqfs_u64 early_dedup_bytes;
+
+	/**
+	 * @brief Number of data blocks that were appended in their on-disk
+	 *        form through @ref sqfs_block_processor_append_raw.
+	 */
+	sqfs_u64 raw_block_count;
+
+	/**
+	 * @brief Number of tail-end fragment bytes that were not stored,
+	 *        because an identical fragment already existed.
+	 */
+	sqfs_u64 frag_dedup_bytes;
+
+	/**
+	 * @brief Nanoseconds spent in the front end functions, i.e. copying
+	 *        data into blocks and hashing them for deduplication.
+	 *
+	 * This does not include the time spent in back end work that the
+	 * front end functions had to wait for, which is accounted for in the
+	 * fields below.
+	 */
+	sqfs_u64 frontend_time_ns;
+
+	/**
+	 * @brief Sum of nanoseconds all worker threads spent processing
+	 *        blocks, i.e. hashing and compressing them.
+	 *
+	 * See @ref sqfs_block_processor_get_worker_time for the break down
+	 * by worker.
+	 */
+	sqfs_u64 worker_time_ns;
+
+	/**
+	 * @brief Nanoseconds spent deduplicating and packing tail-end
+	 *        fragments into fragment blocks.
+	 */
+	sqfs_u64 fragment_time_ns;
+
+	/**
+	 * @brief Nanoseconds spent handing completed blocks to the
+	 *        block writer.
+	 */
+	sqfs_u64 write_time_ns;
+
+	/**
+	 * @brief Nanoseconds spent waiting for the workers to complete
+	 *        a block.
+	 *
+	 * If libsquashfs was built without thread support, the blocks are
+	 * processed while waiting for them and this includes the time
+	 * reported in @ref worker_time_ns.
+	 */
+	sqfs_u64 wait_time_ns;
+
+	/**
+	 * @brief Number of blocks handed to the workers.
+	 */
+	sqfs_u64 blocks_enqueued;
+
+	/**
+	 * @brief Sum of the number of blocks in flight, sampled every time
+	 *        a block was handed to the workers.
+	 *
+	 * Divided by @ref blocks_enqueued, this is the average queue depth.
+	 */
+	sqfs_u64 backlog_sum;
+
+	/**
+	 * @brief The maximum number of blocks in flight at the same time.
+	 */
+	sqfs_u64 backlog_max;
+
+	/**
+	 * @brief The number of workers used by the block processor.
+	 */
+	sqfs_u64 worker_count;
 };
 
 /**
@@ -186,6 +446,107 @@ struct sqfs_block_processor_desc_t {
 	 * @copydoc file
 	 */
 	sqfs_compressor_t *uncmp;
+
+	/**
+	 * @brief Entropy threshold for the incompressibility probe, in
+	 *        thousandths of a bit per byte.
+	 *
+	 * Before compressing a block, a sample of it is checked for byte
+	 * value entropy and repetitions. If the estimated entropy is at
+	 * least this value and the sample contains practically no repeated
+	 * sequences, the block is assumed to be already compressed and is
+	 * stored as is. A value around 7950 catches compressed and encrypted
+	 * data. Zero disables the probe.
+	 *
+	 * This field was added in libsquashfs 1.2. Older versions of the
+	 * structure, without it and @ref min_gain, are still accepted and
+	 * the probe is disabled for them.
+	 */
+	sqfs_u32 probe_threshold;
+
+	/**
+	 * @brief Minimum space saving in percent for a block to be stored
+	 *        compressed.
+	 *
+	 * If compressing a block saves less than this percentage of its
+	 * size, it is stored uncompressed instead, so it can be read back
+	 * without the overhead of decompressing it. Zero keeps every block
+	 * that shrinks at all. Values of 100 or above are rejected.
+	 */
+	sqfs_u32 min_gain;
+
+	/**
+	 * @brief A combination of @ref SQFS_BLOCK_PROCESSOR_FLAGS.
+	 *
+	 * Unknown flags are rejected with @ref SQFS_ERROR_UNSUPPORTED.
+	 */
+	sqfs_u32 flags;
+
+	/**
+	 * @brief The number of bytes to set aside for data blocks.
+	 *
+	 * If not zero, the block buffers are allocated up front, as slots
+	 * in a single memory region of this size (backed by huge pages, if
+	 * the system supports it), and @ref max_backlog is ignored. Instead,
+	 * the number of blocks in flight is derived from the number of
+	 * slots. A small part of the slots is set aside for fragment blocks,
+	 * which are kept uncompressed until written, and for holding back
+	 * blocks of possibly duplicate files.
+	 *
+	 * This is a soft limit. If the reserved slots run out, additional
+	 * blocks are allocated on demand, rather than stalling or failing.
+	 *
+	 * If the limit is too small to hold at least five blocks,
+	 * @ref sqfs_block_processor_create_ex fails with
+	 * @ref SQFS_ERROR_ARG_INVALID.
+	 */
+	sqfs_u64 mem_limit;
+
+	/**
+	 * @brief Upper bound in bytes for the tail-end fragments buffered
+	 *        with @ref SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS.
+	 *
+	 * Once the buffered tail-ends would exceed this size, they are
+	 * packed into fragment blocks. Zero selects a default of 64 times
+	 * the block size. Values below the block size are raised to it.
+	 *
+	 * This field was added in libsquashfs 1.2. Older versions of the
+	 * structure, without it, are still accepted and use the default.
+	 */
+	sqfs_u64 frag_defer_limit;
+
+	/**
+	 * @brief The compressors to choose from with
+	 *        @ref SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL.
+	 *
+	 * An array of @ref num_levels compressors, ordered from the fastest
+	 * to the one with the best compression ratio. Typically, these are
+	 * the same compressor with the same options, except for the level.
+	 * The data they produce must be readable with the options of
+	 * @ref cmp. Every worker creates its own copies of them.
+	 *
+	 * This field and the ones below were added in libsquashfs 1.2. Older
+	 * versions of the structure, without them, are still accepted.
+	 */
+	sqfs_compressor_t **level_cmp;
+
+	/**
+	 * @brief The number of entries in @ref level_cmp.
+	 *
+	 * With @ref SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL, this must be between
+	 * 1 and 16, otherwise @ref sqfs_block_processor_create_ex fails with
+	 * @ref SQFS_ERROR_ARG_INVALID.
+	 */
+	sqfs_u32 num_levels;
+
+	/**
+	 * @brief The number of input bytes per second the workers should at
+	 *        least be able to compress.
+	 *
+	 * Zero always uses the last entry of @ref level_cmp. Can be changed
+	 * later on with @ref sqfs_block_processor_set_target_rate.
+	 */
+	sqfs_u64 target_rate;
 };
 
 #ifdef __cplusplus
@@ -273,6 +634,47 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 					     sqfs_inode_generic_t **inode,
 					     void *user, sqfs_u32 flags);
 
+/**
+ * @brief Set the group that the tail-end of the current file belongs to.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * If the block processor was created with
+ * @ref SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, tail-ends with the same group
+ * are packed next to each other, e.g. to keep the small files of one
+ * directory in as few fragment blocks as possible. The value itself has no
+ * meaning beyond identifying the group. Without the flag, the group is
+ * ignored. Every file starts out in group 0.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param group An arbitrary number identifying the group.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_SEQUENCE if not called between
+ *         @ref sqfs_block_processor_begin_file and
+ *         @ref sqfs_block_processor_end_file.
+ */
+SQFS_API
+int sqfs_block_processor_set_fragment_group(sqfs_block_processor_t *proc,
+					    sqfs_u64 group);
+
+/**
+ * @brief Change the target rate for picking compression levels.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * See @ref sqfs_block_processor_desc_t::target_rate. This can be used to
+ * finish within a deadline, by setting the rate to the number of bytes
+ * left divided by the time left every now and then. Blocks that are
+ * already in flight are not affected. Without
+ * @ref SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL, the rate is ignored.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param rate The new target rate in bytes per second.
+ */
+SQFS_API
+void sqfs_block_processor_set_target_rate(sqfs_block_processor_t *proc,
+					  sqfs_u64 rate);
+
 /**
  * @brief Append data to the current file.
  *
@@ -290,6 +692,36 @@ SQFS_API int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 SQFS_API int sqfs_block_processor_append(sqfs_block_processor_t *proc,
 					 const void *data, size_t size);
 
+/**
+ * @brief Append a data block in its on-disk form to the current file.
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This can be used to copy a block of a file verbatim, e.g. from an existing
+ * image written with the same compressor and block size, instead of
+ * compressing the same data again. The block is not compressed or checked
+ * for sparseness, but otherwise treated like any other data block of the
+ * file, including deduplication by the block writer.
+ *
+ * The block must hold exactly one full block (i.e. the maximum block size) of
+ * file data, and the data appended to the file so far must also be a multiple
+ * of the block size. A shorter tail end has to be appended uncompressed
+ * using @ref sqfs_block_processor_append.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param data A pointer to the on-disk representation of the block.
+ * @param size The on-disk size of the block in bytes.
+ * @param flags Either @ref SQFS_BLK_IS_COMPRESSED if the data is compressed,
+ *              or zero if it is stored uncompressed.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure. If the file
+ *         data so far is not block aligned, @ref SQFS_ERROR_SEQUENCE is
+ *         returned.
+ */
+SQFS_API int sqfs_block_processor_append_raw(sqfs_block_processor_t *proc,
+					     const void *data, size_t size,
+					     sqfs_u32 flags);
+
 /**
  * @brief Stop writing the current file and flush everything that is
  *        buffered internally.
@@ -343,6 +775,9 @@ SQFS_API int sqfs_block_processor_submit_block(sqfs_block_processor_t *proc,
  *
  * @memberof sqfs_block_processor_t
  *
+ * With @ref SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, this also packs the
+ * buffered tail-end fragments into fragment blocks.
+ *
  * @param proc A pointer to a block processor object.
  *
  * @return Zero on success, an @ref SQFS_ERROR value on failure. The failure
@@ -381,6 +816,70 @@ SQFS_API int sqfs_block_processor_finish(sqfs_block_processor_t *proc);
 SQFS_API const sqfs_block_processor_stats_t
 *sqfs_block_processor_get_stats(const sqfs_block_processor_t *proc);
 
+/**
+ * @brief Get the time a single worker spent processing blocks
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * The time is only accounted for once the processed block has been picked
+ * up from the worker, so blocks still in flight are not included.
+ * The sum over all workers is available through
+ * @ref sqfs_block_processor_stats_t::worker_time_ns.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param index The index of the worker, smaller than
+ *              @ref sqfs_block_processor_stats_t::worker_count.
+ * @param out Returns the accumulated busy time in nanoseconds.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_OUT_OF_BOUNDS if the index
+ *         is out of range.
+ */
+SQFS_API
+int sqfs_block_processor_get_worker_time(const sqfs_block_processor_t *proc,
+					 sqfs_u32 index, sqfs_u64 *out);
+
+/**
+ * @brief Get the number of blocks compressed with one of the levels of
+ *        @ref SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * Like the worker time, blocks are only counted once they have been picked
+ * up from the worker.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param index An index into @ref sqfs_block_processor_desc_t::level_cmp.
+ * @param out Returns the number of blocks.
+ *
+ * @return Zero on success, @ref SQFS_ERROR_OUT_OF_BOUNDS if the index
+ *         is out of range or the flag is not set.
+ */
+SQFS_API
+int sqfs_block_processor_get_level_count(const sqfs_block_processor_t *proc,
+					 sqfs_u32 index, sqfs_u64 *out);
+
+/**
+ * @brief Get the events recorded by one of the threads of a block processor
+ *
+ * @memberof sqfs_block_processor_t
+ *
+ * This only returns something if the processor was created with the
+ * @ref SQFS_BLOCK_PROCESSOR_TRACE flag. The events of the workers are only
+ * safe to access once all blocks are completed, e.g. after calling
+ * @ref sqfs_block_processor_finish.
+ *
+ * @param proc A pointer to a block processor object.
+ * @param thread Zero for the thread that uses the block processor, or one
+ *               plus the index of a worker.
+ * @param count Returns the number of events.
+ *
+ * @return A pointer to an array of events in the order they were recorded,
+ *         or NULL if there are none or the thread index is out of range.
+ */
+SQFS_API const sqfs_block_processor_trace_event_t
+*sqfs_block_processor_get_trace(const sqfs_block_processor_t *proc,
+				sqfs_u32 thread, size_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,8 +47,39 @@
  *
  * The data reader abstracts all of this away in a simple interface that allows
  * reading file data through an inode description and a location in the file.
+ *
+ * By default, a data reader must only be used by one thread at a time. If
+ * created with the @ref SQFS_DATA_READER_SHARED flag, the read functions can
+ * be called on the same object from multiple threads concurrently.
  */
 
+/**
+ * @enum SQFS_DATA_READER_FLAGS
+ *
+ * @brief Flags for @ref sqfs_data_reader_create
+ */
+typedef enum {
+	/**
+	 * @brief Allow concurrent reads from multiple threads.
+	 *
+	 * Instead of keeping the last data and fragment block, the reader
+	 * caches recently used blocks in a cache that is split into
+	 * independently locked shards, and uncompresses blocks using a pool
+	 * of compressor copies, so that threads only wait for each other if
+	 * they access the same part of the cache at the same time.
+	 *
+	 * The read functions are then safe to call concurrently, as long as
+	 * the read_at function of the underlying file is. This is the case
+	 * for files opened with @ref sqfs_open_file. The fragment table
+	 * must be loaded before the reader is shared between threads.
+	 *
+	 * Copies of a shared reader share the block cache.
+	 */
+	SQFS_DATA_READER_SHARED = 0x00000001,
+
+	SQFS_DATA_READER_ALL_FLAGS = 0x00000001,
+} SQFS_DATA_READER_FLAGS;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -62,10 +93,11 @@ extern "C" {
  *             underlying filesystem image.
  * @param block_size The data block size from the super block.
  * @param cmp A compressor to use for uncompressing blocks read from disk.
- * @param flags Currently must be 0 or the function will fail.
+ * @param flags A combination of @ref SQFS_DATA_READER_FLAGS. Unknown flags
+ *              make the function fail.
  *
  * @return A pointer to a new data reader object. NULL means
- *         allocation failure.
+ *         allocation failure or unknown flags.
  */
 SQFS_API sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 						     size_t block_size,
@@ -130,6 +162,10 @@ SQFS_API int sqfs_data_reader_get_block(sqfs_data_reader_t *data,
  * care of reading accross data blocks and fragment internally, using a
  * data and fragment block cache.
  *
+ * If the reader was created with @ref SQFS_DATA_READER_SHARED, this
+ * function can be called from several threads at the same time, similar
+ * to the pread system call.
+ *
  * @param data A pointer to a data reader object.
  * @param inode A pointer to the inode describing the file.
  * @param offset An arbitrary byte offset into the uncompressed file.
@@ -170,7 +170,18 @@ typedef enum {
 	 */
 	SQFS_DIR_READER_DOT_ENTRIES = 0x00000001,
 
-	SQFS_DIR_READER_ALL_FLAGS = 0x00000001,
+	/**
+	 * @brief Keep a cache of recently used meta data blocks.
+	 *
+	 * If this flag is set, the internal meta data readers for the inode
+	 * and directory tables are created with a small LRU cache (see
+	 * @ref sqfs_meta_reader_enable_cache). This speeds up operations that
+	 * interleave directory and inode reads, or revisit directories, like
+	 * @ref sqfs_dir_reader_get_full_hierarchy or path lookups.
+	 */
+	SQFS_DIR_READER_BLOCK_CACHE = 0x00000002,
+
+	SQFS_DIR_READER_ALL_FLAGS = 0x00000003,
 } SQFS_DIR_READER_FLAGS;
 
 /**
@@ -203,8 +214,9 @@ extern "C" {
  * @memberof sqfs_dir_reader_t
  *
  * The function fails if any unknown flag is set. In squashfs-tools-ng
- * version 1.2 introduced the @ref SQFS_DIR_READER_DOT_ENTRIES flag,
- * earlier versions require the flags field to be set to zero.
+ * version 1.2 introduced the @ref SQFS_DIR_READER_DOT_ENTRIES and
+ * @ref SQFS_DIR_READER_BLOCK_CACHE flags, earlier versions require the
+ * flags field to be set to zero.
  *
  * @param super A pointer to the super block. Kept internally an used for
  *              resolving table positions.
@@ -327,6 +339,33 @@ SQFS_API int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
 SQFS_API int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 					    sqfs_inode_generic_t **inode);
 
+/**
+ * @brief Read an inode by its inode number, using the export table.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This only works if the image has an NFS export table. The table is loaded
+ * on demand, one meta data block at a time, and kept in memory after that,
+ * so repeated lookups do not require any further reads of the table.
+ *
+ * If the reader was created with the @ref SQFS_DIR_READER_DOT_ENTRIES flag,
+ * the export table is also used for finding the parent of a directory that
+ * has not been visited yet when opening it.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param inode_number The number of the inode to read, starting at 1.
+ * @param out Returns a pointer to a generic inode that can be freed with a
+ *            single @ref sqfs_free call.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure. If the image
+ *         has no export table, @ref SQFS_ERROR_UNSUPPORTED is returned.
+ *         @ref SQFS_ERROR_OUT_OF_BOUNDS is returned if the inode number is
+ *         not used in the image.
+ */
+SQFS_API int sqfs_dir_reader_get_inode_by_number(sqfs_dir_reader_t *rd,
+						 sqfs_u32 inode_number,
+						 sqfs_inode_generic_t **out);
+
 /**
  * @brief Find an inode through path traversal starting from the root or a
  *        given node downwards.
@@ -374,12 +413,36 @@ SQFS_API int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 						sqfs_u32 flags,
 						sqfs_tree_node_t **out);
 
+/**
+ * @brief Read and uncompress the entire inode and directory table up front.
+ *
+ * @memberof sqfs_dir_reader_t
+ *
+ * This calls @ref sqfs_meta_reader_preload on the internal meta data readers.
+ * It is intended for operations that are going to visit most of the
+ * filesystem tree anyway, e.g. @ref sqfs_dir_reader_get_full_hierarchy on
+ * the root directory, and trades memory for far fewer read and decompress
+ * round trips.
+ *
+ * @param rd A pointer to a directory reader.
+ * @param num_jobs The number of worker threads to uncompress blocks with.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_dir_reader_preload(sqfs_dir_reader_t *rd, size_t num_jobs);
+
 /**
  * @brief Recursively destroy a tree of @ref sqfs_tree_node_t nodes
  *
  * This function can be used to clean up after
  * @ref sqfs_dir_reader_get_full_hierarchy.
  *
+ * The nodes of a tree, including their names and inodes, are allocated in
+ * bulk and must not be freed individually. Sub trees can still be unlinked
+ * and destroyed separately, or moved between trees, but the memory is only
+ * released once all nodes loaded by the same call to
+ * @ref sqfs_dir_reader_get_full_hierarchy have been destroyed.
+ *
  * @param root A pointer to the root node or NULL.
  */
 SQFS_API void sqfs_dir_tree_destroy(sqfs_tree_node_t *root);
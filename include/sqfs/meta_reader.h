@@ -46,8 +46,53 @@
  * The main task of the meta data read is to provide a simple read and seek
  * functions that transparently take care of fetching and uncompressing blocks
  * from disk and reading transparently across block boarders if required.
+ *
+ * By default, only the current block is kept in memory. Optionally, a cache
+ * of recently used, uncompressed blocks can be enabled using
+ * @ref sqfs_meta_reader_enable_cache, which is useful if a reader frequently
+ * jumps back and forth between a small set of blocks.
  */
 
+/**
+ * @struct sqfs_meta_reader_stats_t
+ *
+ * @brief Used to store runtime statistics about
+ *        the @ref sqfs_meta_reader_t.
+ */
+struct sqfs_meta_reader_stats_t {
+	/**
+	 * @brief Holds the size of the structure.
+	 *
+	 * If a later version of libsquashfs expands this structure, the value
+	 * of this field can be used to check at runtime whether the newer
+	 * fields are avaialable or not.
+	 */
+	size_t size;
+
+	/**
+	 * @brief Total number of meta data blocks read from disk and
+	 *        uncompressed if necessary.
+	 */
+	sqfs_u64 blocks_loaded;
+
+	/**
+	 * @brief Number of block switches that could be served from the cache.
+	 */
+	sqfs_u64 cache_hits;
+
+	/**
+	 * @brief Number of block switches that did not find the block in
+	 *        the cache.
+	 */
+	sqfs_u64 cache_misses;
+
+	/**
+	 * @brief Number of blocks this reader evicted from the cache to make
+	 *        room for a newly loaded one.
+	 */
+	sqfs_u64 cache_evictions;
+};
+
 /**
  * @struct sqfs_readdir_state_t
  *
@@ -103,13 +148,86 @@ SQFS_API sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 						     sqfs_u64 start,
 						     sqfs_u64 limit);
 
+/**
+ * @brief Enable a cache of recently used meta data blocks.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * After enabling the cache, the reader keeps up to the specified number of
+ * uncompressed blocks in memory and evicts the least recently used one if the
+ * cache is full. Seeking to a block in the cache does not touch the
+ * underlying file and does not uncompress the block again.
+ *
+ * Copies of a meta data reader created with @ref sqfs_copy after enabling
+ * the cache share the same cache. The cache is reference counted and
+ * destroyed together with the last reader using it. Access to the shared
+ * cache is internally serialized, so copies can be used from different
+ * threads.
+ *
+ * Enabling the cache again replaces the existing cache of this reader with
+ * a new, empty one. Setting the size to 0 disables the cache.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param num_blocks The maximum number of blocks to keep in the cache.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_reader_enable_cache(sqfs_meta_reader_t *m,
+					   size_t num_blocks);
+
+/**
+ * @brief Read and uncompress all meta data blocks of the reader up front.
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * This function reads the entire region between the start and limit of the
+ * reader with a single read operation, splits it into meta data blocks and
+ * uncompresses them, using the specified number of worker threads. Seeking
+ * to a preloaded block afterwards does not touch the underlying file and
+ * reading from it does not require an intermediate copy.
+ *
+ * This is intended for operations that walk an entire table anyway, e.g.
+ * unpacking an entire image, where it replaces thousands of small, serialized
+ * read & decompress round trips. The memory required is roughly the
+ * uncompressed size of the table.
+ *
+ * Splitting stops at the first location that does not look like a valid
+ * meta data block header. Blocks that fail to uncompress are skipped and
+ * later loaded on demand as usual, so errors are still reported on access.
+ *
+ * Copies of a meta data reader created with @ref sqfs_copy after preloading
+ * share the preloaded data.
+ *
+ * @param m A pointer to a meta data reader.
+ * @param num_jobs The number of worker threads to uncompress blocks with.
+ *
+ * @return Zero on success, an @ref SQFS_ERROR value on failure.
+ */
+SQFS_API int sqfs_meta_reader_preload(sqfs_meta_reader_t *m, size_t num_jobs);
+
+/**
+ * @brief Get accumulated runtime statistics from a meta data reader
+ *
+ * @memberof sqfs_meta_reader_t
+ *
+ * The statistics are counted per reader object, i.e. a copy starts with
+ * a copy of the statistics of its original, even if it shares a cache.
+ *
+ * @param m A pointer to a meta data reader.
+ *
+ * @return A pointer to a @ref sqfs_meta_reader_stats_t structure.
+ */
+SQFS_API const sqfs_meta_reader_stats_t
+*sqfs_meta_reader_get_stats(const sqfs_meta_reader_t *m);
+
 /**
  * @brief Seek to a specific meta data block and offset.
  *
  * @memberof sqfs_meta_reader_t
  *
  * The underlying block is fetched from disk and uncompressed, unless it
- * already is the current block.
+ * already is the current block, it has been preloaded, or the block cache is
+ * enabled and the block is found in the cache.
  *
  * @param m A pointer to a meta data reader.
  * @param block_start Absolute position where the block header can be found.
@@ -82,6 +82,7 @@ typedef struct sqfs_dir_writer_t sqfs_dir_writer_t;
 typedef struct sqfs_dir_reader_t sqfs_dir_reader_t;
 typedef struct sqfs_id_table_t sqfs_id_table_t;
 typedef struct sqfs_meta_reader_t sqfs_meta_reader_t;
+typedef struct sqfs_meta_reader_stats_t sqfs_meta_reader_stats_t;
 typedef struct sqfs_meta_writer_t sqfs_meta_writer_t;
 typedef struct sqfs_xattr_reader_t sqfs_xattr_reader_t;
 typedef struct sqfs_file_t sqfs_file_t;
@@ -94,6 +95,8 @@ typedef struct sqfs_block_writer_t sqfs_block_writer_t;
 typedef struct sqfs_block_writer_stats_t sqfs_block_writer_stats_t;
 typedef struct sqfs_block_processor_stats_t sqfs_block_processor_stats_t;
 typedef struct sqfs_block_processor_desc_t sqfs_block_processor_desc_t;
+typedef struct sqfs_block_processor_trace_event_t
+	sqfs_block_processor_trace_event_t;
 typedef struct sqfs_readdir_state_t sqfs_readdir_state_t;
 
 typedef struct sqfs_fragment_t sqfs_fragment_t;
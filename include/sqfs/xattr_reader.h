@@ -63,6 +63,26 @@
  * consecutively to read and decode each key-value pair.
  */
 
+/**
+ * @enum SQFS_XATTR_READER_FLAGS
+ *
+ * @brief Flags for @ref sqfs_xattr_reader_create
+ */
+typedef enum {
+	/**
+	 * @brief Keep a cache of recently used meta data blocks.
+	 *
+	 * Reading out-of-line values requires seeking away from the current
+	 * key-value block and back again. If this flag is set, the internal
+	 * meta data readers are created with a small LRU cache
+	 * (see @ref sqfs_meta_reader_enable_cache), so jumping back and forth
+	 * between a few blocks does not repeatedly read and uncompress them.
+	 */
+	SQFS_XATTR_READER_BLOCK_CACHE = 0x00000001,
+
+	SQFS_XATTR_READER_ALL_FLAGS = 0x00000001,
+} SQFS_XATTR_READER_FLAGS;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -83,7 +103,10 @@ extern "C" {
  * Do not destroy any of the pointed to objects before destroying the xattr
  * reader.
  *
- * @param flags Currently must be set to 0, or creation will fail.
+ * The function fails if any unknown flag is set. Versions of
+ * squashfs-tools-ng prior to 1.2 require the flags to be set to zero.
+ *
+ * @param flags A combination of @ref SQFS_XATTR_READER_FLAGS.
  *
  * @return A pointer to a new xattr reader instance on success, NULL on
  *         allocation failure.
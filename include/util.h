@@ -30,9 +30,24 @@ void *alloc_array(size_t item_size, size_t nmemb);
 
 SQFS_INTERNAL sqfs_u32 xxh32(const void *input, const size_t len);
 
+#define SHA256_SIZE (32)
+
+/*
+  Compute the SHA-256 digest of a buffer. Used where a checksum has to be
+  strong enough to consider two buffers equal without comparing them.
+ */
+SQFS_INTERNAL void sha256(const void *data, size_t size,
+			  sqfs_u8 digest[SHA256_SIZE]);
+
 /*
   Returns true if the given region of memory is filled with zero-bytes only.
  */
 SQFS_INTERNAL bool is_memory_zero(const void *blob, size_t size);
 
+/*
+  Returns a monotonic timestamp in nanoseconds. Only the difference between
+  two timestamps is meaningful.
+ */
+SQFS_INTERNAL sqfs_u64 get_time_ns(void);
+
 #endif /* SQFS_UTIL_H */
@@ -31,7 +31,7 @@ static inline int pthread_create(pthread_t *thread, const void *attr,
 	return 0;
 }
 
-static int pthread_join(pthread_t thread, void **retval)
+static inline int pthread_join(pthread_t thread, void **retval)
 {
 	WaitForSingleObject(thread, INFINITE);
 	CloseHandle(thread);
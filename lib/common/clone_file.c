@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * clone_file.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "common.h"
+#include "util.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#endif
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+int inode_data_compare(const sqfs_inode_generic_t *lhs,
+		       const sqfs_inode_generic_t *rhs)
+{
+	sqfs_u32 lhs_idx, lhs_off, rhs_idx, rhs_off;
+	sqfs_u64 lhs_val, rhs_val;
+	size_t lhs_count, rhs_count;
+
+	sqfs_inode_get_file_size(lhs, &lhs_val);
+	sqfs_inode_get_file_size(rhs, &rhs_val);
+	if (lhs_val != rhs_val)
+		return lhs_val < rhs_val ? -1 : 1;
+
+	sqfs_inode_get_file_block_start(lhs, &lhs_val);
+	sqfs_inode_get_file_block_start(rhs, &rhs_val);
+	if (lhs_val != rhs_val)
+		return lhs_val < rhs_val ? -1 : 1;
+
+	sqfs_inode_get_frag_location(lhs, &lhs_idx, &lhs_off);
+	sqfs_inode_get_frag_location(rhs, &rhs_idx, &rhs_off);
+	if (lhs_idx != rhs_idx)
+		return lhs_idx < rhs_idx ? -1 : 1;
+	if (lhs_off != rhs_off)
+		return lhs_off < rhs_off ? -1 : 1;
+
+	lhs_count = sqfs_inode_get_file_block_count(lhs);
+	rhs_count = sqfs_inode_get_file_block_count(rhs);
+	if (lhs_count != rhs_count)
+		return lhs_count < rhs_count ? -1 : 1;
+
+	return memcmp(lhs->extra, rhs->extra, lhs_count * sizeof(sqfs_u32));
+}
+
+sqfs_u32 inode_data_hash(const sqfs_inode_generic_t *inode)
+{
+	sqfs_u32 idx, off, hash;
+	sqfs_u64 size, start;
+
+	sqfs_inode_get_file_size(inode, &size);
+	sqfs_inode_get_file_block_start(inode, &start);
+	sqfs_inode_get_frag_location(inode, &idx, &off);
+
+	hash = xxh32(inode->extra, inode->payload_bytes_used);
+	hash ^= (sqfs_u32)start ^ (sqfs_u32)(start >> 32);
+	hash ^= (sqfs_u32)size * 0x9E3779B1;
+	hash ^= idx * 0x85EBCA77 ^ off;
+	return hash;
+}
+
+#ifdef _WIN32
+int clone_file(const char *src, const char *dst, int flags)
+{
+	(void)src; (void)dst; (void)flags;
+	return -1;
+}
+#else
+static int write_all(int fd, const char *data, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, data, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int copy_data(int sfd, int dfd, int flags)
+{
+	bool hole = false;
+	off_t total = 0;
+	char *buffer;
+	ssize_t ret;
+
+	buffer = malloc(COPY_BUFFER_SIZE);
+	if (buffer == NULL)
+		return -1;
+
+	for (;;) {
+		ret = read(sfd, buffer, COPY_BUFFER_SIZE);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		total += ret;
+
+		if ((flags & OSTREAM_OPEN_SPARSE) &&
+		    is_memory_zero(buffer, ret)) {
+			if (lseek(dfd, ret, SEEK_CUR) == (off_t)-1)
+				goto fail;
+			hole = true;
+			continue;
+		}
+
+		if (write_all(dfd, buffer, ret))
+			goto fail;
+	}
+
+	if (ret < 0)
+		goto fail;
+
+	if (hole && ftruncate(dfd, total) != 0)
+		goto fail;
+
+	free(buffer);
+	return 0;
+fail:
+	free(buffer);
+	return -1;
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static int copy_range(int sfd, int dfd)
+{
+	struct stat sb;
+	ssize_t ret;
+	off_t size;
+
+	if (fstat(sfd, &sb) != 0)
+		return -1;
+
+	for (size = sb.st_size; size > 0; size -= ret) {
+		ret = copy_file_range(sfd, NULL, dfd, NULL, size, 0);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+#endif
+
+int clone_file(const char *src, const char *dst, int flags)
+{
+	int sfd, dfd, ret = -1;
+
+	sfd = open(src, O_RDONLY | O_CLOEXEC);
+	if (sfd < 0)
+		return -1;
+
+	dfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (dfd < 0)
+		goto out_src;
+
+#ifdef FICLONE
+	if (ioctl(dfd, FICLONE, sfd) == 0) {
+		ret = 0;
+		goto out;
+	}
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	if (!(flags & OSTREAM_OPEN_SPARSE) && copy_range(sfd, dfd) == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	/* start over, in case copy_file_range gave up half way through */
+	if (lseek(sfd, 0, SEEK_SET) == (off_t)-1 ||
+	    lseek(dfd, 0, SEEK_SET) == (off_t)-1 || ftruncate(dfd, 0) != 0) {
+		goto out;
+	}
+#endif
+	ret = copy_data(sfd, dfd, flags);
+out:
+	close(dfd);
+out_src:
+	close(sfd);
+	return ret;
+}
+#endif
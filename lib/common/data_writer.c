@@ -9,8 +9,8 @@
 static sqfs_u8 buffer[4096];
 
 int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
-			 sqfs_inode_generic_t **inode, sqfs_file_t *file,
-			 int flags)
+			 sqfs_reference_t *ref, sqfs_inode_generic_t **inode,
+			 sqfs_file_t *file, int flags, sqfs_u64 group)
 {
 	sqfs_u64 filesz, offset;
 	size_t diff;
@@ -22,6 +22,12 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 		return -1;
 	}
 
+	ret = sqfs_block_processor_set_fragment_group(data, group);
+	if (ret) {
+		sqfs_perror(filename, "setting fragment group", ret);
+		return -1;
+	}
+
 	filesz = file->get_size(file);
 
 	for (offset = 0; offset < filesz; offset += diff) {
@@ -37,14 +43,16 @@ int write_data_from_file(const char *filename, sqfs_block_processor_t *data,
 			return -1;
 		}
 
-		ret = sqfs_block_processor_append(data, buffer, diff);
+		ret = sqfs_reference_append(ref, data, buffer, diff);
 		if (ret) {
 			sqfs_perror(filename, "packing file data", ret);
 			return -1;
 		}
 	}
 
-	ret = sqfs_block_processor_end_file(data);
+	ret = sqfs_reference_end_file(ref, data);
+	if (ret == 0)
+		ret = sqfs_block_processor_end_file(data);
 	if (ret) {
 		sqfs_perror(filename, "finishing file data", ret);
 		return -1;
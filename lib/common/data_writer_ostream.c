@@ -13,6 +13,7 @@ typedef struct{
 	ostream_t base;
 
 	sqfs_block_processor_t *proc;
+	sqfs_reference_t *ref;
 	const char *filename;
 } data_writer_ostream_t;
 
@@ -21,7 +22,7 @@ static int stream_append(ostream_t *base, const void *data, size_t size)
 	data_writer_ostream_t *strm = (data_writer_ostream_t *)base;
 	int ret;
 
-	ret = sqfs_block_processor_append(strm->proc, data, size);
+	ret = sqfs_reference_append(strm->ref, strm->proc, data, size);
 
 	if (ret != 0) {
 		sqfs_perror(strm->filename, NULL, ret);
@@ -36,7 +37,9 @@ static int stream_flush(ostream_t *base)
 	data_writer_ostream_t *strm = (data_writer_ostream_t *)base;
 	int ret;
 
-	ret = sqfs_block_processor_end_file(strm->proc);
+	ret = sqfs_reference_end_file(strm->ref, strm->proc);
+	if (ret == 0)
+		ret = sqfs_block_processor_end_file(strm->proc);
 
 	if (ret != 0) {
 		sqfs_perror(strm->filename, NULL, ret);
@@ -60,6 +63,7 @@ static void stream_destroy(sqfs_object_t *base)
 
 ostream_t *data_writer_ostream_create(const char *filename,
 				      sqfs_block_processor_t *proc,
+				      sqfs_reference_t *ref,
 				      sqfs_inode_generic_t **inode,
 				      int flags)
 {
@@ -82,6 +86,7 @@ ostream_t *data_writer_ostream_create(const char *filename,
 	}
 
 	strm->proc = proc;
+	strm->ref = ref;
 	strm->filename = filename;
 	base->append = stream_append;
 	base->flush = stream_flush;
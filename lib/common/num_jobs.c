@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * num_jobs.c
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "common.h"
+
+#ifdef HAVE_SYS_SYSINFO_H
+#include <sys/sysinfo.h>
+
+size_t os_get_num_jobs(void)
+{
+	int nprocs;
+
+	nprocs = get_nprocs_conf();
+	return nprocs < 1 ? 1 : nprocs;
+}
+#else
+size_t os_get_num_jobs(void)
+{
+	return 1;
+}
+#endif
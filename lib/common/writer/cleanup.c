@@ -17,6 +17,7 @@ void sqfs_writer_cleanup(sqfs_writer_t *sqfs, int status)
 	sqfs_destroy(sqfs->dm);
 	sqfs_destroy(sqfs->im);
 	sqfs_destroy(sqfs->idtbl);
+	sqfs_reference_destroy(sqfs->ref);
 	sqfs_destroy(sqfs->data);
 	sqfs_destroy(sqfs->blkwr);
 	sqfs_destroy(sqfs->fragtbl);
@@ -9,13 +9,59 @@
 
 #include <stdlib.h>
 
+static void print_seconds(const char *what, sqfs_u64 ns)
+{
+	printf("%s: " PRI_U64 ".%03us\n", what, ns / 1000000000UL,
+	       (unsigned int)((ns / 1000000UL) % 1000UL));
+}
+
+static void print_timing(const sqfs_block_processor_t *blk,
+			 const sqfs_block_processor_stats_t *proc_stats)
+{
+	sqfs_u64 busy, avg_backlog = 0;
+	char dedup_sz[32];
+	sqfs_u32 i;
+
+	if (proc_stats->blocks_enqueued > 0) {
+		avg_backlog = (100 * proc_stats->backlog_sum) /
+			proc_stats->blocks_enqueued;
+	}
+
+	print_size(proc_stats->early_dedup_bytes +
+		   proc_stats->frag_dedup_bytes, dedup_sz, false);
+
+	print_seconds("Time spent in front end", proc_stats->frontend_time_ns);
+	print_seconds("Time spent processing blocks",
+		      proc_stats->worker_time_ns);
+
+	for (i = 0; i < proc_stats->worker_count; ++i) {
+		if (sqfs_block_processor_get_worker_time(blk, i, &busy))
+			break;
+
+		printf("    worker %u: " PRI_U64 ".%03us\n", (unsigned int)i,
+		       busy / 1000000000UL,
+		       (unsigned int)((busy / 1000000UL) % 1000UL));
+	}
+
+	print_seconds("Time spent packing fragments",
+		      proc_stats->fragment_time_ns);
+	print_seconds("Time spent writing blocks", proc_stats->write_time_ns);
+	print_seconds("Time spent waiting for workers",
+		      proc_stats->wait_time_ns);
+	printf("Average queue depth: " PRI_U64 ".%02u\n",
+	       avg_backlog / 100, (unsigned int)(avg_backlog % 100));
+	printf("Maximum queue depth: " PRI_U64 "\n", proc_stats->backlog_max);
+	printf("Input bytes deduplicated: %s\n", dedup_sz);
+	fputc('\n', stdout);
+}
+
 static void print_statistics(const sqfs_super_t *super,
 			     const sqfs_block_processor_t *blk,
 			     const sqfs_block_writer_t *wr)
 {
 	const sqfs_block_processor_stats_t *proc_stats;
 	sqfs_u64 bytes_written, blocks_written;
-	char read_sz[32], written_sz[32];
+	char read_sz[32], written_sz[32], dedup_sz[32];
 	size_t ratio;
 
 	proc_stats = sqfs_block_processor_get_stats(blk);
@@ -31,6 +77,7 @@ static void print_statistics(const sqfs_super_t *super,
 
 	print_size(proc_stats->input_bytes_read, read_sz, false);
 	print_size(bytes_written, written_sz, false);
+	print_size(proc_stats->early_dedup_bytes, dedup_sz, false);
 
 	fputs("---------------------------------------------------\n", stdout);
 	printf("Data bytes read: %s\n", read_sz);
@@ -48,6 +95,14 @@ static void print_statistics(const sqfs_super_t *super,
 
 	printf("Sparse blocks omitted: " PRI_U64 "\n",
 	       proc_stats->sparse_block_count);
+	printf("Incompressible blocks not compressed: " PRI_U64 "\n",
+	       proc_stats->probe_skip_count);
+	printf("Blocks stored uncompressed for low gain: " PRI_U64 "\n",
+	       proc_stats->low_gain_count);
+	printf("Duplicate files not compressed: " PRI_U64 " (%s)\n",
+	       proc_stats->early_dedup_file_count, dedup_sz);
+	printf("Blocks copied from reference image: " PRI_U64 "\n",
+	       proc_stats->raw_block_count);
 	fputc('\n', stdout);
 
 	printf("Fragments actually written: " PRI_U64 "\n",
@@ -57,6 +112,26 @@ static void print_statistics(const sqfs_super_t *super,
 	printf("Total number of inodes: %u\n", super->inode_count);
 	printf("Number of unique group/user IDs: %u\n", super->id_count);
 	fputc('\n', stdout);
+
+	print_timing(blk, proc_stats);
+}
+
+static void print_levels(const sqfs_writer_t *sqfs)
+{
+	sqfs_u64 count;
+	size_t i;
+
+	fputs("Blocks compressed per level:\n", stdout);
+
+	for (i = 0; i < sqfs->num_levels; ++i) {
+		if (sqfs_block_processor_get_level_count(sqfs->data, i, &count))
+			break;
+
+		printf("    level %u: " PRI_U64 "\n",
+		       (unsigned int)sqfs->levels[i], count);
+	}
+
+	fputc('\n', stdout);
 }
 
 static int padd_sqfs(sqfs_file_t *file, sqfs_u64 size, size_t blocksize)
@@ -101,6 +176,11 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		return -1;
 	}
 
+	if (cfg->trace_file != NULL &&
+	    sqfs_writer_write_trace(sqfs->data, cfg->trace_file)) {
+		return -1;
+	}
+
 	if (!cfg->quiet)
 		fputs("Writing inodes and directories...\n", stdout);
 
@@ -169,8 +249,12 @@ int sqfs_writer_finish(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *cfg)
 		return -1;
 	}
 
-	if (!cfg->quiet)
+	if (!cfg->quiet) {
 		print_statistics(&sqfs->super, sqfs->data, sqfs->blkwr);
 
+		if (sqfs->num_levels > 0)
+			print_levels(sqfs);
+	}
+
 	return 0;
 }
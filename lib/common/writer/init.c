@@ -11,23 +11,6 @@
 #include <string.h>
 #include <stdlib.h>
 
-#ifdef HAVE_SYS_SYSINFO_H
-#include <sys/sysinfo.h>
-
-static size_t os_get_num_jobs(void)
-{
-	int nprocs;
-
-	nprocs = get_nprocs_conf();
-	return nprocs < 1 ? 1 : nprocs;
-}
-#else
-static size_t os_get_num_jobs(void)
-{
-	return 1;
-}
-#endif
-
 void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 {
 	memset(cfg, 0, sizeof(*cfg));
@@ -38,13 +21,73 @@ void sqfs_writer_cfg_init(sqfs_writer_cfg_t *cfg)
 	cfg->comp_id = compressor_get_default();
 }
 
+/*
+  The levels to choose from are spread evenly from the fastest one up to the
+  configured level, which is also the one used for the meta data.
+ */
+static int create_level_compressors(sqfs_writer_t *sqfs,
+				    const sqfs_writer_cfg_t *wrcfg,
+				    const sqfs_compressor_config_t *cfg,
+				    sqfs_compressor_t **level_cmp)
+{
+	sqfs_compressor_config_t lvlcfg = *cfg;
+	sqfs_u32 min_level, range;
+	size_t i, count;
+	int ret;
+
+	switch (cfg->id) {
+	case SQFS_COMP_GZIP:
+		min_level = SQFS_GZIP_MIN_LEVEL;
+		break;
+	case SQFS_COMP_XZ:
+		min_level = SQFS_XZ_MIN_LEVEL;
+		break;
+	case SQFS_COMP_ZSTD:
+		min_level = SQFS_ZSTD_MIN_LEVEL;
+		break;
+	default:
+		fprintf(stderr, "%s: adaptive compression levels are only "
+			"supported for gzip, xz and zstd.\n", wrcfg->filename);
+		return -1;
+	}
+
+	lvlcfg.flags &= ~SQFS_COMP_FLAG_UNCOMPRESS;
+	range = cfg->level > min_level ? cfg->level - min_level : 0;
+	count = range < SQFS_WRITER_MAX_LEVELS ? range + 1 :
+		SQFS_WRITER_MAX_LEVELS;
+
+	for (i = 0; i < count; ++i) {
+		lvlcfg.level = cfg->level;
+		if (count > 1)
+			lvlcfg.level = min_level + (range * i) / (count - 1);
+
+		ret = sqfs_compressor_create(&lvlcfg, level_cmp + i);
+		if (ret != 0) {
+			sqfs_perror(wrcfg->filename, "creating compressor",
+				    ret);
+			while (i > 0)
+				sqfs_destroy(level_cmp[--i]);
+			return -1;
+		}
+
+		sqfs->levels[i] = lvlcfg.level;
+	}
+
+	sqfs->num_levels = count;
+	return 0;
+}
+
 int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 {
+	sqfs_compressor_t *level_cmp[SQFS_WRITER_MAX_LEVELS];
 	sqfs_block_processor_desc_t blkdesc;
 	sqfs_compressor_config_t cfg;
 	int ret, flags;
+	size_t i;
 
 	sqfs->filename = wrcfg->filename;
+	sqfs->ref = NULL;
+	sqfs->num_levels = 0;
 
 	if (compressor_cfg_init_options(&cfg, wrcfg->comp_id,
 					wrcfg->block_size,
@@ -134,19 +177,56 @@ int sqfs_writer_init(sqfs_writer_t *sqfs, const sqfs_writer_cfg_t *wrcfg)
 	blkdesc.max_block_size = wrcfg->block_size;
 	blkdesc.num_workers = wrcfg->num_jobs;
 	blkdesc.max_backlog = wrcfg->max_backlog;
+	blkdesc.mem_limit = wrcfg->mem_limit;
 	blkdesc.cmp = sqfs->cmp;
 	blkdesc.wr = sqfs->blkwr;
 	blkdesc.tbl = sqfs->fragtbl;
 	blkdesc.file = sqfs->outfile;
 	blkdesc.uncmp = sqfs->uncmp;
+	blkdesc.probe_threshold = wrcfg->probe_threshold;
+	blkdesc.min_gain = wrcfg->min_gain;
+	blkdesc.flags = 0;
+
+	if (wrcfg->early_dedup)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_EARLY_DEDUP;
+
+	if (wrcfg->trace_file != NULL)
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_TRACE;
+
+	if (wrcfg->group_fragments) {
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS;
+		blkdesc.frag_defer_limit = wrcfg->frag_defer_limit;
+	}
+
+	if (wrcfg->adaptive_level) {
+		if (create_level_compressors(sqfs, wrcfg, &cfg, level_cmp))
+			goto fail_fragtbl;
+
+		blkdesc.flags |= SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL;
+		blkdesc.level_cmp = level_cmp;
+		blkdesc.num_levels = sqfs->num_levels;
+		blkdesc.target_rate = wrcfg->target_rate;
+	}
 
 	ret = sqfs_block_processor_create_ex(&blkdesc, &sqfs->data);
+
+	/* the workers have their own copies */
+	for (i = 0; i < sqfs->num_levels; ++i)
+		sqfs_destroy(level_cmp[i]);
+
 	if (ret != 0) {
 		sqfs_perror(wrcfg->filename, "creating data block processor",
 			    ret);
 		goto fail_fragtbl;
 	}
 
+	if (wrcfg->reference != NULL) {
+		if (sqfs_reference_open(&sqfs->ref, wrcfg->reference,
+					sqfs->cmp)) {
+			goto fail_data;
+		}
+	}
+
 	sqfs->idtbl = sqfs_id_table_create(0);
 	if (sqfs->idtbl == NULL) {
 		sqfs_perror(wrcfg->filename, "creating ID table",
@@ -198,6 +278,7 @@ fail_xwr:
 fail_id:
 	sqfs_destroy(sqfs->idtbl);
 fail_data:
+	sqfs_reference_destroy(sqfs->ref);
 	sqfs_destroy(sqfs->data);
 fail_fragtbl:
 	sqfs_destroy(sqfs->fragtbl);
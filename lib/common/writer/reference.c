@@ -0,0 +1,455 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * reference.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "simple_writer.h"
+#include "hash_table.h"
+#include "common.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  A previously built image, whose data blocks are copied verbatim instead of
+  compressing the same data again.
+
+  Files are matched up by path. Every full block of the new file is compared
+  against the uncompressed block at the same position in the old one, and if
+  they are identical, the on-disk block is passed on to the block processor
+  as is. Uncompressing and comparing is a lot cheaper than compressing. After
+  the first mismatch, the rest of the file is compressed normally, since the
+  content most likely shifted. Tail ends always go through the fragment
+  packing, as fragment blocks are shared with other files.
+ */
+typedef struct {
+	const sqfs_inode_generic_t *inode;
+	char path[];
+} ref_file_t;
+
+struct sqfs_reference_t {
+	sqfs_file_t *file;
+	sqfs_compressor_t *cmp;
+	sqfs_id_table_t *idtbl;
+	sqfs_dir_reader_t *dr;
+	sqfs_tree_node_t *root;
+	struct hash_table *files;
+	size_t block_size;
+
+	/* state of the file currently being written */
+	const sqfs_inode_generic_t *inode;
+	sqfs_u64 offset;
+	sqfs_u32 index;
+	sqfs_u32 count;
+	size_t used;
+
+	sqfs_u8 *buffer;
+	sqfs_u8 *raw;
+	sqfs_u8 *scratch;
+};
+
+static bool path_equals(void *user, const void *a, const void *b)
+{
+	(void)user;
+	return strcmp(a, b) == 0;
+}
+
+static void free_file(struct hash_entry *ent)
+{
+	free(ent->data);
+}
+
+static int add_files(sqfs_reference_t *ref, const sqfs_tree_node_t *n)
+{
+	struct hash_entry *ent;
+	ref_file_t *file;
+	sqfs_u32 hash;
+	char *path;
+
+	for (; n != NULL; n = n->next) {
+		if (S_ISDIR(n->inode->base.mode)) {
+			if (add_files(ref, n->children))
+				return -1;
+			continue;
+		}
+
+		if (n->inode->base.type != SQFS_INODE_FILE &&
+		    n->inode->base.type != SQFS_INODE_EXT_FILE) {
+			continue;
+		}
+
+		path = sqfs_tree_node_get_path(n);
+		if (path == NULL)
+			goto fail_errno;
+
+		if (canonicalize_name(path) != 0) {
+			free(path);
+			continue;
+		}
+
+		/* skip duplicates in a corrupted image */
+		hash = xxh32(path, strlen(path));
+
+		if (hash_table_search_pre_hashed(ref->files, hash,
+						 path) != NULL) {
+			free(path);
+			continue;
+		}
+
+		file = alloc_flex(sizeof(*file), 1, strlen(path) + 1);
+		if (file == NULL) {
+			free(path);
+			goto fail_errno;
+		}
+
+		file->inode = n->inode;
+		strcpy(file->path, path);
+		free(path);
+
+		ent = hash_table_insert_pre_hashed(ref->files, hash,
+						   file->path, file);
+		if (ent == NULL) {
+			free(file);
+			goto fail_errno;
+		}
+	}
+
+	return 0;
+fail_errno:
+	perror("indexing reference image");
+	return -1;
+}
+
+static int open_image(sqfs_reference_t *ref, const char *filename)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_super_t super;
+	int ret;
+
+	ref->file = sqfs_open_file(filename, SQFS_FILE_OPEN_READ_ONLY);
+	if (ref->file == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	ret = sqfs_super_read(&super, ref->file);
+	if (ret) {
+		sqfs_perror(filename, "reading super block", ret);
+		return -1;
+	}
+
+	sqfs_compressor_config_init(&cfg, super.compression_id,
+				    super.block_size,
+				    SQFS_COMP_FLAG_UNCOMPRESS);
+
+	ret = sqfs_compressor_create(&cfg, &ref->cmp);
+
+#ifdef WITH_LZO
+	if (super.compression_id == SQFS_COMP_LZO && ret != 0)
+		ret = lzo_compressor_create(&cfg, &ref->cmp);
+#endif
+
+	if (ret != 0) {
+		sqfs_perror(filename, "creating compressor", ret);
+		return -1;
+	}
+
+	if (super.flags & SQFS_FLAG_COMPRESSOR_OPTIONS) {
+		ret = ref->cmp->read_options(ref->cmp, ref->file);
+		if (ret) {
+			sqfs_perror(filename, "reading compressor options",
+				    ret);
+			return -1;
+		}
+	}
+
+	ref->idtbl = sqfs_id_table_create(0);
+	if (ref->idtbl == NULL) {
+		sqfs_perror(filename, "creating ID table", SQFS_ERROR_ALLOC);
+		return -1;
+	}
+
+	ret = sqfs_id_table_read(ref->idtbl, ref->file, &super, ref->cmp);
+	if (ret) {
+		sqfs_perror(filename, "loading ID table", ret);
+		return -1;
+	}
+
+	ref->dr = sqfs_dir_reader_create(&super, ref->cmp, ref->file,
+					 SQFS_DIR_READER_BLOCK_CACHE);
+	if (ref->dr == NULL) {
+		sqfs_perror(filename, "creating directory reader",
+			    SQFS_ERROR_ALLOC);
+		return -1;
+	}
+
+	ret = sqfs_dir_reader_preload(ref->dr, os_get_num_jobs());
+	if (ret) {
+		sqfs_perror(filename, "preloading inode and directory table",
+			    ret);
+		return -1;
+	}
+
+	ret = sqfs_dir_reader_get_full_hierarchy(ref->dr, ref->idtbl,
+						 NULL, 0, &ref->root);
+	if (ret) {
+		sqfs_perror(filename, "loading filesystem tree", ret);
+		return -1;
+	}
+
+	ref->block_size = super.block_size;
+	return 0;
+}
+
+/*
+  Whether blocks from the reference can be decoded with the options that
+  are stored in the new image. The kernel allocates the xz dictionary up
+  front, from the dictionary size in the compressor options.
+ */
+static bool can_reuse_blocks(const sqfs_compressor_config_t *img,
+			     const sqfs_compressor_config_t *ref)
+{
+	if (img->id != ref->id || img->block_size != ref->block_size)
+		return false;
+
+	if (img->id == SQFS_COMP_XZ &&
+	    ref->opt.xz.dict_size > img->opt.xz.dict_size) {
+		return false;
+	}
+
+	return true;
+}
+
+int sqfs_reference_open(sqfs_reference_t **out, const char *filename,
+			const sqfs_compressor_t *cmp)
+{
+	sqfs_compressor_config_t a, b;
+	sqfs_reference_t *ref;
+
+	*out = NULL;
+
+	ref = calloc(1, sizeof(*ref));
+	if (ref == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	if (open_image(ref, filename))
+		goto fail;
+
+	cmp->get_configuration(cmp, &a);
+	ref->cmp->get_configuration(ref->cmp, &b);
+
+	if (!can_reuse_blocks(&a, &b)) {
+		fprintf(stderr, "WARNING: %s: compressor, compressor options "
+			"or block size differ, not reusing any data "
+			"blocks.\n", filename);
+		sqfs_reference_destroy(ref);
+		return 0;
+	}
+
+	ref->buffer = malloc(3 * ref->block_size);
+	ref->files = hash_table_create(NULL, path_equals);
+
+	if (ref->buffer == NULL || ref->files == NULL) {
+		perror(filename);
+		goto fail;
+	}
+
+	ref->raw = ref->buffer + ref->block_size;
+	ref->scratch = ref->raw + ref->block_size;
+
+	if (add_files(ref, ref->root))
+		goto fail;
+
+	*out = ref;
+	return 0;
+fail:
+	sqfs_reference_destroy(ref);
+	return -1;
+}
+
+void sqfs_reference_destroy(sqfs_reference_t *ref)
+{
+	if (ref == NULL)
+		return;
+
+	if (ref->files != NULL)
+		hash_table_destroy(ref->files, free_file);
+
+	if (ref->root != NULL)
+		sqfs_dir_tree_destroy(ref->root);
+
+	if (ref->dr != NULL)
+		sqfs_destroy(ref->dr);
+
+	if (ref->idtbl != NULL)
+		sqfs_destroy(ref->idtbl);
+
+	if (ref->cmp != NULL)
+		sqfs_destroy(ref->cmp);
+
+	if (ref->file != NULL)
+		sqfs_destroy(ref->file);
+
+	free(ref->buffer);
+	free(ref);
+}
+
+void sqfs_reference_begin_file(sqfs_reference_t *ref, const char *path)
+{
+	struct hash_entry *ent;
+	sqfs_u64 size;
+
+	if (ref == NULL)
+		return;
+
+	ref->inode = NULL;
+	ref->used = 0;
+
+	ent = hash_table_search_pre_hashed(ref->files,
+					   xxh32(path, strlen(path)), path);
+	if (ent == NULL)
+		return;
+
+	ref->inode = ((ref_file_t *)ent->data)->inode;
+	ref->index = 0;
+
+	sqfs_inode_get_file_block_start(ref->inode, &ref->offset);
+	sqfs_inode_get_file_size(ref->inode, &size);
+
+	ref->count = ref->inode->payload_bytes_used / sizeof(sqfs_u32);
+	if (ref->count > size / ref->block_size)
+		ref->count = size / ref->block_size;
+}
+
+static int block_matches(sqfs_reference_t *ref, const sqfs_u8 *data,
+			 sqfs_u32 size, bool compressed)
+{
+	sqfs_s32 ret;
+	int err;
+
+	err = ref->file->read_at(ref->file, ref->offset, ref->raw, size);
+	if (err)
+		return err;
+
+	if (!compressed)
+		return size == ref->block_size &&
+			memcmp(ref->raw, data, size) == 0;
+
+	ret = ref->cmp->do_block(ref->cmp, ref->raw, size, ref->scratch,
+				 ref->block_size);
+
+	/* a corrupted block in the reference is no reason to fail */
+	if (ret <= 0)
+		return 0;
+
+	return (size_t)ret == ref->block_size &&
+		memcmp(ref->scratch, data, ref->block_size) == 0;
+}
+
+static int append_block(sqfs_reference_t *ref, sqfs_block_processor_t *proc,
+			const sqfs_u8 *data)
+{
+	sqfs_u32 size, on_disk;
+	bool compressed;
+	int ret;
+
+	if (ref->index >= ref->count) {
+		ref->inode = NULL;
+		goto out_append;
+	}
+
+	size = ref->inode->extra[ref->index++];
+	on_disk = SQFS_ON_DISK_BLOCK_SIZE(size);
+	compressed = SQFS_IS_BLOCK_COMPRESSED(size);
+
+	if (on_disk == 0)
+		goto out_append;
+
+	/* a corrupted size in the reference is treated as a mismatch */
+	if (on_disk > ref->block_size) {
+		ref->inode = NULL;
+		goto out_append;
+	}
+
+	ret = block_matches(ref, data, on_disk, compressed);
+	if (ret < 0)
+		return ret;
+
+	ref->offset += on_disk;
+
+	if (ret == 0) {
+		ref->inode = NULL;
+		goto out_append;
+	}
+
+	return sqfs_block_processor_append_raw(proc, ref->raw, on_disk,
+					       compressed ?
+					       SQFS_BLK_IS_COMPRESSED : 0);
+out_append:
+	return sqfs_block_processor_append(proc, data, ref->block_size);
+}
+
+int sqfs_reference_append(sqfs_reference_t *ref, sqfs_block_processor_t *proc,
+			  const void *data, size_t size)
+{
+	size_t diff;
+	int ret;
+
+	if (ref == NULL || ref->inode == NULL)
+		goto out_flush;
+
+	while (size > 0) {
+		if (ref->used == 0 && size >= ref->block_size) {
+			ret = append_block(ref, proc, data);
+			diff = ref->block_size;
+		} else {
+			diff = ref->block_size - ref->used;
+			if (diff > size)
+				diff = size;
+
+			memcpy(ref->buffer + ref->used, data, diff);
+			ref->used += diff;
+			ret = 0;
+
+			if (ref->used == ref->block_size) {
+				ref->used = 0;
+				ret = append_block(ref, proc, ref->buffer);
+			}
+		}
+
+		if (ret)
+			return ret;
+
+		data = (const char *)data + diff;
+		size -= diff;
+
+		if (ref->inode == NULL)
+			goto out_flush;
+	}
+
+	return 0;
+out_flush:
+	if (ref != NULL && ref->used > 0) {
+		ret = sqfs_block_processor_append(proc, ref->buffer,
+						  ref->used);
+		ref->used = 0;
+		if (ret)
+			return ret;
+	}
+
+	return size > 0 ? sqfs_block_processor_append(proc, data, size) : 0;
+}
+
+int sqfs_reference_end_file(sqfs_reference_t *ref,
+			    sqfs_block_processor_t *proc)
+{
+	if (ref == NULL)
+		return 0;
+
+	ref->inode = NULL;
+	return sqfs_reference_append(ref, proc, NULL, 0);
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * trace.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "simple_writer.h"
+#include "compat.h"
+
+#include <stdio.h>
+
+/*
+  Dumps the block processor events in the Chrome trace event format, which
+  can be loaded into chrome://tracing or https://ui.perfetto.dev. Timestamps
+  in that format are microseconds, so nanoseconds are printed as fractions.
+ */
+static const char *event_names[] = {
+	[SQFS_TRACE_EVENT_SUBMIT] = "submit",
+	[SQFS_TRACE_EVENT_PROCESS] = "process",
+	[SQFS_TRACE_EVENT_WAIT] = "wait",
+	[SQFS_TRACE_EVENT_REORDER] = "reorder",
+	[SQFS_TRACE_EVENT_FRAGMENT] = "fragment",
+	[SQFS_TRACE_EVENT_WRITE] = "write",
+};
+
+static void print_us(FILE *fp, const char *key, sqfs_u64 ns)
+{
+	fprintf(fp, ",\"%s\":" PRI_U64 ".%03u", key, ns / 1000,
+		(unsigned int)(ns % 1000));
+}
+
+static void print_event(FILE *fp, const char *phase, sqfs_u32 tid,
+			const sqfs_block_processor_trace_event_t *ev,
+			sqfs_u64 ts)
+{
+	fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"block\",\"ph\":\"%s\","
+		"\"pid\":1,\"tid\":%u", event_names[ev->type], phase,
+		(unsigned int)tid);
+	print_us(fp, "ts", ts);
+
+	if (phase[0] == 'X')
+		print_us(fp, "dur", ev->duration);
+
+	if (phase[0] == 'i')
+		fputs(",\"s\":\"t\"", fp);
+
+	if (phase[0] == 'b' || phase[0] == 'e')
+		fprintf(fp, ",\"id\":%u", (unsigned int)ev->block);
+
+	fprintf(fp, ",\"args\":{\"block\":%u,\"size\":%u,\"flags\":%u}}",
+		(unsigned int)ev->block, (unsigned int)ev->size,
+		(unsigned int)ev->flags);
+}
+
+static void print_thread(FILE *fp, const sqfs_block_processor_t *proc,
+			 sqfs_u32 tid)
+{
+	const sqfs_block_processor_trace_event_t *ev;
+	size_t i, count;
+
+	fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"tid\":%u,\"args\":{\"name\":\"", (unsigned int)tid);
+
+	if (tid == 0) {
+		fputs("main\"}}", fp);
+	} else {
+		fprintf(fp, "worker %u\"}}", (unsigned int)(tid - 1));
+	}
+
+	ev = sqfs_block_processor_get_trace(proc, tid, &count);
+
+	for (i = 0; i < count; ++i, ++ev) {
+		if (ev->type >= sizeof(event_names) / sizeof(event_names[0]))
+			continue;
+
+		switch (ev->type) {
+		case SQFS_TRACE_EVENT_SUBMIT:
+			print_event(fp, "i", tid, ev, ev->start);
+			break;
+		case SQFS_TRACE_EVENT_REORDER:
+			print_event(fp, "b", tid, ev, ev->start);
+			print_event(fp, "e", tid, ev,
+				    ev->start + ev->duration);
+			break;
+		default:
+			print_event(fp, "X", tid, ev, ev->start);
+			break;
+		}
+	}
+}
+
+int sqfs_writer_write_trace(const sqfs_block_processor_t *proc,
+			    const char *filename)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_u32 i;
+	FILE *fp;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	stats = sqfs_block_processor_get_stats(proc);
+
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+	      "\"args\":{\"name\":\"block processor\"}}", fp);
+
+	for (i = 0; i <= stats->worker_count; ++i)
+		print_thread(fp, proc, i);
+
+	fputs("\n]}\n", fp);
+
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: error writing trace\n", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	if (fclose(fp) != 0) {
+		perror(filename);
+		return -1;
+	}
+
+	return 0;
+}
@@ -6,101 +6,150 @@
  */
 #include "internal.h"
 
-static void ltrim(char *buffer)
+static int append_scratch(istream_t *strm, const sqfs_u8 *data, size_t size,
+			  size_t *count)
 {
-	size_t i = 0;
+	size_t new_sz;
+	char *new;
 
-	while (isspace(buffer[i]))
-		++i;
+	if (SZ_ADD_OV(*count, size, &new_sz) || SZ_ADD_OV(new_sz, 1, &new_sz)) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	if (new_sz > strm->line_scratch_size) {
+		new = realloc(strm->line_scratch, new_sz);
+		if (new == NULL)
+			return -1;
 
-	if (i > 0)
-		memmove(buffer, buffer + i, strlen(buffer + i) + 1);
+		strm->line_scratch = new;
+		strm->line_scratch_size = new_sz;
+	}
+
+	memcpy(strm->line_scratch + *count, data, size);
+	*count += size;
+	strm->line_scratch[*count] = '\0';
+	return 0;
 }
 
-static void rtrim(char *buffer)
+/*
+  Lines that are completely inside the buffer are terminated in place. The
+  buffer is only refilled (and the unread part moved to the front) once no
+  line break is left in it. Only a line that does not fit into the buffer
+  or that ends without a line break at the end of the stream is assembled in
+  the scratch buffer of the stream.
+ */
+static int next_line(istream_t *strm, char **out, size_t *len)
 {
-	size_t i = strlen(buffer);
+	size_t avail, scanned = 0, count = 0;
+	sqfs_u8 *start, *end;
 
-	while (i > 0 && isspace(buffer[i - 1]))
-		--i;
+	for (;;) {
+		avail = strm->buffer_used - strm->buffer_offset;
+		start = strm->buffer + strm->buffer_offset;
+		end = NULL;
 
-	buffer[i] = '\0';
-}
+		if (avail > scanned)
+			end = memchr(start + scanned, '\n', avail - scanned);
 
-static size_t trim(char *buffer, int flags)
-{
-	if (flags & ISTREAM_LINE_LTRIM)
-		ltrim(buffer);
+		if (end != NULL) {
+			strm->buffer_offset += (end - start) + 1;
 
-	if (flags & ISTREAM_LINE_RTRIM)
-		rtrim(buffer);
+			if (end > start && end[-1] == '\r')
+				--end;
 
-	return strlen(buffer);
-}
+			if (count == 0) {
+				*end = '\0';
+				*out = (char *)start;
+				*len = end - start;
+				return 0;
+			}
 
-int istream_get_line(istream_t *strm, char **out,
-		     size_t *line_num, int flags)
-{
-	char *line = NULL, *new;
-	size_t i, line_len = 0;
-	bool have_line = false;
+			if (append_scratch(strm, start, end - start, &count))
+				return -1;
 
-	*out = NULL;
+			/* CR in the scratch buffer, LF in the stream buffer */
+			if (end == start &&
+			    strm->line_scratch[count - 1] == '\r') {
+				strm->line_scratch[--count] = '\0';
+			}
+			break;
+		}
 
-	for (;;) {
-		if (istream_precache(strm))
-			return -1;
+		scanned = avail;
 
-		if (strm->buffer_used == 0) {
-			if (line_len == 0)
-				goto out_eof;
+		if (!strm->eof) {
+			if (istream_precache(strm))
+				return -1;
 
-			line_len = trim(line, flags);
+			if ((strm->buffer_used - strm->buffer_offset) > avail)
+				continue;
+		}
 
-			if (line_len == 0 &&
-			    (flags & ISTREAM_LINE_SKIP_EMPTY)) {
-				goto out_eof;
-			}
+		/* end-of-file, or the buffer is full without a line break */
+		if (avail == 0) {
+			if (count == 0)
+				return 1;
 			break;
 		}
 
-		for (i = 0; i < strm->buffer_used; ++i) {
-			if (strm->buffer[i] == '\n')
-				break;
+		if (append_scratch(strm, strm->buffer + strm->buffer_offset,
+				   avail, &count)) {
+			return -1;
 		}
 
-		if (i < strm->buffer_used) {
-			have_line = true;
-			strm->buffer_offset = i + 1;
+		strm->buffer_offset = strm->buffer_used;
+		scanned = 0;
+
+		if (strm->eof)
+			break;
+	}
 
-			if (i > 0 && strm->buffer[i - 1] == '\r')
-				--i;
-		} else {
-			strm->buffer_offset = i;
+	*out = strm->line_scratch;
+	*len = count;
+	return 0;
+}
+
+static char *trim(char *line, size_t *len, int flags)
+{
+	if (flags & ISTREAM_LINE_LTRIM) {
+		while (*len > 0 && isspace(*line)) {
+			++line;
+			--(*len);
 		}
+	}
 
-		new = realloc(line, line_len + i + 1);
-		if (new == NULL)
-			goto fail_errno;
+	if (flags & ISTREAM_LINE_RTRIM) {
+		while (*len > 0 && isspace(line[*len - 1]))
+			--(*len);
+	}
+
+	line[*len] = '\0';
+	return line;
+}
 
-		line = new;
-		memcpy(line + line_len, strm->buffer, i);
-		line_len += i;
-		line[line_len] = '\0';
+int istream_get_line_inplace(istream_t *strm, char **out,
+			     size_t *line_num, int flags)
+{
+	size_t len;
+	char *line;
+	int ret;
 
-		if (have_line) {
-			line_len = trim(line, flags);
+	*out = NULL;
 
-			if (line_len == 0 &&
-			    (flags & ISTREAM_LINE_SKIP_EMPTY)) {
-				free(line);
-				line = NULL;
-				have_line = false;
-				*line_num += 1;
-				continue;
-			}
+	for (;;) {
+		ret = next_line(strm, &line, &len);
+		if (ret < 0)
+			goto fail_errno;
+		if (ret > 0)
+			return 1;
+
+		line = trim(line, &len, flags);
+
+		if (len > 0 || !(flags & ISTREAM_LINE_SKIP_EMPTY))
 			break;
-		}
+
+		*line_num += 1;
 	}
 
 	*out = line;
@@ -108,11 +157,27 @@ int istream_get_line(istream_t *strm, char **out,
 fail_errno:
 	fprintf(stderr, "%s: " PRI_SZ ": %s.\n", strm->get_filename(strm),
 		*line_num, strerror(errno));
-	free(line);
-	*out = NULL;
 	return -1;
-out_eof:
-	free(line);
-	*out = NULL;
-	return 1;
+}
+
+int istream_get_line(istream_t *strm, char **out,
+		     size_t *line_num, int flags)
+{
+	char *line;
+	int ret;
+
+	ret = istream_get_line_inplace(strm, &line, line_num, flags);
+	if (ret != 0) {
+		*out = NULL;
+		return ret;
+	}
+
+	*out = strdup(line);
+	if (*out == NULL) {
+		fprintf(stderr, "%s: " PRI_SZ ": %s.\n",
+			strm->get_filename(strm), *line_num, strerror(errno));
+		return -1;
+	}
+
+	return 0;
 }
@@ -19,6 +19,7 @@ static void comp_destroy(sqfs_object_t *obj)
 
 	comp->cleanup(comp);
 	sqfs_destroy(comp->wrapped);
+	free(comp->base.line_scratch);
 	free(comp);
 }
 
@@ -71,6 +71,7 @@ static void file_destroy(sqfs_object_t *obj)
 		free(file->path);
 	}
 
+	free(file->base.line_scratch);
 	free(file);
 }
 
@@ -262,29 +262,61 @@ fail:
 
 }
 #else
-static void discard_node(tree_node_t *root, tree_node_t *n)
+/*
+  The entries of a directory are collected in an array while scanning it and
+  only sorted into the tree once the scan is done. Inserting them one by one
+  would cost a walk of the children list for every entry.
+ */
+typedef struct {
+	tree_node_t **nodes;
+	size_t count;
+	size_t max;
+} node_array_t;
+
+static int add_pending(node_array_t *pending, tree_node_t *root,
+		       tree_node_t *n)
 {
-	tree_node_t *it;
+	size_t new_max;
+	void *new;
 
-	if (n == root->data.dir.children) {
-		root->data.dir.children = n->next;
-	} else {
-		it = root->data.dir.children;
+	if (root->link_count == 0x0FFFF) {
+		errno = EMLINK;
+		return -1;
+	}
 
-		while (it != NULL && it->next != n)
-			it = it->next;
+	if (pending->count == pending->max) {
+		new_max = pending->max ? pending->max : 64;
+
+		if (SZ_MUL_OV(new_max, 2, &new_max) ||
+		    SZ_MUL_OV(new_max, sizeof(pending->nodes[0]), &new_max)) {
+			errno = EOVERFLOW;
+			return -1;
+		}
+
+		new = realloc(pending->nodes, new_max);
+		if (new == NULL)
+			return -1;
 
-		if (it != NULL)
-			it->next = n->next;
+		pending->nodes = new;
+		pending->max = new_max / sizeof(pending->nodes[0]);
 	}
 
-	free(n);
+	pending->nodes[pending->count++] = n;
+	root->link_count++;
+	return 0;
+}
+
+static void flush_pending(node_array_t *pending, tree_node_t *root)
+{
+	fstree_insert_sorted_array(root, pending->nodes, pending->count);
+	free(pending->nodes);
 }
 
 static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 			dev_t devstart, scan_node_callback cb,
 			void *user, unsigned int flags)
 {
+	node_array_t pending = { NULL, 0, 0 };
 	char *extra = NULL;
 	struct dirent *ent;
 	int ret, childfd;
@@ -392,14 +424,23 @@ static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 
 			ret = 0;
 		} else {
-			n = fstree_mknode(root, ent->d_name,
+			n = fstree_mknode(NULL, ent->d_name,
 					  strlen(ent->d_name), extra, &sb);
 			if (n == NULL) {
 				perror("creating tree node");
 				goto fail;
 			}
 
+			n->parent = root;
 			ret = (cb == NULL) ? 0 : cb(user, fs, n);
+
+			if (ret == 0 && add_pending(&pending, root, n)) {
+				perror("creating tree node");
+				ret = -1;
+			}
+
+			if (ret != 0)
+				free(n);
 		}
 
 		free(extra);
@@ -408,10 +449,8 @@ static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 		if (ret < 0)
 			goto fail;
 
-		if (ret > 0) {
-			discard_node(root, n);
+		if (ret > 0)
 			continue;
-		}
 
 		if (S_ISDIR(n->mode) && !(flags & DIR_SCAN_NO_RECURSION)) {
 			childfd = openat(dir_fd, n->name, O_DIRECTORY |
@@ -428,11 +467,13 @@ static int populate_dir(int dir_fd, fstree_t *fs, tree_node_t *root,
 		}
 	}
 
+	flush_pending(&pending, root);
 	closedir(dir);
 	return 0;
 fail_rdlink:
 	perror("readlink");
 fail:
+	flush_pending(&pending, root);
 	closedir(dir);
 	free(extra);
 	return -1;
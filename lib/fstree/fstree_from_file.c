@@ -550,8 +550,9 @@ int fstree_from_file_stream(fstree_t *fs, istream_t *fp, const char *basepath)
 	filename = istream_get_filename(fp);
 
 	for (;;) {
-		ret = istream_get_line(fp, &line, &line_num,
-				       ISTREAM_LINE_LTRIM | ISTREAM_LINE_SKIP_EMPTY);
+		ret = istream_get_line_inplace(fp, &line, &line_num,
+					       ISTREAM_LINE_LTRIM |
+					       ISTREAM_LINE_SKIP_EMPTY);
 		if (ret < 0)
 			return -1;
 		if (ret > 0)
@@ -560,18 +561,14 @@ int fstree_from_file_stream(fstree_t *fs, istream_t *fp, const char *basepath)
 		if (line[0] != '#') {
 			if (handle_line(fs, filename, line_num,
 					line, basepath)) {
-				goto fail_line;
+				return -1;
 			}
 		}
 
-		free(line);
 		++line_num;
 	}
 
 	return 0;
-fail_line:
-	free(line);
-	return -1;
 }
 
 int fstree_from_file(fstree_t *fs, const char *filename, const char *basepath)
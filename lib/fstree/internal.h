@@ -19,4 +19,11 @@ sqfs_u32 get_source_date_epoch(void);
 
 void fstree_insert_sorted(tree_node_t *root, tree_node_t *n);
 
+/*
+  Sort an array of nodes by name and merge them into the children list
+  of a directory in one go. The nodes must not be linked into any list yet.
+ */
+void fstree_insert_sorted_array(tree_node_t *root, tree_node_t **nodes,
+				size_t count);
+
 #endif /* FSTREE_INTERNAL_H */
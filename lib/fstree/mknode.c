@@ -15,6 +15,13 @@
 void fstree_insert_sorted(tree_node_t *root, tree_node_t *n)
 {
 	tree_node_t *it = root->data.dir.children, *prev = NULL;
+	tree_node_t *tail = root->data.dir.children_tail;
+
+	/* fast path for input that is already sorted */
+	if (tail != NULL && strcmp(tail->name, n->name) < 0) {
+		it = NULL;
+		prev = tail;
+	}
 
 	while (it != NULL && strcmp(it->name, n->name) < 0) {
 		prev = it;
@@ -29,6 +36,49 @@ void fstree_insert_sorted(tree_node_t *root, tree_node_t *n)
 	} else {
 		prev->next = n;
 	}
+
+	if (it == NULL)
+		root->data.dir.children_tail = n;
+}
+
+static int compare_names(const void *lhs, const void *rhs)
+{
+	const tree_node_t *l = *((const tree_node_t *const *)lhs);
+	const tree_node_t *r = *((const tree_node_t *const *)rhs);
+
+	return strcmp(l->name, r->name);
+}
+
+void fstree_insert_sorted_array(tree_node_t *root, tree_node_t **nodes,
+				size_t count)
+{
+	tree_node_t *it = root->data.dir.children, *head = NULL, *n;
+	tree_node_t **next = &head;
+	size_t i = 0;
+
+	if (count == 0)
+		return;
+
+	qsort(nodes, count, sizeof(nodes[0]), compare_names);
+
+	/* merge with the existing entries, new nodes go before equal ones */
+	while (it != NULL || i < count) {
+		if (i == count || (it != NULL &&
+				   strcmp(it->name, nodes[i]->name) < 0)) {
+			n = it;
+			it = it->next;
+		} else {
+			n = nodes[i++];
+			n->parent = root;
+		}
+
+		*next = n;
+		next = &n->next;
+		root->data.dir.children_tail = n;
+	}
+
+	*next = NULL;
+	root->data.dir.children = head;
 }
 
 tree_node_t *fstree_mknode(tree_node_t *parent, const char *name,
@@ -88,14 +138,13 @@ tree_node_t *fstree_mknode(tree_node_t *parent, const char *name,
 	}
 
 	if (parent != NULL) {
-		fstree_insert_sorted(parent, n);
-
 		if (parent->link_count == 0x0FFFF) {
 			free(n);
 			errno = EMLINK;
 			return NULL;
 		}
 
+		fstree_insert_sorted(parent, n);
 		parent->link_count++;
 	}
 
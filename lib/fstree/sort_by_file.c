@@ -272,37 +272,28 @@ int fstree_sort_files(fstree_t *fs, istream_t *sortfile)
 		sqfs_s64 priority;
 		int ret, flags;
 
-		ret = istream_get_line(sortfile, &line, &line_num,
-				       ISTREAM_LINE_LTRIM |
-				       ISTREAM_LINE_RTRIM |
-				       ISTREAM_LINE_SKIP_EMPTY);
-		if (ret != 0) {
-			free(line);
-			if (ret < 0)
-				return -1;
+		ret = istream_get_line_inplace(sortfile, &line, &line_num,
+					       ISTREAM_LINE_LTRIM |
+					       ISTREAM_LINE_RTRIM |
+					       ISTREAM_LINE_SKIP_EMPTY);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
 			break;
-		}
 
-		if (line[0] == '#') {
-			free(line);
+		if (line[0] == '#')
 			continue;
-		}
 
-		if (decode_priority(filename, line_num, line, &priority)) {
-			free(line);
+		if (decode_priority(filename, line_num, line, &priority))
 			return -1;
-		}
 
 		if (decode_flags(filename, line_num, &do_glob, &path_glob,
 				 &flags, line)) {
-			free(line);
 			return -1;
 		}
 
-		if (decode_filename(filename, line_num, line)) {
-			free(line);
+		if (decode_filename(filename, line_num, line))
 			return -1;
-		}
 
 		have_match = false;
 
@@ -318,7 +309,6 @@ int fstree_sort_files(fstree_t *fs, istream_t *sortfile)
 			if (path == NULL) {
 				fprintf(stderr, "%s: " PRI_SZ ": out-of-memory\n",
 					filename, line_num);
-				free(line);
 				return -1;
 			}
 
@@ -327,7 +317,6 @@ int fstree_sort_files(fstree_t *fs, istream_t *sortfile)
 					"%s: " PRI_SZ ": [BUG] error "
 					"reconstructing node path\n",
 					filename, line_num);
-				free(line);
 				free(path);
 				return -1;
 			}
@@ -358,8 +347,6 @@ int fstree_sort_files(fstree_t *fs, istream_t *sortfile)
 				"for '%s'.\n",
 				filename, line_num, line);
 		}
-
-		free(line);
 	}
 
 	sort_file_list(fs);
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * adaptive.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  Picking a compression level per block.
+
+  For every level, the time a worker needs to compress a KiB of input is
+  tracked as a moving average over the blocks compressed with it. Together,
+  the workers can then get through roughly the number of workers divided by
+  that cost per second. The strongest level for which this meets the target
+  rate is used.
+
+  To get a first estimate for all of them, the first blocks are sent off
+  with one level each. After that, whenever the chosen level leaves room,
+  a single block is compressed with the next stronger one every
+  PROBE_INTERVAL blocks, in case the data got easier to compress. If the
+  data gets harder, the estimate of the level in use grows and the
+  controller falls back to a faster one.
+
+  The costs are measured in wall-clock time. If there are more workers than
+  CPU cores, the measured cost grows accordingly, so the estimated rate
+  remains plausible.
+ */
+#define PROBE_INTERVAL (64)
+
+static bool fast_enough(const sqfs_block_processor_t *proc, sqfs_u32 level)
+{
+	const level_ctl_t *ctl = &proc->levels;
+	sqfs_u64 kib_per_sec;
+
+	if (ctl->cost[level] == 0)
+		return false;
+
+	kib_per_sec = (proc->stats.worker_count * 1000000000UL) /
+		ctl->cost[level];
+
+	return (kib_per_sec * 1024) >= ctl->target_rate;
+}
+
+void level_ctl_init(sqfs_block_processor_t *proc, sqfs_u32 count,
+		    sqfs_u64 target_rate)
+{
+	level_ctl_t *ctl = &proc->levels;
+
+	memset(ctl, 0, sizeof(*ctl));
+	ctl->enabled = true;
+	ctl->count = count;
+	ctl->target_rate = target_rate;
+	ctl->probe = count;
+}
+
+sqfs_u32 level_ctl_pick(sqfs_block_processor_t *proc)
+{
+	level_ctl_t *ctl = &proc->levels;
+	sqfs_u32 i, best = 0;
+
+	if (ctl->target_rate == 0)
+		return ctl->count - 1;
+
+	if (ctl->calibrated < ctl->count)
+		return ctl->calibrated++;
+
+	for (i = 0; i < ctl->count; ++i) {
+		if (fast_enough(proc, i))
+			best = i;
+	}
+
+	ctl->since_probe += 1;
+
+	if ((best + 1) >= ctl->count || ctl->probe < ctl->count ||
+	    !fast_enough(proc, best)) {
+		return best;
+	}
+
+	if (ctl->cost[best + 1] != 0 && ctl->since_probe < PROBE_INTERVAL)
+		return best;
+
+	ctl->probe = best + 1;
+	ctl->since_probe = 0;
+	return ctl->probe;
+}
+
+void level_ctl_update(sqfs_block_processor_t *proc, const sqfs_block_t *blk)
+{
+	level_ctl_t *ctl = &proc->levels;
+
+	if (blk->level == LEVEL_NONE)
+		return;
+
+	if (blk->level == ctl->probe)
+		ctl->probe = ctl->count;
+
+	if (blk->comp_cost == 0 || blk->level >= ctl->count)
+		return;
+
+	ctl->blocks[blk->level] += 1;
+
+	if (ctl->cost[blk->level] == 0) {
+		ctl->cost[blk->level] = blk->comp_cost;
+	} else {
+		ctl->cost[blk->level] = (3 * ctl->cost[blk->level] +
+					 blk->comp_cost) / 4;
+	}
+}
+
+void sqfs_block_processor_set_target_rate(sqfs_block_processor_t *proc,
+					  sqfs_u64 rate)
+{
+	proc->levels.target_rate = rate;
+}
+
+int sqfs_block_processor_get_level_count(const sqfs_block_processor_t *proc,
+					 sqfs_u32 index, sqfs_u64 *out)
+{
+	if (!proc->levels.enabled || index >= proc->levels.count) {
+		*out = 0;
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+	}
+
+	*out = proc->levels.blocks[index];
+	return 0;
+}
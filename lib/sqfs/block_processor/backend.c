@@ -44,6 +44,37 @@ static int set_block_size(sqfs_inode_generic_t **inode,
 	return 0;
 }
 
+static int copy_file_layout(sqfs_inode_generic_t **inode,
+			    sqfs_inode_generic_t *const *original)
+{
+	sqfs_u32 i, count, index, offset;
+	sqfs_u64 location;
+	int err;
+
+	count = (*original)->payload_bytes_used / sizeof(sqfs_u32);
+
+	for (i = 0; i < count; ++i) {
+		err = set_block_size(inode, i, (*original)->extra[i]);
+		if (err)
+			return err;
+	}
+
+	sqfs_inode_get_file_block_start(*original, &location);
+	sqfs_inode_set_file_block_start(*inode, location);
+
+	sqfs_inode_get_frag_location(*original, &index, &offset);
+	sqfs_inode_set_frag_location(*inode, index, offset);
+
+	if ((*original)->base.type == SQFS_INODE_EXT_FILE &&
+	    (*original)->data.file_ext.sparse > 0) {
+		sqfs_inode_make_extended(*inode);
+		(*inode)->data.file_ext.sparse =
+			(*original)->data.file_ext.sparse;
+	}
+
+	return 0;
+}
+
 static void release_old_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
 	blk->next = proc->free_list;
@@ -54,14 +85,27 @@ static void release_old_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 
 static int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
-	sqfs_u64 location;
+	sqfs_u64 location, start, end;
 	sqfs_u32 size;
 	int err;
 
-	if (blk->flags & SQFS_BLK_FRAGMENT_BLOCK) {
+	if (proc->trace.enabled) {
+		trace_event(&proc->trace, SQFS_TRACE_EVENT_REORDER, blk,
+			    blk->done_ns, get_time_ns());
+	}
+
+	if (blk->flags & BLK_FLAG_DUPLICATE) {
+		err = copy_file_layout(blk->inode, blk->original);
+
+		if (err == 0 && proc->defer.enabled)
+			err = defer_alias(proc, blk->inode, blk->original);
+		goto out;
+	}
+
+	if (blk->source != NULL) {
 		sqfs_block_t *it = proc->fblk_in_flight, *prev = NULL;
 
-		while (it != NULL && it->index != blk->index) {
+		while (it != NULL && it != blk->source) {
 			prev = it;
 			it = it->next;
 		}
@@ -72,19 +116,40 @@ static int process_completed_block(sqfs_block_processor_t *proc, sqfs_block_t *b
 			} else {
 				prev->next = it->next;
 			}
-			free(it);
 		}
+
+		/* the source block accounts for both in the backlog */
+		blk->source->next = proc->free_list;
+		proc->free_list = blk->source;
+		blk->source = NULL;
 	}
 
+	start = get_time_ns();
 	err = proc->wr->write_data_block(proc->wr, blk->user, blk->size,
 					 blk->checksum,
 					 blk->flags & ~BLK_FLAG_INTERNAL,
 					 blk->data, &location);
+	end = get_time_ns();
+	proc->stats.write_time_ns += end - start;
+
+	if (proc->trace.enabled) {
+		trace_event(&proc->trace, SQFS_TRACE_EVENT_WRITE, blk,
+			    start, end);
+	}
 	if (err)
 		goto out;
 
 	proc->stats.output_bytes_generated += blk->size;
 
+	if (blk->flags & BLK_FLAG_PROBE_SKIPPED)
+		proc->stats.probe_skip_count += 1;
+
+	if (blk->flags & BLK_FLAG_LOW_GAIN)
+		proc->stats.low_gain_count += 1;
+
+	if (blk->flags & BLK_FLAG_RAW)
+		proc->stats.raw_block_count += 1;
+
 	if (blk->flags & SQFS_BLK_IS_SPARSE) {
 		if (blk->inode != NULL) {
 			sqfs_inode_make_extended(*(blk->inode));
@@ -127,65 +192,57 @@ out:
 	return err;
 }
 
-static int process_completed_fragment(sqfs_block_processor_t *proc,
-				      sqfs_block_t *frag)
+int fragment_dedup(sqfs_block_processor_t *proc, const sqfs_u8 *data,
+		   sqfs_u32 size, sqfs_u32 hash, sqfs_inode_generic_t **inode)
 {
-	chunk_info_t *chunk = NULL, search;
+	chunk_info_t *chunk, search;
 	struct hash_entry *entry;
-	sqfs_u32 index, offset;
-	int err;
 
-	if (frag->flags & SQFS_BLK_IS_SPARSE) {
-		if (frag->inode != NULL) {
-			sqfs_inode_make_extended(*(frag->inode));
-			set_block_size(frag->inode, frag->index, 0);
-			(*(frag->inode))->data.file_ext.sparse += frag->size;
-		}
-		proc->stats.sparse_block_count += 1;
-		release_old_block(proc, frag);
-		return 0;
-	}
+	search.hash = hash;
+	search.size = size;
 
-	proc->stats.total_frag_count += 1;
+	proc->current_frag = data;
+	proc->fblk_lookup_error = 0;
+	entry = hash_table_search_pre_hashed(proc->frag_ht,
+					     search.hash, &search);
+	proc->current_frag = NULL;
 
-	if (!(frag->flags & SQFS_BLK_DONT_DEDUPLICATE)) {
-		search.hash = frag->checksum;
-		search.size = frag->size;
+	if (proc->fblk_lookup_error != 0)
+		return proc->fblk_lookup_error;
 
-		proc->current_frag = frag;
-		proc->fblk_lookup_error = 0;
-		entry = hash_table_search_pre_hashed(proc->frag_ht,
-						     search.hash, &search);
-		proc->current_frag = NULL;
+	if (entry == NULL)
+		return 0;
 
-		if (proc->fblk_lookup_error != 0) {
-			err = proc->fblk_lookup_error;
-			goto fail;
-		}
+	proc->stats.frag_dedup_bytes += size;
 
-		if (entry != NULL) {
-			if (frag->inode != NULL) {
-				chunk = entry->data;
-				sqfs_inode_set_frag_location(*(frag->inode),
-							     chunk->index,
-							     chunk->offset);
-			}
-			release_old_block(proc, frag);
-			return 0;
-		}
+	if (inode != NULL) {
+		chunk = entry->data;
+		sqfs_inode_set_frag_location(*inode, chunk->index,
+					     chunk->offset);
 	}
+	return 1;
+}
 
-	if (proc->frag_block != NULL) {
-		size_t size = proc->frag_block->size + frag->size;
+int fragment_store(sqfs_block_processor_t *proc, sqfs_block_t *reuse,
+		   const sqfs_u8 *data, sqfs_u32 size, sqfs_u32 hash,
+		   sqfs_u32 flags, sqfs_inode_generic_t **inode, void *user)
+{
+	chunk_info_t *chunk = NULL;
+	struct hash_entry *entry;
+	sqfs_u32 index, offset;
+	int err;
 
-		if (size > proc->max_block_size) {
+	flags &= (SQFS_BLK_DONT_COMPRESS | SQFS_BLK_ALIGN);
+
+	if (proc->frag_block != NULL) {
+		if ((proc->frag_block->size + size) > proc->max_block_size) {
 			proc->frag_block->io_seq_num = proc->io_seq_num++;
 
 			err = enqueue_block(proc, proc->frag_block);
 			proc->frag_block = NULL;
 
 			if (err)
-				goto fail;
+				return err;
 		}
 	}
 
@@ -196,69 +253,125 @@ static int process_completed_fragment(sqfs_block_processor_t *proc,
 			err = sqfs_frag_table_append(proc->frag_tbl,
 						     0, 0, &index);
 			if (err)
-				goto fail;
+				return err;
+		}
+
+		if (reuse == NULL) {
+			/* accounted for in the backlog like a reused one */
+			reuse = block_alloc(proc);
+			if (reuse == NULL)
+				return SQFS_ERROR_ALLOC;
+
+			proc->backlog += 1;
+			reuse->user = user;
+			reuse->size = size;
+			memcpy(reuse->data, data, size);
 		}
 
 		offset = 0;
-		proc->frag_block = frag;
+		proc->frag_block = reuse;
 		proc->frag_block->index = index;
-		proc->frag_block->flags &=
-			(SQFS_BLK_DONT_COMPRESS | SQFS_BLK_ALIGN);
-		proc->frag_block->flags |= SQFS_BLK_FRAGMENT_BLOCK;
+		proc->frag_block->flags = flags | SQFS_BLK_FRAGMENT_BLOCK;
 	} else {
 		index = proc->frag_block->index;
 		offset = proc->frag_block->size;
 
 		memcpy(proc->frag_block->data + proc->frag_block->size,
-		       frag->data, frag->size);
+		       data, size);
 
-		proc->frag_block->size += frag->size;
-		proc->frag_block->flags |=
-			(frag->flags &
-			 (SQFS_BLK_DONT_COMPRESS | SQFS_BLK_ALIGN));
+		proc->frag_block->size += size;
+		proc->frag_block->flags |= flags;
 	}
 
 	if (proc->frag_tbl != NULL) {
-		err = SQFS_ERROR_ALLOC;
 		chunk = calloc(1, sizeof(*chunk));
 		if (chunk == NULL)
-			goto fail;
+			return SQFS_ERROR_ALLOC;
 
 		chunk->index = index;
 		chunk->offset = offset;
-		chunk->size = frag->size;
-		chunk->hash = frag->checksum;
+		chunk->size = size;
+		chunk->hash = hash;
 
-		proc->current_frag = frag;
+		proc->current_frag = data;
 		proc->fblk_lookup_error = 0;
 		entry = hash_table_insert_pre_hashed(proc->frag_ht, chunk->hash,
 						     chunk, chunk);
 		proc->current_frag = NULL;
 
 		if (proc->fblk_lookup_error != 0) {
-			err = proc->fblk_lookup_error;
-			goto fail;
+			free(chunk);
+			return proc->fblk_lookup_error;
 		}
 
-		if (entry == NULL)
-			goto fail;
+		if (entry == NULL) {
+			free(chunk);
+			return SQFS_ERROR_ALLOC;
+		}
 	}
 
-	if (frag->inode != NULL)
-		sqfs_inode_set_frag_location(*(frag->inode), index, offset);
-
-	if (frag != proc->frag_block)
-		release_old_block(proc, frag);
+	if (inode != NULL)
+		sqfs_inode_set_frag_location(*inode, index, offset);
 
 	proc->stats.actual_frag_count += 1;
 	return 0;
-fail:
-	free(chunk);
+}
+
+static int process_completed_fragment(sqfs_block_processor_t *proc,
+				      sqfs_block_t *frag)
+{
+	int err;
+
+	if (frag->flags & SQFS_BLK_IS_SPARSE) {
+		if (frag->inode != NULL) {
+			sqfs_inode_make_extended(*(frag->inode));
+			set_block_size(frag->inode, frag->index, 0);
+			(*(frag->inode))->data.file_ext.sparse += frag->size;
+		}
+		proc->stats.sparse_block_count += 1;
+		release_old_block(proc, frag);
+		return 0;
+	}
+
+	proc->stats.total_frag_count += 1;
+
+	if (!(frag->flags & SQFS_BLK_DONT_DEDUPLICATE)) {
+		err = fragment_dedup(proc, frag->data, frag->size,
+				     frag->checksum, frag->inode);
+		if (err != 0) {
+			release_old_block(proc, frag);
+			return err < 0 ? err : 0;
+		}
+	}
+
+	if (proc->defer.enabled) {
+		err = defer_fragment(proc, frag);
+	} else {
+		err = fragment_store(proc, frag, frag->data, frag->size,
+				     frag->checksum, frag->flags, frag->inode,
+				     frag->user);
+	}
+
 	if (frag != proc->frag_block)
 		release_old_block(proc, frag);
 	return err;
 }
 
+static void account_worker_time(sqfs_block_processor_t *proc,
+				const sqfs_block_t *blk)
+{
+	worker_data_t *worker;
+
+	for (worker = proc->workers; worker != NULL; worker = worker->next) {
+		if (worker->index == blk->worker_index) {
+			worker->busy_ns += blk->proc_time_ns;
+			break;
+		}
+	}
+
+	proc->stats.worker_time_ns += blk->proc_time_ns;
+}
+
 static void store_io_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
 	sqfs_block_t *prev = NULL, *it = proc->io_queue;
@@ -281,6 +394,7 @@ int dequeue_block(sqfs_block_processor_t *proc)
 {
 	size_t backlog_old = proc->backlog;
 	sqfs_block_t *blk;
+	sqfs_u64 start, end;
 	int status;
 
 	do {
@@ -310,15 +424,39 @@ int dequeue_block(sqfs_block_processor_t *proc)
 			break;
 		}
 
+		start = get_time_ns();
 		blk = proc->pool->dequeue(proc->pool);
+		end = get_time_ns();
+		proc->stats.wait_time_ns += end - start;
 
 		if (blk == NULL) {
 			status = proc->pool->get_status(proc->pool);
 			return status ? status : SQFS_ERROR_INTERNAL;
 		}
 
+		if (proc->trace.enabled) {
+			trace_event(&proc->trace, SQFS_TRACE_EVENT_WAIT, blk,
+				    start, end);
+		}
+
+		account_worker_time(proc, blk);
+		blk->done_ns = end;
+
+		if (proc->levels.enabled)
+			level_ctl_update(proc, blk);
+
 		if (blk->flags & SQFS_BLK_IS_FRAGMENT) {
+			/* the block is recycled, but not reused in between */
+			start = get_time_ns();
 			status = process_completed_fragment(proc, blk);
+			end = get_time_ns();
+			proc->stats.fragment_time_ns += end - start;
+
+			if (proc->trace.enabled) {
+				trace_event(&proc->trace,
+					    SQFS_TRACE_EVENT_FRAGMENT,
+					    blk, start, end);
+			}
 			if (status != 0)
 				return status;
 		} else {
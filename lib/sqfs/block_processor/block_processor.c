@@ -7,17 +7,18 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
-static int process_block(void *userptr, void *workitem)
+static int compress_block(worker_data_t *worker, sqfs_block_t *block,
+			  const sqfs_u8 *data)
 {
-	worker_data_t *worker = userptr;
-	sqfs_block_t *block = workitem;
+	sqfs_compressor_t *cmp = worker->cmp;
+	sqfs_u64 start = 0;
 	sqfs_s32 ret;
 
 	if (block->size == 0)
 		return 0;
 
-	if (!(block->flags & SQFS_BLK_IGNORE_SPARSE) &&
-	    is_memory_zero(block->data, block->size)) {
+	if (!(block->flags & (SQFS_BLK_IGNORE_SPARSE | BLK_FLAG_RAW)) &&
+	    is_memory_zero(data, block->size)) {
 		block->flags |= SQFS_BLK_IS_SPARSE;
 		return 0;
 	}
@@ -25,17 +26,49 @@ static int process_block(void *userptr, void *workitem)
 	if (block->flags & SQFS_BLK_DONT_HASH) {
 		block->checksum = 0;
 	} else {
-		block->checksum = xxh32(block->data, block->size);
+		block->checksum = xxh32(data, block->size);
 	}
 
+	if (block->flags & BLK_FLAG_RAW)
+		return 0;
+
 	if (block->flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_DONT_COMPRESS))
 		return 0;
 
-	ret = worker->cmp->do_block(worker->cmp, block->data, block->size,
-				    worker->scratch, worker->scratch_size);
+	if (worker->probe_threshold > 0 &&
+	    is_block_incompressible(data, block->size,
+				    worker->probe_threshold)) {
+		block->flags |= BLK_FLAG_PROBE_SKIPPED;
+		return 0;
+	}
+
+	if (block->level != LEVEL_NONE && block->level < worker->num_levels) {
+		cmp = worker->level_cmp[block->level];
+		start = get_time_ns();
+	}
+
+	sqfs_compressor_set_bcj_hint(cmp, block->bcj_hint);
+
+	ret = cmp->do_block(cmp, data, block->size,
+			    worker->scratch, worker->scratch_size);
 	if (ret < 0)
 		return ret;
 
+	if (cmp != worker->cmp) {
+		block->comp_cost = ((get_time_ns() - start) * 1024) /
+			block->size;
+
+		if (block->comp_cost == 0)
+			block->comp_cost = 1;
+	}
+
+	if (ret > 0 && worker->min_gain > 0 &&
+	    (sqfs_u64)(block->size - ret) * 100 <
+	    (sqfs_u64)block->size * worker->min_gain) {
+		block->flags |= BLK_FLAG_LOW_GAIN;
+		return 0;
+	}
+
 	if (ret > 0) {
 		memcpy(block->data, worker->scratch, ret);
 		block->size = ret;
@@ -44,6 +77,35 @@ static int process_block(void *userptr, void *workitem)
 	return 0;
 }
 
+static int process_block(void *userptr, void *workitem)
+{
+	worker_data_t *worker = userptr;
+	sqfs_block_t *block = workitem;
+	sqfs_u64 start = get_time_ns(), end;
+	int ret;
+
+	if (block->source != NULL) {
+		ret = compress_block(worker, block, block->source->data);
+
+		if (ret == 0 && !(block->flags & (SQFS_BLK_IS_COMPRESSED |
+						  SQFS_BLK_IS_SPARSE))) {
+			memcpy(block->data, block->source->data, block->size);
+		}
+	} else {
+		ret = compress_block(worker, block, block->data);
+	}
+	end = get_time_ns();
+
+	if (worker->trace.enabled) {
+		trace_event(&worker->trace, SQFS_TRACE_EVENT_PROCESS,
+			    block, start, end);
+	}
+
+	block->worker_index = worker->index;
+	block->proc_time_ns = end - start;
+	return ret;
+}
+
 static int load_frag_block(sqfs_block_processor_t *proc, sqfs_u32 index)
 {
 	sqfs_fragment_t info;
@@ -140,13 +202,8 @@ static bool chunk_info_equals(void *user, const void *k, const void *c)
 		return false;
 	}
 
-	if (cmp->size != proc->current_frag->size) {
-		proc->fblk_lookup_error = SQFS_ERROR_CORRUPTED;
-		return false;
-	}
-
 	return memcmp(it->data + cmp->offset,
-		      proc->current_frag->data, cmp->size) == 0;
+		      proc->current_frag, cmp->size) == 0;
 }
 
 static void ht_delete_function(struct hash_entry *entry)
@@ -154,12 +211,12 @@ static void ht_delete_function(struct hash_entry *entry)
 	free(entry->data);
 }
 
-static void free_block_list(sqfs_block_t *list)
+static void free_block_list(sqfs_block_processor_t *proc, sqfs_block_t *list)
 {
 	while (list != NULL) {
 		sqfs_block_t *it = list;
 		list = it->next;
-		free(it);
+		block_free(proc, it);
 	}
 }
 
@@ -167,13 +224,17 @@ static void block_processor_destroy(sqfs_object_t *base)
 {
 	sqfs_block_processor_t *proc = (sqfs_block_processor_t *)base;
 
-	free(proc->frag_block);
-	free(proc->blk_current);
+	if (proc->frag_block != NULL)
+		block_free(proc, proc->frag_block);
+
+	if (proc->blk_current != NULL)
+		block_free(proc, proc->blk_current);
+
 	free(proc->cached_frag_blk);
 
-	free_block_list(proc->free_list);
-	free_block_list(proc->io_queue);
-	free_block_list(proc->fblk_in_flight);
+	dedup_cleanup(proc);
+	defer_cleanup(proc);
+	trace_cleanup(&proc->trace);
 
 	if (proc->frag_ht != NULL)
 		hash_table_destroy(proc->frag_ht, ht_delete_function);
@@ -182,18 +243,28 @@ static void block_processor_destroy(sqfs_object_t *base)
 	if (proc->pool != NULL)
 		proc->pool->destroy(proc->pool);
 
+	free_block_list(proc, proc->free_list);
+	free_block_list(proc, proc->io_queue);
+	free_block_list(proc, proc->fblk_in_flight);
+	block_pool_cleanup(proc);
+
 	while (proc->workers != NULL) {
 		worker_data_t *worker = proc->workers;
 		proc->workers = worker->next;
 
+		trace_cleanup(&worker->trace);
 		sqfs_destroy(worker->cmp);
+
+		while (worker->num_levels > 0)
+			sqfs_destroy(worker->level_cmp[--worker->num_levels]);
+
 		free(worker);
 	}
 
 	free(proc);
 }
 
-int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
+static int sync_blocks(sqfs_block_processor_t *proc)
 {
 	int ret;
 
@@ -219,6 +290,22 @@ int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
 	return 0;
 }
 
+int sqfs_block_processor_sync(sqfs_block_processor_t *proc)
+{
+	int ret;
+
+	ret = sync_blocks(proc);
+	if (ret != 0 || proc->defer.frags.used == 0)
+		return ret;
+
+	/* the fragment blocks filled by the buffered tail-ends */
+	ret = defer_flush(proc);
+	if (ret != 0)
+		return ret;
+
+	return sync_blocks(proc);
+}
+
 int sqfs_block_processor_finish(sqfs_block_processor_t *proc)
 {
 	sqfs_block_t *blk;
@@ -251,15 +338,79 @@ const sqfs_block_processor_stats_t
 	return &proc->stats;
 }
 
+int sqfs_block_processor_get_worker_time(const sqfs_block_processor_t *proc,
+					 sqfs_u32 index, sqfs_u64 *out)
+{
+	const worker_data_t *worker;
+
+	for (worker = proc->workers; worker != NULL; worker = worker->next) {
+		if (worker->index == index) {
+			*out = worker->busy_ns;
+			return 0;
+		}
+	}
+
+	*out = 0;
+	return SQFS_ERROR_OUT_OF_BOUNDS;
+}
+
 int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 				   sqfs_block_processor_t **out)
 {
-	size_t i, count, scratch_size = 0;
+	sqfs_u32 probe_threshold = 0, min_gain = 0, flags = 0, num_levels = 0;
+	sqfs_u64 mem_limit = 0, defer_limit = 0, target_rate = 0;
+	sqfs_compressor_t **level_cmp = NULL;
+	size_t i, j, count, scratch_size = 0;
 	sqfs_block_processor_t *proc;
 	int ret;
 
-	if (desc->size != sizeof(sqfs_block_processor_desc_t))
+	if (desc->size != sizeof(sqfs_block_processor_desc_t) &&
+	    desc->size != offsetof(sqfs_block_processor_desc_t, level_cmp) &&
+	    desc->size != offsetof(sqfs_block_processor_desc_t,
+				   frag_defer_limit) &&
+	    desc->size != offsetof(sqfs_block_processor_desc_t,
+				   probe_threshold)) {
 		return SQFS_ERROR_ARG_INVALID;
+	}
+
+	if (desc->size == sizeof(sqfs_block_processor_desc_t)) {
+		level_cmp = desc->level_cmp;
+		num_levels = desc->num_levels;
+		target_rate = desc->target_rate;
+	}
+
+	if (desc->size > offsetof(sqfs_block_processor_desc_t,
+				  frag_defer_limit)) {
+		defer_limit = desc->frag_defer_limit;
+	}
+
+	if (desc->size > offsetof(sqfs_block_processor_desc_t,
+				  probe_threshold)) {
+		probe_threshold = desc->probe_threshold;
+		min_gain = desc->min_gain;
+		flags = desc->flags;
+		mem_limit = desc->mem_limit;
+
+		if (min_gain >= 100)
+			return SQFS_ERROR_ARG_INVALID;
+
+		if (flags & ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS)
+			return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	if (flags & SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL) {
+		if (level_cmp == NULL || num_levels == 0 ||
+		    num_levels > LEVEL_MAX_COUNT) {
+			return SQFS_ERROR_ARG_INVALID;
+		}
+
+		for (i = 0; i < num_levels; ++i) {
+			if (level_cmp[i] == NULL)
+				return SQFS_ERROR_ARG_INVALID;
+		}
+	} else {
+		num_levels = 0;
+	}
 
 	if (desc->file != NULL && desc->uncmp != NULL)
 		scratch_size = desc->max_block_size;
@@ -281,15 +432,24 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 	if (proc->max_backlog < 3)
 		proc->max_backlog = 3;
 
+	if (flags & SQFS_BLOCK_PROCESSOR_TRACE) {
+		if (trace_init(&proc->trace, get_time_ns())) {
+			free(proc);
+			return SQFS_ERROR_ALLOC;
+		}
+	}
+
 	/* create the thread pool */
 	proc->pool = thread_pool_create(desc->num_workers, process_block);
 	if (proc->pool == NULL) {
+		trace_cleanup(&proc->trace);
 		free(proc);
 		return SQFS_ERROR_INTERNAL;
 	}
 
 	/* create the worker compressors & scratch buffer */
 	count = proc->pool->get_worker_count(proc->pool);
+	proc->stats.worker_count = count;
 
 	for (i = 0; i < count; ++i) {
 		worker_data_t *worker = alloc_flex(sizeof(*worker), 1,
@@ -300,6 +460,9 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 		}
 
 		worker->scratch_size = desc->max_block_size;
+		worker->probe_threshold = probe_threshold;
+		worker->min_gain = min_gain;
+		worker->index = i;
 		worker->next = proc->workers;
 		proc->workers = worker;
 
@@ -309,6 +472,22 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 			goto fail_pool;
 		}
 
+		for (j = 0; j < num_levels; ++j) {
+			worker->level_cmp[j] = sqfs_copy(level_cmp[j]);
+			if (worker->level_cmp[j] == NULL) {
+				ret = SQFS_ERROR_ALLOC;
+				goto fail_pool;
+			}
+
+			worker->num_levels = j + 1;
+		}
+
+		if (flags & SQFS_BLOCK_PROCESSOR_TRACE) {
+			ret = trace_init(&worker->trace, proc->trace.base);
+			if (ret != 0)
+				goto fail_pool;
+		}
+
 		proc->pool->set_worker_ptr(proc->pool, i, worker);
 	}
 
@@ -320,6 +499,28 @@ int sqfs_block_processor_create_ex(const sqfs_block_processor_desc_t *desc,
 	}
 
 	proc->frag_ht->user = proc;
+
+	if (flags & SQFS_BLOCK_PROCESSOR_EARLY_DEDUP) {
+		ret = dedup_init(proc);
+		if (ret != 0)
+			goto fail_pool;
+	}
+
+	if (flags & SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS) {
+		ret = defer_init(proc, defer_limit);
+		if (ret != 0)
+			goto fail_pool;
+	}
+
+	if (flags & SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL)
+		level_ctl_init(proc, num_levels, target_rate);
+
+	if (mem_limit > 0) {
+		ret = block_pool_init(proc, mem_limit);
+		if (ret != 0)
+			goto fail_pool;
+	}
+
 	*out = proc;
 	return 0;
 fail_pool:
@@ -0,0 +1,322 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * dedup.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  Early, whole file deduplication.
+
+  For every file that has at least one full block, the SHA-256 digests of
+  its raw blocks are recorded, keyed by the digest of the first block.
+
+  While a new file is appended, its full blocks are held back instead of
+  being sent to the workers, as long as the digests seen so far match a
+  recorded file. If the file turns out to be identical, the held blocks are
+  dropped and the front end queues a marker block instead, that makes the
+  back end copy the block list and fragment location of the original inode
+  once that is final. Otherwise, the held blocks are released to the
+  workers.
+
+  To bound memory use, at most DEDUP_MAX_HELD_BYTES worth of blocks (or
+  max_backlog blocks, if that is more) are held back. Longer files are
+  still fed to the workers early and only caught by the block writer.
+ */
+#define DEDUP_MAX_HELD_BYTES (16 * 1024 * 1024)
+
+struct file_record_t {
+	struct file_record_t *next;
+	sqfs_inode_generic_t **inode;
+	sqfs_u32 flags;
+	sqfs_u32 tail_size;
+	size_t num_blocks;
+	sqfs_u8 tail_digest[SHA256_SIZE];
+	sqfs_u8 digest[][SHA256_SIZE];
+};
+
+static sqfs_u32 digest_hash(const sqfs_u8 *digest)
+{
+	sqfs_u32 hash;
+
+	memcpy(&hash, digest, sizeof(hash));
+	return hash;
+}
+
+static bool digest_equals(void *user, const void *a, const void *b)
+{
+	(void)user;
+	return memcmp(a, b, SHA256_SIZE) == 0;
+}
+
+static bool record_matches(const file_record_t *rec, const array_t *digests)
+{
+	if (rec->num_blocks < digests->used)
+		return false;
+
+	return memcmp(rec->digest, digests->data,
+		      digests->used * SHA256_SIZE) == 0;
+}
+
+static void hold_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	blk->next = NULL;
+
+	if (proc->held_last == NULL) {
+		proc->held_first = blk;
+	} else {
+		proc->held_last->next = blk;
+	}
+
+	proc->held_last = blk;
+	proc->held_count += 1;
+
+	/* held blocks are accounted for separately, see above */
+	proc->backlog -= 1;
+}
+
+static int flush_held(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+	int ret;
+
+	while (proc->held_first != NULL) {
+		blk = proc->held_first;
+		proc->held_first = blk->next;
+		proc->held_count -= 1;
+		proc->backlog += 1;
+
+		ret = enqueue_block(proc, blk);
+		if (ret != 0)
+			return ret;
+	}
+
+	proc->held_last = NULL;
+	return 0;
+}
+
+static void drop_held(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+	while (proc->held_first != NULL) {
+		blk = proc->held_first;
+		proc->held_first = blk->next;
+
+		blk->next = proc->free_list;
+		proc->free_list = blk;
+	}
+
+	proc->held_last = NULL;
+	proc->held_count = 0;
+}
+
+static int add_record(sqfs_block_processor_t *proc, const sqfs_block_t *tail,
+		      const sqfs_u8 *tail_digest)
+{
+	size_t count = proc->file_digests.used;
+	struct hash_entry *ent;
+	file_record_t *rec;
+	sqfs_u32 hash;
+
+	rec = alloc_flex(sizeof(*rec), SHA256_SIZE, count);
+	if (rec == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->inode = proc->inode;
+	rec->flags = proc->file_flags;
+	rec->num_blocks = count;
+	memcpy(rec->digest, proc->file_digests.data, count * SHA256_SIZE);
+
+	if (tail != NULL) {
+		rec->tail_size = tail->size;
+		memcpy(rec->tail_digest, tail_digest, SHA256_SIZE);
+	}
+
+	hash = digest_hash(rec->digest[0]);
+	ent = hash_table_search_pre_hashed(proc->file_ht, hash,
+					   rec->digest[0]);
+
+	if (ent != NULL) {
+		rec->next = ent->data;
+		ent->data = rec;
+		return 0;
+	}
+
+	ent = hash_table_insert_pre_hashed(proc->file_ht, hash,
+					   rec->digest[0], rec);
+	if (ent == NULL) {
+		free(rec);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	return 0;
+}
+
+int dedup_init(sqfs_block_processor_t *proc)
+{
+	if (array_init(&proc->file_digests, SHA256_SIZE, 0))
+		return SQFS_ERROR_ALLOC;
+
+	proc->file_ht = hash_table_create(NULL, digest_equals);
+	if (proc->file_ht == NULL) {
+		array_cleanup(&proc->file_digests);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	proc->max_held = DEDUP_MAX_HELD_BYTES / proc->max_block_size;
+	if (proc->max_held < proc->max_backlog)
+		proc->max_held = proc->max_backlog;
+
+	proc->early_dedup = true;
+	return 0;
+}
+
+void dedup_cleanup(sqfs_block_processor_t *proc)
+{
+	file_record_t *rec;
+
+	if (!proc->early_dedup)
+		return;
+
+	hash_table_foreach(proc->file_ht, ent) {
+		while (ent->data != NULL) {
+			rec = ent->data;
+			ent->data = rec->next;
+			free(rec);
+		}
+	}
+
+	hash_table_destroy(proc->file_ht, NULL);
+	array_cleanup(&proc->file_digests);
+
+	while (proc->held_first != NULL) {
+		sqfs_block_t *blk = proc->held_first;
+		proc->held_first = blk->next;
+		block_free(proc, blk);
+	}
+}
+
+void dedup_begin_file(sqfs_block_processor_t *proc, sqfs_u32 flags)
+{
+	proc->dedup_active = proc->early_dedup && proc->inode != NULL &&
+		!(flags & SQFS_BLK_DONT_DEDUPLICATE);
+	proc->dedup_cand = NULL;
+	proc->file_flags = flags;
+	proc->file_digests.used = 0;
+}
+
+int dedup_cancel_file(sqfs_block_processor_t *proc)
+{
+	if (!proc->early_dedup || !proc->dedup_active)
+		return 0;
+
+	proc->dedup_active = false;
+	proc->dedup_cand = NULL;
+	return flush_held(proc);
+}
+
+int dedup_enqueue_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	sqfs_u8 digest[SHA256_SIZE];
+	struct hash_entry *ent;
+	file_record_t *rec;
+	int ret;
+
+	if (!proc->early_dedup || !proc->dedup_active)
+		return enqueue_block(proc, blk);
+
+	sha256(blk->data, blk->size, digest);
+
+	if (array_append(&proc->file_digests, digest) != 0)
+		return SQFS_ERROR_ALLOC;
+
+	if (proc->file_digests.used == 1) {
+		ent = hash_table_search_pre_hashed(proc->file_ht,
+						   digest_hash(digest),
+						   digest);
+		proc->dedup_cand = ent == NULL ? NULL : ent->data;
+	}
+
+	for (rec = proc->dedup_cand; rec != NULL; rec = rec->next) {
+		if (rec->flags == proc->file_flags &&
+		    record_matches(rec, &proc->file_digests)) {
+			break;
+		}
+	}
+
+	proc->dedup_cand = rec;
+
+	if (rec != NULL && proc->held_count < proc->max_held) {
+		hold_block(proc, blk);
+		return 0;
+	}
+
+	proc->dedup_cand = NULL;
+
+	ret = flush_held(proc);
+	if (ret != 0)
+		return ret;
+
+	return enqueue_block(proc, blk);
+}
+
+int dedup_end_file(sqfs_block_processor_t *proc, sqfs_block_t *tail,
+		   sqfs_inode_generic_t ***original)
+{
+	sqfs_u8 tail_digest[SHA256_SIZE];
+	file_record_t *rec;
+	sqfs_u64 size;
+	int ret;
+
+	*original = NULL;
+
+	if (!proc->dedup_active || proc->file_digests.used == 0)
+		return 0;
+
+	if (tail != NULL)
+		sha256(tail->data, tail->size, tail_digest);
+
+	for (rec = proc->dedup_cand; rec != NULL; rec = rec->next) {
+		if (rec->flags != proc->file_flags ||
+		    rec->num_blocks != proc->file_digests.used ||
+		    !record_matches(rec, &proc->file_digests)) {
+			continue;
+		}
+
+		if (tail == NULL) {
+			if (rec->tail_size == 0)
+				break;
+		} else if (rec->tail_size == tail->size &&
+			   memcmp(rec->tail_digest, tail_digest,
+				  SHA256_SIZE) == 0) {
+			break;
+		}
+	}
+
+	if (rec == NULL) {
+		ret = flush_held(proc);
+		if (ret != 0)
+			return ret;
+
+		return add_record(proc, tail, tail_digest);
+	}
+
+	drop_held(proc);
+
+	if (tail != NULL) {
+		tail->next = proc->free_list;
+		proc->free_list = tail;
+		proc->backlog -= 1;
+	}
+
+	sqfs_inode_get_file_size(*(proc->inode), &size);
+	proc->stats.early_dedup_file_count += 1;
+	proc->stats.early_dedup_bytes += size;
+
+	*original = rec->inode;
+	return 0;
+}
@@ -0,0 +1,260 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * defer.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  Deferred, grouped packing of tail-end fragments.
+
+  Tail-ends that are not duplicates of an already packed fragment are copied
+  into a buffer instead of being appended to the current fragment block right
+  away. Once the buffer is full, or the processor is synced, the buffered
+  tail-ends are sorted by group and packed. The groups are ordered by the
+  first tail-end that was seen for them, and the tail-ends within a group by
+  the order in which they arrived, so the packing order only depends on the
+  order of the files and the group values, not on their numeric value.
+
+  Since the order in which completed fragments are picked up from the
+  workers is the order in which they were submitted, the resulting layout is
+  just as reproducible as without deferring.
+
+  Duplicates among the buffered tail-ends are caught by the regular fragment
+  deduplication while packing them.
+ */
+#define DEFER_DEFAULT_BLOCKS (64)
+
+typedef struct {
+	sqfs_inode_generic_t **inode;
+	void *user;
+
+	sqfs_u64 group;
+
+	/* sequence number of the first tail-end of the same group */
+	size_t rank;
+	size_t seq;
+
+	size_t offset;
+	sqfs_u32 size;
+	sqfs_u32 hash;
+	sqfs_u32 flags;
+} deferred_frag_t;
+
+typedef struct {
+	sqfs_inode_generic_t **inode;
+	sqfs_inode_generic_t *const *original;
+} frag_alias_t;
+
+static bool inode_equals(void *user, const void *a, const void *b)
+{
+	(void)user;
+	return a == b;
+}
+
+static sqfs_u32 inode_hash(sqfs_inode_generic_t *const *inode)
+{
+	return xxh32(&inode, sizeof(inode));
+}
+
+static int compare_group(const void *a, const void *b)
+{
+	const deferred_frag_t *lhs = a, *rhs = b;
+
+	if (lhs->group != rhs->group)
+		return lhs->group < rhs->group ? -1 : 1;
+
+	return lhs->seq < rhs->seq ? -1 : (lhs->seq > rhs->seq ? 1 : 0);
+}
+
+static int compare_rank(const void *a, const void *b)
+{
+	const deferred_frag_t *lhs = a, *rhs = b;
+
+	if (lhs->rank != rhs->rank)
+		return lhs->rank < rhs->rank ? -1 : 1;
+
+	return lhs->seq < rhs->seq ? -1 : (lhs->seq > rhs->seq ? 1 : 0);
+}
+
+int defer_init(sqfs_block_processor_t *proc, sqfs_u64 limit)
+{
+	frag_defer_t *defer = &proc->defer;
+
+	if (limit == 0)
+		limit = (sqfs_u64)proc->max_block_size * DEFER_DEFAULT_BLOCKS;
+
+	if (limit < proc->max_block_size)
+		limit = proc->max_block_size;
+
+	if (limit > (sqfs_u64)(~((size_t)0)))
+		return SQFS_ERROR_OVERFLOW;
+
+	if (array_init(&defer->frags, sizeof(deferred_frag_t), 0))
+		return SQFS_ERROR_ALLOC;
+
+	if (array_init(&defer->aliases, sizeof(frag_alias_t), 0))
+		goto fail_frags;
+
+	defer->inodes = hash_table_create(NULL, inode_equals);
+	if (defer->inodes == NULL)
+		goto fail_aliases;
+
+	defer->limit = limit;
+	defer->enabled = true;
+	return 0;
+fail_aliases:
+	array_cleanup(&defer->aliases);
+fail_frags:
+	array_cleanup(&defer->frags);
+	return SQFS_ERROR_ALLOC;
+}
+
+void defer_cleanup(sqfs_block_processor_t *proc)
+{
+	frag_defer_t *defer = &proc->defer;
+
+	if (!defer->enabled)
+		return;
+
+	array_cleanup(&defer->frags);
+	array_cleanup(&defer->aliases);
+	hash_table_destroy(defer->inodes, NULL);
+	free(defer->data);
+	memset(defer, 0, sizeof(*defer));
+}
+
+int defer_fragment(sqfs_block_processor_t *proc, const sqfs_block_t *frag)
+{
+	frag_defer_t *defer = &proc->defer;
+	deferred_frag_t ent;
+	size_t new_max;
+	sqfs_u8 *new;
+	int ret;
+
+	if ((defer->used + frag->size) > defer->limit) {
+		ret = defer_flush(proc);
+		if (ret != 0)
+			return ret;
+	}
+
+	if ((defer->used + frag->size) > defer->max) {
+		new_max = defer->max ? defer->max : proc->max_block_size;
+
+		while (new_max < (defer->used + frag->size))
+			new_max *= 2;
+
+		if (new_max > defer->limit)
+			new_max = defer->limit;
+
+		new = realloc(defer->data, new_max);
+		if (new == NULL)
+			return SQFS_ERROR_ALLOC;
+
+		defer->data = new;
+		defer->max = new_max;
+	}
+
+	memset(&ent, 0, sizeof(ent));
+	ent.inode = frag->inode;
+	ent.user = frag->user;
+	ent.group = frag->group;
+	ent.seq = defer->frags.used;
+	ent.offset = defer->used;
+	ent.size = frag->size;
+	ent.hash = frag->checksum;
+	ent.flags = frag->flags;
+
+	if (array_append(&defer->frags, &ent))
+		return SQFS_ERROR_ALLOC;
+
+	if (ent.inode != NULL &&
+	    hash_table_insert_pre_hashed(defer->inodes, inode_hash(ent.inode),
+					 ent.inode, NULL) == NULL) {
+		return SQFS_ERROR_ALLOC;
+	}
+
+	memcpy(defer->data + defer->used, frag->data, frag->size);
+	defer->used += frag->size;
+	return 0;
+}
+
+int defer_alias(sqfs_block_processor_t *proc, sqfs_inode_generic_t **inode,
+		sqfs_inode_generic_t *const *original)
+{
+	frag_defer_t *defer = &proc->defer;
+	frag_alias_t alias;
+
+	/* the fragment of the original is known already, if not buffered */
+	if (hash_table_search_pre_hashed(defer->inodes, inode_hash(original),
+					 original) == NULL) {
+		return 0;
+	}
+
+	alias.inode = inode;
+	alias.original = original;
+
+	if (array_append(&defer->aliases, &alias))
+		return SQFS_ERROR_ALLOC;
+
+	return 0;
+}
+
+int defer_flush(sqfs_block_processor_t *proc)
+{
+	frag_defer_t *defer = &proc->defer;
+	deferred_frag_t *ent = defer->frags.data;
+	sqfs_u32 index, offset;
+	frag_alias_t *alias;
+	const sqfs_u8 *data;
+	size_t i, rank = 0;
+	int ret = 0;
+
+	array_sort_range(&defer->frags, 0, defer->frags.used, compare_group);
+
+	for (i = 0; i < defer->frags.used; ++i) {
+		if (i == 0 || ent[i].group != ent[i - 1].group)
+			rank = ent[i].seq;
+
+		ent[i].rank = rank;
+	}
+
+	array_sort_range(&defer->frags, 0, defer->frags.used, compare_rank);
+
+	for (i = 0; i < defer->frags.used; ++i) {
+		data = defer->data + ent[i].offset;
+
+		if (!(ent[i].flags & SQFS_BLK_DONT_DEDUPLICATE)) {
+			ret = fragment_dedup(proc, data, ent[i].size,
+					     ent[i].hash, ent[i].inode);
+			if (ret < 0)
+				goto out;
+			if (ret > 0)
+				continue;
+		}
+
+		ret = fragment_store(proc, NULL, data, ent[i].size,
+				     ent[i].hash, ent[i].flags, ent[i].inode,
+				     ent[i].user);
+		if (ret != 0)
+			goto out;
+	}
+
+	alias = defer->aliases.data;
+
+	for (i = 0; i < defer->aliases.used; ++i) {
+		sqfs_inode_get_frag_location(*(alias[i].original),
+					     &index, &offset);
+		sqfs_inode_set_frag_location(*(alias[i].inode), index, offset);
+	}
+
+	ret = 0;
+out:
+	defer->frags.used = 0;
+	defer->aliases.used = 0;
+	defer->used = 0;
+	hash_table_clear(defer->inodes);
+	return ret;
+}
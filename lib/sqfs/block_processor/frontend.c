@@ -17,16 +17,10 @@ static int get_new_block(sqfs_block_processor_t *proc, sqfs_block_t **out)
 			return ret;
 	}
 
-	if (proc->free_list != NULL) {
-		blk = proc->free_list;
-		proc->free_list = blk->next;
-	} else {
-		blk = malloc(sizeof(*blk) + proc->max_block_size);
-		if (blk == NULL)
-			return SQFS_ERROR_ALLOC;
-	}
+	blk = block_alloc(proc);
+	if (blk == NULL)
+		return SQFS_ERROR_ALLOC;
 
-	memset(blk, 0, sizeof(*blk));
 	*out = blk;
 
 	proc->backlog += 1;
@@ -48,37 +42,141 @@ static int add_sentinel_block(sqfs_block_processor_t *proc)
 	return enqueue_block(proc, blk);
 }
 
+static int add_duplicate_block(sqfs_block_processor_t *proc,
+			       sqfs_inode_generic_t **original)
+{
+	sqfs_block_t *blk;
+	int ret;
+
+	ret = get_new_block(proc, &blk);
+	if (ret != 0)
+		return ret;
+
+	blk->inode = proc->inode;
+	blk->flags = BLK_FLAG_DUPLICATE;
+	blk->original = original;
+
+	return enqueue_block(proc, blk);
+}
+
 int enqueue_block(sqfs_block_processor_t *proc, sqfs_block_t *blk)
 {
+	sqfs_block_t *source = NULL;
 	int status;
 
+	/*
+	  Sniff the file type once, from the first block, and pass the
+	  result on with every data block of the file, so the compressor
+	  does not have to guess for every block on its own.
+	 */
+	if (!(blk->flags & (SQFS_BLK_FRAGMENT_BLOCK | BLK_FLAG_RAW |
+			    BLK_FLAG_MANUAL_SUBMISSION))) {
+		if (blk->flags & SQFS_BLK_FIRST_BLOCK) {
+			proc->bcj_hint = sqfs_bcj_detect_header(blk->data,
+								blk->size);
+		}
+
+		blk->bcj_hint = proc->bcj_hint;
+	}
+
+	/*
+	  Fragment blocks have to stay around uncompressed, until written, for
+	  comparing new fragments against. Instead of copying the data, keep
+	  the block itself and let the worker compress it into a new one.
+	 */
 	if ((blk->flags & SQFS_BLK_FRAGMENT_BLOCK) &&
 	    proc->file != NULL && proc->uncmp != NULL) {
-		sqfs_block_t *copy = alloc_flex(sizeof(*copy), 1, blk->size);
+		source = blk;
 
-		if (copy == NULL)
-			return SQFS_ERROR_ALLOC;
+		blk = block_alloc(proc);
+		if (blk == NULL) {
+			blk = source;
+			status = SQFS_ERROR_ALLOC;
+			goto fail;
+		}
+
+		blk->flags = source->flags;
+		blk->size = source->size;
+		blk->index = source->index;
+		blk->io_seq_num = source->io_seq_num;
+		blk->user = source->user;
+		blk->source = source;
+
+		source->next = proc->fblk_in_flight;
+		proc->fblk_in_flight = source;
+	}
+
+	if (proc->levels.enabled &&
+	    !(blk->flags & (SQFS_BLK_IS_FRAGMENT | SQFS_BLK_FRAGMENT_BLOCK |
+			    SQFS_BLK_DONT_COMPRESS | BLK_FLAG_RAW))) {
+		blk->level = level_ctl_pick(proc);
+	}
+
+	blk->trace_id = proc->stats.blocks_enqueued;
 
-		copy->size = blk->size;
-		copy->index = blk->index;
-		memcpy(copy->data, blk->data, blk->size);
+	if (proc->trace.enabled) {
+		sqfs_u64 now = get_time_ns();
 
-		copy->next = proc->fblk_in_flight;
-		proc->fblk_in_flight = copy;
+		trace_event(&proc->trace, SQFS_TRACE_EVENT_SUBMIT, blk,
+			    now, now);
 	}
 
+	proc->stats.blocks_enqueued += 1;
+	proc->stats.backlog_sum += proc->backlog;
+
+	if (proc->backlog > proc->stats.backlog_max)
+		proc->stats.backlog_max = proc->backlog;
+
 	if (proc->pool->submit(proc->pool, blk) != 0) {
 		status = proc->pool->get_status(proc->pool);
 
 		if (status == 0)
 			status = SQFS_ERROR_ALLOC;
 
+		goto fail;
+	}
+
+	return 0;
+fail:
+	if (source != NULL) {
+		proc->fblk_in_flight = source->next;
+		source->next = proc->free_list;
+		proc->free_list = source;
+	}
+
+	if (blk != source) {
 		blk->next = proc->free_list;
 		proc->free_list = blk;
-		return status;
 	}
+	return status;
+}
 
-	return 0;
+/*
+  The front end functions may have to wait for the workers and do back end
+  work on the way, which is timed separately. Subtract it from the time
+  spent inside the front end.
+ */
+static sqfs_u64 backend_time(const sqfs_block_processor_t *proc)
+{
+	return proc->stats.wait_time_ns + proc->stats.write_time_ns +
+		proc->stats.fragment_time_ns;
+}
+
+static void frontend_enter(sqfs_block_processor_t *proc)
+{
+	proc->fe_backend = backend_time(proc);
+	proc->fe_start = get_time_ns();
+}
+
+static int frontend_leave(sqfs_block_processor_t *proc, int ret)
+{
+	sqfs_u64 total = get_time_ns() - proc->fe_start;
+	sqfs_u64 backend = backend_time(proc) - proc->fe_backend;
+
+	if (total > backend)
+		proc->stats.frontend_time_ns += total - backend;
+
+	return ret;
 }
 
 int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
@@ -104,12 +202,16 @@ int sqfs_block_processor_begin_file(sqfs_block_processor_t *proc,
 	proc->inode = inode;
 	proc->blk_flags = flags | SQFS_BLK_FIRST_BLOCK;
 	proc->blk_index = 0;
+	proc->bcj_hint = 0;
 	proc->user = user;
+	proc->frag_group = 0;
+
+	if (proc->early_dedup)
+		dedup_begin_file(proc, flags);
 	return 0;
 }
 
-int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
-				size_t size)
+static int append(sqfs_block_processor_t *proc, const void *data, size_t size)
 {
 	sqfs_block_t *new;
 	sqfs_u64 filesize;
@@ -141,7 +243,7 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 		diff = proc->max_block_size - proc->blk_current->size;
 
 		if (diff == 0) {
-			err = enqueue_block(proc, proc->blk_current);
+			err = dedup_enqueue_block(proc, proc->blk_current);
 			proc->blk_current = NULL;
 
 			if (err)
@@ -163,7 +265,7 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	}
 
 	if (proc->blk_current->size == proc->max_block_size) {
-		err = enqueue_block(proc, proc->blk_current);
+		err = dedup_enqueue_block(proc, proc->blk_current);
 		proc->blk_current = NULL;
 
 		if (err)
@@ -173,14 +275,70 @@ int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
 	return 0;
 }
 
-int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+static int append_raw(sqfs_block_processor_t *proc, const void *data,
+		      size_t size, sqfs_u32 flags)
 {
+	sqfs_block_t *blk;
+	sqfs_u64 filesize;
+	int err;
+
+	if (!proc->begin_called || proc->blk_current != NULL)
+		return SQFS_ERROR_SEQUENCE;
+
+	if (size == 0 || size > proc->max_block_size)
+		return SQFS_ERROR_OVERFLOW;
+
+	if (flags & ~SQFS_BLK_IS_COMPRESSED)
+		return SQFS_ERROR_UNSUPPORTED;
+
+	err = dedup_cancel_file(proc);
+	if (err)
+		return err;
+
+	err = get_new_block(proc, &blk);
+	if (err)
+		return err;
+
+	blk->flags = proc->blk_flags | flags | BLK_FLAG_RAW;
+	blk->inode = proc->inode;
+	blk->user = proc->user;
+	blk->index = proc->blk_index++;
+	blk->size = size;
+	memcpy(blk->data, data, size);
+
+	proc->blk_flags &= ~SQFS_BLK_FIRST_BLOCK;
+
+	if (proc->inode != NULL) {
+		sqfs_inode_get_file_size(*(proc->inode), &filesize);
+		sqfs_inode_set_file_size(*(proc->inode),
+					 filesize + proc->max_block_size);
+	}
+
+	proc->stats.input_bytes_read += proc->max_block_size;
+	return enqueue_block(proc, blk);
+}
+
+static int end_file(sqfs_block_processor_t *proc)
+{
+	sqfs_inode_generic_t **original = NULL;
 	int err;
 
 	if (!proc->begin_called)
 		return SQFS_ERROR_SEQUENCE;
 
-	if (proc->blk_current == NULL) {
+	if (proc->early_dedup) {
+		err = dedup_end_file(proc, proc->blk_current, &original);
+		if (err)
+			return err;
+	}
+
+	if (original != NULL) {
+		proc->blk_current = NULL;
+
+		err = add_duplicate_block(proc, original);
+		if (err)
+			return err;
+	} else if (proc->blk_current == NULL) {
 		if (!(proc->blk_flags & SQFS_BLK_FIRST_BLOCK)) {
 			err = add_sentinel_block(proc);
 			if (err)
@@ -198,6 +356,7 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 			}
 
 			proc->blk_current->flags |= SQFS_BLK_IS_FRAGMENT;
+			proc->blk_current->group = proc->frag_group;
 		}
 
 		err = enqueue_block(proc, proc->blk_current);
@@ -214,9 +373,8 @@ int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
 	return 0;
 }
 
-int sqfs_block_processor_submit_block(sqfs_block_processor_t *proc, void *user,
-				      sqfs_u32 flags, const void *data,
-				      size_t size)
+static int submit_block(sqfs_block_processor_t *proc, void *user,
+			sqfs_u32 flags, const void *data, size_t size)
 {
 	sqfs_block_t *blk;
 	int ret;
@@ -241,3 +399,43 @@ int sqfs_block_processor_submit_block(sqfs_block_processor_t *proc, void *user,
 
 	return enqueue_block(proc, blk);
 }
+
+int sqfs_block_processor_set_fragment_group(sqfs_block_processor_t *proc,
+					    sqfs_u64 group)
+{
+	if (!proc->begin_called)
+		return SQFS_ERROR_SEQUENCE;
+
+	proc->frag_group = group;
+	return 0;
+}
+
+int sqfs_block_processor_append(sqfs_block_processor_t *proc, const void *data,
+				size_t size)
+{
+	frontend_enter(proc);
+	return frontend_leave(proc, append(proc, data, size));
+}
+
+int sqfs_block_processor_append_raw(sqfs_block_processor_t *proc,
+				    const void *data, size_t size,
+				    sqfs_u32 flags)
+{
+	frontend_enter(proc);
+	return frontend_leave(proc, append_raw(proc, data, size, flags));
+}
+
+int sqfs_block_processor_end_file(sqfs_block_processor_t *proc)
+{
+	frontend_enter(proc);
+	return frontend_leave(proc, end_file(proc));
+}
+
+int sqfs_block_processor_submit_block(sqfs_block_processor_t *proc, void *user,
+				      sqfs_u32 flags, const void *data,
+				      size_t size)
+{
+	frontend_enter(proc);
+	return frontend_leave(proc, submit_block(proc, user, flags,
+						 data, size));
+}
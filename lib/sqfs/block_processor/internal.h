@@ -19,8 +19,10 @@
 #include "sqfs/block.h"
 #include "sqfs/io.h"
 
+#include "../comp/bcj_detect.h"
 #include "hash_table.h"
 #include "threadpool.h"
+#include "array.h"
 #include "util.h"
 
 #include <string.h>
@@ -34,10 +36,68 @@ typedef struct {
 } chunk_info_t;
 
 enum {
+	BLK_FLAG_RAW = 0x04000000,
+	BLK_FLAG_DUPLICATE = 0x08000000,
 	BLK_FLAG_MANUAL_SUBMISSION = 0x10000000,
-	BLK_FLAG_INTERNAL = 0x10000000,
+	BLK_FLAG_PROBE_SKIPPED = 0x20000000,
+	BLK_FLAG_LOW_GAIN = 0x40000000,
+	BLK_FLAG_INTERNAL = 0x7C000000,
 };
 
+typedef struct file_record_t file_record_t;
+
+/* tail-end fragments buffered for grouped packing, see defer.c */
+typedef struct {
+	bool enabled;
+	size_t limit;
+
+	/* deferred_frag_t entries, with the data in a separate buffer */
+	array_t frags;
+	sqfs_u8 *data;
+	size_t used;
+	size_t max;
+
+	/* the inodes of the buffered tail-ends, to look up aliases */
+	struct hash_table *inodes;
+
+	/* duplicate files waiting for the fragment of the original */
+	array_t aliases;
+} frag_defer_t;
+
+#define LEVEL_MAX_COUNT (16)
+
+/* level of blocks that are compressed with the regular compressor */
+#define LEVEL_NONE (LEVEL_MAX_COUNT)
+
+/* picks the compression level per block, see adaptive.c */
+typedef struct {
+	bool enabled;
+	sqfs_u32 count;
+	sqfs_u64 target_rate;
+
+	/* estimated nanoseconds a worker needs per KiB, 0 if not known */
+	sqfs_u64 cost[LEVEL_MAX_COUNT];
+	sqfs_u64 blocks[LEVEL_MAX_COUNT];
+
+	/* number of levels that the first blocks were sent through */
+	sqfs_u32 calibrated;
+
+	/* a stronger level that is tried out, or count if none */
+	sqfs_u32 probe;
+	sqfs_u32 since_probe;
+} level_ctl_t;
+
+/*
+  Events recorded by a single thread. Only the owning thread appends to it,
+  the events are read once the processor is idle.
+ */
+typedef struct {
+	bool enabled;
+	sqfs_u64 base;
+	size_t dropped;
+	array_t events;
+} trace_buffer_t;
+
 typedef struct sqfs_block_t {
 	struct sqfs_block_t *next;
 	sqfs_inode_generic_t **inode;
@@ -54,6 +114,34 @@ typedef struct sqfs_block_t {
 	/* User data pointer */
 	void *user;
 
+	/* Compressor hint derived from the file header, see bcj_detect.h */
+	sqfs_u32 bcj_hint;
+
+	/* For BLK_FLAG_DUPLICATE: the inode to copy the layout from */
+	sqfs_inode_generic_t **original;
+
+	/*
+	  For fragment blocks: the uncompressed block the data is read from.
+	  It is kept in the in-flight list until this block is written.
+	 */
+	struct sqfs_block_t *source;
+
+	/* The worker that processed the block and how long it took */
+	sqfs_u32 worker_index;
+	sqfs_u64 proc_time_ns;
+
+	/* With adaptive levels: the level to use, or LEVEL_NONE, and the
+	   nanoseconds per KiB the compressor took, 0 if it was not used */
+	sqfs_u32 level;
+	sqfs_u64 comp_cost;
+
+	/* For tracing: block number and when it was picked up from the pool */
+	sqfs_u32 trace_id;
+	sqfs_u64 done_ns;
+
+	/* For tail-end fragments: the group set for the file, see defer.c */
+	sqfs_u64 group;
+
 	sqfs_u8 data[];
 } sqfs_block_t;
 
@@ -61,6 +149,19 @@ typedef struct worker_data_t {
 	struct worker_data_t *next;
 	sqfs_compressor_t *cmp;
 
+	/* copies of the compressors for adaptive levels */
+	sqfs_compressor_t *level_cmp[LEVEL_MAX_COUNT];
+	sqfs_u32 num_levels;
+
+	sqfs_u32 probe_threshold;
+	sqfs_u32 min_gain;
+	sqfs_u32 index;
+
+	/* only updated by the main thread, when picking up blocks */
+	sqfs_u64 busy_ns;
+
+	trace_buffer_t trace;
+
 	size_t scratch_size;
 	sqfs_u8 scratch[];
 } worker_data_t;
@@ -78,6 +179,7 @@ struct sqfs_block_processor_t {
 	sqfs_block_t *blk_current;
 	sqfs_u32 blk_flags;
 	sqfs_u32 blk_index;
+	sqfs_u32 bcj_hint;
 	void *user;
 
 	struct hash_table *frag_ht;
@@ -87,8 +189,19 @@ struct sqfs_block_processor_t {
 	size_t max_backlog;
 	size_t backlog;
 
+	/* pre-allocated block buffers if there is a memory limit */
+	sqfs_u8 *arena;
+	size_t arena_size;
+	size_t slot_size;
+
 	bool begin_called;
 
+	trace_buffer_t trace;
+
+	/* state of the front end call currently being timed */
+	sqfs_u64 fe_start;
+	sqfs_u64 fe_backend;
+
 	sqfs_file_t *file;
 	sqfs_compressor_t *uncmp;
 
@@ -99,11 +212,29 @@ struct sqfs_block_processor_t {
 	sqfs_u32 io_seq_num;
 	sqfs_u32 io_deq_seq_num;
 
-	sqfs_block_t *current_frag;
+	/* the data of the fragment currently looked up in frag_ht */
+	const sqfs_u8 *current_frag;
 	sqfs_block_t *cached_frag_blk;
 	sqfs_block_t *fblk_in_flight;
 	int fblk_lookup_error;
 
+	/* early whole-file deduplication, see dedup.c */
+	bool early_dedup;
+	bool dedup_active;
+	sqfs_u32 file_flags;
+	struct hash_table *file_ht;
+	file_record_t *dedup_cand;
+	array_t file_digests;
+	sqfs_block_t *held_first;
+	sqfs_block_t *held_last;
+	size_t held_count;
+	size_t max_held;
+
+	sqfs_u64 frag_group;
+	frag_defer_t defer;
+
+	level_ctl_t levels;
+
 	sqfs_u8 scratch[];
 };
 
@@ -112,4 +243,103 @@ SQFS_INTERNAL int enqueue_block(sqfs_block_processor_t *proc,
 
 SQFS_INTERNAL int dequeue_block(sqfs_block_processor_t *proc);
 
+/*
+  Cheaply predict from a sample of a block whether it is worth compressing.
+  Returns true if the estimated entropy in thousandths of a bit per byte is
+  at least the threshold and the sample has no noteworthy repetitions.
+ */
+SQFS_INTERNAL bool is_block_incompressible(const sqfs_u8 *data, size_t size,
+					   sqfs_u32 threshold);
+
+SQFS_INTERNAL int block_pool_init(sqfs_block_processor_t *proc,
+				  sqfs_u64 mem_limit);
+
+SQFS_INTERNAL void block_pool_cleanup(sqfs_block_processor_t *proc);
+
+/* Get a block from the free list, or allocate a new one if it is empty. */
+SQFS_INTERNAL sqfs_block_t *block_alloc(sqfs_block_processor_t *proc);
+
+/* Free a block that is not on a list, unless it is part of the arena. */
+SQFS_INTERNAL void block_free(sqfs_block_processor_t *proc,
+			      sqfs_block_t *blk);
+
+SQFS_INTERNAL int trace_init(trace_buffer_t *trace, sqfs_u64 base);
+
+SQFS_INTERNAL void trace_cleanup(trace_buffer_t *trace);
+
+SQFS_INTERNAL void trace_event(trace_buffer_t *trace, sqfs_u32 type,
+			       const sqfs_block_t *blk,
+			       sqfs_u64 start, sqfs_u64 end);
+
+SQFS_INTERNAL int dedup_init(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void dedup_cleanup(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void dedup_begin_file(sqfs_block_processor_t *proc,
+				    sqfs_u32 flags);
+
+/* Release the held blocks and stop deduplicating the current file. */
+SQFS_INTERNAL int dedup_cancel_file(sqfs_block_processor_t *proc);
+
+/* Enqueue a full data block of the current file, or hold it back. */
+SQFS_INTERNAL int dedup_enqueue_block(sqfs_block_processor_t *proc,
+				      sqfs_block_t *blk);
+
+/*
+  Called before the last block of a file is enqueued. If the file is
+  a duplicate, the held blocks and the tail are released and a pointer
+  to the inode of the original is returned via `original`.
+ */
+SQFS_INTERNAL int dedup_end_file(sqfs_block_processor_t *proc,
+				 sqfs_block_t *tail,
+				 sqfs_inode_generic_t ***original);
+
+/*
+  Look up a tail-end fragment among the already packed ones. If an identical
+  one is found, the fragment location is set in the inode and 1 is returned.
+ */
+SQFS_INTERNAL int fragment_dedup(sqfs_block_processor_t *proc,
+				 const sqfs_u8 *data, sqfs_u32 size,
+				 sqfs_u32 hash, sqfs_inode_generic_t **inode);
+
+/*
+  Add a tail-end fragment to the current fragment block. If a new fragment
+  block has to be started, `reuse` (which must then hold the data) is turned
+  into the new fragment block if not NULL, otherwise one is allocated.
+ */
+SQFS_INTERNAL int fragment_store(sqfs_block_processor_t *proc,
+				 sqfs_block_t *reuse, const sqfs_u8 *data,
+				 sqfs_u32 size, sqfs_u32 hash, sqfs_u32 flags,
+				 sqfs_inode_generic_t **inode, void *user);
+
+SQFS_INTERNAL int defer_init(sqfs_block_processor_t *proc, sqfs_u64 limit);
+
+SQFS_INTERNAL void defer_cleanup(sqfs_block_processor_t *proc);
+
+/* Copy a tail-end fragment into the buffer, packing it first if full. */
+SQFS_INTERNAL int defer_fragment(sqfs_block_processor_t *proc,
+				 const sqfs_block_t *frag);
+
+/*
+  The layout of a duplicate file was copied from an original. If the tail-end
+  of the original is still buffered, the fragment location is copied over
+  once it has been packed.
+ */
+SQFS_INTERNAL int defer_alias(sqfs_block_processor_t *proc,
+			      sqfs_inode_generic_t **inode,
+			      sqfs_inode_generic_t *const *original);
+
+/* Pack all buffered tail-end fragments into fragment blocks. */
+SQFS_INTERNAL int defer_flush(sqfs_block_processor_t *proc);
+
+SQFS_INTERNAL void level_ctl_init(sqfs_block_processor_t *proc,
+				  sqfs_u32 count, sqfs_u64 target_rate);
+
+/* Pick the compression level for a block that is about to be enqueued. */
+SQFS_INTERNAL sqfs_u32 level_ctl_pick(sqfs_block_processor_t *proc);
+
+/* Learn from the compression time of a block picked up from a worker. */
+SQFS_INTERNAL void level_ctl_update(sqfs_block_processor_t *proc,
+				    const sqfs_block_t *blk);
+
 #endif /* INTERNAL_H */
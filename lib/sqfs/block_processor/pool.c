@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * pool.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/*
+  With a memory limit, all block buffers are carved from a single region
+  that is allocated up front and the free list is filled with the slots.
+
+  The slots are divided up as follows: an eighth (plus one) is set aside
+  for the fragment blocks that are kept uncompressed while in flight and,
+  if enabled, a quarter for blocks held back by the early deduplication.
+  The rest determines the backlog. Only if the reserve is exhausted, blocks
+  are allocated on demand like without a limit.
+ */
+#define SLOT_ALIGN (64)
+
+static void *map_arena(size_t size)
+{
+	void *ptr;
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+	ptr = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+			   PAGE_READWRITE);
+#else
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (ptr == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+#endif
+	return ptr;
+}
+
+static void unmap_arena(void *ptr, size_t size)
+{
+#if defined(_WIN32) || defined(__WINDOWS__)
+	(void)size;
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size);
+#endif
+}
+
+int block_pool_init(sqfs_block_processor_t *proc, sqfs_u64 mem_limit)
+{
+	size_t i, count, reserve, held;
+	sqfs_block_t *blk;
+
+	proc->slot_size = sizeof(sqfs_block_t) + proc->max_block_size;
+	if (proc->slot_size % SLOT_ALIGN)
+		proc->slot_size += SLOT_ALIGN - proc->slot_size % SLOT_ALIGN;
+
+	if (mem_limit / proc->slot_size > (sqfs_u64)(~((size_t)0)) /
+	    proc->slot_size) {
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	count = mem_limit / proc->slot_size;
+	reserve = count / 8 + 1;
+	held = proc->early_dedup ? (count / 4) : 0;
+
+	if (count < 5 || (count - reserve - held) < 3)
+		return SQFS_ERROR_ARG_INVALID;
+
+	proc->arena_size = count * proc->slot_size;
+	proc->arena = map_arena(proc->arena_size);
+	if (proc->arena == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	for (i = count; i > 0; --i) {
+		blk = (void *)(proc->arena + (i - 1) * proc->slot_size);
+		blk->next = proc->free_list;
+		proc->free_list = blk;
+	}
+
+	proc->max_backlog = count - reserve - held;
+	if (proc->early_dedup)
+		proc->max_held = held;
+	return 0;
+}
+
+void block_pool_cleanup(sqfs_block_processor_t *proc)
+{
+	if (proc->arena != NULL)
+		unmap_arena(proc->arena, proc->arena_size);
+
+	proc->arena = NULL;
+}
+
+sqfs_block_t *block_alloc(sqfs_block_processor_t *proc)
+{
+	sqfs_block_t *blk;
+
+	if (proc->free_list != NULL) {
+		blk = proc->free_list;
+		proc->free_list = blk->next;
+	} else {
+		blk = malloc(sizeof(*blk) + proc->max_block_size);
+		if (blk == NULL)
+			return NULL;
+	}
+
+	memset(blk, 0, sizeof(*blk));
+	blk->level = LEVEL_NONE;
+	return blk;
+}
+
+void block_free(sqfs_block_processor_t *proc, sqfs_block_t *blk)
+{
+	const sqfs_u8 *ptr = (const sqfs_u8 *)blk;
+
+	if (proc->arena != NULL && ptr >= proc->arena &&
+	    ptr < (proc->arena + proc->arena_size)) {
+		return;
+	}
+
+	free(blk);
+}
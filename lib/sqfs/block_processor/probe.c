@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * probe.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+/*
+  Blocks are sampled in PROBE_WINDOWS evenly spaced windows of up to
+  PROBE_WINDOW_SIZE bytes. Smaller blocks are not worth probing.
+ */
+#define PROBE_MIN_SIZE (4096)
+#define PROBE_WINDOWS (16)
+#define PROBE_WINDOW_SIZE (512)
+
+#define PROBE_HASH_BITS (12)
+
+/* log2(x) as 16.16 fixed point number, x must not be zero */
+static sqfs_u64 log2_fixed(sqfs_u32 x)
+{
+	sqfs_u64 result = 0, v;
+	int i, n = 0;
+
+	while ((x >> n) > 1)
+		++n;
+
+	result = (sqfs_u64)n << 16;
+
+	/* mantissa in [1, 2) with 31 fractional bits */
+	v = ((sqfs_u64)x << 31) >> n;
+
+	for (i = 15; i >= 0; --i) {
+		v = (v * v) >> 31;
+
+		if (v >= ((sqfs_u64)1 << 32)) {
+			v >>= 1;
+			result |= (sqfs_u64)1 << i;
+		}
+	}
+
+	return result;
+}
+
+bool is_block_incompressible(const sqfs_u8 *data, size_t size,
+			     sqfs_u32 threshold)
+{
+	sqfs_u32 table[1 << PROBE_HASH_BITS];
+	sqfs_u32 count[256], total = 0, matches = 0, v, *slot;
+	size_t i, j, stride, window;
+	sqfs_u64 sum, entropy;
+
+	if (size < PROBE_MIN_SIZE)
+		return false;
+
+	stride = size / PROBE_WINDOWS;
+	window = stride < PROBE_WINDOW_SIZE ? stride : PROBE_WINDOW_SIZE;
+
+	memset(count, 0, sizeof(count));
+	memset(table, 0, sizeof(table));
+
+	for (i = 0; i < PROBE_WINDOWS; ++i) {
+		const sqfs_u8 *ptr = data + i * stride;
+
+		for (j = 0; j < window; ++j)
+			count[ptr[j]] += 1;
+
+		/* a poor man's LZ match finder over 4 byte sequences */
+		for (j = 0; j + 4 <= window; ++j) {
+			v = ptr[j] | (ptr[j + 1] << 8) | (ptr[j + 2] << 16) |
+				((sqfs_u32)ptr[j + 3] << 24);
+
+			slot = table + ((v * 2654435761U) >>
+					(32 - PROBE_HASH_BITS));
+
+			matches += (*slot == v);
+			*slot = v;
+		}
+
+		total += window;
+	}
+
+	/* anything an LZ compressor could work with makes it compressible */
+	if (matches * 64 >= total)
+		return false;
+
+	/* H = log2(N) - sum(c * log2(c)) / N */
+	sum = 0;
+
+	for (i = 0; i < 256; ++i) {
+		if (count[i] > 1)
+			sum += count[i] * log2_fixed(count[i]);
+	}
+
+	entropy = log2_fixed(total) - sum / total;
+
+	return ((entropy * 1000) >> 16) >= threshold;
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * trace.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+void trace_event(trace_buffer_t *trace, sqfs_u32 type, const sqfs_block_t *blk,
+		 sqfs_u64 start, sqfs_u64 end)
+{
+	sqfs_block_processor_trace_event_t ev;
+
+	ev.start = start - trace->base;
+	ev.duration = end - start;
+	ev.type = type;
+	ev.block = blk->trace_id;
+	ev.size = blk->size;
+	ev.flags = blk->flags & ~BLK_FLAG_INTERNAL;
+
+	/* a trace with gaps is still more useful than failing the build */
+	if (array_append(&trace->events, &ev) != 0)
+		trace->dropped += 1;
+}
+
+int trace_init(trace_buffer_t *trace, sqfs_u64 base)
+{
+	int ret;
+
+	ret = array_init(&trace->events,
+			 sizeof(sqfs_block_processor_trace_event_t), 0);
+	if (ret != 0)
+		return ret;
+
+	trace->base = base;
+	trace->dropped = 0;
+	trace->enabled = true;
+	return 0;
+}
+
+void trace_cleanup(trace_buffer_t *trace)
+{
+	if (trace->enabled)
+		array_cleanup(&trace->events);
+
+	trace->enabled = false;
+}
+
+const sqfs_block_processor_trace_event_t
+*sqfs_block_processor_get_trace(const sqfs_block_processor_t *proc,
+				sqfs_u32 thread, size_t *count)
+{
+	const trace_buffer_t *trace = NULL;
+	const worker_data_t *worker;
+
+	if (thread == 0) {
+		trace = &proc->trace;
+	} else {
+		for (worker = proc->workers; worker != NULL;
+		     worker = worker->next) {
+			if (worker->index == thread - 1) {
+				trace = &worker->trace;
+				break;
+			}
+		}
+	}
+
+	if (trace == NULL || !trace->enabled || trace->events.used == 0) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = trace->events.used;
+	return (const sqfs_block_processor_trace_event_t *)trace->events.data;
+}
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * bcj_detect.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#define SQFS_BUILDING_DLL
+#include "internal.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define ARM_FILTERS (SQFS_COMP_FLAG_XZ_ARM | SQFS_COMP_FLAG_XZ_ARMTHUMB)
+
+static sqfs_u16 get16(const sqfs_u8 *ptr, bool be)
+{
+	return be ? ((ptr[0] << 8) | ptr[1]) : ((ptr[1] << 8) | ptr[0]);
+}
+
+static sqfs_u32 get32(const sqfs_u8 *ptr, bool be)
+{
+	if (be) {
+		return ((sqfs_u32)ptr[0] << 24) | ((sqfs_u32)ptr[1] << 16) |
+			((sqfs_u32)ptr[2] << 8) | (sqfs_u32)ptr[3];
+	}
+
+	return ((sqfs_u32)ptr[3] << 24) | ((sqfs_u32)ptr[2] << 16) |
+		((sqfs_u32)ptr[1] << 8) | (sqfs_u32)ptr[0];
+}
+
+static sqfs_u32 detect_elf(const sqfs_u8 *data, size_t size)
+{
+	bool be;
+
+	if (size < 20 || (data[5] != 1 && data[5] != 2))
+		return 0;
+
+	be = (data[5] == 2);
+
+	switch (get16(data + 18, be)) {
+	case 3:		/* i386 */
+	case 62:	/* x86_64 */
+		return SQFS_COMP_FLAG_XZ_X86;
+	case 20:	/* PowerPC */
+	case 21:	/* PowerPC 64 */
+		/* the PowerPC filter only handles big endian code */
+		return be ? SQFS_COMP_FLAG_XZ_POWERPC : 0;
+	case 40:	/* 32 bit ARM, could be either instruction set */
+		return be ? 0 : ARM_FILTERS;
+	case 2:		/* SPARC */
+	case 18:	/* SPARC32PLUS */
+	case 43:	/* SPARC V9 */
+		return SQFS_COMP_FLAG_XZ_SPARC;
+	case 50:	/* IA-64 */
+		return SQFS_COMP_FLAG_XZ_IA64;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static sqfs_u32 detect_pe(const sqfs_u8 *data, size_t size)
+{
+	sqfs_u32 offset = get32(data + 0x3C, false);
+
+	/* plain DOS executables are left to the statistics */
+	if (offset > size || (size - offset) < 6)
+		return 0;
+
+	if (memcmp(data + offset, "PE\0\0", 4) != 0)
+		return 0;
+
+	switch (get16(data + offset + 4, false)) {
+	case 0x014c:	/* i386 */
+	case 0x8664:	/* AMD64 */
+		return SQFS_BCJ_HINT_KNOWN | SQFS_COMP_FLAG_XZ_X86;
+	case 0x01c0:	/* ARM */
+	case 0x01c2:	/* Thumb */
+	case 0x01c4:	/* ARMv7 Thumb-2 */
+		return SQFS_BCJ_HINT_KNOWN | ARM_FILTERS;
+	case 0x0200:	/* IA-64 */
+		return SQFS_BCJ_HINT_KNOWN | SQFS_COMP_FLAG_XZ_IA64;
+	default:
+		break;
+	}
+
+	return SQFS_BCJ_HINT_KNOWN;
+}
+
+static sqfs_u32 detect_macho(const sqfs_u8 *data, bool be)
+{
+	switch (get32(data + 4, be)) {
+	case 0x00000007:	/* i386 */
+	case 0x01000007:	/* x86_64 */
+		return SQFS_COMP_FLAG_XZ_X86;
+	case 0x00000012:	/* PowerPC */
+	case 0x01000012:	/* PowerPC 64 */
+		return be ? SQFS_COMP_FLAG_XZ_POWERPC : 0;
+	case 0x0000000C:	/* 32 bit ARM */
+		return ARM_FILTERS;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+sqfs_u32 sqfs_bcj_detect_header(const sqfs_u8 *data, size_t size)
+{
+	sqfs_u32 magic;
+
+	if (size < 0x40)
+		return 0;
+
+	if (memcmp(data, "\177ELF", 4) == 0)
+		return SQFS_BCJ_HINT_KNOWN | detect_elf(data, size);
+
+	if (data[0] == 'M' && data[1] == 'Z')
+		return detect_pe(data, size);
+
+	magic = get32(data, false);
+
+	if (magic == 0xFEEDFACE || magic == 0xFEEDFACF)
+		return SQFS_BCJ_HINT_KNOWN | detect_macho(data, false);
+
+	magic = get32(data, true);
+
+	if (magic == 0xFEEDFACE || magic == 0xFEEDFACF)
+		return SQFS_BCJ_HINT_KNOWN | detect_macho(data, true);
+
+	return 0;
+}
+
+/*
+  Count the instruction patterns the individual BCJ filters rewrite. In
+  random data, each of them shows up roughly once per KiB or less, while in
+  actual machine code of the respective architecture function calls are a
+  lot more frequent than that.
+ */
+static size_t count_x86(const sqfs_u8 *data, size_t size)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i + 4 < size; ++i) {
+		if ((data[i] & 0xFE) == 0xE8 &&
+		    (data[i + 4] == 0x00 || data[i + 4] == 0xFF)) {
+			++count;
+			i += 4;
+		}
+	}
+
+	return count;
+}
+
+static size_t count_arm(const sqfs_u8 *data, size_t size)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i + 4 <= size; i += 4)
+		count += (data[i + 3] == 0xEB);
+
+	return count;
+}
+
+static size_t count_thumb(const sqfs_u8 *data, size_t size)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i + 4 <= size; i += 2) {
+		if ((data[i + 1] & 0xF8) == 0xF0 &&
+		    (data[i + 3] & 0xF8) == 0xF8) {
+			++count;
+			i += 2;
+		}
+	}
+
+	return count;
+}
+
+static size_t count_ppc(const sqfs_u8 *data, size_t size)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i + 4 <= size; i += 4)
+		count += ((data[i] & 0xFC) == 0x48 && (data[i + 3] & 3) == 1);
+
+	return count;
+}
+
+static size_t count_sparc(const sqfs_u8 *data, size_t size)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i + 4 <= size; i += 4) {
+		if (data[i] != 0x40)
+			continue;
+
+		if ((data[i + 1] == 0x00 && (data[i + 2] & 0xC0) == 0x00) ||
+		    (data[i + 1] == 0xFF && (data[i + 2] & 0xC0) == 0xC0)) {
+			++count;
+		}
+	}
+
+	return count;
+}
+
+sqfs_u32 sqfs_bcj_guess(const sqfs_u8 *data, size_t size, sqfs_u32 enabled)
+{
+	static const struct {
+		sqfs_u32 flag;
+		size_t (*count)(const sqfs_u8 *data, size_t size);
+
+		/* minimum number of hits per KiB */
+		size_t threshold;
+	} tests[] = {
+		{ SQFS_COMP_FLAG_XZ_X86, count_x86, 2 },
+		{ SQFS_COMP_FLAG_XZ_POWERPC, count_ppc, 4 },
+		{ SQFS_COMP_FLAG_XZ_ARM, count_arm, 4 },
+		{ SQFS_COMP_FLAG_XZ_ARMTHUMB, count_thumb, 4 },
+		{ SQFS_COMP_FLAG_XZ_SPARC, count_sparc, 4 },
+	};
+	size_t i, count, best = 0, second = 0;
+	sqfs_u32 selected = 0;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		if (!(enabled & tests[i].flag))
+			continue;
+
+		count = tests[i].count(data, size);
+
+		if (count * 1024 < tests[i].threshold * size)
+			continue;
+
+		if (count > best) {
+			second = best;
+			best = count;
+			selected = tests[i].flag;
+		} else if (count > second) {
+			second = count;
+		}
+	}
+
+	/*
+	  Two architectures look alike, try them all the hard way. IA-64 is
+	  left out, its calls hide in 128 bit bundles and it is only ever
+	  selected through a file header.
+	 */
+	if (second > 0 && second * 2 > best)
+		return enabled & ~SQFS_COMP_FLAG_XZ_IA64;
+
+	return selected;
+}
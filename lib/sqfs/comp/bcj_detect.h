@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * bcj_detect.h
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef BCJ_DETECT_H
+#define BCJ_DETECT_H
+
+#include "sqfs/predef.h"
+
+/*
+  Set in a hint if the file type was positively identified from its
+  header. The remaining bits are the SQFS_COMP_FLAG_XZ_* filters that
+  match the architecture, possibly none at all.
+ */
+#define SQFS_BCJ_HINT_KNOWN (0x80000000U)
+
+/*
+  Look at the start of a file for an ELF, PE or Mach-O header. Returns 0 if
+  the data is not recognized, SQFS_BCJ_HINT_KNOWN and the matching BCJ
+  filter flags otherwise.
+ */
+SQFS_INTERNAL sqfs_u32 sqfs_bcj_detect_header(const sqfs_u8 *data,
+					      size_t size);
+
+/*
+  Guess a BCJ filter from call instruction statistics. Returns the flag of
+  the filter out of `enabled` that stands out clearly, 0 if none of them
+  looks worth trying, or all of `enabled` except IA-64 if the result is
+  ambiguous.
+ */
+SQFS_INTERNAL sqfs_u32 sqfs_bcj_guess(const sqfs_u8 *data, size_t size,
+				      sqfs_u32 enabled);
+
+/*
+  Forward a hint from sqfs_bcj_detect_header to a compressor. Compressors
+  that do not use BCJ filters ignore it.
+ */
+SQFS_INTERNAL void sqfs_compressor_set_bcj_hint(sqfs_compressor_t *cmp,
+						sqfs_u32 hint);
+
+#endif /* BCJ_DETECT_H */
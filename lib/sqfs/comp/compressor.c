@@ -40,6 +40,15 @@ static const char *names[] = {
 	[SQFS_COMP_ZSTD] = "zstd",
 };
 
+void sqfs_compressor_set_bcj_hint(sqfs_compressor_t *cmp, sqfs_u32 hint)
+{
+#ifdef WITH_XZ
+	xz_compressor_set_bcj_hint(cmp, hint);
+#else
+	(void)cmp; (void)hint;
+#endif
+}
+
 int sqfs_generic_write_options(sqfs_file_t *file, const void *data, size_t size)
 {
 	sqfs_u8 buffer[64];
@@ -124,45 +124,119 @@ static int flag_to_zlib_strategy(int flag)
 	return 0;
 }
 
+/*
+  Blocks at least this large only have a strided sample compressed with each
+  strategy, made up of SAMPLE_CHUNKS chunks that add up to 1/SAMPLE_RATIO
+  of the block.
+ */
+#define SAMPLE_MIN_BLOCK (64 * 1024)
+#define SAMPLE_CHUNKS (8)
+#define SAMPLE_RATIO (8)
+
+static int try_strategy(gzip_compressor_t *gzip, int strategy,
+			const sqfs_u8 *in, sqfs_u32 size,
+			sqfs_u8 *out, sqfs_u32 outsize,
+			bool sample, size_t *length)
+{
+	sqfs_u32 chunk, stride;
+	int flush, ret;
+	size_t i;
+
+	ret = deflateReset(&gzip->strm);
+	if (ret != Z_OK)
+		return SQFS_ERROR_COMPRESSOR;
+
+	gzip->strm.next_out = out;
+	gzip->strm.avail_out = outsize;
+
+	ret = deflateParams(&gzip->strm, gzip->opt.level, strategy);
+	if (ret != Z_OK)
+		return SQFS_ERROR_COMPRESSOR;
+
+	if (!sample) {
+		chunk = stride = size;
+	} else {
+		stride = size / SAMPLE_CHUNKS;
+		chunk = stride / SAMPLE_RATIO;
+	}
+
+	for (i = 0; i < size / stride; ++i) {
+		flush = (i + 1 < size / stride) ? Z_NO_FLUSH : Z_FINISH;
+
+		gzip->strm.next_in = (z_const Bytef *)(in + i * stride);
+		gzip->strm.avail_in = chunk;
+
+		ret = deflate(&gzip->strm, flush);
+
+		if (ret == Z_STREAM_END)
+			break;
+
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return SQFS_ERROR_COMPRESSOR;
+
+		/* output buffer is full, this strategy is out */
+		if (gzip->strm.avail_out == 0) {
+			*length = 0;
+			return 0;
+		}
+	}
+
+	*length = (ret == Z_STREAM_END) ? gzip->strm.total_out : 0;
+	return 0;
+}
+
 static int find_strategy(gzip_compressor_t *gzip, const sqfs_u8 *in,
 			 sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
 	int ret, strategy, selected = Z_DEFAULT_STRATEGY;
-	size_t i, length, minlength = 0;
+	int runner_up = Z_DEFAULT_STRATEGY;
+	bool sample = (size >= SAMPLE_MIN_BLOCK);
+	size_t i, length, minlength = 0, second = 0;
 
 	for (i = 0x01; i & SQFS_COMP_FLAG_GZIP_ALL; i <<= 1) {
 		if ((gzip->opt.strategies & i) == 0)
 			continue;
 
-		ret = deflateReset(&gzip->strm);
-		if (ret != Z_OK)
-			return SQFS_ERROR_COMPRESSOR;
-
 		strategy = flag_to_zlib_strategy(i);
 
-		gzip->strm.next_in = (z_const Bytef *)in;
-		gzip->strm.avail_in = size;
-		gzip->strm.next_out = out;
-		gzip->strm.avail_out = outsize;
+		ret = try_strategy(gzip, strategy, in, size, out, outsize,
+				   sample, &length);
+		if (ret != 0)
+			return ret;
 
-		ret = deflateParams(&gzip->strm, gzip->opt.level, strategy);
-		if (ret != Z_OK)
-			return SQFS_ERROR_COMPRESSOR;
-
-		ret = deflate(&gzip->strm, Z_FINISH);
-
-		if (ret == Z_STREAM_END) {
-			length = gzip->strm.total_out;
+		if (length == 0)
+			continue;
 
-			if (minlength == 0 || length < minlength) {
-				minlength = length;
-				selected = strategy;
-			}
-		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
-			return SQFS_ERROR_COMPRESSOR;
+		if (minlength == 0 || length < minlength) {
+			second = minlength;
+			runner_up = selected;
+			minlength = length;
+			selected = strategy;
+		} else if (second == 0 || length < second) {
+			second = length;
+			runner_up = strategy;
 		}
 	}
 
+	/*
+	  If the sample can't tell the two best strategies apart (less than
+	  1% difference), compare them on the entire block.
+	 */
+	if (sample && second > 0 && (second - minlength) * 100 < minlength) {
+		ret = try_strategy(gzip, selected, in, size, out, outsize,
+				   false, &minlength);
+		if (ret != 0)
+			return ret;
+
+		ret = try_strategy(gzip, runner_up, in, size, out, outsize,
+				   false, &length);
+		if (ret != 0)
+			return ret;
+
+		if (length > 0 && (minlength == 0 || length < minlength))
+			selected = runner_up;
+	}
+
 	return selected;
 }
 
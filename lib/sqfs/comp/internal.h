@@ -15,6 +15,7 @@
 #include "sqfs/block.h"
 #include "sqfs/io.h"
 #include "util.h"
+#include "bcj_detect.h"
 
 SQFS_INTERNAL
 int sqfs_generic_write_options(sqfs_file_t *file, const void *data,
@@ -27,6 +28,9 @@ SQFS_INTERNAL
 int xz_compressor_create(const sqfs_compressor_config_t *cfg,
 			 sqfs_compressor_t **out);
 
+SQFS_INTERNAL
+void xz_compressor_set_bcj_hint(sqfs_compressor_t *cmp, sqfs_u32 hint);
+
 SQFS_INTERNAL
 int gzip_compressor_create(const sqfs_compressor_config_t *cfg,
 			   sqfs_compressor_t **out);
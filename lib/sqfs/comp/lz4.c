@@ -20,6 +20,9 @@ typedef struct {
 	sqfs_compressor_t base;
 	size_t block_size;
 	bool high_compression;
+
+	/* Encoder state, allocated on first use and reused for every block. */
+	void *state;
 } lz4_compressor_t;
 
 typedef struct {
@@ -74,12 +77,22 @@ static sqfs_s32 lz4_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	if (size >= 0x7FFFFFFF)
 		return SQFS_ERROR_ARG_INVALID;
 
+	if (lz4->state == NULL) {
+		lz4->state = malloc(lz4->high_compression ?
+				    sizeof(LZ4_streamHC_t) :
+				    sizeof(LZ4_stream_t));
+		if (lz4->state == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
 	if (lz4->high_compression) {
-		ret = LZ4_compress_HC((const void *)in, (void *)out,
-				      size, outsize, LZ4HC_CLEVEL_MAX);
+		ret = LZ4_compress_HC_extStateHC(lz4->state, (const void *)in,
+						 (void *)out, size, outsize,
+						 LZ4HC_CLEVEL_MAX);
 	} else {
-		ret = LZ4_compress_default((const void *)in, (void *)out,
-					   size, outsize);
+		ret = LZ4_compress_fast_extState(lz4->state, (const void *)in,
+						 (void *)out, size, outsize,
+						 1);
 	}
 
 	if (ret < 0)
@@ -129,12 +142,16 @@ static sqfs_object_t *lz4_create_copy(const sqfs_object_t *cmp)
 		return NULL;
 
 	memcpy(lz4, cmp, sizeof(*lz4));
+	lz4->state = NULL;
 	return (sqfs_object_t *)lz4;
 }
 
 static void lz4_destroy(sqfs_object_t *base)
 {
-	free(base);
+	lz4_compressor_t *lz4 = (lz4_compressor_t *)base;
+
+	free(lz4->state);
+	free(lz4);
 }
 
 int lz4_compressor_create(const sqfs_compressor_config_t *cfg,
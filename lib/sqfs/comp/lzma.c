@@ -30,6 +30,12 @@ typedef struct {
 	sqfs_u8 lc;
 	sqfs_u8 lp;
 	sqfs_u8 pb;
+
+	/*
+	  Long lived encoder/decoder state, re-initialized for every block,
+	  which reuses the buffers allocated by liblzma.
+	 */
+	lzma_stream strm;
 } lzma_compressor_t;
 
 static int lzma_write_options(sqfs_compressor_t *base, sqfs_file_t *file)
@@ -49,7 +55,7 @@ static sqfs_s32 try_compress(lzma_compressor_t *lzma, sqfs_u32 preset,
 			     const sqfs_u8 *in, size_t size,
 			     sqfs_u8 *out, size_t outsize)
 {
-	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_stream *strm = &lzma->strm;
 	lzma_options_lzma opt;
 	int ret;
 
@@ -59,23 +65,20 @@ static sqfs_s32 try_compress(lzma_compressor_t *lzma, sqfs_u32 preset,
 	opt.lp = lzma->lp;
 	opt.pb = lzma->pb;
 
-	if (lzma_alone_encoder(&strm, &opt) != LZMA_OK) {
-		lzma_end(&strm);
+	if (lzma_alone_encoder(strm, &opt) != LZMA_OK)
 		return SQFS_ERROR_COMPRESSOR;
-	}
 
-	strm.next_out = out;
-	strm.avail_out = outsize;
-	strm.next_in = in;
-	strm.avail_in = size;
+	strm->next_out = out;
+	strm->avail_out = outsize;
+	strm->next_in = in;
+	strm->avail_in = size;
 
-	ret = lzma_code(&strm, LZMA_FINISH);
-	lzma_end(&strm);
+	ret = lzma_code(strm, LZMA_FINISH);
 
 	if (ret != LZMA_STREAM_END)
 		return ret == LZMA_OK ? 0 : SQFS_ERROR_COMPRESSOR;
 
-	if (strm.total_out > size)
+	if (strm->total_out > size)
 		return 0;
 
 	out[LZMA_SIZE_OFFSET    ] = size & 0xFF;
@@ -86,7 +89,7 @@ static sqfs_s32 try_compress(lzma_compressor_t *lzma, sqfs_u32 preset,
 	out[LZMA_SIZE_OFFSET + 5] = 0;
 	out[LZMA_SIZE_OFFSET + 6] = 0;
 	out[LZMA_SIZE_OFFSET + 7] = 0;
-	return strm.total_out;
+	return strm->total_out;
 }
 
 static sqfs_s32 lzma_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
@@ -119,11 +122,11 @@ static sqfs_s32 lzma_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 static sqfs_s32 lzma_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 				  sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
+	lzma_compressor_t *lzma = (lzma_compressor_t *)base;
 	sqfs_u8 lzma_header[LZMA_HEADER_SIZE];
-	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_stream *strm = &lzma->strm;
 	size_t hdrsize;
 	int ret;
-	(void)base;
 
 	if (size >= 0x7FFFFFFF)
 		return SQFS_ERROR_ARG_INVALID;
@@ -139,37 +142,32 @@ static sqfs_s32 lzma_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	if (hdrsize > outsize)
 		return 0;
 
-	if (lzma_alone_decoder(&strm, MEMLIMIT) != LZMA_OK) {
-		lzma_end(&strm);
+	if (lzma_alone_decoder(strm, MEMLIMIT) != LZMA_OK)
 		return SQFS_ERROR_COMPRESSOR;
-	}
 
 	memcpy(lzma_header, in, sizeof(lzma_header));
 	memset(lzma_header + LZMA_SIZE_OFFSET, 0xFF, LZMA_SIZE_BYTES);
 
-	strm.next_out = out;
-	strm.avail_out = outsize;
-	strm.next_in = lzma_header;
-	strm.avail_in = sizeof(lzma_header);
+	strm->next_out = out;
+	strm->avail_out = outsize;
+	strm->next_in = lzma_header;
+	strm->avail_in = sizeof(lzma_header);
 
-	ret = lzma_code(&strm, LZMA_RUN);
+	ret = lzma_code(strm, LZMA_RUN);
 
-	if (ret != LZMA_OK || strm.avail_in != 0) {
-		lzma_end(&strm);
+	if (ret != LZMA_OK || strm->avail_in != 0)
 		return SQFS_ERROR_COMPRESSOR;
-	}
 
-	strm.next_in = in + sizeof(lzma_header);
-	strm.avail_in = size - sizeof(lzma_header);
+	strm->next_in = in + sizeof(lzma_header);
+	strm->avail_in = size - sizeof(lzma_header);
 
-	ret = lzma_code(&strm, LZMA_FINISH);
-	lzma_end(&strm);
+	ret = lzma_code(strm, LZMA_FINISH);
 
 	if (ret != LZMA_STREAM_END && ret != LZMA_OK)
 		return SQFS_ERROR_COMPRESSOR;
 
 	if (ret == LZMA_OK) {
-		if (strm.total_out < hdrsize || strm.avail_in != 0)
+		if (strm->total_out < hdrsize || strm->avail_in != 0)
 			return 0;
 	}
 
@@ -194,22 +192,29 @@ static void lzma_get_configuration(const sqfs_compressor_t *base,
 
 static sqfs_object_t *lzma_create_copy(const sqfs_object_t *cmp)
 {
+	static const lzma_stream strm_init = LZMA_STREAM_INIT;
 	lzma_compressor_t *copy = malloc(sizeof(*copy));
 
-	if (copy != NULL)
+	if (copy != NULL) {
 		memcpy(copy, cmp, sizeof(*copy));
+		copy->strm = strm_init;
+	}
 
 	return (sqfs_object_t *)copy;
 }
 
 static void lzma_destroy(sqfs_object_t *base)
 {
-	free(base);
+	lzma_compressor_t *lzma = (lzma_compressor_t *)base;
+
+	lzma_end(&lzma->strm);
+	free(lzma);
 }
 
 int lzma_compressor_create(const sqfs_compressor_config_t *cfg,
 			   sqfs_compressor_t **out)
 {
+	static const lzma_stream strm_init = LZMA_STREAM_INIT;
 	sqfs_compressor_t *base;
 	lzma_compressor_t *lzma;
 	sqfs_u32 mask;
@@ -267,6 +272,7 @@ int lzma_compressor_create(const sqfs_compressor_config_t *cfg,
 	lzma->lc = cfg->opt.lzma.lc;
 	lzma->lp = cfg->opt.lzma.lp;
 	lzma->pb = cfg->opt.lzma.pb;
+	lzma->strm = strm_init;
 
 	base->get_configuration = lzma_get_configuration;
 	base->do_block = (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) ?
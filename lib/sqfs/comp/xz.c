@@ -25,6 +25,18 @@ typedef struct {
 	sqfs_u8 pb;
 
 	int flags;
+
+	/* BCJ filter hint for the current file, see bcj_detect.h */
+	sqfs_u32 bcj_hint;
+
+	/*
+	  Long lived encoder/decoder state. Re-initializing an existing stream
+	  with the same filter chain reuses its allocated buffers and match
+	  finder, so only the plain and the most recent BCJ filtered chain are
+	  kept around. Copies get their own, fresh streams.
+	 */
+	lzma_stream strm;
+	lzma_stream strm_bcj;
 } xz_compressor_t;
 
 typedef struct {
@@ -91,7 +103,7 @@ static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 {
 	lzma_filter filters[5];
 	lzma_options_lzma opt;
-	size_t written = 0;
+	lzma_stream *strm;
 	lzma_ret ret;
 	int i = 0;
 
@@ -117,16 +129,26 @@ static sqfs_s32 compress(xz_compressor_t *xz, lzma_vli filter,
 	filters[i].options = NULL;
 	++i;
 
-	ret = lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, NULL,
-					in, size, out, &written, outsize);
-
-	if (ret == LZMA_OK)
-		return (written >= size) ? 0 : written;
+	strm = (filter == LZMA_VLI_UNKNOWN) ? &xz->strm : &xz->strm_bcj;
 
-	if (ret != LZMA_BUF_ERROR)
+	if (lzma_stream_encoder(strm, filters, LZMA_CHECK_CRC32) != LZMA_OK)
 		return SQFS_ERROR_COMPRESSOR;
 
-	return 0;
+	strm->next_in = in;
+	strm->avail_in = size;
+	strm->next_out = out;
+	strm->avail_out = outsize;
+
+	ret = lzma_code(strm, LZMA_FINISH);
+
+	if (ret == LZMA_STREAM_END)
+		return (strm->total_out >= size) ? 0 : strm->total_out;
+
+	/* output buffer full */
+	if (ret == LZMA_OK || ret == LZMA_BUF_ERROR)
+		return 0;
+
+	return SQFS_ERROR_COMPRESSOR;
 }
 
 static lzma_vli flag_to_vli(int flag)
@@ -151,13 +173,29 @@ static lzma_vli flag_to_vli(int flag)
 	return LZMA_VLI_UNKNOWN;
 }
 
+static sqfs_u32 select_filters(const xz_compressor_t *xz, const sqfs_u8 *in,
+			       sqfs_u32 size)
+{
+	sqfs_u32 enabled = xz->flags & SQFS_COMP_FLAG_XZ_ALL;
+
+	enabled &= ~SQFS_COMP_FLAG_XZ_EXTREME;
+	if (enabled == 0)
+		return 0;
+
+	if (xz->bcj_hint & SQFS_BCJ_HINT_KNOWN)
+		return xz->bcj_hint & enabled;
+
+	return sqfs_bcj_guess(in, size, enabled);
+}
+
 static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 			      sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
 	xz_compressor_t *xz = (xz_compressor_t *)base;
 	lzma_vli filter, selected = LZMA_VLI_UNKNOWN;
+	sqfs_u32 candidates;
 	sqfs_s32 ret, smallest;
-	bool extreme;
+	bool extreme, done;
 	size_t i;
 
 	if (size >= 0x7FFFFFFF)
@@ -168,27 +206,40 @@ static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 	if (ret < 0 || xz->flags == 0)
 		return ret;
 
+	/*
+	  Instead of trying every enabled BCJ filter on every block, only
+	  try the ones that match the file header or that the instruction
+	  statistics point at. If nothing does, the plain result is final.
+	 */
+	candidates = select_filters(xz, in, size);
+
+	if (candidates == 0 && !(xz->flags & SQFS_COMP_FLAG_XZ_EXTREME))
+		return ret;
+
 	smallest = ret;
 	extreme = false;
+	done = true;
 
 	if (xz->flags & SQFS_COMP_FLAG_XZ_EXTREME) {
 		ret = compress(xz, LZMA_VLI_UNKNOWN, in, size, out, outsize,
 			       xz->level | LZMA_PRESET_EXTREME);
 
-		if (ret > 0 && (smallest == 0 || ret < smallest)) {
+		done = (ret > 0 && (smallest == 0 || ret < smallest));
+		if (done) {
 			smallest = ret;
 			extreme = true;
 		}
 	}
 
 	for (i = 1; i & SQFS_COMP_FLAG_XZ_ALL; i <<= 1) {
-		if ((i & SQFS_COMP_FLAG_XZ_EXTREME) || (xz->flags & i) == 0)
+		if ((candidates & i) == 0)
 			continue;
 
 		filter = flag_to_vli(i);
 
 		ret = compress(xz, filter, in, size, out, outsize, xz->level);
-		if (ret > 0 && (smallest == 0 || ret < smallest)) {
+		done = (ret > 0 && (smallest == 0 || ret < smallest));
+		if (done) {
 			smallest = ret;
 			selected = filter;
 			extreme = false;
@@ -198,7 +249,8 @@ static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 			ret = compress(xz, filter, in, size, out, outsize,
 				       xz->level | LZMA_PRESET_EXTREME);
 
-			if (ret > 0 && (smallest == 0 || ret < smallest)) {
+			done = (ret > 0 && (smallest == 0 || ret < smallest));
+			if (done) {
 				smallest = ret;
 				selected = filter;
 				extreme = true;
@@ -206,31 +258,42 @@ static sqfs_s32 xz_comp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 		}
 	}
 
-	if (smallest == 0)
-		return 0;
+	/* the output buffer still holds the result of the last attempt */
+	if (smallest == 0 || done)
+		return smallest;
 
 	return compress(xz, selected, in, size, out, outsize,
 			xz->level | (extreme ? LZMA_PRESET_EXTREME : 0));
 }
 
+void xz_compressor_set_bcj_hint(sqfs_compressor_t *cmp, sqfs_u32 hint)
+{
+	if (cmp->do_block == xz_comp_block)
+		((xz_compressor_t *)cmp)->bcj_hint = hint;
+}
+
 static sqfs_s32 xz_uncomp_block(sqfs_compressor_t *base, const sqfs_u8 *in,
 				sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
 {
+	xz_compressor_t *xz = (xz_compressor_t *)base;
 	sqfs_u64 memlimit = 65 * 1024 * 1024;
-	size_t dest_pos = 0;
-	size_t src_pos = 0;
 	lzma_ret ret;
-	(void)base;
 
 	if (outsize >= 0x7FFFFFFF)
 		return SQFS_ERROR_ARG_INVALID;
 
-	ret = lzma_stream_buffer_decode(&memlimit, 0, NULL,
-					in, &src_pos, size,
-					out, &dest_pos, outsize);
+	if (lzma_stream_decoder(&xz->strm, memlimit, 0) != LZMA_OK)
+		return SQFS_ERROR_COMPRESSOR;
+
+	xz->strm.next_in = in;
+	xz->strm.avail_in = size;
+	xz->strm.next_out = out;
+	xz->strm.avail_out = outsize;
 
-	if (ret == LZMA_OK && size == src_pos)
-		return dest_pos;
+	ret = lzma_code(&xz->strm, LZMA_FINISH);
+
+	if (ret == LZMA_STREAM_END && xz->strm.avail_in == 0)
+		return xz->strm.total_out;
 
 	return SQFS_ERROR_COMPRESSOR;
 }
@@ -256,23 +319,31 @@ static void xz_get_configuration(const sqfs_compressor_t *base,
 
 static sqfs_object_t *xz_create_copy(const sqfs_object_t *cmp)
 {
+	static const lzma_stream strm_init = LZMA_STREAM_INIT;
 	xz_compressor_t *xz = malloc(sizeof(*xz));
 
 	if (xz == NULL)
 		return NULL;
 
 	memcpy(xz, cmp, sizeof(*xz));
+	xz->strm = strm_init;
+	xz->strm_bcj = strm_init;
 	return (sqfs_object_t *)xz;
 }
 
 static void xz_destroy(sqfs_object_t *base)
 {
-	free(base);
+	xz_compressor_t *xz = (xz_compressor_t *)base;
+
+	lzma_end(&xz->strm);
+	lzma_end(&xz->strm_bcj);
+	free(xz);
 }
 
 int xz_compressor_create(const sqfs_compressor_config_t *cfg,
 			 sqfs_compressor_t **out)
 {
+	static const lzma_stream strm_init = LZMA_STREAM_INIT;
 	sqfs_compressor_t *base;
 	xz_compressor_t *xz;
 
@@ -311,6 +382,8 @@ int xz_compressor_create(const sqfs_compressor_config_t *cfg,
 	xz->lp = cfg->opt.xz.lp;
 	xz->pb = cfg->opt.xz.pb;
 	xz->level = cfg->level;
+	xz->strm = strm_init;
+	xz->strm_bcj = strm_init;
 	base->get_configuration = xz_get_configuration;
 	base->do_block = (cfg->flags & SQFS_COMP_FLAG_UNCOMPRESS) ?
 		xz_uncomp_block : xz_comp_block;
@@ -15,14 +15,60 @@
 #include "sqfs/table.h"
 #include "sqfs/inode.h"
 #include "sqfs/io.h"
+#include "mutex.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/*
+  For shared readers, recently used blocks are cached in a number of
+  shards, each with its own lock, selected by the on-disk location of a
+  block. A shard is a tiny LRU cache.
+ */
+#define CACHE_SHARDS (16)
+#define CACHE_SHARD_BLOCKS (4)
+
+typedef struct {
+	/* on-disk location of the block, ~0 if the slot is unused */
+	sqfs_u64 location;
+	sqfs_u64 last_use;
+	size_t size;
+	sqfs_u8 *data;
+} cache_entry_t;
+
+typedef struct {
+	pthread_mutex_t mtx;
+	sqfs_u64 use_counter;
+	cache_entry_t entries[CACHE_SHARD_BLOCKS];
+} cache_shard_t;
+
+/* A compressor copy and buffers for one block, used by one thread at a time */
+typedef struct read_ctx_t {
+	struct read_ctx_t *next;
+	sqfs_compressor_t *cmp;
+	sqfs_u8 *scratch;
+	sqfs_u8 data[];
+} read_ctx_t;
+
+/* State of a shared reader, shared with its copies */
+typedef struct {
+	/* protects the reference count and the context list */
+	pthread_mutex_t mtx;
+	size_t refcount;
+	read_ctx_t *contexts;
+
+	cache_shard_t shards[CACHE_SHARDS];
+
+	sqfs_u8 *cache_data;
+} shared_state_t;
+
 struct sqfs_data_reader_t {
 	sqfs_object_t obj;
 
+	/* If not NULL, the reader may be used by several threads */
+	shared_state_t *shared;
+
 	sqfs_frag_table_t *frag_tbl;
 	sqfs_compressor_t *cmp;
 	sqfs_file_t *file;
@@ -39,54 +85,115 @@ struct sqfs_data_reader_t {
 	sqfs_u8 scratch[];
 };
 
-static int get_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
-		     sqfs_u32 max_size, size_t *out_sz, sqfs_u8 **out)
+static int unpack_block(sqfs_file_t *file, sqfs_compressor_t *cmp,
+			sqfs_u8 *scratch, sqfs_u64 off, sqfs_u32 size,
+			sqfs_u32 max_size, sqfs_u8 *out, size_t *out_sz)
 {
 	sqfs_u32 on_disk_size;
 	sqfs_s32 ret;
 	int err;
 
-	*out = alloc_array(1, max_size);
 	*out_sz = max_size;
 
-	if (*out == NULL) {
-		err = SQFS_ERROR_ALLOC;
-		goto fail;
-	}
-
-	if (SQFS_IS_SPARSE_BLOCK(size))
+	if (SQFS_IS_SPARSE_BLOCK(size)) {
+		memset(out, 0, max_size);
 		return 0;
+	}
 
 	on_disk_size = SQFS_ON_DISK_BLOCK_SIZE(size);
 
-	if (on_disk_size > max_size) {
-		err = SQFS_ERROR_OVERFLOW;
-		goto fail;
-	}
+	if (on_disk_size > max_size)
+		return SQFS_ERROR_OVERFLOW;
 
 	if (SQFS_IS_BLOCK_COMPRESSED(size)) {
-		err = data->file->read_at(data->file, off,
-					  data->scratch, on_disk_size);
+		err = file->read_at(file, off, scratch, on_disk_size);
 		if (err)
-			goto fail;
+			return err;
 
-		ret = data->cmp->do_block(data->cmp, data->scratch,
-					  on_disk_size, *out, max_size);
-		if (ret <= 0) {
-			err = ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
-			goto fail;
-		}
+		ret = cmp->do_block(cmp, scratch, on_disk_size, out, max_size);
+		if (ret <= 0)
+			return ret < 0 ? ret : SQFS_ERROR_OVERFLOW;
 
 		*out_sz = ret;
 	} else {
-		err = data->file->read_at(data->file, off,
-					  *out, on_disk_size);
+		err = file->read_at(file, off, out, on_disk_size);
 		if (err)
-			goto fail;
+			return err;
 
 		*out_sz = on_disk_size;
 	}
 
+	return 0;
+}
+
+static read_ctx_t *ctx_get(sqfs_data_reader_t *data)
+{
+	shared_state_t *shared = data->shared;
+	read_ctx_t *ctx;
+
+	pthread_mutex_lock(&shared->mtx);
+	ctx = shared->contexts;
+	if (ctx != NULL)
+		shared->contexts = ctx->next;
+	pthread_mutex_unlock(&shared->mtx);
+
+	if (ctx != NULL)
+		return ctx;
+
+	ctx = alloc_flex(sizeof(*ctx), 2, data->block_size);
+	if (ctx == NULL)
+		return NULL;
+
+	ctx->cmp = sqfs_copy(data->cmp);
+	if (ctx->cmp == NULL) {
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->scratch = ctx->data + data->block_size;
+	return ctx;
+}
+
+static void ctx_put(shared_state_t *shared, read_ctx_t *ctx)
+{
+	pthread_mutex_lock(&shared->mtx);
+	ctx->next = shared->contexts;
+	shared->contexts = ctx;
+	pthread_mutex_unlock(&shared->mtx);
+}
+
+static int get_block(sqfs_data_reader_t *data, sqfs_u64 off, sqfs_u32 size,
+		     sqfs_u32 max_size, size_t *out_sz, sqfs_u8 **out)
+{
+	read_ctx_t *ctx = NULL;
+	int err;
+
+	*out = alloc_array(1, max_size);
+	*out_sz = max_size;
+
+	if (*out == NULL) {
+		err = SQFS_ERROR_ALLOC;
+		goto fail;
+	}
+
+	if (data->shared == NULL) {
+		err = unpack_block(data->file, data->cmp, data->scratch,
+				   off, size, max_size, *out, out_sz);
+	} else {
+		ctx = ctx_get(data);
+		if (ctx == NULL) {
+			err = SQFS_ERROR_ALLOC;
+			goto fail;
+		}
+
+		err = unpack_block(data->file, ctx->cmp, ctx->scratch,
+				   off, size, max_size, *out, out_sz);
+		ctx_put(data->shared, ctx);
+	}
+
+	if (err)
+		goto fail;
+
 	return 0;
 fail:
 	free(*out);
@@ -95,6 +202,185 @@ fail:
 	return err;
 }
 
+static cache_shard_t *get_shard(shared_state_t *shared, sqfs_u64 location)
+{
+	sqfs_u64 hash = location * 0x9E3779B97F4A7C15ULL;
+
+	return shared->shards + (hash >> 60) % CACHE_SHARDS;
+}
+
+static bool copy_range(sqfs_u8 *dst, const sqfs_u8 *src, size_t src_size,
+		       size_t offset, size_t size)
+{
+	if (offset > src_size || (src_size - offset) < size)
+		return false;
+
+	memcpy(dst, src + offset, size);
+	return true;
+}
+
+/*
+  Copy a range of an uncompressed block to a buffer. The block is
+  uncompressed outside of the shard lock, so other threads can use
+  the shard in the meantime. If two threads miss the same block at the
+  same time, both uncompress it and only the first one is kept.
+ */
+static int shared_copy(sqfs_data_reader_t *data, sqfs_u64 location,
+		       sqfs_u32 disk_size, size_t offset, void *buffer,
+		       size_t size)
+{
+	cache_shard_t *shard = get_shard(data->shared, location);
+	cache_entry_t *ent, *victim;
+	read_ctx_t *ctx;
+	size_t i, used;
+	bool ok;
+	int err;
+
+	pthread_mutex_lock(&shard->mtx);
+	for (i = 0; i < CACHE_SHARD_BLOCKS; ++i) {
+		ent = shard->entries + i;
+
+		if (ent->location == location) {
+			ent->last_use = ++shard->use_counter;
+			ok = copy_range(buffer, ent->data, ent->size,
+					offset, size);
+			pthread_mutex_unlock(&shard->mtx);
+			return ok ? 0 : SQFS_ERROR_OUT_OF_BOUNDS;
+		}
+	}
+	pthread_mutex_unlock(&shard->mtx);
+
+	ctx = ctx_get(data);
+	if (ctx == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	err = unpack_block(data->file, ctx->cmp, ctx->scratch, location,
+			   disk_size, data->block_size, ctx->data, &used);
+	if (err)
+		goto out;
+
+	pthread_mutex_lock(&shard->mtx);
+	victim = shard->entries;
+
+	for (i = 0; i < CACHE_SHARD_BLOCKS; ++i) {
+		ent = shard->entries + i;
+
+		if (ent->location == location) {
+			victim = NULL;
+			break;
+		}
+
+		if (ent->last_use < victim->last_use)
+			victim = ent;
+	}
+
+	if (victim != NULL) {
+		victim->location = location;
+		victim->last_use = ++shard->use_counter;
+		victim->size = used;
+		memcpy(victim->data, ctx->data, used);
+	}
+	pthread_mutex_unlock(&shard->mtx);
+
+	if (!copy_range(buffer, ctx->data, used, offset, size))
+		err = SQFS_ERROR_OUT_OF_BOUNDS;
+out:
+	ctx_put(data->shared, ctx);
+	return err;
+}
+
+static shared_state_t *shared_create(size_t block_size)
+{
+	shared_state_t *shared;
+	size_t i, j, count;
+
+	shared = calloc(1, sizeof(*shared));
+	if (shared == NULL)
+		return NULL;
+
+	count = CACHE_SHARDS * CACHE_SHARD_BLOCKS;
+
+	shared->cache_data = alloc_array(block_size, count);
+	if (shared->cache_data == NULL)
+		goto fail;
+
+	if (pthread_mutex_init(&shared->mtx, NULL) != 0)
+		goto fail;
+
+	for (i = 0; i < CACHE_SHARDS; ++i) {
+		cache_shard_t *shard = shared->shards + i;
+
+		if (pthread_mutex_init(&shard->mtx, NULL) != 0) {
+			while (i-- > 0)
+				pthread_mutex_destroy(&shared->shards[i].mtx);
+			pthread_mutex_destroy(&shared->mtx);
+			goto fail;
+		}
+
+		for (j = 0; j < CACHE_SHARD_BLOCKS; ++j) {
+			shard->entries[j].location = 0xFFFFFFFFFFFFFFFFULL;
+			shard->entries[j].data = shared->cache_data +
+				(i * CACHE_SHARD_BLOCKS + j) * block_size;
+		}
+	}
+
+	shared->refcount = 1;
+	return shared;
+fail:
+	free(shared->cache_data);
+	free(shared);
+	return NULL;
+}
+
+static void shared_grab(shared_state_t *shared)
+{
+	pthread_mutex_lock(&shared->mtx);
+	shared->refcount += 1;
+	pthread_mutex_unlock(&shared->mtx);
+}
+
+static void shared_drop(shared_state_t *shared)
+{
+	size_t i, refcount;
+	read_ctx_t *ctx;
+
+	pthread_mutex_lock(&shared->mtx);
+	refcount = --shared->refcount;
+	pthread_mutex_unlock(&shared->mtx);
+
+	if (refcount > 0)
+		return;
+
+	while (shared->contexts != NULL) {
+		ctx = shared->contexts;
+		shared->contexts = ctx->next;
+
+		sqfs_destroy(ctx->cmp);
+		free(ctx);
+	}
+
+	for (i = 0; i < CACHE_SHARDS; ++i)
+		pthread_mutex_destroy(&shared->shards[i].mtx);
+
+	pthread_mutex_destroy(&shared->mtx);
+	free(shared->cache_data);
+	free(shared);
+}
+
+static void shared_invalidate(shared_state_t *shared)
+{
+	size_t i, j;
+
+	for (i = 0; i < CACHE_SHARDS; ++i) {
+		pthread_mutex_lock(&shared->shards[i].mtx);
+		for (j = 0; j < CACHE_SHARD_BLOCKS; ++j) {
+			shared->shards[i].entries[j].location =
+				0xFFFFFFFFFFFFFFFFULL;
+		}
+		pthread_mutex_unlock(&shared->shards[i].mtx);
+	}
+}
+
 static int precache_data_block(sqfs_data_reader_t *data, sqfs_u64 location,
 			       sqfs_u32 size)
 {
@@ -127,10 +413,60 @@ static int precache_fragment_block(sqfs_data_reader_t *data, size_t idx)
 			 &data->frag_blk_size, &data->frag_block);
 }
 
+static int copy_from_block(sqfs_data_reader_t *data, sqfs_u64 location,
+			   sqfs_u32 size, size_t offset, void *buffer,
+			   size_t count)
+{
+	int err;
+
+	if (data->shared != NULL) {
+		return shared_copy(data, location, size, offset,
+				   buffer, count);
+	}
+
+	err = precache_data_block(data, location, size);
+	if (err)
+		return err;
+
+	memcpy(buffer, (char *)data->data_block + offset, count);
+	return 0;
+}
+
+static int copy_from_fragment(sqfs_data_reader_t *data, sqfs_u32 index,
+			      size_t offset, void *buffer, size_t count)
+{
+	sqfs_fragment_t ent;
+	int err;
+
+	if (data->shared != NULL) {
+		err = sqfs_frag_table_lookup(data->frag_tbl, index, &ent);
+		if (err)
+			return err;
+
+		return shared_copy(data, ent.start_offset, ent.size, offset,
+				   buffer, count);
+	}
+
+	err = precache_fragment_block(data, index);
+	if (err)
+		return err;
+
+	if (offset >= data->frag_blk_size ||
+	    (data->frag_blk_size - offset) < count) {
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+	}
+
+	memcpy(buffer, (char *)data->frag_block + offset, count);
+	return 0;
+}
+
 static void data_reader_destroy(sqfs_object_t *obj)
 {
 	sqfs_data_reader_t *data = (sqfs_data_reader_t *)obj;
 
+	if (data->shared != NULL)
+		shared_drop(data->shared);
+
 	sqfs_destroy(data->frag_tbl);
 	free(data->data_block);
 	free(data->frag_block);
@@ -170,6 +506,9 @@ static sqfs_object_t *data_reader_copy(const sqfs_object_t *obj)
 		       data->frag_blk_size);
 	}
 
+	if (copy->shared != NULL)
+		shared_grab(copy->shared);
+
 	/* XXX: file and cmp aren't deep-copied becaues data
 	        doesn't own them either. */
 	return (sqfs_object_t *)copy;
@@ -189,7 +528,7 @@ sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 {
 	sqfs_data_reader_t *data;
 
-	if (flags != 0)
+	if (flags & ~SQFS_DATA_READER_ALL_FLAGS)
 		return NULL;
 
 	data = alloc_flex(sizeof(*data), 1, block_size);
@@ -202,6 +541,15 @@ sqfs_data_reader_t *sqfs_data_reader_create(sqfs_file_t *file,
 		return NULL;
 	}
 
+	if (flags & SQFS_DATA_READER_SHARED) {
+		data->shared = shared_create(block_size);
+		if (data->shared == NULL) {
+			sqfs_destroy(data->frag_tbl);
+			free(data);
+			return NULL;
+		}
+	}
+
 	((sqfs_object_t *)data)->destroy = data_reader_destroy;
 	((sqfs_object_t *)data)->copy = data_reader_copy;
 	data->file = file;
@@ -219,6 +567,9 @@ int sqfs_data_reader_load_fragment_table(sqfs_data_reader_t *data,
 	data->frag_block = NULL;
 	data->current_frag_index = 0;
 
+	if (data->shared != NULL)
+		shared_invalidate(data->shared);
+
 	ret = sqfs_frag_table_read(data->frag_tbl, data->file,
 				   super, data->cmp);
 	if (ret != 0)
@@ -276,10 +627,6 @@ int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
 
 	frag_sz = filesz % data->block_size;
 
-	err = precache_fragment_block(data, frag_idx);
-	if (err)
-		return err;
-
 	if (frag_off + frag_sz > data->block_size)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
@@ -287,8 +634,14 @@ int sqfs_data_reader_get_fragment(sqfs_data_reader_t *data,
 	if (*out == NULL)
 		return SQFS_ERROR_ALLOC;
 
+	err = copy_from_fragment(data, frag_idx, frag_off, *out, frag_sz);
+	if (err) {
+		free(*out);
+		*out = NULL;
+		return err;
+	}
+
 	*size = frag_sz;
-	memcpy(*out, (char *)data->frag_block + frag_off, frag_sz);
 	return 0;
 }
 
@@ -299,7 +652,6 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 	sqfs_u32 frag_idx, frag_off, diff, total = 0;
 	size_t i, block_count;
 	sqfs_u64 off, filesz;
-	char *ptr;
 	int err;
 
 	if (size >= 0x7FFFFFFF)
@@ -335,11 +687,11 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 		if (SQFS_IS_SPARSE_BLOCK(inode->extra[i])) {
 			memset(buffer, 0, diff);
 		} else {
-			err = precache_data_block(data, off, inode->extra[i]);
+			err = copy_from_block(data, off, inode->extra[i],
+					      offset, buffer, diff);
 			if (err)
 				return err;
 
-			memcpy(buffer, (char *)data->data_block + offset, diff);
 			off += SQFS_ON_DISK_BLOCK_SIZE(inode->extra[i]);
 		}
 
@@ -352,18 +704,11 @@ sqfs_s32 sqfs_data_reader_read(sqfs_data_reader_t *data,
 
 	/* copy from fragment */
 	if (size > 0) {
-		err = precache_fragment_block(data, frag_idx);
+		err = copy_from_fragment(data, frag_idx, frag_off + offset,
+					 buffer, size);
 		if (err)
 			return err;
 
-		if ((frag_off + offset) >= data->frag_blk_size)
-			return SQFS_ERROR_OUT_OF_BOUNDS;
-
-		if ((data->frag_blk_size - (frag_off + offset)) < size)
-			return SQFS_ERROR_OUT_OF_BOUNDS;
-
-		ptr = (char *)data->frag_block + frag_off + offset;
-		memcpy(buffer, ptr, size);
 		total += size;
 	}
 
@@ -45,6 +45,130 @@ static int dcache_add(sqfs_dir_reader_t *rd,
 	return rbtree_insert(&rd->dcache, &inum, &ref);
 }
 
+static void export_cleanup(sqfs_dir_reader_t *rd)
+{
+	size_t i;
+
+	if (rd->export_blocks != NULL) {
+		for (i = 0; i < rd->export_block_count; ++i)
+			free(rd->export_blocks[i]);
+	}
+
+	free(rd->export_blocks);
+	free(rd->export_index);
+	sqfs_destroy(rd->meta_export);
+
+	rd->export_blocks = NULL;
+	rd->export_index = NULL;
+	rd->meta_export = NULL;
+	rd->export_block_count = 0;
+}
+
+static int export_init(sqfs_dir_reader_t *rd)
+{
+	const sqfs_super_t *super = rd->super;
+	size_t i, count;
+	int ret;
+
+	if (!(super->flags & SQFS_FLAG_EXPORTABLE) ||
+	    super->export_table_start == 0xFFFFFFFFFFFFFFFFUL) {
+		return SQFS_ERROR_UNSUPPORTED;
+	}
+
+	count = super->inode_count / EXPORT_ENTRIES_PER_BLOCK;
+	if (super->inode_count % EXPORT_ENTRIES_PER_BLOCK)
+		count += 1;
+
+	rd->export_index = alloc_array(sizeof(sqfs_u64), count);
+	rd->export_blocks = alloc_array(sizeof(sqfs_u64 *), count);
+	if (rd->export_index == NULL || rd->export_blocks == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto fail;
+	}
+
+	rd->export_block_count = count;
+
+	ret = rd->file->read_at(rd->file, super->export_table_start,
+				rd->export_index, count * sizeof(sqfs_u64));
+	if (ret)
+		goto fail;
+
+	for (i = 0; i < count; ++i)
+		rd->export_index[i] = le64toh(rd->export_index[i]);
+
+	rd->meta_export = sqfs_meta_reader_create(rd->file, rd->cmp,
+						  super->directory_table_start,
+						  super->export_table_start);
+	if (rd->meta_export == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto fail;
+	}
+
+	return 0;
+fail:
+	export_cleanup(rd);
+	return ret;
+}
+
+static int export_load_block(sqfs_dir_reader_t *rd, size_t idx)
+{
+	size_t i, count = EXPORT_ENTRIES_PER_BLOCK;
+	sqfs_u64 *blk;
+	int ret;
+
+	if (idx == rd->export_block_count - 1 &&
+	    (rd->super->inode_count % EXPORT_ENTRIES_PER_BLOCK) != 0) {
+		count = rd->super->inode_count % EXPORT_ENTRIES_PER_BLOCK;
+	}
+
+	blk = alloc_array(sizeof(sqfs_u64), count);
+	if (blk == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	ret = sqfs_meta_reader_seek(rd->meta_export, rd->export_index[idx], 0);
+	if (ret == 0) {
+		ret = sqfs_meta_reader_read(rd->meta_export, blk,
+					    count * sizeof(sqfs_u64));
+	}
+
+	if (ret) {
+		free(blk);
+		return ret;
+	}
+
+	for (i = 0; i < count; ++i)
+		blk[i] = le64toh(blk[i]);
+
+	rd->export_blocks[idx] = blk;
+	return 0;
+}
+
+static int export_find(sqfs_dir_reader_t *rd, sqfs_u32 inode, sqfs_u64 *ref)
+{
+	size_t idx;
+	int ret;
+
+	if (inode < 1 || inode > rd->super->inode_count)
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (rd->export_index == NULL) {
+		ret = export_init(rd);
+		if (ret)
+			return ret;
+	}
+
+	idx = (inode - 1) / EXPORT_ENTRIES_PER_BLOCK;
+
+	if (rd->export_blocks[idx] == NULL) {
+		ret = export_load_block(rd, idx);
+		if (ret)
+			return ret;
+	}
+
+	*ref = rd->export_blocks[idx][(inode - 1) % EXPORT_ENTRIES_PER_BLOCK];
+	return 0;
+}
+
 static int dcache_find(sqfs_dir_reader_t *rd, sqfs_u32 inode, sqfs_u64 *ref)
 {
 	rbtree_node_t *node;
@@ -53,8 +177,13 @@ static int dcache_find(sqfs_dir_reader_t *rd, sqfs_u32 inode, sqfs_u64 *ref)
 		return SQFS_ERROR_NO_ENTRY;
 
 	node = rbtree_lookup(&rd->dcache, &inode);
-	if (node == NULL)
+	if (node == NULL) {
+		/* directories that were not visited yet */
+		if (rd->super->flags & SQFS_FLAG_EXPORTABLE)
+			return export_find(rd, inode, ref);
+
 		return SQFS_ERROR_NO_ENTRY;
+	}
 
 	*ref = *((sqfs_u64 *)rbtree_node_value(node));
 	return 0;
@@ -67,6 +196,8 @@ static void dir_reader_destroy(sqfs_object_t *obj)
 	if (rd->flags & SQFS_DIR_READER_DOT_ENTRIES)
 		rbtree_cleanup(&rd->dcache);
 
+	export_cleanup(rd);
+
 	sqfs_destroy(rd->meta_inode);
 	sqfs_destroy(rd->meta_dir);
 	free(rd);
@@ -82,6 +213,12 @@ static sqfs_object_t *dir_reader_copy(const sqfs_object_t *obj)
 
 	memcpy(copy, rd, sizeof(*copy));
 
+	/* the copy loads the export table again when it needs it */
+	copy->meta_export = NULL;
+	copy->export_index = NULL;
+	copy->export_blocks = NULL;
+	copy->export_block_count = 0;
+
 	if (rd->flags & SQFS_DIR_READER_DOT_ENTRIES) {
 		if (rbtree_copy(&rd->dcache, &copy->dcache))
 			goto fail_cache;
@@ -150,12 +287,28 @@ sqfs_dir_reader_t *sqfs_dir_reader_create(const sqfs_super_t *super,
 	if (rd->meta_dir == NULL)
 		goto fail_mdir;
 
+	if (flags & SQFS_DIR_READER_BLOCK_CACHE) {
+		if (sqfs_meta_reader_enable_cache(rd->meta_inode,
+						  DIR_READER_CACHE_BLOCKS)) {
+			goto fail_cache;
+		}
+
+		if (sqfs_meta_reader_enable_cache(rd->meta_dir,
+						  DIR_READER_CACHE_BLOCKS)) {
+			goto fail_cache;
+		}
+	}
+
 	((sqfs_object_t *)rd)->destroy = dir_reader_destroy;
 	((sqfs_object_t *)rd)->copy = dir_reader_copy;
 	rd->super = super;
 	rd->flags = flags;
 	rd->state = DIR_STATE_NONE;
+	rd->file = file;
+	rd->cmp = cmp;
 	return rd;
+fail_cache:
+	sqfs_destroy(rd->meta_dir);
 fail_mdir:
 	sqfs_destroy(rd->meta_inode);
 fail_mino:
@@ -253,6 +406,17 @@ int sqfs_dir_reader_read(sqfs_dir_reader_t *rd, sqfs_dir_entry_t **out)
 					out, NULL, &rd->ent_ref);
 }
 
+int sqfs_dir_reader_preload(sqfs_dir_reader_t *rd, size_t num_jobs)
+{
+	int ret;
+
+	ret = sqfs_meta_reader_preload(rd->meta_inode, num_jobs);
+	if (ret)
+		return ret;
+
+	return sqfs_meta_reader_preload(rd->meta_dir, num_jobs);
+}
+
 int sqfs_dir_reader_rewind(sqfs_dir_reader_t *rd)
 {
 	if (rd->state == DIR_STATE_NONE)
@@ -300,6 +464,21 @@ int sqfs_dir_reader_get_inode(sqfs_dir_reader_t *rd,
 	return dcache_add(rd, *inode, rd->ent_ref);
 }
 
+int dir_reader_get_inode_into(sqfs_dir_reader_t *rd, sqfs_u64 ref,
+			      const inode_alloc_t *alloc,
+			      sqfs_inode_generic_t **inode)
+{
+	int ret;
+
+	ret = sqfs_meta_reader_read_inode_into(rd->meta_inode, rd->super,
+					       ref >> 16, ref & 0x0FFFF,
+					       alloc, inode);
+	if (ret != 0)
+		return ret;
+
+	return dcache_add(rd, *inode, ref);
+}
+
 int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 				   sqfs_inode_generic_t **inode)
 {
@@ -315,6 +494,31 @@ int sqfs_dir_reader_get_root_inode(sqfs_dir_reader_t *rd,
 	return dcache_add(rd, *inode, rd->super->root_inode_ref);
 }
 
+int sqfs_dir_reader_get_inode_by_number(sqfs_dir_reader_t *rd,
+					sqfs_u32 inode_number,
+					sqfs_inode_generic_t **inode)
+{
+	sqfs_u64 ref;
+	int ret;
+
+	ret = export_find(rd, inode_number, &ref);
+	if (ret != 0)
+		return ret;
+
+	ret = sqfs_meta_reader_read_inode(rd->meta_inode, rd->super,
+					  ref >> 16, ref & 0x0FFFF, inode);
+	if (ret != 0)
+		return ret;
+
+	if ((*inode)->base.inode_number != inode_number) {
+		free(*inode);
+		*inode = NULL;
+		return SQFS_ERROR_CORRUPTED;
+	}
+
+	return dcache_add(rd, *inode, ref);
+}
+
 int sqfs_dir_reader_find_by_path(sqfs_dir_reader_t *rd,
 				 const sqfs_inode_generic_t *start,
 				 const char *path, sqfs_inode_generic_t **out)
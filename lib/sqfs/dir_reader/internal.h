@@ -16,13 +16,21 @@
 #include "sqfs/super.h"
 #include "sqfs/inode.h"
 #include "sqfs/error.h"
+#include "sqfs/block.h"
 #include "sqfs/dir.h"
+#include "sqfs/io.h"
+#include "../read_inode.h"
+#include "../readdir.h"
 #include "rbtree.h"
 #include "util.h"
 
 #include <string.h>
 #include <stdlib.h>
 
+#define DIR_READER_CACHE_BLOCKS (16)
+
+#define EXPORT_ENTRIES_PER_BLOCK (SQFS_META_BLOCK_SIZE / sizeof(sqfs_u64))
+
 enum {
 	DIR_STATE_NONE = 0,
 	DIR_STATE_OPENED = 1,
@@ -47,6 +55,23 @@ struct sqfs_dir_reader_t {
 	sqfs_u64 cur_ref;
 	sqfs_u64 ent_ref;
 	rbtree_t dcache;
+
+	/* export table, loaded on demand one meta data block at a time */
+	sqfs_file_t *file;
+	sqfs_compressor_t *cmp;
+	sqfs_meta_reader_t *meta_export;
+	sqfs_u64 *export_index;
+	sqfs_u64 **export_blocks;
+	size_t export_block_count;
 };
 
+/*
+  Read the inode with the given reference, like sqfs_dir_reader_get_inode,
+  using a custom allocator.
+ */
+SQFS_INTERNAL int dir_reader_get_inode_into(sqfs_dir_reader_t *rd,
+					    sqfs_u64 ref,
+					    const inode_alloc_t *alloc,
+					    sqfs_inode_generic_t **inode);
+
 #endif /* DIR_READER_INTERNAL_H */
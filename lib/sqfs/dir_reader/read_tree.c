@@ -7,6 +7,106 @@
 #define SQFS_BUILDING_DLL
 #include "internal.h"
 
+/* Size of a regular arena chunk. Larger allocations get their own chunk. */
+#define TREE_ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Every arena allocation is rounded up to a multiple of this. */
+#define TREE_ARENA_ALIGN (sizeof(sqfs_u64))
+
+typedef struct tree_chunk_t {
+	struct tree_chunk_t *next;
+
+	union {
+		sqfs_u64 align;
+		sqfs_u8 data[1];
+	} payload;
+} tree_chunk_t;
+
+/*
+  A bump allocator for the nodes, names and inodes of a tree loaded by
+  sqfs_dir_reader_get_full_hierarchy. Memory is never given back
+  individually, instead the arena counts the nodes allocated from it and
+  releases everything at once when the last one is destroyed.
+ */
+typedef struct {
+	size_t refcount;
+
+	tree_chunk_t *chunks;
+	size_t used;
+	size_t avail;
+} tree_arena_t;
+
+/*
+  Hidden header in front of every tree node, so that any node, e.g. after
+  moving sub trees around or destroying them individually, can find the
+  arena it belongs to.
+ */
+typedef union {
+	tree_arena_t *arena;
+	sqfs_u64 align;
+} node_header_t;
+
+static tree_arena_t *arena_create(void)
+{
+	return calloc(1, sizeof(tree_arena_t));
+}
+
+static void arena_destroy(tree_arena_t *arena)
+{
+	tree_chunk_t *chunk;
+
+	while (arena->chunks != NULL) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
+
+static void *arena_alloc(tree_arena_t *arena, size_t size)
+{
+	tree_chunk_t *chunk;
+	void *ptr;
+
+	if (SZ_ADD_OV(size, TREE_ARENA_ALIGN - 1, &size))
+		return NULL;
+
+	size -= size % TREE_ARENA_ALIGN;
+
+	if (size > (TREE_ARENA_CHUNK_SIZE / 4)) {
+		chunk = alloc_flex(sizeof(*chunk), 1, size);
+		if (chunk == NULL)
+			return NULL;
+
+		/* keep the current chunk on top */
+		if (arena->chunks == NULL) {
+			chunk->next = NULL;
+			arena->chunks = chunk;
+		} else {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+
+		return chunk->payload.data;
+	}
+
+	if (arena->chunks == NULL || size > (arena->avail - arena->used)) {
+		chunk = alloc_flex(sizeof(*chunk), 1, TREE_ARENA_CHUNK_SIZE);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->used = 0;
+		arena->avail = TREE_ARENA_CHUNK_SIZE;
+	}
+
+	ptr = arena->chunks->payload.data + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
 static int should_skip(int type, unsigned int flags)
 {
 	switch (type) {
@@ -45,59 +145,98 @@ static bool would_be_own_parent(sqfs_tree_node_t *parent, sqfs_tree_node_t *n)
 	return false;
 }
 
-static sqfs_tree_node_t *create_node(sqfs_inode_generic_t *inode,
-				     const char *name)
+static void *inode_alloc(void *user, size_t size)
 {
+	void *ptr = arena_alloc(user, size);
+
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+
+	return ptr;
+}
+
+static void release_node(sqfs_tree_node_t *n)
+{
+	tree_arena_t *arena = ((node_header_t *)n - 1)->arena;
+
+	arena->refcount -= 1;
+
+	if (arena->refcount == 0)
+		arena_destroy(arena);
+}
+
+/*
+  Decode the inode with the given reference straight into the arena. If that
+  fails, the memory stays in the arena until it is destroyed.
+ */
+static int create_node(sqfs_dir_reader_t *rd, tree_arena_t *arena,
+		       sqfs_u64 ref, const char *name, sqfs_tree_node_t **out)
+{
+	inode_alloc_t alloc = { inode_alloc, NULL, arena };
+	size_t name_len = strlen(name);
+	node_header_t *hdr;
 	sqfs_tree_node_t *n;
+	int ret;
 
-	n = alloc_flex(sizeof(*n), 1, strlen(name) + 1);
-	if (n == NULL)
-		return NULL;
+	hdr = arena_alloc(arena, sizeof(*hdr) + sizeof(*n) + name_len + 1);
+	if (hdr == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	n = (sqfs_tree_node_t *)(hdr + 1);
+	memset(n, 0, sizeof(*n));
+	memcpy(n->name, name, name_len + 1);
+
+	ret = dir_reader_get_inode_into(rd, ref, &alloc, &n->inode);
+	if (ret != 0)
+		return ret;
+
+	hdr->arena = arena;
+	arena->refcount += 1;
+	*out = n;
+	return 0;
+}
+
+static int read_entry(sqfs_dir_reader_t *rd, sqfs_dir_entry_t *ent)
+{
+	if (rd->state != DIR_STATE_ENTRIES)
+		return SQFS_ERROR_SEQUENCE;
 
-	n->inode = inode;
-	strcpy((char *)n->name, name);
-	return n;
+	return sqfs_meta_reader_readdir_into(rd->meta_dir, &rd->it, ent,
+					     SQFS_MAX_DIR_ENT, NULL,
+					     &rd->ent_ref);
 }
 
-static int fill_dir(sqfs_dir_reader_t *dr, sqfs_tree_node_t *root,
-		    unsigned int flags)
+typedef union {
+	sqfs_dir_entry_t ent;
+	sqfs_u8 raw[sizeof(sqfs_dir_entry_t) + SQFS_MAX_DIR_ENT + 1];
+} dir_entry_buffer_t;
+
+static int fill_dir(sqfs_dir_reader_t *dr, tree_arena_t *arena,
+		    sqfs_tree_node_t *root, unsigned int flags)
 {
 	sqfs_tree_node_t *n, *prev, **tail;
-	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
+	dir_entry_buffer_t buffer;
 	int err;
 
 	tail = &root->children;
 
 	for (;;) {
-		err = sqfs_dir_reader_read(dr, &ent);
+		err = read_entry(dr, &buffer.ent);
 		if (err > 0)
 			break;
 		if (err < 0)
 			return err;
 
-		if (should_skip(ent->type, flags)) {
-			free(ent);
+		if (should_skip(buffer.ent.type, flags))
 			continue;
-		}
 
-		err = sqfs_dir_reader_get_inode(dr, &inode);
-		if (err) {
-			free(ent);
+		err = create_node(dr, arena, dr->ent_ref,
+				  (const char *)buffer.ent.name, &n);
+		if (err)
 			return err;
-		}
-
-		n = create_node(inode, (const char *)ent->name);
-		free(ent);
-
-		if (n == NULL) {
-			free(inode);
-			return SQFS_ERROR_ALLOC;
-		}
 
 		if (would_be_own_parent(root, n)) {
-			free(n);
-			free(inode);
+			release_node(n);
 			return SQFS_ERROR_LINK_LOOP;
 		}
 
@@ -118,21 +257,20 @@ static int fill_dir(sqfs_dir_reader_t *dr, sqfs_tree_node_t *root,
 				if (err)
 					return err;
 
-				err = fill_dir(dr, n, flags);
+				err = fill_dir(dr, arena, n, flags);
 				if (err)
 					return err;
 			}
 
 			if (n->children == NULL &&
 			    (flags & SQFS_TREE_NO_EMPTY)) {
-				free(n->inode);
 				if (prev == NULL) {
 					root->children = root->children->next;
-					free(n);
+					release_node(n);
 					n = root->children;
 				} else {
 					prev->next = n->next;
-					free(n);
+					release_node(n);
 					n = prev->next;
 				}
 				continue;
@@ -177,8 +315,7 @@ void sqfs_dir_tree_destroy(sqfs_tree_node_t *root)
 		sqfs_dir_tree_destroy(it);
 	}
 
-	free(root->inode);
-	free(root);
+	release_node(root);
 }
 
 int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
@@ -187,24 +324,25 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 				       sqfs_tree_node_t **out)
 {
 	sqfs_tree_node_t *root, *tail, *new;
-	sqfs_inode_generic_t *inode;
-	sqfs_dir_entry_t *ent;
+	dir_entry_buffer_t buffer;
+	tree_arena_t *arena;
 	const char *ptr;
 	int ret;
 
 	if (flags & ~SQFS_TREE_ALL_FLAGS)
 		return SQFS_ERROR_UNSUPPORTED;
 
-	ret = sqfs_dir_reader_get_root_inode(rd, &inode);
-	if (ret)
-		return ret;
-
-	root = tail = create_node(inode, "");
-	if (root == NULL) {
-		free(inode);
+	arena = arena_create();
+	if (arena == NULL)
 		return SQFS_ERROR_ALLOC;
+
+	ret = create_node(rd, arena, rd->super->root_inode_ref, "", &root);
+	if (ret) {
+		arena_destroy(arena);
+		return ret;
 	}
-	inode = NULL;
+
+	tail = root;
 
 	while (path != NULL && *path != '\0') {
 		if (*path == '/') {
@@ -221,7 +359,7 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 		ptr = strchrnul(path, '/');
 
 		for (;;) {
-			ret = sqfs_dir_reader_read(rd, &ent);
+			ret = read_entry(rd, &buffer.ent);
 			if (ret < 0)
 				goto fail;
 			if (ret > 0) {
@@ -229,29 +367,17 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 				goto fail;
 			}
 
-			ret = strncmp((const char *)ent->name,
+			ret = strncmp((const char *)buffer.ent.name,
 				      path, ptr - path);
-			if (ret == 0 && ent->name[ptr - path] == '\0')
+			if (ret == 0 && buffer.ent.name[ptr - path] == '\0')
 				break;
-			free(ent);
 		}
 
-		ret = sqfs_dir_reader_get_inode(rd, &inode);
-		if (ret) {
-			free(ent);
-			goto fail;
-		}
-
-		new = create_node(inode, (const char *)ent->name);
-		free(ent);
-
-		if (new == NULL) {
-			free(inode);
-			ret = SQFS_ERROR_ALLOC;
+		ret = create_node(rd, arena, rd->ent_ref,
+				  (const char *)buffer.ent.name, &new);
+		if (ret)
 			goto fail;
-		}
 
-		inode = NULL;
 		path = ptr;
 
 		if (flags & SQFS_TREE_STORE_PARENTS) {
@@ -271,7 +397,7 @@ int sqfs_dir_reader_get_full_hierarchy(sqfs_dir_reader_t *rd,
 		if (ret)
 			goto fail;
 
-		ret = fill_dir(rd, tail, flags);
+		ret = fill_dir(rd, arena, tail, flags);
 		if (ret)
 			goto fail;
 	}
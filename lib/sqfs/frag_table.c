@@ -45,6 +45,8 @@ static sqfs_object_t *frag_table_copy(const sqfs_object_t *obj)
 		return NULL;
 	}
 
+	((sqfs_object_t *)copy)->copy = frag_table_copy;
+	((sqfs_object_t *)copy)->destroy = frag_table_destroy;
 	return (sqfs_object_t *)copy;
 }
 
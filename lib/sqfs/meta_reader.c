@@ -12,11 +12,82 @@
 #include "sqfs/error.h"
 #include "sqfs/block.h"
 #include "sqfs/io.h"
+#include "threadpool.h"
+#include "mutex.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+typedef struct {
+	/* The location of the block in the image, ~0 if the slot is unused */
+	sqfs_u64 block_offset;
+
+	/* The location of the next block after this one */
+	sqfs_u64 next_block;
+
+	/* Last time this block was used, for LRU eviction */
+	sqfs_u64 last_use;
+
+	size_t data_used;
+
+	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
+} cache_entry_t;
+
+/* An LRU cache of uncompressed blocks, shared by a reader and its copies */
+typedef struct {
+	pthread_mutex_t mtx;
+
+	size_t refcount;
+
+	/* Incremented on every access, used as LRU time stamp */
+	sqfs_u64 use_counter;
+
+	size_t num_entries;
+	cache_entry_t entries[];
+} meta_cache_t;
+
+/* Number of blocks a preload worker unpacks per work item */
+#define PRELOAD_BLOCKS_PER_JOB (64)
+
+typedef struct {
+	/* The location of the block in the image */
+	sqfs_u64 block_offset;
+
+	/* The location of the next block after this one */
+	sqfs_u64 next_block;
+
+	/* Size of the uncompressed data, 0 if unpacking failed */
+	size_t data_used;
+} preload_entry_t;
+
+/*
+  The fully unpacked contents of the area covered by a reader, shared by
+  a reader and its copies. Read only after creation.
+ */
+typedef struct {
+	pthread_mutex_t mtx;
+
+	size_t refcount;
+
+	size_t num_blocks;
+	preload_entry_t *blocks;
+
+	/* num_blocks slots of SQFS_META_BLOCK_SIZE bytes each */
+	sqfs_u8 *data;
+} meta_preload_t;
+
+typedef struct {
+	meta_preload_t *preload;
+
+	/* The raw, on-disk data of the region and its location */
+	const sqfs_u8 *raw;
+	sqfs_u64 raw_start;
+
+	size_t first;
+	size_t count;
+} preload_job_t;
+
 struct sqfs_meta_reader_t {
 	sqfs_object_t base;
 
@@ -39,6 +110,17 @@ struct sqfs_meta_reader_t {
 	/* A pointer to the compressor to use for extracting data */
 	sqfs_compressor_t *cmp;
 
+	/* An optional cache of recently used blocks */
+	meta_cache_t *cache;
+
+	/* If not NULL, all blocks have been unpacked in advance */
+	meta_preload_t *preload;
+
+	/* Points to the uncompressed data of the current block */
+	const sqfs_u8 *current;
+
+	sqfs_meta_reader_stats_t stats;
+
 	/* The raw data read from the input file */
 	sqfs_u8 data[SQFS_META_BLOCK_SIZE];
 
@@ -46,8 +128,328 @@ struct sqfs_meta_reader_t {
 	sqfs_u8 scratch[SQFS_META_BLOCK_SIZE];
 };
 
-static void meta_reader_destroy(sqfs_object_t *m)
+static meta_cache_t *cache_create(size_t num_entries)
+{
+	meta_cache_t *cache;
+	size_t i;
+
+	cache = alloc_flex(sizeof(*cache), sizeof(cache->entries[0]),
+			   num_entries);
+	if (cache == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&cache->mtx, NULL) != 0) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->refcount = 1;
+	cache->use_counter = 0;
+	cache->num_entries = num_entries;
+
+	for (i = 0; i < num_entries; ++i) {
+		cache->entries[i].block_offset = 0xFFFFFFFFFFFFFFFFUL;
+		cache->entries[i].last_use = 0;
+	}
+
+	return cache;
+}
+
+static void cache_grab(meta_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->mtx);
+	cache->refcount += 1;
+	pthread_mutex_unlock(&cache->mtx);
+}
+
+static void cache_drop(meta_cache_t *cache)
+{
+	size_t refcount;
+
+	pthread_mutex_lock(&cache->mtx);
+	refcount = --cache->refcount;
+	pthread_mutex_unlock(&cache->mtx);
+
+	if (refcount == 0) {
+		pthread_mutex_destroy(&cache->mtx);
+		free(cache);
+	}
+}
+
+static bool cache_fetch(sqfs_meta_reader_t *m, sqfs_u64 block_start)
+{
+	meta_cache_t *cache = m->cache;
+	cache_entry_t *ent;
+	bool found = false;
+	size_t i;
+
+	pthread_mutex_lock(&cache->mtx);
+
+	for (i = 0; i < cache->num_entries; ++i) {
+		ent = cache->entries + i;
+
+		if (ent->block_offset == block_start) {
+			ent->last_use = ++cache->use_counter;
+
+			memcpy(m->data, ent->data, ent->data_used);
+			m->data_used = ent->data_used;
+			m->next_block = ent->next_block;
+			found = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&cache->mtx);
+
+	if (found) {
+		m->stats.cache_hits += 1;
+	} else {
+		m->stats.cache_misses += 1;
+	}
+
+	return found;
+}
+
+static void cache_store(sqfs_meta_reader_t *m, sqfs_u64 block_start)
+{
+	meta_cache_t *cache = m->cache;
+	cache_entry_t *ent, *victim;
+	size_t i;
+
+	pthread_mutex_lock(&cache->mtx);
+
+	victim = cache->entries;
+
+	for (i = 0; i < cache->num_entries; ++i) {
+		ent = cache->entries + i;
+
+		/* a copy sharing the cache may have raced us */
+		if (ent->block_offset == block_start) {
+			victim = ent;
+			break;
+		}
+
+		if (ent->last_use < victim->last_use)
+			victim = ent;
+	}
+
+	if (victim->block_offset != 0xFFFFFFFFFFFFFFFFUL &&
+	    victim->block_offset != block_start) {
+		m->stats.cache_evictions += 1;
+	}
+
+	victim->block_offset = block_start;
+	victim->next_block = m->next_block;
+	victim->data_used = m->data_used;
+	victim->last_use = ++cache->use_counter;
+	memcpy(victim->data, m->data, m->data_used);
+
+	pthread_mutex_unlock(&cache->mtx);
+}
+
+static void preload_grab(meta_preload_t *preload)
+{
+	pthread_mutex_lock(&preload->mtx);
+	preload->refcount += 1;
+	pthread_mutex_unlock(&preload->mtx);
+}
+
+static void preload_drop(meta_preload_t *preload)
+{
+	size_t refcount;
+
+	pthread_mutex_lock(&preload->mtx);
+	refcount = --preload->refcount;
+	pthread_mutex_unlock(&preload->mtx);
+
+	if (refcount == 0) {
+		pthread_mutex_destroy(&preload->mtx);
+		free(preload->blocks);
+		free(preload->data);
+		free(preload);
+	}
+}
+
+static const preload_entry_t *preload_find(const meta_preload_t *preload,
+					    sqfs_u64 block_start)
+{
+	size_t first = 0, last = preload->num_blocks;
+
+	while (first < last) {
+		size_t i = first + (last - first) / 2;
+		const preload_entry_t *ent = preload->blocks + i;
+
+		if (ent->block_offset == block_start)
+			return ent->data_used > 0 ? ent : NULL;
+
+		if (ent->block_offset < block_start) {
+			first = i + 1;
+		} else {
+			last = i;
+		}
+	}
+
+	return NULL;
+}
+
+static int preload_worker(void *user, void *work_item)
+{
+	sqfs_compressor_t *cmp = user;
+	preload_job_t *job = work_item;
+	meta_preload_t *preload = job->preload;
+	const sqfs_u8 *src;
+	preload_entry_t *ent;
+	sqfs_u8 *dst;
+	sqfs_u16 header;
+	sqfs_u32 size;
+	sqfs_s32 ret;
+	size_t i;
+
+	for (i = job->first; i < (job->first + job->count); ++i) {
+		ent = preload->blocks + i;
+		src = job->raw + (ent->block_offset - job->raw_start);
+		dst = preload->data + i * SQFS_META_BLOCK_SIZE;
+
+		memcpy(&header, src, sizeof(header));
+		header = le16toh(header);
+		size = header & 0x7FFF;
+
+		if (header & 0x8000) {
+			memcpy(dst, src + 2, size);
+			ent->data_used = size;
+			continue;
+		}
+
+		/* on failure, the block is loaded (and reported) on demand */
+		ret = cmp->do_block(cmp, src + 2, size,
+				    dst, SQFS_META_BLOCK_SIZE);
+		ent->data_used = ret > 0 ? ret : 0;
+	}
+
+	return 0;
+}
+
+static size_t preload_count_blocks(const sqfs_u8 *raw, size_t size,
+				   sqfs_u64 raw_start,
+				   preload_entry_t *blocks)
+{
+	size_t offset = 0, count = 0;
+	sqfs_u16 header;
+	sqfs_u32 disk_size;
+
+	while ((size - offset) > sizeof(header)) {
+		memcpy(&header, raw + offset, sizeof(header));
+		disk_size = le16toh(header) & 0x7FFF;
+
+		/* stop at the first thing that doesn't look like a block */
+		if (disk_size == 0 || disk_size > SQFS_META_BLOCK_SIZE)
+			break;
+
+		if (disk_size > (size - offset - sizeof(header)))
+			break;
+
+		if (blocks != NULL) {
+			blocks[count].block_offset = raw_start + offset;
+			blocks[count].next_block = raw_start + offset +
+				sizeof(header) + disk_size;
+			blocks[count].data_used = 0;
+		}
+
+		offset += sizeof(header) + disk_size;
+		++count;
+	}
+
+	return count;
+}
+
+static int preload_unpack(sqfs_meta_reader_t *m, meta_preload_t *preload,
+			  const sqfs_u8 *raw, size_t num_jobs)
+{
+	sqfs_compressor_t **workers = NULL;
+	preload_job_t *jobs = NULL;
+	size_t i, num_workers, job_count;
+	thread_pool_t *pool;
+	int ret;
+
+	pool = thread_pool_create(num_jobs < 1 ? 1 : num_jobs, preload_worker);
+	if (pool == NULL)
+		return SQFS_ERROR_INTERNAL;
+
+	num_workers = pool->get_worker_count(pool);
+
+	workers = alloc_array(sizeof(workers[0]), num_workers);
+	if (workers == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out;
+	}
+
+	for (i = 0; i < num_workers; ++i) {
+		workers[i] = sqfs_copy(m->cmp);
+		if (workers[i] == NULL) {
+			ret = SQFS_ERROR_ALLOC;
+			goto out;
+		}
+
+		pool->set_worker_ptr(pool, i, workers[i]);
+	}
+
+	job_count = preload->num_blocks / PRELOAD_BLOCKS_PER_JOB;
+	if (preload->num_blocks % PRELOAD_BLOCKS_PER_JOB)
+		++job_count;
+
+	jobs = alloc_array(sizeof(jobs[0]), job_count);
+	if (jobs == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out;
+	}
+
+	for (i = 0; i < job_count; ++i) {
+		jobs[i].preload = preload;
+		jobs[i].raw = raw;
+		jobs[i].raw_start = m->start;
+		jobs[i].first = i * PRELOAD_BLOCKS_PER_JOB;
+		jobs[i].count = preload->num_blocks - jobs[i].first;
+
+		if (jobs[i].count > PRELOAD_BLOCKS_PER_JOB)
+			jobs[i].count = PRELOAD_BLOCKS_PER_JOB;
+
+		ret = pool->submit(pool, jobs + i);
+		if (ret != 0) {
+			ret = SQFS_ERROR_INTERNAL;
+			goto out;
+		}
+	}
+
+	while (pool->dequeue(pool) != NULL)
+		;
+
+	ret = pool->get_status(pool);
+out:
+	/* XXX: shut down the pool first before cleaning up the worker data */
+	pool->destroy(pool);
+
+	if (workers != NULL) {
+		for (i = 0; i < num_workers; ++i) {
+			if (workers[i] != NULL)
+				sqfs_destroy(workers[i]);
+		}
+	}
+
+	free(workers);
+	free(jobs);
+	return ret;
+}
+
+static void meta_reader_destroy(sqfs_object_t *obj)
 {
+	sqfs_meta_reader_t *m = (sqfs_meta_reader_t *)obj;
+
+	if (m->cache != NULL)
+		cache_drop(m->cache);
+
+	if (m->preload != NULL)
+		preload_drop(m->preload);
+
 	free(m);
 }
 
@@ -58,6 +460,15 @@ static sqfs_object_t *meta_reader_copy(const sqfs_object_t *obj)
 
 	if (copy != NULL) {
 		memcpy(copy, m, sizeof(*m));
+
+		if (copy->cache != NULL)
+			cache_grab(copy->cache);
+
+		if (copy->preload != NULL)
+			preload_grab(copy->preload);
+
+		if (m->current == m->data)
+			copy->current = copy->data;
 	}
 
 	/* XXX: cmp and file aren't deep-copied because m
@@ -77,6 +488,8 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 	((sqfs_object_t *)m)->copy = meta_reader_copy;
 	((sqfs_object_t *)m)->destroy = meta_reader_destroy;
 	m->block_offset = 0xFFFFFFFFFFFFFFFFUL;
+	m->current = m->data;
+	m->stats.size = sizeof(m->stats);
 	m->start = start;
 	m->limit = limit;
 	m->file = file;
@@ -84,6 +497,109 @@ sqfs_meta_reader_t *sqfs_meta_reader_create(sqfs_file_t *file,
 	return m;
 }
 
+int sqfs_meta_reader_enable_cache(sqfs_meta_reader_t *m, size_t num_blocks)
+{
+	meta_cache_t *cache = NULL;
+
+	if (num_blocks > 0) {
+		cache = cache_create(num_blocks);
+		if (cache == NULL)
+			return SQFS_ERROR_ALLOC;
+	}
+
+	if (m->cache != NULL)
+		cache_drop(m->cache);
+
+	m->cache = cache;
+	return 0;
+}
+
+int sqfs_meta_reader_preload(sqfs_meta_reader_t *m, size_t num_jobs)
+{
+	meta_preload_t *preload;
+	size_t size, count;
+	sqfs_u8 *raw;
+	int ret;
+
+	if (m->limit <= m->start)
+		return 0;
+
+	if ((m->limit - m->start) > (sqfs_u64)((size_t)-1))
+		return SQFS_ERROR_OVERFLOW;
+
+	size = m->limit - m->start;
+
+	raw = malloc(size);
+	if (raw == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	ret = m->file->read_at(m->file, m->start, raw, size);
+	if (ret != 0)
+		goto out_raw;
+
+	preload = calloc(1, sizeof(*preload));
+	if (preload == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out_raw;
+	}
+
+	if (pthread_mutex_init(&preload->mtx, NULL) != 0) {
+		free(preload);
+		ret = SQFS_ERROR_INTERNAL;
+		goto out_raw;
+	}
+
+	preload->refcount = 1;
+
+	count = preload_count_blocks(raw, size, m->start, NULL);
+	if (count == 0) {
+		preload_drop(preload);
+		ret = 0;
+		goto out_raw;
+	}
+
+	preload->num_blocks = count;
+	preload->blocks = alloc_array(sizeof(preload->blocks[0]), count);
+	preload->data = alloc_array(SQFS_META_BLOCK_SIZE, count);
+
+	if (preload->blocks == NULL || preload->data == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out_preload;
+	}
+
+	preload_count_blocks(raw, size, m->start, preload->blocks);
+
+	ret = preload_unpack(m, preload, raw, num_jobs);
+	if (ret != 0)
+		goto out_preload;
+
+	/* a copy may still reference the old block via m->current */
+	if (m->preload != NULL) {
+		if (m->current != m->data) {
+			m->block_offset = 0xFFFFFFFFFFFFFFFFUL;
+			m->current = m->data;
+		}
+
+		preload_drop(m->preload);
+	}
+
+	m->preload = preload;
+	m->stats.blocks_loaded += count;
+	free(raw);
+	return 0;
+out_preload:
+	preload_drop(preload);
+out_raw:
+	free(raw);
+	return ret;
+}
+
+const sqfs_meta_reader_stats_t
+*sqfs_meta_reader_get_stats(const sqfs_meta_reader_t *m)
+{
+	return &m->stats;
+}
+
 int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 			  size_t offset)
 {
@@ -104,6 +620,29 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		return 0;
 	}
 
+	if (m->preload != NULL) {
+		const preload_entry_t *ent;
+
+		ent = preload_find(m->preload, block_start);
+
+		if (ent != NULL) {
+			m->block_offset = 0xFFFFFFFFFFFFFFFFUL;
+			m->current = m->preload->data +
+				(ent - m->preload->blocks) *
+				SQFS_META_BLOCK_SIZE;
+			m->data_used = ent->data_used;
+			m->next_block = ent->next_block;
+			goto out;
+		}
+	}
+
+	/* the current block is about to be overwritten */
+	m->block_offset = 0xFFFFFFFFFFFFFFFFUL;
+	m->current = m->data;
+
+	if (m->cache != NULL && cache_fetch(m, block_start))
+		goto out;
+
 	err = m->file->read_at(m->file, block_start, &header, 2);
 	if (err)
 		return err;
@@ -135,11 +674,16 @@ int sqfs_meta_reader_seek(sqfs_meta_reader_t *m, sqfs_u64 block_start,
 		m->data_used = size;
 	}
 
+	m->next_block = block_start + size + 2;
+	m->stats.blocks_loaded += 1;
+
+	if (m->cache != NULL)
+		cache_store(m, block_start);
+out:
 	if (offset >= m->data_used)
 		return SQFS_ERROR_OUT_OF_BOUNDS;
 
 	m->block_offset = block_start;
-	m->next_block = block_start + size + 2;
 	m->offset = offset;
 	return 0;
 }
@@ -174,7 +718,7 @@ int sqfs_meta_reader_read(sqfs_meta_reader_t *m, void *data, size_t size)
 		if (diff > size)
 			diff = size;
 
-		memcpy(data, m->data + m->offset, diff);
+		memcpy(data, m->current + m->offset, diff);
 
 		m->offset += diff;
 		data = (char *)data + diff;
@@ -12,11 +12,11 @@
 #include "sqfs/super.h"
 #include "sqfs/inode.h"
 #include "sqfs/dir.h"
+#include "read_inode.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 
 #define SWAB16(x) x = le16toh(x)
 #define SWAB32(x) x = le32toh(x)
@@ -62,6 +62,48 @@ static int set_mode(sqfs_inode_t *inode)
 	return 0;
 }
 
+static void *default_alloc(void *user, size_t size)
+{
+	(void)user;
+	return calloc(1, size);
+}
+
+static void default_release(void *user, void *ptr)
+{
+	(void)user;
+	free(ptr);
+}
+
+static const inode_alloc_t default_allocator = {
+	default_alloc,
+	default_release,
+	NULL,
+};
+
+static int alloc_inode(const inode_alloc_t *alloc, sqfs_u64 payload,
+		       sqfs_inode_generic_t **out)
+{
+	size_t size;
+
+	if (payload > (sqfs_u64)(~((size_t)0)) ||
+	    SZ_ADD_OV(sizeof(**out), (size_t)payload, &size)) {
+		return SQFS_ERROR_OVERFLOW;
+	}
+
+	*out = alloc->alloc(alloc->user, size);
+	if (*out == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	return 0;
+}
+
+static void release_inode(const inode_alloc_t *alloc,
+			  sqfs_inode_generic_t *inode)
+{
+	if (alloc->release != NULL)
+		alloc->release(alloc->user, inode);
+}
+
 static sqfs_u64 get_block_count(sqfs_u64 size, sqfs_u64 block_size,
 				sqfs_u32 frag_index, sqfs_u32 frag_offset)
 {
@@ -76,7 +118,8 @@ static sqfs_u64 get_block_count(sqfs_u64 size, sqfs_u64 block_size,
 }
 
 static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
-			   size_t block_size, sqfs_inode_generic_t **result)
+			   size_t block_size, const inode_alloc_t *alloc,
+			   sqfs_inode_generic_t **result)
 {
 	sqfs_inode_generic_t *out;
 	sqfs_inode_file_t file;
@@ -95,9 +138,12 @@ static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	count = get_block_count(file.file_size, block_size,
 				file.fragment_index, file.fragment_offset);
 
-	out = alloc_flex(sizeof(*out), sizeof(sqfs_u32), count);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	if (count > ((sqfs_u64)(~((size_t)0)) / sizeof(sqfs_u32)))
+		return SQFS_ERROR_OVERFLOW;
+
+	err = alloc_inode(alloc, count * sizeof(sqfs_u32), &out);
+	if (err)
+		return err;
 
 	out->base = *base;
 	out->data.file = file;
@@ -106,7 +152,7 @@ static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 
 	err = sqfs_meta_reader_read(ir, out->extra, count * sizeof(sqfs_u32));
 	if (err) {
-		free(out);
+		release_inode(alloc, out);
 		return err;
 	}
 
@@ -118,7 +164,8 @@ static int read_inode_file(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 }
 
 static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
-			       size_t block_size, sqfs_inode_generic_t **result)
+			       size_t block_size, const inode_alloc_t *alloc,
+			       sqfs_inode_generic_t **result)
 {
 	sqfs_inode_file_ext_t file;
 	sqfs_inode_generic_t *out;
@@ -140,11 +187,12 @@ static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	count = get_block_count(file.file_size, block_size,
 				file.fragment_idx, file.fragment_offset);
 
-	out = alloc_flex(sizeof(*out), sizeof(sqfs_u32), count);
-	if (out == NULL) {
-		return errno == EOVERFLOW ? SQFS_ERROR_OVERFLOW :
-			SQFS_ERROR_ALLOC;
-	}
+	if (count > ((sqfs_u64)(~((size_t)0)) / sizeof(sqfs_u32)))
+		return SQFS_ERROR_OVERFLOW;
+
+	err = alloc_inode(alloc, count * sizeof(sqfs_u32), &out);
+	if (err)
+		return err;
 
 	out->base = *base;
 	out->data.file_ext = file;
@@ -153,7 +201,7 @@ static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 
 	err = sqfs_meta_reader_read(ir, out->extra, count * sizeof(sqfs_u32));
 	if (err) {
-		free(out);
+		release_inode(alloc, out);
 		return err;
 	}
 
@@ -165,11 +213,11 @@ static int read_inode_file_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 }
 
 static int read_inode_slink(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
+			    const inode_alloc_t *alloc,
 			    sqfs_inode_generic_t **result)
 {
 	sqfs_inode_generic_t *out;
 	sqfs_inode_slink_t slink;
-	size_t size;
 	int err;
 
 	err = sqfs_meta_reader_read(ir, &slink, sizeof(slink));
@@ -179,23 +227,18 @@ static int read_inode_slink(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	SWAB32(slink.nlink);
 	SWAB32(slink.target_size);
 
-	if (SZ_ADD_OV(slink.target_size, 1, &size) ||
-	    SZ_ADD_OV(sizeof(*out), size, &size)) {
-		return SQFS_ERROR_OVERFLOW;
-	}
-
-	out = calloc(1, size);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	err = alloc_inode(alloc, (sqfs_u64)slink.target_size + 1, &out);
+	if (err)
+		return err;
 
-	out->payload_bytes_available = size - sizeof(*out);
-	out->payload_bytes_used = size - sizeof(*out) - 1;
+	out->payload_bytes_available = slink.target_size + 1;
+	out->payload_bytes_used = slink.target_size;
 	out->base = *base;
 	out->data.slink = slink;
 
 	err = sqfs_meta_reader_read(ir, (void *)out->extra, slink.target_size);
 	if (err) {
-		free(out);
+		release_inode(alloc, out);
 		return err;
 	}
 
@@ -204,18 +247,19 @@ static int read_inode_slink(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 }
 
 static int read_inode_slink_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
+				const inode_alloc_t *alloc,
 				sqfs_inode_generic_t **result)
 {
 	sqfs_u32 xattr;
 	int err;
 
-	err = read_inode_slink(ir, base, result);
+	err = read_inode_slink(ir, base, alloc, result);
 	if (err)
 		return err;
 
 	err = sqfs_meta_reader_read(ir, &xattr, sizeof(xattr));
 	if (err) {
-		free(*result);
+		release_inode(alloc, *result);
 		return err;
 	}
 
@@ -224,6 +268,7 @@ static int read_inode_slink_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 }
 
 static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
+			      const inode_alloc_t *alloc,
 			      sqfs_inode_generic_t **result)
 {
 	size_t i, new_sz, index_max, index_used;
@@ -247,9 +292,9 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	index_max = dir.size ? 128 : 0;
 	index_used = 0;
 
-	out = alloc_flex(sizeof(*out), 1, index_max);
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	err = alloc_inode(alloc, index_max, &out);
+	if (err)
+		return err;
 
 	out->base = *base;
 	out->data.dir_ext = dir;
@@ -261,10 +306,8 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 
 	for (i = 0; i < dir.inodex_count; ++i) {
 		err = sqfs_meta_reader_read(ir, &ent, sizeof(ent));
-		if (err) {
-			free(out);
-			return err;
-		}
+		if (err)
+			goto fail;
 
 		SWAB32(ent.start_block);
 		SWAB32(ent.index);
@@ -273,17 +316,18 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 		new_sz = index_max;
 		while (sizeof(ent) + ent.size + 1 > new_sz - index_used) {
 			if (SZ_MUL_OV(new_sz, 2, &new_sz)) {
-				free(out);
-				return SQFS_ERROR_OVERFLOW;
+				err = SQFS_ERROR_OVERFLOW;
+				goto fail;
 			}
 		}
 
 		if (new_sz > index_max) {
-			new = realloc(out, sizeof(*out) + new_sz);
-			if (new == NULL) {
-				free(out);
-				return SQFS_ERROR_ALLOC;
-			}
+			err = alloc_inode(alloc, new_sz, &new);
+			if (err)
+				goto fail;
+
+			memcpy(new, out, sizeof(*out) + index_used);
+			release_inode(alloc, out);
 			out = new;
 			index_max = new_sz;
 		}
@@ -293,10 +337,8 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 
 		err = sqfs_meta_reader_read(ir, (char *)out->extra + index_used,
 					    ent.size + 1);
-		if (err) {
-			free(out);
-			return err;
-		}
+		if (err)
+			goto fail;
 
 		index_used += ent.size + 1;
 	}
@@ -305,12 +347,16 @@ static int read_inode_dir_ext(sqfs_meta_reader_t *ir, sqfs_inode_t *base,
 	out->payload_bytes_available = index_used;
 	*result = out;
 	return 0;
+fail:
+	release_inode(alloc, out);
+	return err;
 }
 
-int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
-				const sqfs_super_t *super,
-				sqfs_u64 block_start, size_t offset,
-				sqfs_inode_generic_t **result)
+int sqfs_meta_reader_read_inode_into(sqfs_meta_reader_t *ir,
+				     const sqfs_super_t *super,
+				     sqfs_u64 block_start, size_t offset,
+				     const inode_alloc_t *alloc,
+				     sqfs_inode_generic_t **result)
 {
 	sqfs_inode_generic_t *out;
 	sqfs_inode_t inode;
@@ -341,24 +387,25 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 	/* inode types where the size is variable */
 	switch (inode.type) {
 	case SQFS_INODE_FILE:
-		return read_inode_file(ir, &inode, super->block_size, result);
+		return read_inode_file(ir, &inode, super->block_size, alloc,
+				       result);
 	case SQFS_INODE_SLINK:
-		return read_inode_slink(ir, &inode, result);
+		return read_inode_slink(ir, &inode, alloc, result);
 	case SQFS_INODE_EXT_FILE:
 		return read_inode_file_ext(ir, &inode, super->block_size,
-					   result);
+					   alloc, result);
 	case SQFS_INODE_EXT_SLINK:
-		return read_inode_slink_ext(ir, &inode, result);
+		return read_inode_slink_ext(ir, &inode, alloc, result);
 	case SQFS_INODE_EXT_DIR:
-		return read_inode_dir_ext(ir, &inode, result);
+		return read_inode_dir_ext(ir, &inode, alloc, result);
 	default:
 		break;
 	}
 
 	/* everything else */
-	out = calloc(1, sizeof(*out));
-	if (out == NULL)
-		return SQFS_ERROR_ALLOC;
+	err = alloc_inode(alloc, 0, &out);
+	if (err)
+		return err;
 
 	out->base = inode;
 
@@ -419,6 +466,15 @@ int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
 	*result = out;
 	return 0;
 fail_free:
-	free(out);
+	release_inode(alloc, out);
 	return err;
 }
+
+int sqfs_meta_reader_read_inode(sqfs_meta_reader_t *ir,
+				const sqfs_super_t *super,
+				sqfs_u64 block_start, size_t offset,
+				sqfs_inode_generic_t **result)
+{
+	return sqfs_meta_reader_read_inode_into(ir, super, block_start, offset,
+						&default_allocator, result);
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * read_inode.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef SQFS_READ_INODE_H
+#define SQFS_READ_INODE_H
+
+#include "config.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+
+/*
+  Where sqfs_meta_reader_read_inode_into gets the memory for an inode from.
+  The memory returned by alloc must be zero initialized. Release is called
+  for memory that is not needed after all, it can be NULL if the memory is
+  released some other way.
+ */
+typedef struct {
+	void *(*alloc)(void *user, size_t size);
+	void (*release)(void *user, void *ptr);
+	void *user;
+} inode_alloc_t;
+
+/*
+  Same as sqfs_meta_reader_read_inode, but with the memory for the inode
+  coming from a custom allocator.
+ */
+SQFS_INTERNAL
+int sqfs_meta_reader_read_inode_into(sqfs_meta_reader_t *ir,
+				     const sqfs_super_t *super,
+				     sqfs_u64 block_start, size_t offset,
+				     const inode_alloc_t *alloc,
+				     sqfs_inode_generic_t **result);
+
+#endif /* SQFS_READ_INODE_H */
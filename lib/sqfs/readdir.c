@@ -12,6 +12,7 @@
 #include "sqfs/super.h"
 #include "sqfs/inode.h"
 #include "sqfs/dir.h"
+#include "readdir.h"
 #include "compat.h"
 
 #include <stdlib.h>
@@ -34,23 +35,33 @@ int sqfs_meta_reader_read_dir_header(sqfs_meta_reader_t *m,
 	return 0;
 }
 
-int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
-				  sqfs_dir_entry_t **result)
+static int read_dir_ent_header(sqfs_meta_reader_t *m, sqfs_dir_entry_t *ent)
 {
-	sqfs_dir_entry_t ent, *out;
 	sqfs_u16 *diff_u16;
 	int err;
 
-	err = sqfs_meta_reader_read(m, &ent, sizeof(ent));
+	err = sqfs_meta_reader_read(m, ent, sizeof(*ent));
 	if (err)
 		return err;
 
-	diff_u16 = (sqfs_u16 *)&ent.inode_diff;
+	diff_u16 = (sqfs_u16 *)&ent->inode_diff;
 	*diff_u16 = le16toh(*diff_u16);
 
-	ent.offset = le16toh(ent.offset);
-	ent.type = le16toh(ent.type);
-	ent.size = le16toh(ent.size);
+	ent->offset = le16toh(ent->offset);
+	ent->type = le16toh(ent->type);
+	ent->size = le16toh(ent->size);
+	return 0;
+}
+
+int sqfs_meta_reader_read_dir_ent(sqfs_meta_reader_t *m,
+				  sqfs_dir_entry_t **result)
+{
+	sqfs_dir_entry_t ent, *out;
+	int err;
+
+	err = read_dir_ent_header(m, &ent);
+	if (err)
+		return err;
 
 	out = calloc(1, sizeof(*out) + ent.size + 2);
 	if (out == NULL)
@@ -89,11 +100,8 @@ int sqfs_readdir_state_init(sqfs_readdir_state_t *s, const sqfs_super_t *super,
 	return 0;
 }
 
-int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
-			     sqfs_dir_entry_t **ent,
-			     sqfs_u32 *inum, sqfs_u64 *iref)
+static int readdir_begin(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it)
 {
-	size_t count;
 	int ret;
 
 	if (it->entries == 0) {
@@ -120,24 +128,29 @@ int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
 		it->inode_block = hdr.start_block;
 	}
 
-	if (it->current.size <= sizeof(**ent))
+	if (it->current.size <= sizeof(sqfs_dir_entry_t))
 		goto out_eof;
 
-	ret = sqfs_meta_reader_seek(m, it->current.block, it->current.offset);
-	if (ret != 0)
-		return ret;
+	return sqfs_meta_reader_seek(m, it->current.block, it->current.offset);
+out_eof:
+	it->current.size = 0;
+	it->entries = 0;
+	return 1;
+}
 
-	ret = sqfs_meta_reader_read_dir_ent(m, ent);
-	if (ret)
-		return ret;
+static void readdir_end(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
+			const sqfs_dir_entry_t *ent,
+			sqfs_u32 *inum, sqfs_u64 *iref)
+{
+	size_t count;
 
 	sqfs_meta_reader_get_position(m, &it->current.block,
 				      &it->current.offset);
 
-	it->current.size -= sizeof(**ent);
+	it->current.size -= sizeof(*ent);
 	it->entries -= 1;
 
-	count = (*ent)->size + 1;
+	count = ent->size + 1;
 
 	if (count >= it->current.size) {
 		it->current.size = 0;
@@ -146,16 +159,56 @@ int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
 	}
 
 	if (inum != NULL)
-		*inum = it->inum_base + (*ent)->inode_diff;
+		*inum = it->inum_base + ent->inode_diff;
 
 	if (iref != NULL) {
 		*iref = (sqfs_u64)it->inode_block << 16UL;
-		*iref |= (*ent)->offset;
+		*iref |= ent->offset;
 	}
+}
+
+int sqfs_meta_reader_readdir(sqfs_meta_reader_t *m, sqfs_readdir_state_t *it,
+			     sqfs_dir_entry_t **ent,
+			     sqfs_u32 *inum, sqfs_u64 *iref)
+{
+	int ret;
 
+	ret = readdir_begin(m, it);
+	if (ret != 0)
+		return ret;
+
+	ret = sqfs_meta_reader_read_dir_ent(m, ent);
+	if (ret)
+		return ret;
+
+	readdir_end(m, it, *ent, inum, iref);
+	return 0;
+}
+
+int sqfs_meta_reader_readdir_into(sqfs_meta_reader_t *m,
+				  sqfs_readdir_state_t *it,
+				  sqfs_dir_entry_t *ent, size_t max_name,
+				  sqfs_u32 *inum, sqfs_u64 *iref)
+{
+	int ret;
+
+	ret = readdir_begin(m, it);
+	if (ret != 0)
+		return ret;
+
+	ret = read_dir_ent_header(m, ent);
+	if (ret)
+		return ret;
+
+	if (((size_t)ent->size + 1) > max_name)
+		return SQFS_ERROR_CORRUPTED;
+
+	ret = sqfs_meta_reader_read(m, ent->name, ent->size + 1);
+	if (ret)
+		return ret;
+
+	ent->name[ent->size + 1] = '\0';
+
+	readdir_end(m, it, ent, inum, iref);
 	return 0;
-out_eof:
-	it->current.size = 0;
-	it->entries = 0;
-	return 1;
 }
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * readdir.h
+ *
+ * Copyright (C) 2019 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef SQFS_READDIR_H
+#define SQFS_READDIR_H
+
+#include "config.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/dir.h"
+
+/*
+  Same as sqfs_meta_reader_readdir, but reads the entry into a caller provided
+  buffer with space for max_name bytes (plus null-terminator) of name.
+ */
+SQFS_INTERNAL int sqfs_meta_reader_readdir_into(sqfs_meta_reader_t *m,
+						sqfs_readdir_state_t *it,
+						sqfs_dir_entry_t *ent,
+						size_t max_name,
+						sqfs_u32 *inum, sqfs_u64 *iref);
+
+#endif /* SQFS_READDIR_H */
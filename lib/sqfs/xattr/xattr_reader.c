@@ -20,9 +20,13 @@
 #include <string.h>
 #include <errno.h>
 
+#define XATTR_READER_CACHE_BLOCKS (16)
+
 struct sqfs_xattr_reader_t {
 	sqfs_object_t base;
 
+	sqfs_u32 flags;
+
 	sqfs_u64 xattr_start;
 	sqfs_u64 xattr_end;
 
@@ -161,6 +165,8 @@ int sqfs_xattr_reader_load(sqfs_xattr_reader_t *xr, const sqfs_super_t *super,
 	}
 
 	/* create the meta data readers */
+	err = SQFS_ERROR_ALLOC;
+
 	xr->idrd = sqfs_meta_reader_create(file, cmp, super->id_table_start,
 					   super->bytes_used);
 	if (xr->idrd == NULL)
@@ -171,8 +177,23 @@ int sqfs_xattr_reader_load(sqfs_xattr_reader_t *xr, const sqfs_super_t *super,
 	if (xr->kvrd == NULL)
 		goto fail_idrd;
 
+	if (xr->flags & SQFS_XATTR_READER_BLOCK_CACHE) {
+		err = sqfs_meta_reader_enable_cache(xr->idrd,
+						    XATTR_READER_CACHE_BLOCKS);
+		if (err)
+			goto fail_kvrd;
+
+		err = sqfs_meta_reader_enable_cache(xr->kvrd,
+						    XATTR_READER_CACHE_BLOCKS);
+		if (err)
+			goto fail_kvrd;
+	}
+
 	xr->xattr_end = super->bytes_used;
 	return 0;
+fail_kvrd:
+	sqfs_destroy(xr->kvrd);
+	xr->kvrd = NULL;
 fail_idrd:
 	sqfs_destroy(xr->idrd);
 	xr->idrd = NULL;
@@ -340,13 +361,14 @@ sqfs_xattr_reader_t *sqfs_xattr_reader_create(sqfs_u32 flags)
 {
 	sqfs_xattr_reader_t *xr;
 
-	if (flags != 0)
+	if (flags & ~SQFS_XATTR_READER_ALL_FLAGS)
 		return NULL;
 
 	xr = calloc(1, sizeof(*xr));
 	if (xr == NULL)
 		return NULL;
 
+	xr->flags = flags;
 	((sqfs_object_t *)xr)->copy = xattr_reader_copy;
 	((sqfs_object_t *)xr)->destroy = xattr_reader_destroy;
 	return xr;
@@ -21,7 +21,7 @@ static sqfs_object_t *xattr_writer_copy(const sqfs_object_t *obj)
 	if (str_table_copy(&copy->keys, &xwr->keys))
 		goto fail_keys;
 
-	if (str_table_copy(&copy->values, &xwr->values))
+	if (blob_table_copy(&copy->values, &xwr->values))
 		goto fail_values;
 
 	if (array_init_copy(&copy->kv_pairs, &xwr->kv_pairs))
@@ -48,7 +48,7 @@ static sqfs_object_t *xattr_writer_copy(const sqfs_object_t *obj)
 fail_tree:
 	array_cleanup(&copy->kv_pairs);
 fail_pairs:
-	str_table_cleanup(&copy->values);
+	blob_table_cleanup(&copy->values);
 fail_values:
 	str_table_cleanup(&copy->keys);
 fail_keys:
@@ -62,7 +62,7 @@ static void xattr_writer_destroy(sqfs_object_t *obj)
 
 	rbtree_cleanup(&xwr->kv_block_tree);
 	array_cleanup(&xwr->kv_pairs);
-	str_table_cleanup(&xwr->values);
+	blob_table_cleanup(&xwr->values);
 	str_table_cleanup(&xwr->keys);
 	free(xwr);
 }
@@ -98,7 +98,7 @@ sqfs_xattr_writer_t *sqfs_xattr_writer_create(sqfs_u32 flags)
 	if (str_table_init(&xwr->keys))
 		goto fail_keys;
 
-	if (str_table_init(&xwr->values))
+	if (blob_table_init(&xwr->values))
 		goto fail_values;
 
 	if (array_init(&xwr->kv_pairs, sizeof(sqfs_u64),
@@ -119,7 +119,7 @@ sqfs_xattr_writer_t *sqfs_xattr_writer_create(sqfs_u32 flags)
 fail_tree:
 	array_cleanup(&xwr->kv_pairs);
 fail_pairs:
-	str_table_cleanup(&xwr->values);
+	blob_table_cleanup(&xwr->values);
 fail_values:
 	str_table_cleanup(&xwr->keys);
 fail_keys:
@@ -18,6 +18,7 @@
 #include "sqfs/block.h"
 #include "sqfs/io.h"
 
+#include "blob_table.h"
 #include "str_table.h"
 #include "rbtree.h"
 #include "array.h"
@@ -48,7 +49,7 @@ struct sqfs_xattr_writer_t {
 	sqfs_object_t base;
 
 	str_table_t keys;
-	str_table_t values;
+	blob_table_t values;
 
 	array_t kv_pairs;
 
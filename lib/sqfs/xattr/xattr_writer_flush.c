@@ -6,32 +6,6 @@
  */
 #include "xattr_writer.h"
 
-static const char *hexmap = "0123456789ABCDEF";
-
-static void *from_base32(const char *input, size_t *size_out)
-{
-	sqfs_u8 lo, hi, *out, *ptr;
-	size_t len;
-
-	len = strlen(input);
-	*size_out = len / 2;
-
-	out = malloc(*size_out);
-	if (out == NULL)
-		return NULL;
-
-	ptr = out;
-
-	while (*input != '\0') {
-		lo = strchr(hexmap, *(input++)) - hexmap;
-		hi = strchr(hexmap, *(input++)) - hexmap;
-
-		*(ptr++) = lo | (hi << 4);
-	}
-
-	return out;
-}
-
 static sqfs_s32 write_key(sqfs_meta_writer_t *mw, const char *key,
 			  bool value_is_ool)
 {
@@ -65,20 +39,14 @@ static sqfs_s32 write_key(sqfs_meta_writer_t *mw, const char *key,
 	return sizeof(kent) + len;
 }
 
-static sqfs_s32 write_value(sqfs_meta_writer_t *mw, const char *value_str,
-			    sqfs_u64 *value_ref_out)
+static sqfs_s32 write_value(sqfs_meta_writer_t *mw, const void *value,
+			    size_t size, sqfs_u64 *value_ref_out)
 {
 	sqfs_xattr_value_t vent;
 	sqfs_u32 offset;
 	sqfs_u64 block;
-	size_t size;
-	void *value;
 	int err;
 
-	value = from_base32(value_str, &size);
-	if (value == NULL)
-		return SQFS_ERROR_ALLOC;
-
 	memset(&vent, 0, sizeof(vent));
 	vent.size = htole32(size);
 
@@ -87,17 +55,13 @@ static sqfs_s32 write_value(sqfs_meta_writer_t *mw, const char *value_str,
 
 	err = sqfs_meta_writer_append(mw, &vent, sizeof(vent));
 	if (err)
-		goto fail;
+		return err;
 
 	err = sqfs_meta_writer_append(mw, value, size);
 	if (err)
-		goto fail;
+		return err;
 
-	free(value);
 	return sizeof(vent) + size;
-fail:
-	free(value);
-	return err;
 }
 
 static sqfs_s32 write_value_ool(sqfs_meta_writer_t *mw, sqfs_u64 location)
@@ -121,7 +85,7 @@ static sqfs_s32 write_value_ool(sqfs_meta_writer_t *mw, sqfs_u64 location)
 	return sizeof(vent) + sizeof(ref);
 }
 
-static bool should_store_ool(const char *val_str, size_t refcount)
+static bool should_store_ool(size_t size, size_t refcount)
 {
 	if (refcount < 2)
 		return false;
@@ -137,7 +101,7 @@ static bool should_store_ool(const char *val_str, size_t refcount)
 	   => (refcount - 1) * len > (refcount - 1) * 8
 	   => len > 8
 	 */
-	return (strlen(val_str) / 2) > sizeof(sqfs_u64);
+	return size > sizeof(sqfs_u64);
 }
 
 static int write_block_pairs(const sqfs_xattr_writer_t *xwr,
@@ -145,9 +109,10 @@ static int write_block_pairs(const sqfs_xattr_writer_t *xwr,
 			     const kv_block_desc_t *blk,
 			     sqfs_u64 *ool_locations)
 {
-	const char *key_str, *value_str;
 	sqfs_s32 diff, total = 0;
-	size_t i, refcount;
+	size_t i, refcount, size;
+	const char *key_str;
+	const void *value;
 	sqfs_u64 ref;
 
 	for (i = 0; i < blk->count; ++i) {
@@ -156,7 +121,7 @@ static int write_block_pairs(const sqfs_xattr_writer_t *xwr,
 		sqfs_u32 val_idx = GET_VALUE(ent);
 
 		key_str = str_table_get_string(&xwr->keys, key_idx);
-		value_str = str_table_get_string(&xwr->values, val_idx);
+		value = blob_table_get_blob(&xwr->values, val_idx, &size);
 
 		if (ool_locations[val_idx] == 0xFFFFFFFFFFFFFFFFUL) {
 			diff = write_key(mw, key_str, false);
@@ -164,15 +129,15 @@ static int write_block_pairs(const sqfs_xattr_writer_t *xwr,
 				return diff;
 			total += diff;
 
-			diff = write_value(mw, value_str, &ref);
+			diff = write_value(mw, value, size, &ref);
 			if (diff < 0)
 				return diff;
 			total += diff;
 
-			refcount = str_table_get_ref_count(&xwr->values,
-							   val_idx);
+			refcount = blob_table_get_ref_count(&xwr->values,
+							    val_idx);
 
-			if (should_store_ool(value_str, refcount))
+			if (should_store_ool(size, refcount))
 				ool_locations[val_idx] = ref;
 		} else {
 			diff = write_key(mw, key_str, true);
@@ -200,11 +165,11 @@ static int write_kv_pairs(const sqfs_xattr_writer_t *xwr,
 	size_t i;
 
 	ool_locations = alloc_array(sizeof(ool_locations[0]),
-				    str_table_count(&xwr->values));
+				    blob_table_count(&xwr->values));
 	if (ool_locations == NULL)
 		return SQFS_ERROR_ALLOC;
 
-	for (i = 0; i < str_table_count(&xwr->values); ++i)
+	for (i = 0; i < blob_table_count(&xwr->values); ++i)
 		ool_locations[i] = 0xFFFFFFFFFFFFFFFFUL;
 
 	for (blk = xwr->kv_block_first; blk != NULL; blk = blk->next) {
@@ -6,29 +6,6 @@
  */
 #include "xattr_writer.h"
 
-static const char *hexmap = "0123456789ABCDEF";
-
-static char *to_base32(const void *input, size_t size)
-{
-	const sqfs_u8 *in = input;
-	char *out, *ptr;
-	size_t i;
-
-	out = malloc(2 * size + 1);
-	if (out == NULL)
-		return NULL;
-
-	ptr = out;
-
-	for (i = 0; i < size; ++i) {
-		*(ptr++) = hexmap[ in[i]       & 0x0F];
-		*(ptr++) = hexmap[(in[i] >> 4) & 0x0F];
-	}
-
-	*ptr = '\0';
-	return out;
-}
-
 static int compare_u64(const void *a, const void *b)
 {
 	sqfs_u64 lhs = *((const sqfs_u64 *)a);
@@ -51,7 +28,6 @@ int sqfs_xattr_writer_add(sqfs_xattr_writer_t *xwr, const char *key,
 {
 	size_t i, key_index, old_value_index, value_index;
 	sqfs_u64 kv_pair;
-	char *value_str;
 	int err;
 
 	if (sqfs_get_xattr_prefix_id(key) < 0)
@@ -61,16 +37,11 @@ int sqfs_xattr_writer_add(sqfs_xattr_writer_t *xwr, const char *key,
 	if (err)
 		return err;
 
-	value_str = to_base32(value, size);
-	if (value_str == NULL)
-		return SQFS_ERROR_ALLOC;
-
-	err = str_table_get_index(&xwr->values, value_str, &value_index);
-	free(value_str);
+	err = blob_table_get_index(&xwr->values, value, size, &value_index);
 	if (err)
 		return err;
 
-	str_table_add_ref(&xwr->values, value_index);
+	blob_table_add_ref(&xwr->values, value_index);
 
 	if (sizeof(size_t) > sizeof(sqfs_u32)) {
 		if (key_index > 0x0FFFFFFFFUL || value_index > 0x0FFFFFFFFUL)
@@ -88,7 +59,7 @@ int sqfs_xattr_writer_add(sqfs_xattr_writer_t *xwr, const char *key,
 		if (GET_KEY(ent) == key_index) {
 			old_value_index = GET_VALUE(ent);
 
-			str_table_del_ref(&xwr->values, old_value_index);
+			blob_table_del_ref(&xwr->values, old_value_index);
 
 			((sqfs_u64 *)xwr->kv_pairs.data)[i] = kv_pair;
 			return 0;
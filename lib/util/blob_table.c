@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * blob_table.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqfs/error.h"
+#include "blob_table.h"
+#include "util.h"
+
+static bool key_equals_function(void *user, const void *a, const void *b)
+{
+	const blob_key_t *lhs = a, *rhs = b;
+	(void)user;
+
+	if (lhs->size != rhs->size)
+		return false;
+
+	return lhs->size == 0 || memcmp(lhs->data, rhs->data, lhs->size) == 0;
+}
+
+int blob_table_init(blob_table_t *table)
+{
+	memset(table, 0, sizeof(*table));
+
+	if (array_init(&table->bucket_ptrs, sizeof(blob_bucket_t *), 0))
+		goto fail_arr;
+
+	table->ht = hash_table_create(NULL, key_equals_function);
+	if (table->ht == NULL)
+		goto fail_ht;
+
+	return 0;
+fail_ht:
+	array_cleanup(&table->bucket_ptrs);
+fail_arr:
+	memset(table, 0, sizeof(*table));
+	return SQFS_ERROR_ALLOC;
+}
+
+int blob_table_copy(blob_table_t *dst, const blob_table_t *src)
+{
+	blob_bucket_t *bucket, **array;
+	const blob_bucket_t *orig;
+	int ret;
+
+	ret = array_init_copy(&dst->bucket_ptrs, &src->bucket_ptrs);
+	if (ret != 0)
+		return ret;
+
+	dst->ht = hash_table_clone(src->ht);
+	if (dst->ht == NULL) {
+		array_cleanup(&dst->bucket_ptrs);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	dst->next_index = src->next_index;
+	array = (blob_bucket_t **)dst->bucket_ptrs.data;
+
+	hash_table_foreach(dst->ht, ent) {
+		orig = ent->data;
+
+		bucket = alloc_flex(sizeof(*bucket), 1, orig->key.size);
+		if (bucket == NULL) {
+			blob_table_cleanup(dst);
+			return SQFS_ERROR_ALLOC;
+		}
+
+		memcpy(bucket, orig, sizeof(*bucket) + orig->key.size);
+		bucket->key.data = bucket->data;
+
+		ent->data = bucket;
+		ent->key = &bucket->key;
+
+		array[bucket->index] = bucket;
+	}
+
+	return 0;
+}
+
+void blob_table_cleanup(blob_table_t *table)
+{
+	hash_table_foreach(table->ht, ent) {
+		free(ent->data);
+		ent->data = NULL;
+		ent->key = NULL;
+	}
+
+	hash_table_destroy(table->ht, NULL);
+	array_cleanup(&table->bucket_ptrs);
+	memset(table, 0, sizeof(*table));
+}
+
+int blob_table_get_index(blob_table_t *table, const void *data,
+			 size_t size, size_t *idx)
+{
+	struct hash_entry *ent;
+	blob_bucket_t *new;
+	blob_key_t key;
+	sqfs_u32 hash;
+
+	key.data = data;
+	key.size = size;
+
+	hash = xxh32(data, size);
+	ent = hash_table_search_pre_hashed(table->ht, hash, &key);
+
+	if (ent != NULL) {
+		*idx = ((blob_bucket_t *)ent->data)->index;
+		return 0;
+	}
+
+	new = alloc_flex(sizeof(*new), 1, size);
+	if (new == NULL)
+		return SQFS_ERROR_ALLOC;
+
+	new->index = table->next_index;
+	new->key.data = new->data;
+	new->key.size = size;
+
+	if (size > 0)
+		memcpy(new->data, data, size);
+
+	ent = hash_table_insert_pre_hashed(table->ht, hash, &new->key, new);
+	if (ent == NULL) {
+		free(new);
+		return SQFS_ERROR_ALLOC;
+	}
+
+	if (array_append(&table->bucket_ptrs, &new) != 0) {
+		free(new);
+		ent->key = NULL;
+		ent->data = NULL;
+		return SQFS_ERROR_ALLOC;
+	}
+
+	*idx = table->next_index++;
+	return 0;
+}
+
+static blob_bucket_t *bucket_by_index(const blob_table_t *table, size_t index)
+{
+	if (index >= table->bucket_ptrs.used)
+		return NULL;
+
+	return ((blob_bucket_t **)table->bucket_ptrs.data)[index];
+}
+
+const void *blob_table_get_blob(const blob_table_t *table, size_t index,
+				size_t *size)
+{
+	blob_bucket_t *bucket = bucket_by_index(table, index);
+
+	if (bucket == NULL) {
+		*size = 0;
+		return NULL;
+	}
+
+	*size = bucket->key.size;
+	return bucket->data;
+}
+
+void blob_table_add_ref(blob_table_t *table, size_t index)
+{
+	blob_bucket_t *bucket = bucket_by_index(table, index);
+
+	if (bucket != NULL && bucket->refcount < ~((size_t)0))
+		bucket->refcount += 1;
+}
+
+void blob_table_del_ref(blob_table_t *table, size_t index)
+{
+	blob_bucket_t *bucket = bucket_by_index(table, index);
+
+	if (bucket != NULL && bucket->refcount > 0)
+		bucket->refcount -= 1;
+}
+
+size_t blob_table_get_ref_count(const blob_table_t *table, size_t index)
+{
+	blob_bucket_t *bucket = bucket_by_index(table, index);
+
+	return bucket != NULL ? bucket->refcount : 0;
+}
@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/*
+ * get_time_ns.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "util.h"
+
+#if defined(_WIN32) || defined(__WINDOWS__)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+sqfs_u64 get_time_ns(void)
+{
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+
+	return (sqfs_u64)((count.QuadPart / freq.QuadPart) * 1000000000ULL +
+			  ((count.QuadPart % freq.QuadPart) * 1000000000ULL) /
+			  freq.QuadPart);
+}
+#elif defined(HAVE_CLOCK_GETTIME)
+#include <time.h>
+
+sqfs_u64 get_time_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return (sqfs_u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#else
+#include <sys/time.h>
+
+sqfs_u64 get_time_ns(void)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) != 0)
+		return 0;
+
+	return (sqfs_u64)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+#endif
@@ -392,6 +392,17 @@ hash_table_insert_pre_hashed(struct hash_table *ht, sqfs_u32 hash,
    return hash_table_insert(ht, hash, key, data);
 }
 
+/**
+ * Removes all entries from the table, but keeps the memory allocated for it.
+ */
+void
+hash_table_clear(struct hash_table *ht)
+{
+   memset(ht->table, 0, ht->size * sizeof(struct hash_entry));
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+}
+
 /**
  * This function is an iterator over the hash table.
  *
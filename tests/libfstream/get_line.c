@@ -143,10 +143,90 @@ static const line_t lines_no_empty_trim[] = {
 	{ 10, "dog" },
 };
 
+/*****************************************************************************/
+
+#define CHUNK_BUFSZ (16)
+
+static const char *chunk_input =
+	"short\r\n"
+	"exactly fifteen\n"
+	"a line that is a lot longer than the stream buffer\r\n"
+	"\n"
+	"split CR-LF pair\r\n"
+	"  trailing line without a break  ";
+
+static const line_t chunk_lines[] = {
+	{ 1, "short" },
+	{ 2, "exactly fifteen" },
+	{ 3, "a line that is a lot longer than the stream buffer" },
+	{ 4, "" },
+	{ 5, "split CR-LF pair" },
+	{ 6, "  trailing line without a break  " },
+};
+
+static sqfs_u8 chunk_buffer[CHUNK_BUFSZ];
+static size_t chunk_offset;
+
+static int chunk_precache(istream_t *strm)
+{
+	size_t diff, avail = strlen(chunk_input) - chunk_offset;
+
+	/* hand out the data in small pieces to exercise refilling */
+	diff = CHUNK_BUFSZ - strm->buffer_used;
+	if (diff > 5)
+		diff = 5;
+	if (diff > avail)
+		diff = avail;
+
+	memcpy(chunk_buffer + strm->buffer_used, chunk_input + chunk_offset,
+	       diff);
+	strm->buffer_used += diff;
+	chunk_offset += diff;
+
+	if (chunk_offset == strlen(chunk_input))
+		strm->eof = true;
+	return 0;
+}
+
+static const char *chunk_get_filename(istream_t *strm)
+{
+	(void)strm;
+	return "chunkstream";
+}
+
+static void run_chunked_test(void)
+{
+	istream_t strm;
+	size_t i, line_num;
+	char *line;
+
+	memset(&strm, 0, sizeof(strm));
+	strm.buffer = chunk_buffer;
+	strm.precache = chunk_precache;
+	strm.get_filename = chunk_get_filename;
+	chunk_offset = 0;
+	line_num = 1;
+
+	for (i = 0; i < sizeof(chunk_lines) / sizeof(chunk_lines[0]); ++i) {
+		TEST_EQUAL_I(istream_get_line_inplace(&strm, &line,
+						      &line_num, 0), 0);
+		TEST_NOT_NULL(line);
+		TEST_EQUAL_UI(line_num, chunk_lines[i].line_num);
+		TEST_STR_EQUAL(line, chunk_lines[i].str);
+		line_num += 1;
+	}
+
+	TEST_ASSERT(istream_get_line_inplace(&strm, &line, &line_num, 0) > 0);
+	TEST_NULL(line);
+	free(strm.line_scratch);
+}
+
 int main(int argc, char **argv)
 {
 	(void)argc; (void)argv;
 
+	run_chunked_test();
+
 	run_test_case(lines_raw, 11, 0);
 	run_test_case(lines_ltrim, 11, ISTREAM_LINE_LTRIM);
 	run_test_case(lines_rtrim, 11, ISTREAM_LINE_RTRIM);
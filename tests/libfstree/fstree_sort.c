@@ -6,12 +6,12 @@
  */
 #include "config.h"
 
-#include "fstree.h"
+#include "internal.h"
 #include "../test.h"
 
 int main(int argc, char **argv)
 {
-	tree_node_t *a, *b, *c, *d;
+	tree_node_t *a, *b, *c, *d, *e, *f, *batch[3];
 	struct stat sb;
 	fstree_t fs;
 	int ret;
@@ -50,6 +50,7 @@ int main(int argc, char **argv)
 	TEST_ASSERT(b->next == c);
 	TEST_ASSERT(c->next == d);
 	TEST_NULL(d->next);
+	TEST_ASSERT(fs.root->data.dir.children_tail == d);
 
 	fstree_cleanup(&fs);
 
@@ -83,6 +84,45 @@ int main(int argc, char **argv)
 	TEST_ASSERT(c->next == d);
 	TEST_NULL(d->next);
 
+	TEST_ASSERT(fs.root->data.dir.children_tail == d);
+
+	fstree_cleanup(&fs);
+
+	/* unsorted batch merged into existing entries */
+	ret = fstree_init(&fs, NULL);
+	TEST_EQUAL_I(ret, 0);
+
+	c = fstree_mknode(fs.root, "c", 1, NULL, &sb);
+	TEST_NOT_NULL(c);
+	a = fstree_mknode(fs.root, "a", 1, NULL, &sb);
+	TEST_NOT_NULL(a);
+
+	batch[0] = d = fstree_mknode(NULL, "d", 1, NULL, &sb);
+	TEST_NOT_NULL(d);
+	batch[1] = e = fstree_mknode(NULL, "e", 1, NULL, &sb);
+	TEST_NOT_NULL(e);
+	batch[2] = b = fstree_mknode(NULL, "b", 1, NULL, &sb);
+	TEST_NOT_NULL(b);
+
+	fstree_insert_sorted_array(fs.root, batch, 3);
+	TEST_ASSERT(fs.root->data.dir.children == a);
+	TEST_ASSERT(a->next == b);
+	TEST_ASSERT(b->next == c);
+	TEST_ASSERT(c->next == d);
+	TEST_ASSERT(d->next == e);
+	TEST_NULL(e->next);
+	TEST_ASSERT(fs.root->data.dir.children_tail == e);
+	TEST_ASSERT(b->parent == fs.root);
+	TEST_ASSERT(d->parent == fs.root);
+	TEST_ASSERT(e->parent == fs.root);
+
+	/* appending after a batch */
+	f = fstree_mknode(fs.root, "f", 1, NULL, &sb);
+	TEST_NOT_NULL(f);
+	TEST_ASSERT(e->next == f);
+	TEST_NULL(f->next);
+	TEST_ASSERT(fs.root->data.dir.children_tail == f);
+
 	fstree_cleanup(&fs);
 	return EXIT_SUCCESS;
 }
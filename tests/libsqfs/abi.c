@@ -125,11 +125,72 @@ static void test_blockproc_stats(void)
 
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
 			       actual_frag_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       probe_skip_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       low_gain_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       early_dedup_file_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       early_dedup_bytes), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       raw_block_count), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       frag_dedup_bytes), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       frontend_time_ns), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       worker_time_ns), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       fragment_time_ns), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       write_time_ns), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       wait_time_ns), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       blocks_enqueued), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       backlog_sum), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       backlog_max), off);
+	off += sizeof(sqfs_u64);
+
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_stats_t,
+			       worker_count), off);
 }
 
 static void test_blockproc_desc(void)
 {
 	sqfs_block_processor_desc_t desc;
+	size_t off, align;
 
 	TEST_ASSERT(sizeof(desc) >= (4 * sizeof(sqfs_u32) +
 				     5 * sizeof(void *)));
@@ -161,6 +222,21 @@ static void test_blockproc_desc(void)
 		      (4 * sizeof(sqfs_u32) + 3 * sizeof(void *)));
 	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, uncmp),
 		      (4 * sizeof(sqfs_u32) + 4 * sizeof(void *)));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, probe_threshold),
+		      (4 * sizeof(sqfs_u32) + 5 * sizeof(void *)));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, min_gain),
+		      (5 * sizeof(sqfs_u32) + 5 * sizeof(void *)));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, flags),
+		      (6 * sizeof(sqfs_u32) + 5 * sizeof(void *)));
+
+	/* the u64 is aligned like the struct, e.g. only 4 bytes on i386 */
+	align = __alignof__(sqfs_block_processor_desc_t);
+	off = 7 * sizeof(sqfs_u32) + 5 * sizeof(void *);
+	if (off % align)
+		off += align - off % align;
+
+	TEST_EQUAL_UI(sizeof(desc.mem_limit), sizeof(sqfs_u64));
+	TEST_EQUAL_UI(offsetof(sqfs_block_processor_desc_t, mem_limit), off);
 }
 
 int main(int argc, char **argv)
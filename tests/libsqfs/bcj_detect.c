@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * bcj_detect.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/compressor.h"
+#include "bcj_detect.h"
+
+#define ARM_FILTERS (SQFS_COMP_FLAG_XZ_ARM | SQFS_COMP_FLAG_XZ_ARMTHUMB)
+#define ALL_FILTERS (SQFS_COMP_FLAG_XZ_X86 | SQFS_COMP_FLAG_XZ_POWERPC | \
+		     SQFS_COMP_FLAG_XZ_IA64 | ARM_FILTERS | \
+		     SQFS_COMP_FLAG_XZ_SPARC)
+
+static sqfs_u8 buffer[64 * 1024];
+
+static void make_elf(int data, sqfs_u16 machine)
+{
+	memset(buffer, 0, sizeof(buffer));
+	memcpy(buffer, "\177ELF", 4);
+	buffer[4] = 2;
+	buffer[5] = data;
+
+	if (data == 2) {
+		buffer[18] = machine >> 8;
+		buffer[19] = machine & 0xFF;
+	} else {
+		buffer[18] = machine & 0xFF;
+		buffer[19] = machine >> 8;
+	}
+}
+
+static void make_pe(sqfs_u16 machine)
+{
+	memset(buffer, 0, sizeof(buffer));
+	buffer[0] = 'M';
+	buffer[1] = 'Z';
+	buffer[0x3C] = 0x80;
+	memcpy(buffer + 0x80, "PE\0\0", 4);
+	buffer[0x84] = machine & 0xFF;
+	buffer[0x85] = machine >> 8;
+}
+
+static void fill_random(void)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i;
+
+	for (i = 0; i < sizeof(buffer); ++i) {
+		seed = seed * 1103515245 + 12345;
+		buffer[i] = (seed >> 16) & 0xFF;
+	}
+}
+
+/* fill the buffer with instruction words, every 4th being a call */
+static void fill_code(const sqfs_u8 *call, size_t call_size,
+		      const sqfs_u8 *nop, size_t nop_size)
+{
+	size_t i = 0, n = 0;
+
+	while (i + call_size <= sizeof(buffer)) {
+		if ((n++ % 4) == 0) {
+			memcpy(buffer + i, call, call_size);
+			i += call_size;
+		} else {
+			memcpy(buffer + i, nop, nop_size);
+			i += nop_size;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const sqfs_u8 x86_call[] = { 0xE8, 0x10, 0x20, 0x00, 0x00 };
+	static const sqfs_u8 x86_nop[] = { 0x48, 0x89, 0xC7 };
+	static const sqfs_u8 arm_call[] = { 0x10, 0x20, 0x00, 0xEB };
+	static const sqfs_u8 arm_nop[] = { 0x00, 0x00, 0xA0, 0xE1 };
+	static const sqfs_u8 ppc_call[] = { 0x48, 0x00, 0x20, 0x01 };
+	static const sqfs_u8 ppc_nop[] = { 0x60, 0x00, 0x00, 0x00 };
+	sqfs_u32 ret;
+	size_t i;
+	(void)argc; (void)argv;
+
+	/* file headers */
+	make_elf(1, 62);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN | SQFS_COMP_FLAG_XZ_X86);
+
+	make_elf(1, 40);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN | ARM_FILTERS);
+
+	make_elf(2, 21);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN | SQFS_COMP_FLAG_XZ_POWERPC);
+
+	/* little endian PowerPC and AArch64 have no matching filter */
+	make_elf(1, 21);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN);
+
+	make_elf(1, 183);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN);
+
+	make_pe(0x8664);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)),
+		      SQFS_BCJ_HINT_KNOWN | SQFS_COMP_FLAG_XZ_X86);
+
+	/* a PE offset pointing out of bounds is not a PE file */
+	buffer[0x3F] = 0x7F;
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)), 0);
+
+	make_elf(1, 62);
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, 16), 0);
+
+	fill_random();
+	TEST_EQUAL_UI(sqfs_bcj_detect_header(buffer, sizeof(buffer)), 0);
+
+	/* instruction statistics */
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS), 0);
+
+	memset(buffer, 'a', sizeof(buffer));
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS), 0);
+
+	fill_code(x86_call, sizeof(x86_call), x86_nop, sizeof(x86_nop));
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS),
+		      SQFS_COMP_FLAG_XZ_X86);
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ARM_FILTERS), 0);
+
+	fill_code(arm_call, sizeof(arm_call), arm_nop, sizeof(arm_nop));
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS),
+		      SQFS_COMP_FLAG_XZ_ARM);
+
+	fill_code(ppc_call, sizeof(ppc_call), ppc_nop, sizeof(ppc_nop));
+	TEST_EQUAL_UI(sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS),
+		      SQFS_COMP_FLAG_XZ_POWERPC);
+
+	/* x86 and ARM code mixed in equal parts is ambiguous */
+	fill_code(x86_call, sizeof(x86_call), x86_nop, sizeof(x86_nop));
+
+	for (i = sizeof(buffer) / 2; i < sizeof(buffer); i += 4)
+		memcpy(buffer + i, (i / 4) % 4 ? arm_nop : arm_call, 4);
+
+	ret = sqfs_bcj_guess(buffer, sizeof(buffer), ALL_FILTERS);
+	TEST_EQUAL_UI(ret, ALL_FILTERS & ~SQFS_COMP_FLAG_XZ_IA64);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_adaptive.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/frag_table.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (4096)
+#define NUM_LEVELS (4)
+#define NUM_BLOCKS (50)
+#define TAIL_SIZE (3000)
+
+static sqfs_u8 file_data[BLK_SIZE];
+static size_t written[NUM_LEVELS + 1];
+
+/* "compresses" a block to half its size, marked with the level */
+static sqfs_s32 tagged_do_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+				sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)outsize;
+
+	memcpy(out, in, size / 2);
+	out[0] = ((dummy_compressor_t *)cmp)->tag;
+	return size / 2;
+}
+
+static int write_hook(sqfs_u32 size, sqfs_u32 flags, const sqfs_u8 *data)
+{
+	(void)size;
+
+	TEST_ASSERT(flags & SQFS_BLK_IS_COMPRESSED);
+	TEST_ASSERT(data[0] <= NUM_LEVELS);
+
+	written[data[0]] += 1;
+	return 0;
+}
+
+/* tag 0 is the regular compressor, the levels are tagged 1 and up */
+static dummy_compressor_t compressors[NUM_LEVELS + 1];
+static sqfs_compressor_t *levels[NUM_LEVELS];
+
+static void init_compressors(void)
+{
+	size_t i;
+
+	for (i = 0; i <= NUM_LEVELS; ++i) {
+		compressors[i] = dummy_compressor;
+		compressors[i].base.do_block = tagged_do_block;
+		compressors[i].tag = i;
+
+		if (i > 0)
+			levels[i - 1] = &compressors[i].base;
+	}
+
+	for (i = 0; i < sizeof(file_data); ++i)
+		file_data[i] = (i * 7) & 0xFF;
+	file_data[0] = 0xFF;
+}
+
+static void init_desc(sqfs_block_processor_desc_t *desc, sqfs_u64 rate)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->size = sizeof(*desc);
+	desc->max_block_size = BLK_SIZE;
+	desc->num_workers = 2;
+	desc->max_backlog = 10;
+	desc->cmp = &compressors[0].base;
+	desc->wr = &dummy_writer;
+	desc->flags = SQFS_BLOCK_PROCESSOR_ADAPTIVE_LEVEL;
+	desc->level_cmp = levels;
+	desc->num_levels = NUM_LEVELS;
+	desc->target_rate = rate;
+}
+
+static void add_blocks(sqfs_block_processor_t *proc, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		TEST_EQUAL_I(sqfs_block_processor_submit_block(proc, NULL, 0,
+							       file_data,
+							       BLK_SIZE), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+}
+
+static void add_tail(sqfs_block_processor_t *proc,
+		     sqfs_inode_generic_t **inode, const sqfs_u8 *data)
+{
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inode, NULL, 0), 0);
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, data, TAIL_SIZE), 0);
+	TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+}
+
+static void check_counts(const sqfs_block_processor_t *proc,
+			 const size_t *expect)
+{
+	sqfs_u64 count;
+	sqfs_u32 i;
+
+	TEST_EQUAL_UI(written[0], 0);
+
+	for (i = 0; i < NUM_LEVELS; ++i) {
+		TEST_EQUAL_UI(written[i + 1], expect[i]);
+		TEST_EQUAL_I(sqfs_block_processor_get_level_count(proc, i,
+								  &count), 0);
+		TEST_EQUAL_UI(count, expect[i]);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_get_level_count(proc, NUM_LEVELS,
+							  &count),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *inode[2] = { NULL, NULL };
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	size_t expect[NUM_LEVELS];
+	sqfs_frag_table_t *tbl;
+	sqfs_u64 count;
+	(void)argc; (void)argv;
+
+	dummy_write_hook = write_hook;
+	init_compressors();
+
+	/* without a target rate, the strongest level is always used */
+	init_desc(&desc, 0);
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	add_blocks(proc, NUM_BLOCKS);
+
+	memset(expect, 0, sizeof(expect));
+	expect[NUM_LEVELS - 1] = NUM_BLOCKS;
+	check_counts(proc, expect);
+
+	/*
+	  An unreachable rate falls back to the fastest level, after trying
+	  out every level once.
+	 */
+	sqfs_block_processor_set_target_rate(proc, 0xFFFFFFFFFFFFFFFFUL);
+	add_blocks(proc, NUM_BLOCKS);
+
+	expect[0] += NUM_BLOCKS - (NUM_LEVELS - 1);
+	expect[1] += 1;
+	expect[2] += 1;
+	expect[3] += 1;
+	check_counts(proc, expect);
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	sqfs_destroy(proc);
+
+	/*
+	  Fragment blocks are compressed with the regular compressor and do
+	  not use up the calibration blocks.
+	 */
+	memset(written, 0, sizeof(written));
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	init_desc(&desc, 0xFFFFFFFFFFFFFFFFUL);
+	desc.tbl = tbl;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+
+	/* the second tail-end does not fit, so the first block is written */
+	add_tail(proc, inode + 0, file_data);
+	add_tail(proc, inode + 1, file_data + 1);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+	TEST_EQUAL_UI(written[0], 1);
+
+	written[0] = 0;
+	add_blocks(proc, NUM_LEVELS);
+
+	memset(expect, 0, sizeof(expect));
+	expect[0] = expect[1] = expect[2] = expect[3] = 1;
+	check_counts(proc, expect);
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	TEST_EQUAL_UI(written[0], 1);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	free(inode[0]);
+	free(inode[1]);
+
+	/* without the flag, the regular compressor is used */
+	memset(written, 0, sizeof(written));
+	init_desc(&desc, 0);
+	desc.flags = 0;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	add_blocks(proc, 10);
+	TEST_EQUAL_UI(written[0], 10);
+	TEST_EQUAL_I(sqfs_block_processor_get_level_count(proc, 0, &count),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	sqfs_destroy(proc);
+
+	/* the flag needs between 1 and 16 compressors */
+	init_desc(&desc, 0);
+	desc.num_levels = 0;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+
+	desc.num_levels = 17;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+
+	init_desc(&desc, 0);
+	desc.level_cmp = NULL;
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+
+	init_desc(&desc, 0);
+	desc.size = offsetof(sqfs_block_processor_desc_t, level_cmp);
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+	return EXIT_SUCCESS;
+}
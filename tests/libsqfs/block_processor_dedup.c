@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_dedup.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (4096)
+#define NUM_BLOCKS (5)
+#define TAIL_SIZE (100)
+#define FILE_SIZE (NUM_BLOCKS * BLK_SIZE + TAIL_SIZE)
+
+static sqfs_u8 file_data[FILE_SIZE];
+
+static void fill_data(void)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i;
+
+	for (i = 0; i < sizeof(file_data); ++i) {
+		seed = seed * 1103515245 + 12345;
+		file_data[i] = (seed >> 16) & 0xFF;
+	}
+}
+
+static void add_file(sqfs_block_processor_t *proc,
+		     sqfs_inode_generic_t **inode, sqfs_u32 flags)
+{
+	size_t i;
+
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inode, NULL,
+						     flags), 0);
+
+	/* odd sized chunks, so blocks are assembled from several appends */
+	for (i = 0; i < FILE_SIZE; i += 1000) {
+		TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data + i,
+							 (FILE_SIZE - i) < 1000 ?
+							 (FILE_SIZE - i) : 1000),
+			     0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+}
+
+static void check_same_layout(const sqfs_inode_generic_t *a,
+			      const sqfs_inode_generic_t *b)
+{
+	sqfs_u32 idx_a, off_a, idx_b, off_b;
+	sqfs_u64 loc_a, loc_b, size_a, size_b;
+
+	TEST_EQUAL_UI(a->payload_bytes_used, b->payload_bytes_used);
+	TEST_ASSERT(memcmp(a->extra, b->extra, a->payload_bytes_used) == 0);
+
+	sqfs_inode_get_file_size(a, &size_a);
+	sqfs_inode_get_file_size(b, &size_b);
+	TEST_EQUAL_UI(size_a, size_b);
+
+	sqfs_inode_get_file_block_start(a, &loc_a);
+	sqfs_inode_get_file_block_start(b, &loc_b);
+	TEST_EQUAL_UI(loc_a, loc_b);
+
+	sqfs_inode_get_frag_location(a, &idx_a, &off_a);
+	sqfs_inode_get_frag_location(b, &idx_b, &off_b);
+	TEST_EQUAL_UI(idx_a, idx_b);
+	TEST_EQUAL_UI(off_a, off_b);
+}
+
+static sqfs_block_processor_t *create(sqfs_u32 flags)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 2;
+	desc.max_backlog = 3;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.flags = flags;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	return proc;
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *a = NULL, *b = NULL, *c = NULL, *d = NULL;
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	(void)argc; (void)argv;
+
+	fill_data();
+
+	/* an identical copy is not compressed again */
+	proc = create(SQFS_BLOCK_PROCESSOR_EARLY_DEDUP);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	add_file(proc, &a, 0);
+	add_file(proc, &b, 0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+
+	TEST_EQUAL_UI(dummy_comp_calls, NUM_BLOCKS);
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 1);
+	TEST_EQUAL_UI(stats->early_dedup_bytes, FILE_SIZE);
+	TEST_EQUAL_UI(stats->data_block_count, NUM_BLOCKS);
+	check_same_layout(a, b);
+
+	/* a different tail end or different flags make it a different file */
+	file_data[FILE_SIZE - 1] ^= 0xFF;
+	add_file(proc, &c, 0);
+	file_data[FILE_SIZE - 1] ^= 0xFF;
+	add_file(proc, &d, SQFS_BLK_DONT_FRAGMENT);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+
+	TEST_EQUAL_UI(dummy_comp_calls, 3 * NUM_BLOCKS + 1);
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 1);
+	TEST_EQUAL_UI(stats->data_block_count, 3 * NUM_BLOCKS + 1);
+	TEST_EQUAL_UI(c->payload_bytes_used, NUM_BLOCKS * sizeof(sqfs_u32));
+	TEST_EQUAL_UI(d->payload_bytes_used,
+		      (NUM_BLOCKS + 1) * sizeof(sqfs_u32));
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	sqfs_destroy(proc);
+	free(a);
+	free(b);
+	free(c);
+	free(d);
+	a = b = NULL;
+
+	/* without the flag, everything is compressed */
+	dummy_comp_calls = 0;
+	proc = create(0);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	add_file(proc, &a, 0);
+	add_file(proc, &b, 0);
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	TEST_EQUAL_UI(dummy_comp_calls, 2 * NUM_BLOCKS + 1);
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 0);
+	TEST_EQUAL_UI(stats->early_dedup_bytes, 0);
+
+	sqfs_destroy(proc);
+	free(a);
+	free(b);
+
+	/* unknown flags are rejected */
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 1;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.flags = ~SQFS_BLOCK_PROCESSOR_ALL_FLAGS;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_UNSUPPORTED);
+	return EXIT_SUCCESS;
+}
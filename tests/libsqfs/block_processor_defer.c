@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_defer.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/frag_table.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (4096)
+#define TAIL_SIZE (100)
+#define NUM_FILES (6)
+#define NUM_MANY (100)
+
+static sqfs_u8 file_data[BLK_SIZE + TAIL_SIZE];
+
+static void fill_data(sqfs_u32 seed)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(file_data); ++i) {
+		seed = seed * 1103515245 + 12345;
+		file_data[i] = (seed >> 16) & 0xFF;
+	}
+}
+
+static void add_file(sqfs_block_processor_t *proc,
+		     sqfs_inode_generic_t **inode, sqfs_u64 group,
+		     size_t size)
+{
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, inode, NULL, 0), 0);
+	TEST_EQUAL_I(sqfs_block_processor_set_fragment_group(proc, group), 0);
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data, size), 0);
+	TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+}
+
+static void check_frag(const sqfs_inode_generic_t *inode,
+		       sqfs_u32 index, sqfs_u32 offset)
+{
+	sqfs_u32 idx, off;
+
+	sqfs_inode_get_frag_location(inode, &idx, &off);
+	TEST_EQUAL_UI(idx, index);
+	TEST_EQUAL_UI(off, offset);
+}
+
+static sqfs_block_processor_t *create(sqfs_u32 flags, sqfs_u64 limit,
+				      sqfs_frag_table_t *tbl)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 2;
+	desc.max_backlog = 3;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.tbl = tbl;
+	desc.flags = flags;
+	desc.frag_defer_limit = limit;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	return proc;
+}
+
+/* files of groups 7, 3 and 5 interleaved, in the order they are written */
+static const sqfs_u64 groups[NUM_FILES] = { 7, 3, 7, 3, 7, 5 };
+
+/* where the tail-ends are expected with grouping: 7 first, then 3, then 5 */
+static const sqfs_u32 grouped_pos[NUM_FILES] = { 0, 3, 1, 4, 2, 5 };
+
+static void test_grouping(sqfs_u32 flags, const sqfs_u32 *expect)
+{
+	sqfs_inode_generic_t *inode[NUM_FILES];
+	sqfs_block_processor_t *proc;
+	sqfs_frag_table_t *tbl;
+	size_t i;
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	proc = create(flags, 0, tbl);
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		inode[i] = NULL;
+		fill_data(i + 1);
+		add_file(proc, inode + i, groups[i], TAIL_SIZE);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		check_frag(inode[i], 0, (expect == NULL ? i : expect[i]) *
+			   TAIL_SIZE);
+		free(inode[i]);
+	}
+
+	TEST_EQUAL_UI(sqfs_block_processor_get_stats(proc)->actual_frag_count,
+		      NUM_FILES);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *a = NULL, *b = NULL, *c = NULL;
+	sqfs_inode_generic_t *many[NUM_MANY];
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_u32 idx, off;
+	sqfs_frag_table_t *tbl;
+	size_t i;
+	(void)argc; (void)argv;
+
+	/* the group is ignored without the flag */
+	test_grouping(0, NULL);
+	test_grouping(SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, grouped_pos);
+
+	/* the group can only be set for the current file */
+	proc = create(SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, 0, NULL);
+	TEST_EQUAL_I(sqfs_block_processor_set_fragment_group(proc, 1),
+		     SQFS_ERROR_SEQUENCE);
+	sqfs_destroy(proc);
+
+	/* duplicates among the buffered tail-ends are caught when packing */
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	proc = create(SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, 0, tbl);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	fill_data(42);
+	add_file(proc, &a, 2, TAIL_SIZE);
+	fill_data(43);
+	add_file(proc, &c, 1, TAIL_SIZE);
+	fill_data(42);
+	add_file(proc, &b, 1, TAIL_SIZE);
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	check_frag(a, 0, 0);
+	check_frag(c, 0, TAIL_SIZE);
+	check_frag(b, 0, 0);
+	TEST_EQUAL_UI(stats->actual_frag_count, 2);
+	TEST_EQUAL_UI(stats->frag_dedup_bytes, TAIL_SIZE);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	free(a);
+	free(b);
+	free(c);
+	a = b = c = NULL;
+
+	/* a file found by early deduplication gets the tail of the original */
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	proc = create(SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS |
+		      SQFS_BLOCK_PROCESSOR_EARLY_DEDUP, 0, tbl);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	fill_data(1337);
+	add_file(proc, &a, 3, sizeof(file_data));
+	add_file(proc, &c, 4, TAIL_SIZE / 2);
+	add_file(proc, &b, 4, sizeof(file_data));
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	TEST_EQUAL_UI(stats->early_dedup_file_count, 1);
+	check_frag(a, 0, 0);
+	check_frag(b, 0, 0);
+	check_frag(c, 0, TAIL_SIZE);
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+	free(a);
+	free(b);
+	free(c);
+
+	/* more tail-ends than fit into the buffer are packed on the way */
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+	proc = create(SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS, 1, tbl);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	for (i = 0; i < NUM_MANY; ++i) {
+		many[i] = NULL;
+		fill_data(i + 1000);
+		add_file(proc, many + i, i % 2, TAIL_SIZE);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+	TEST_EQUAL_UI(stats->actual_frag_count, NUM_MANY);
+
+	/* 40 tail-ends fit into a fragment block */
+	TEST_EQUAL_UI(sqfs_frag_table_get_size(tbl), (NUM_MANY + 39) / 40);
+
+	for (i = 0; i < NUM_MANY; ++i) {
+		sqfs_inode_get_frag_location(many[i], &idx, &off);
+		TEST_ASSERT(idx < sqfs_frag_table_get_size(tbl));
+		TEST_ASSERT(off + TAIL_SIZE <= BLK_SIZE);
+		free(many[i]);
+	}
+
+	sqfs_destroy(proc);
+	sqfs_destroy(tbl);
+
+	/* the structure from before the limit was added is still accepted */
+	memset(&desc, 0, sizeof(desc));
+	desc.size = offsetof(sqfs_block_processor_desc_t, frag_defer_limit);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 1;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.flags = SQFS_BLOCK_PROCESSOR_DEFER_FRAGMENTS;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	sqfs_destroy(proc);
+	return EXIT_SUCCESS;
+}
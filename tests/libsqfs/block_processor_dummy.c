@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_dummy.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "block_processor_dummy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+size_t dummy_comp_calls = 0;
+
+int (*dummy_write_hook)(sqfs_u32 size, sqfs_u32 flags,
+			const sqfs_u8 *data) = NULL;
+
+static sqfs_u64 write_offset = 0;
+
+sqfs_s32 dummy_do_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	(void)cmp; (void)outsize;
+
+	dummy_comp_calls += 1;
+	memcpy(out, in, size / 2);
+	return size / 2;
+}
+
+static sqfs_object_t *dummy_copy(const sqfs_object_t *obj)
+{
+	dummy_compressor_t *cmp = malloc(sizeof(*cmp));
+
+	if (cmp != NULL)
+		memcpy(cmp, obj, sizeof(*cmp));
+
+	return (sqfs_object_t *)cmp;
+}
+
+static void dummy_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static int dummy_write_data_block(sqfs_block_writer_t *wr, void *user,
+				  sqfs_u32 size, sqfs_u32 checksum,
+				  sqfs_u32 flags, const sqfs_u8 *data,
+				  sqfs_u64 *location)
+{
+	(void)wr; (void)user; (void)checksum;
+
+	*location = write_offset;
+	write_offset += size;
+
+	return dummy_write_hook == NULL ? 0 :
+		dummy_write_hook(size, flags, data);
+}
+
+static sqfs_u64 dummy_get_block_count(const sqfs_block_writer_t *wr)
+{
+	(void)wr;
+	return 0;
+}
+
+dummy_compressor_t dummy_compressor = {
+	{
+		{ dummy_destroy, dummy_copy },
+		NULL,
+		NULL,
+		NULL,
+		dummy_do_block,
+	},
+	0,
+};
+
+sqfs_block_writer_t dummy_writer = {
+	{ NULL, NULL },
+	dummy_write_data_block,
+	dummy_get_block_count,
+};
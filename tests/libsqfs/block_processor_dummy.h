@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_dummy.h
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#ifndef BLOCK_PROCESSOR_DUMMY_H
+#define BLOCK_PROCESSOR_DUMMY_H
+
+#include "sqfs/block_processor.h"
+#include "sqfs/block_writer.h"
+#include "sqfs/compressor.h"
+
+/*
+  A compressor for the block processor tests. Copies made for the workers
+  include the tag and the do_block function, so a test can replace the
+  function, or create several tagged compressors from the default one.
+ */
+typedef struct {
+	sqfs_compressor_t base;
+	sqfs_u8 tag;
+} dummy_compressor_t;
+
+/*
+  "Compresses" a block to half its size by cutting it off. The default
+  do_block function of the dummy compressor.
+ */
+sqfs_s32 dummy_do_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize);
+
+extern dummy_compressor_t dummy_compressor;
+
+/* the number of times dummy_do_block was called */
+extern size_t dummy_comp_calls;
+
+/*
+  A block writer that places the blocks one after another, starting at 0.
+  If set, the hook is called for every block and its return value is passed
+  on to the block processor.
+ */
+extern sqfs_block_writer_t dummy_writer;
+
+extern int (*dummy_write_hook)(sqfs_u32 size, sqfs_u32 flags,
+			       const sqfs_u8 *data);
+
+#endif /* BLOCK_PROCESSOR_DUMMY_H */
@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_mem_limit.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/frag_table.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (4096)
+#define NUM_FILES (20)
+#define NUM_BLOCKS (3)
+#define TAIL_SIZE (700)
+#define FILE_SIZE (NUM_BLOCKS * BLK_SIZE + TAIL_SIZE)
+#define MEM_LIMIT (16 * BLK_SIZE)
+
+static sqfs_u8 file_data[NUM_FILES][FILE_SIZE];
+static sqfs_u8 frag_data[NUM_FILES * TAIL_SIZE];
+static size_t frag_used = 0;
+static size_t data_blocks = 0;
+static size_t frag_blocks = 0;
+
+static int write_hook(sqfs_u32 size, sqfs_u32 flags, const sqfs_u8 *data)
+{
+	size_t i;
+
+	/* the end of a file with a tail end is marked with an empty block */
+	if (size == 0)
+		return 0;
+
+	TEST_ASSERT(flags & SQFS_BLK_IS_COMPRESSED);
+
+	if (flags & SQFS_BLK_FRAGMENT_BLOCK) {
+		/* fragments are packed in order, compressed in the middle */
+		TEST_ASSERT(frag_used + size <= sizeof(frag_data));
+		TEST_ASSERT(memcmp(data, frag_data + frag_used, size) == 0);
+		frag_used += 2 * size;
+		frag_blocks += 1;
+	} else {
+		TEST_EQUAL_UI(size, BLK_SIZE / 2);
+
+		i = data_blocks / NUM_BLOCKS;
+		TEST_ASSERT(memcmp(data, file_data[i] + (data_blocks %
+							 NUM_BLOCKS) * BLK_SIZE,
+				   size) == 0);
+		data_blocks += 1;
+	}
+
+	return 0;
+}
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file; (void)offset; (void)buffer; (void)size;
+	return SQFS_ERROR_IO;
+}
+
+static sqfs_file_t dummy_file = {
+	{ NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static void fill_data(void)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i, j;
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		for (j = 0; j < FILE_SIZE; ++j) {
+			seed = seed * 1103515245 + 12345;
+			file_data[i][j] = (seed >> 16) & 0xFF;
+		}
+
+		memcpy(frag_data + i * TAIL_SIZE,
+		       file_data[i] + NUM_BLOCKS * BLK_SIZE, TAIL_SIZE);
+	}
+}
+
+static void init_desc(sqfs_block_processor_desc_t *desc,
+		      sqfs_frag_table_t *tbl, sqfs_u64 mem_limit)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->size = sizeof(*desc);
+	desc->max_block_size = BLK_SIZE;
+	desc->num_workers = 2;
+	desc->max_backlog = 1000;
+	desc->cmp = &dummy_compressor.base;
+	desc->wr = &dummy_writer;
+	desc->tbl = tbl;
+	desc->file = &dummy_file;
+	desc->uncmp = &dummy_compressor.base;
+	desc->mem_limit = mem_limit;
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	sqfs_frag_table_t *tbl;
+	size_t i;
+	(void)argc; (void)argv;
+
+	dummy_write_hook = write_hook;
+	fill_data();
+
+	tbl = sqfs_frag_table_create(0);
+	TEST_NOT_NULL(tbl);
+
+	/* a limit that cannot hold enough blocks is rejected */
+	init_desc(&desc, tbl, 4 * BLK_SIZE);
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+
+	/* the backlog is derived from the limit, not from max_backlog */
+	init_desc(&desc, tbl, MEM_LIMIT);
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+
+	for (i = 0; i < NUM_FILES; ++i) {
+		TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, NULL,
+							     NULL, 0), 0);
+		TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data[i],
+							 FILE_SIZE), 0);
+		TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+	}
+
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->data_block_count, NUM_FILES * NUM_BLOCKS);
+	TEST_EQUAL_UI(stats->frag_block_count, frag_blocks);
+	TEST_EQUAL_UI(stats->actual_frag_count, NUM_FILES);
+	TEST_ASSERT(stats->backlog_max < (MEM_LIMIT / BLK_SIZE));
+
+	TEST_EQUAL_UI(data_blocks, NUM_FILES * NUM_BLOCKS);
+	TEST_EQUAL_UI(frag_used, sizeof(frag_data));
+	TEST_ASSERT(frag_blocks > 1);
+
+	sqfs_destroy(proc);
+
+	sqfs_destroy(tbl);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_probe.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (65536)
+
+static sqfs_u8 block[BLK_SIZE];
+static sqfs_u32 last_flags;
+static sqfs_u32 last_size;
+
+/* "compresses" a block by the percentage stored in its first byte */
+static sqfs_s32 percent_do_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+				 sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_u32 newsize = size - (size * in[0]) / 100;
+	(void)cmp;
+
+	dummy_comp_calls += 1;
+
+	if (newsize >= size || newsize > outsize)
+		return 0;
+
+	memset(out, 0, newsize);
+	return newsize;
+}
+
+static int write_hook(sqfs_u32 size, sqfs_u32 flags, const sqfs_u8 *data)
+{
+	(void)data;
+	last_flags = flags;
+	last_size = size;
+	return 0;
+}
+
+static void fill_random(sqfs_u8 percent)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i;
+
+	for (i = 0; i < sizeof(block); ++i) {
+		seed = seed * 1103515245 + 12345;
+		block[i] = (seed >> 16) & 0xFF;
+	}
+
+	block[0] = percent;
+}
+
+static void fill_text(sqfs_u8 percent)
+{
+	static const char *text = "The quick brown fox jumps over the lazy dog. ";
+	size_t i, len = strlen(text);
+
+	for (i = 0; i < sizeof(block); ++i)
+		block[i] = text[i % len];
+
+	block[0] = percent;
+}
+
+static void submit(sqfs_block_processor_t *proc)
+{
+	TEST_EQUAL_I(sqfs_block_processor_submit_block(proc, NULL,
+						       SQFS_BLK_DONT_FRAGMENT,
+						       block, sizeof(block)),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_sync(proc), 0);
+}
+
+static sqfs_block_processor_t *create(sqfs_u32 size, sqfs_u32 threshold,
+				      sqfs_u32 min_gain)
+{
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = size;
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 1;
+	desc.max_backlog = 3;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.probe_threshold = threshold;
+	desc.min_gain = min_gain;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	return proc;
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_block_processor_t *proc;
+	(void)argc; (void)argv;
+
+	dummy_compressor.base.do_block = percent_do_block;
+	dummy_write_hook = write_hook;
+
+	/* random data is skipped by the probe, text is not */
+	proc = create(sizeof(desc), 7950, 0);
+	stats = sqfs_block_processor_get_stats(proc);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+
+	fill_random(50);
+	submit(proc);
+	TEST_EQUAL_UI(dummy_comp_calls, 0);
+	TEST_ASSERT(!(last_flags & SQFS_BLK_IS_COMPRESSED));
+	TEST_EQUAL_UI(last_size, BLK_SIZE);
+	TEST_EQUAL_UI(stats->probe_skip_count, 1);
+
+	fill_text(50);
+	submit(proc);
+	TEST_EQUAL_UI(dummy_comp_calls, 1);
+	TEST_ASSERT(last_flags & SQFS_BLK_IS_COMPRESSED);
+	TEST_EQUAL_UI(last_size, BLK_SIZE / 2);
+	TEST_EQUAL_UI(stats->probe_skip_count, 1);
+	TEST_EQUAL_UI(stats->low_gain_count, 0);
+	sqfs_destroy(proc);
+
+	/* blocks that barely shrink are stored uncompressed */
+	proc = create(sizeof(desc), 0, 10);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	fill_random(5);
+	submit(proc);
+	TEST_EQUAL_UI(dummy_comp_calls, 2);
+	TEST_ASSERT(!(last_flags & SQFS_BLK_IS_COMPRESSED));
+	TEST_EQUAL_UI(last_size, BLK_SIZE);
+	TEST_EQUAL_UI(stats->probe_skip_count, 0);
+	TEST_EQUAL_UI(stats->low_gain_count, 1);
+
+	fill_text(20);
+	submit(proc);
+	TEST_EQUAL_UI(dummy_comp_calls, 3);
+	TEST_ASSERT(last_flags & SQFS_BLK_IS_COMPRESSED);
+	TEST_EQUAL_UI(stats->low_gain_count, 1);
+	sqfs_destroy(proc);
+
+	/* the old structure layout is accepted and disables both */
+	proc = create(offsetof(sqfs_block_processor_desc_t, probe_threshold),
+		      7950, 10);
+
+	fill_random(5);
+	submit(proc);
+	TEST_EQUAL_UI(dummy_comp_calls, 4);
+	TEST_ASSERT(last_flags & SQFS_BLK_IS_COMPRESSED);
+	sqfs_destroy(proc);
+
+	/* nonsensical gain values are rejected */
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 1;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.min_gain = 100;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc),
+		     SQFS_ERROR_ARG_INVALID);
+	return EXIT_SUCCESS;
+}
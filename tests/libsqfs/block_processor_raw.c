@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * block_processor_raw.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "../test.h"
+
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+
+#include "block_processor_dummy.h"
+
+#define BLK_SIZE (4096)
+#define FILE_SIZE (2 * BLK_SIZE)
+
+static sqfs_u8 file_data[FILE_SIZE];
+static sqfs_u32 write_flags[8];
+static size_t write_count = 0;
+
+static int write_hook(sqfs_u32 size, sqfs_u32 flags, const sqfs_u8 *data)
+{
+	(void)size; (void)data;
+	if (write_count < sizeof(write_flags) / sizeof(write_flags[0]))
+		write_flags[write_count++] = flags;
+	return 0;
+}
+
+static void count_events(const sqfs_block_processor_t *proc, sqfs_u32 thread,
+			 size_t events[6])
+{
+	const sqfs_block_processor_trace_event_t *ev;
+	size_t i, count;
+
+	memset(events, 0, 6 * sizeof(events[0]));
+	ev = sqfs_block_processor_get_trace(proc, thread, &count);
+
+	for (i = 0; i < count; ++i) {
+		TEST_ASSERT(ev[i].type < 6);
+		events[ev[i].type] += 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_block_processor_stats_t *stats;
+	sqfs_block_processor_desc_t desc;
+	sqfs_inode_generic_t *inode = NULL;
+	sqfs_block_processor_t *proc;
+	sqfs_u64 size, busy[3];
+	size_t events[12], count;
+	sqfs_u8 raw[BLK_SIZE];
+	(void)argc; (void)argv;
+
+	dummy_write_hook = write_hook;
+	memset(raw, 0, sizeof(raw));
+	memset(file_data, 'A', sizeof(file_data));
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = BLK_SIZE;
+	desc.num_workers = 2;
+	desc.max_backlog = 3;
+	desc.cmp = &dummy_compressor.base;
+	desc.wr = &dummy_writer;
+	desc.flags = SQFS_BLOCK_PROCESSOR_EARLY_DEDUP |
+		SQFS_BLOCK_PROCESSOR_TRACE;
+
+	TEST_EQUAL_I(sqfs_block_processor_create_ex(&desc, &proc), 0);
+	stats = sqfs_block_processor_get_stats(proc);
+
+	/* not allowed outside of a file */
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, 10, 0),
+		     SQFS_ERROR_SEQUENCE);
+
+	TEST_EQUAL_I(sqfs_block_processor_begin_file(proc, &inode, NULL, 0), 0);
+
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, 0, 0),
+		     SQFS_ERROR_OVERFLOW);
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, BLK_SIZE + 1,
+						     0),
+		     SQFS_ERROR_OVERFLOW);
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, 10,
+						     SQFS_BLK_DONT_FRAGMENT),
+		     SQFS_ERROR_UNSUPPORTED);
+
+	/* raw blocks can be mixed with regular ones, if block aligned */
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data, BLK_SIZE),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, 100,
+						     SQFS_BLK_IS_COMPRESSED),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, BLK_SIZE, 0),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data, 10), 0);
+	TEST_EQUAL_I(sqfs_block_processor_append_raw(proc, raw, 100, 0),
+		     SQFS_ERROR_SEQUENCE);
+	TEST_EQUAL_I(sqfs_block_processor_append(proc, file_data,
+						 BLK_SIZE - 10), 0);
+	TEST_EQUAL_I(sqfs_block_processor_end_file(proc), 0);
+	TEST_EQUAL_I(sqfs_block_processor_finish(proc), 0);
+
+	/* only the regular blocks went through the compressor */
+	TEST_EQUAL_UI(dummy_comp_calls, 2);
+	TEST_EQUAL_UI(stats->raw_block_count, 2);
+	TEST_EQUAL_UI(stats->data_block_count, 4);
+	TEST_EQUAL_UI(stats->input_bytes_read, 4 * BLK_SIZE);
+
+	/* the all zero, raw block is not mistaken for a sparse one */
+	TEST_EQUAL_UI(stats->sparse_block_count, 0);
+
+	sqfs_inode_get_file_size(inode, &size);
+	TEST_EQUAL_UI(size, 4 * BLK_SIZE);
+	TEST_EQUAL_UI(inode->payload_bytes_used, 4 * sizeof(sqfs_u32));
+	TEST_EQUAL_UI(inode->extra[0], BLK_SIZE / 2);
+	TEST_EQUAL_UI(inode->extra[1], 100);
+	TEST_EQUAL_UI(inode->extra[2], (BLK_SIZE | (1 << 24)));
+	TEST_EQUAL_UI(inode->extra[3], BLK_SIZE / 2);
+
+	TEST_EQUAL_UI(write_count, 5);
+	TEST_ASSERT(write_flags[0] & SQFS_BLK_FIRST_BLOCK);
+	TEST_ASSERT(write_flags[1] & SQFS_BLK_IS_COMPRESSED);
+	TEST_ASSERT(!(write_flags[2] & SQFS_BLK_IS_COMPRESSED));
+	TEST_ASSERT(!(write_flags[1] & SQFS_BLK_FIRST_BLOCK));
+
+	/* 4 data blocks and the sentinel marking the end of the file */
+	TEST_EQUAL_UI(stats->blocks_enqueued, 5);
+	TEST_ASSERT(stats->backlog_max >= 1 && stats->backlog_max <= 3);
+	TEST_ASSERT(stats->backlog_sum >= stats->blocks_enqueued);
+	TEST_ASSERT(stats->backlog_sum <= 3 * stats->blocks_enqueued);
+
+	/* the per worker times add up */
+	TEST_EQUAL_UI(stats->worker_count, 2);
+	TEST_EQUAL_I(sqfs_block_processor_get_worker_time(proc, 0, &busy[0]),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_get_worker_time(proc, 1, &busy[1]),
+		     0);
+	TEST_EQUAL_I(sqfs_block_processor_get_worker_time(proc, 2, &busy[2]),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	TEST_EQUAL_UI(busy[0] + busy[1], stats->worker_time_ns);
+
+	/* every block shows up in the trace */
+	count_events(proc, 0, events);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_SUBMIT], 5);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_WAIT], 5);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_REORDER], 5);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_WRITE], 5);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_PROCESS], 0);
+
+	count_events(proc, 1, events);
+	count_events(proc, 2, events + 6);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_PROCESS] +
+		      events[6 + SQFS_TRACE_EVENT_PROCESS], 5);
+	TEST_EQUAL_UI(events[SQFS_TRACE_EVENT_SUBMIT], 0);
+
+	TEST_NULL(sqfs_block_processor_get_trace(proc, 3, &count));
+	TEST_EQUAL_UI(count, 0);
+
+	sqfs_destroy(proc);
+	free(inode);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,371 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * comp_benchmark.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "common.h"
+#include "compress_cli.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+static struct option long_opts[] = {
+	{ "compressor", required_argument, NULL, 'c' },
+	{ "comp-extra", required_argument, NULL, 'X' },
+	{ "block-size", required_argument, NULL, 'b' },
+	{ "block-count", required_argument, NULL, 'n' },
+	{ "input", required_argument, NULL, 'i' },
+	{ "version", no_argument, NULL, 'V' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "c:X:b:n:i:hV";
+
+static const char *help_string =
+"Usage: comp_benchmark [OPTIONS...]\n"
+"\n"
+"Repeatedly compresses and uncompresses data blocks through the libsquashfs\n"
+"block compressors and prints the achieved throughput in blocks per second.\n"
+"\n"
+"Possible options:\n"
+"\n"
+"  --compressor, -c <name>    Only benchmark the specified compressor. The\n"
+"                             default is to try all available ones.\n"
+"  --comp-extra, -X <options> Extra compressor options, same as for\n"
+"                             gensquashfs. Requires --compressor.\n"
+"  --block-size, -b <size>    The block size to use. Default is 128k.\n"
+"  --block-count, -n <count>  How many blocks to process. Default is 1000.\n"
+"  --input, -i <file>         Read the input data from a file, split into\n"
+"                             blocks and cycled through as needed. The\n"
+"                             default is to generate moderately compressible\n"
+"                             data.\n"
+"\n";
+
+static sqfs_u8 *load_file(const char *path, size_t *size)
+{
+	sqfs_u8 *data = NULL, *new;
+	size_t used = 0, total = 0;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	for (;;) {
+		if (used == total) {
+			total = total ? total * 2 : 1024 * 1024;
+			new = realloc(data, total);
+			if (new == NULL) {
+				perror(path);
+				goto fail;
+			}
+			data = new;
+		}
+
+		used += fread(data + used, 1, total - used, fp);
+
+		if (ferror(fp)) {
+			perror(path);
+			goto fail;
+		}
+
+		if (feof(fp))
+			break;
+	}
+
+	fclose(fp);
+
+	if (used == 0) {
+		fprintf(stderr, "%s: file is empty\n", path);
+		free(data);
+		return NULL;
+	}
+
+	*size = used;
+	return data;
+fail:
+	fclose(fp);
+	free(data);
+	return NULL;
+}
+
+static sqfs_u8 *gen_data(size_t size)
+{
+	static const char *words[] = {
+		"squashfs", "block", "fragment", "inode", "directory",
+		"compressor", "xattr", "table", "super", "data",
+	};
+	sqfs_u32 seed = 0xDEADBEEF;
+	sqfs_u8 *data;
+	size_t i, len;
+
+	data = malloc(size);
+	if (data == NULL) {
+		perror("generating input data");
+		return NULL;
+	}
+
+	for (i = 0; i < size; i += len) {
+		seed = seed * 1103515245 + 12345;
+
+		if ((seed >> 16) % 4 == 0) {
+			data[i] = (seed >> 8) & 0xFF;
+			len = 1;
+		} else {
+			const char *w = words[(seed >> 16) % 10];
+
+			len = strlen(w);
+			if (len > size - i)
+				len = size - i;
+
+			memcpy(data + i, w, len);
+		}
+	}
+
+	return data;
+}
+
+static double elapsed(clock_t start)
+{
+	double diff = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	return diff > 0.0 ? diff : 1e-9;
+}
+
+static int run_benchmark(const sqfs_compressor_config_t *cfg,
+			 const sqfs_u8 *data, size_t size, long count,
+			 bool verbose)
+{
+	sqfs_compressor_config_t ucfg;
+	sqfs_compressor_t *cmp, *ucmp;
+	size_t i, nblocks, total_in = 0, total_out = 0;
+	sqfs_u8 *packed, *buffer;
+	sqfs_u32 *sizes;
+	double ctime, utime;
+	const char *name;
+	sqfs_s32 ret;
+	clock_t start;
+	long n;
+
+	name = sqfs_compressor_name_from_id(cfg->id);
+
+	ret = sqfs_compressor_create(cfg, &cmp);
+#ifdef WITH_LZO
+	if (cfg->id == SQFS_COMP_LZO && ret != 0)
+		ret = lzo_compressor_create(cfg, &cmp);
+#endif
+	if (ret != 0) {
+		if (verbose)
+			sqfs_perror(name, "creating compressor", ret);
+		return -1;
+	}
+
+	ucfg = *cfg;
+	ucfg.flags |= SQFS_COMP_FLAG_UNCOMPRESS;
+
+	ret = sqfs_compressor_create(&ucfg, &ucmp);
+#ifdef WITH_LZO
+	if (cfg->id == SQFS_COMP_LZO && ret != 0)
+		ret = lzo_compressor_create(&ucfg, &ucmp);
+#endif
+	if (ret != 0) {
+		sqfs_perror(name, "creating decompressor", ret);
+		sqfs_destroy(cmp);
+		return -1;
+	}
+
+	nblocks = size / cfg->block_size;
+
+	packed = calloc(nblocks, cfg->block_size);
+	buffer = malloc(cfg->block_size);
+	sizes = calloc(nblocks, sizeof(sizes[0]));
+
+	if (packed == NULL || buffer == NULL || sizes == NULL) {
+		perror(name);
+		ret = -1;
+		goto out;
+	}
+
+	/* compress */
+	start = clock();
+
+	for (n = 0; n < count; ++n) {
+		i = n % nblocks;
+
+		ret = cmp->do_block(cmp, data + i * cfg->block_size,
+				    cfg->block_size,
+				    packed + i * cfg->block_size,
+				    cfg->block_size);
+		if (ret < 0) {
+			sqfs_perror(name, "compressing block", ret);
+			goto out;
+		}
+
+		sizes[i] = ret;
+		total_in += cfg->block_size;
+		total_out += ret > 0 ? (size_t)ret : cfg->block_size;
+	}
+
+	ctime = elapsed(start);
+
+	/* uncompress */
+	start = clock();
+
+	for (n = 0; n < count; ++n) {
+		i = n % nblocks;
+
+		if (sizes[i] == 0)
+			continue;
+
+		ret = ucmp->do_block(ucmp, packed + i * cfg->block_size,
+				     sizes[i], buffer, cfg->block_size);
+		if (ret < 0) {
+			sqfs_perror(name, "uncompressing block", ret);
+			goto out;
+		}
+
+		if ((size_t)ret != cfg->block_size ||
+		    memcmp(buffer, data + i * cfg->block_size, ret) != 0) {
+			fprintf(stderr, "%s: round trip mismatch\n", name);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	utime = elapsed(start);
+
+	printf("%-6s compress: %10.1f blocks/s  uncompress: %10.1f blocks/s  "
+	       "ratio: %.3f\n", name, count / ctime, count / utime,
+	       (double)total_out / (double)total_in);
+	ret = 0;
+out:
+	free(sizes);
+	free(buffer);
+	free(packed);
+	sqfs_destroy(ucmp);
+	sqfs_destroy(cmp);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i, size, block_size = SQFS_DEFAULT_BLOCK_SIZE;
+	char *comp_extra = NULL, *input = NULL;
+	sqfs_compressor_config_t cfg;
+	int id = -1, status = EXIT_SUCCESS;
+	sqfs_u8 *data, *new;
+	long count = 1000;
+
+	for (;;) {
+		int i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'c':
+			id = sqfs_compressor_id_from_name(optarg);
+			if (id < 0) {
+				fprintf(stderr, "Unsupported compressor '%s'\n",
+					optarg);
+				goto fail_arg;
+			}
+			break;
+		case 'X':
+			comp_extra = optarg;
+			break;
+		case 'b':
+			if (parse_size("Block size", &block_size, optarg, 0))
+				return EXIT_FAILURE;
+			break;
+		case 'n':
+			count = strtol(optarg, NULL, 0);
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'h':
+			fputs(help_string, stdout);
+			return EXIT_SUCCESS;
+		case 'V':
+			print_version("comp_benchmark");
+			return EXIT_SUCCESS;
+		default:
+			goto fail_arg;
+		}
+	}
+
+	if (count <= 0) {
+		fputs("A block count > 0 must be specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (block_size < SQFS_MIN_BLOCK_SIZE ||
+	    block_size > SQFS_MAX_BLOCK_SIZE) {
+		fputs("Block size out of range.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (comp_extra != NULL && id < 0) {
+		fputs("Compressor options require a compressor.\n", stderr);
+		goto fail_arg;
+	}
+
+	/* at least one full block, rounded down to a multiple of blocks */
+	if (input != NULL) {
+		data = load_file(input, &size);
+		if (data == NULL)
+			return EXIT_FAILURE;
+
+		if (size < block_size) {
+			new = realloc(data, block_size);
+			if (new == NULL) {
+				perror(input);
+				free(data);
+				return EXIT_FAILURE;
+			}
+
+			memset(new + size, 0, block_size - size);
+			data = new;
+			size = block_size;
+		}
+	} else {
+		size = 16 * block_size;
+
+		data = gen_data(size);
+		if (data == NULL)
+			return EXIT_FAILURE;
+	}
+
+	for (i = SQFS_COMP_MIN; i <= SQFS_COMP_MAX; ++i) {
+		if (id >= 0 && i != (size_t)id)
+			continue;
+
+		if (compressor_cfg_init_options(&cfg, i, block_size,
+						comp_extra)) {
+			if (id < 0)
+				continue;
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		if (run_benchmark(&cfg, data, size, count, id >= 0)) {
+			if (id >= 0)
+				status = EXIT_FAILURE;
+		}
+	}
+
+	free(data);
+	return status;
+fail_arg:
+	fputs("Try `comp_benchmark --help' for more information.\n", stderr);
+	return EXIT_FAILURE;
+}
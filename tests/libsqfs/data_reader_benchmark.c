@@ -0,0 +1,478 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_benchmark.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "common.h"
+#include "util.h"
+#include "threadpool.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+#include <sys/resource.h>
+#endif
+
+#define MAX_LIST (16)
+
+static struct option long_opts[] = {
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "reads", required_argument, NULL, 'n' },
+	{ "read-size", required_argument, NULL, 's' },
+	{ "mode", required_argument, NULL, 'm' },
+	{ "version", no_argument, NULL, 'V' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "j:n:s:m:hV";
+
+static const char *help_string =
+"Usage: data_reader_benchmark [OPTIONS...] <squashfs-file>\n"
+"\n"
+"Reads random ranges of random files from a SquashFS image, from several\n"
+"threads at once, and prints one line of CSV per thread count and mode.\n"
+"\n"
+"Possible options:\n"
+"\n"
+"  --jobs, -j <list>         A comma separated list of thread counts.\n"
+"                            Defaults to 1 and the number of CPUs.\n"
+"  --reads, -n <count>       Number of reads per thread. Defaults to 10000.\n"
+"  --read-size, -s <size>    Number of bytes per read. Defaults to 4K.\n"
+"  --mode, -m <mode>         Either 'shared', where all threads use one\n"
+"                            data reader created with the shared flag, or\n"
+"                            'private', where every thread creates its own\n"
+"                            data reader and compressor. The default is to\n"
+"                            run both.\n"
+"\n";
+
+typedef struct {
+	sqfs_file_t *file;
+	sqfs_compressor_t *cmp;
+	sqfs_super_t super;
+	sqfs_tree_node_t *root;
+
+	const sqfs_inode_generic_t **files;
+	size_t num_files;
+} image_t;
+
+typedef struct {
+	const image_t *img;
+	sqfs_data_reader_t *data;
+	sqfs_compressor_t *cmp;
+	sqfs_u32 seed;
+	size_t reads;
+	size_t read_size;
+	sqfs_u64 bytes;
+	int status;
+} job_t;
+
+static int add_files(image_t *img, const sqfs_tree_node_t *n)
+{
+	const sqfs_inode_generic_t **new;
+	sqfs_u64 size;
+
+	for (; n != NULL; n = n->next) {
+		if (S_ISDIR(n->inode->base.mode)) {
+			if (add_files(img, n->children))
+				return -1;
+			continue;
+		}
+
+		if (n->inode->base.type != SQFS_INODE_FILE &&
+		    n->inode->base.type != SQFS_INODE_EXT_FILE) {
+			continue;
+		}
+
+		sqfs_inode_get_file_size(n->inode, &size);
+		if (size == 0)
+			continue;
+
+		new = realloc(img->files,
+			      (img->num_files + 1) * sizeof(img->files[0]));
+		if (new == NULL) {
+			perror("indexing files");
+			return -1;
+		}
+
+		img->files = new;
+		img->files[img->num_files++] = n->inode;
+	}
+
+	return 0;
+}
+
+static int open_image(image_t *img, const char *filename)
+{
+	sqfs_compressor_config_t cfg;
+	sqfs_id_table_t *idtbl = NULL;
+	sqfs_dir_reader_t *dr = NULL;
+	int ret;
+
+	img->file = sqfs_open_file(filename, SQFS_FILE_OPEN_READ_ONLY);
+	if (img->file == NULL) {
+		perror(filename);
+		return -1;
+	}
+
+	ret = sqfs_super_read(&img->super, img->file);
+	if (ret) {
+		sqfs_perror(filename, "reading super block", ret);
+		return -1;
+	}
+
+	sqfs_compressor_config_init(&cfg, img->super.compression_id,
+				    img->super.block_size,
+				    SQFS_COMP_FLAG_UNCOMPRESS);
+
+	ret = sqfs_compressor_create(&cfg, &img->cmp);
+#ifdef WITH_LZO
+	if (img->super.compression_id == SQFS_COMP_LZO && ret != 0)
+		ret = lzo_compressor_create(&cfg, &img->cmp);
+#endif
+	if (ret != 0) {
+		sqfs_perror(filename, "creating compressor", ret);
+		return -1;
+	}
+
+	if (img->super.flags & SQFS_FLAG_COMPRESSOR_OPTIONS) {
+		ret = img->cmp->read_options(img->cmp, img->file);
+		if (ret) {
+			sqfs_perror(filename, "reading compressor options",
+				    ret);
+			return -1;
+		}
+	}
+
+	idtbl = sqfs_id_table_create(0);
+	dr = sqfs_dir_reader_create(&img->super, img->cmp, img->file,
+				    SQFS_DIR_READER_BLOCK_CACHE);
+	if (idtbl == NULL || dr == NULL) {
+		sqfs_perror(filename, "loading directory tree",
+			    SQFS_ERROR_ALLOC);
+		goto fail;
+	}
+
+	ret = sqfs_id_table_read(idtbl, img->file, &img->super, img->cmp);
+	if (ret == 0) {
+		ret = sqfs_dir_reader_get_full_hierarchy(dr, idtbl, NULL, 0,
+							 &img->root);
+	}
+
+	if (ret) {
+		sqfs_perror(filename, "loading directory tree", ret);
+		goto fail;
+	}
+
+	sqfs_destroy(dr);
+	sqfs_destroy(idtbl);
+
+	if (add_files(img, img->root))
+		return -1;
+
+	if (img->num_files == 0) {
+		fprintf(stderr, "%s: no files with data found.\n", filename);
+		return -1;
+	}
+
+	return 0;
+fail:
+	sqfs_destroy(dr);
+	sqfs_destroy(idtbl);
+	return -1;
+}
+
+static void close_image(image_t *img)
+{
+	if (img->root != NULL)
+		sqfs_dir_tree_destroy(img->root);
+
+	sqfs_destroy(img->cmp);
+	sqfs_destroy(img->file);
+	free(img->files);
+}
+
+static sqfs_data_reader_t *create_reader(const image_t *img,
+					 sqfs_compressor_t *cmp,
+					 sqfs_u32 flags)
+{
+	sqfs_data_reader_t *data;
+	int ret;
+
+	data = sqfs_data_reader_create(img->file, img->super.block_size,
+				       cmp, flags);
+	if (data == NULL) {
+		sqfs_perror(NULL, "creating data reader", SQFS_ERROR_ALLOC);
+		return NULL;
+	}
+
+	ret = sqfs_data_reader_load_fragment_table(data, &img->super);
+	if (ret) {
+		sqfs_perror(NULL, "loading fragment table", ret);
+		sqfs_destroy(data);
+		return NULL;
+	}
+
+	return data;
+}
+
+static sqfs_u32 next_random(sqfs_u32 *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 1;
+}
+
+static int read_job(void *user, void *item)
+{
+	const sqfs_inode_generic_t *inode;
+	job_t *job = item;
+	sqfs_u64 size, offset;
+	sqfs_u8 *buffer;
+	sqfs_s32 ret;
+	size_t i;
+	(void)user;
+
+	buffer = malloc(job->read_size);
+	if (buffer == NULL) {
+		job->status = SQFS_ERROR_ALLOC;
+		return 0;
+	}
+
+	/* in private mode, the setup is part of the measured work */
+	if (job->data == NULL) {
+		job->cmp = sqfs_copy(job->img->cmp);
+		if (job->cmp != NULL)
+			job->data = create_reader(job->img, job->cmp, 0);
+
+		if (job->data == NULL) {
+			job->status = SQFS_ERROR_ALLOC;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < job->reads; ++i) {
+		inode = job->img->files[next_random(&job->seed) %
+					job->img->num_files];
+
+		sqfs_inode_get_file_size(inode, &size);
+		offset = ((sqfs_u64)next_random(&job->seed) << 31 |
+			  next_random(&job->seed)) % size;
+
+		ret = sqfs_data_reader_read(job->data, inode, offset,
+					    buffer, job->read_size);
+		if (ret < 0) {
+			job->status = ret;
+			break;
+		}
+
+		job->bytes += ret;
+	}
+out:
+	free(buffer);
+	return 0;
+}
+
+static int run(const image_t *img, bool shared, size_t num_jobs,
+	       size_t reads, size_t read_size)
+{
+	sqfs_data_reader_t *data = NULL;
+	sqfs_u64 bytes = 0, start, end;
+	thread_pool_t *pool;
+	job_t *jobs;
+	double wall;
+	size_t i;
+	int ret = -1;
+
+	jobs = alloc_array(sizeof(jobs[0]), num_jobs);
+	pool = thread_pool_create(num_jobs, read_job);
+
+	if (jobs == NULL || pool == NULL) {
+		fputs("Error creating worker threads.\n", stderr);
+		goto out;
+	}
+
+	if (shared) {
+		data = create_reader(img, img->cmp, SQFS_DATA_READER_SHARED);
+		if (data == NULL)
+			goto out;
+	}
+
+	for (i = 0; i < num_jobs; ++i) {
+		jobs[i].img = img;
+		jobs[i].data = data;
+		jobs[i].seed = 0xDEADBEEF ^ (sqfs_u32)(i * 0x9E3779B9);
+		jobs[i].reads = reads;
+		jobs[i].read_size = read_size;
+	}
+
+	start = get_time_ns();
+
+	for (i = 0; i < num_jobs; ++i) {
+		if (pool->submit(pool, jobs + i)) {
+			fputs("Error submitting work.\n", stderr);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < num_jobs; ++i)
+		pool->dequeue(pool);
+
+	end = get_time_ns();
+
+	for (i = 0; i < num_jobs; ++i) {
+		if (jobs[i].status != 0) {
+			sqfs_perror(NULL, "reading file data", jobs[i].status);
+			goto out;
+		}
+
+		bytes += jobs[i].bytes;
+	}
+
+	wall = (double)(end - start) / 1e9;
+
+	printf("%s,%lu,%lu,%lu,%.3f,%.1f,%.0f",
+	       shared ? "shared" : "private", (unsigned long)num_jobs,
+	       (unsigned long)(num_jobs * reads), (unsigned long)bytes, wall,
+	       (double)bytes / (1024.0 * 1024.0) / wall,
+	       (double)(num_jobs * reads) / wall);
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+	{
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			printf(",%ld", usage.ru_maxrss);
+	}
+#endif
+	fputc('\n', stdout);
+	ret = 0;
+out:
+	if (pool != NULL)
+		pool->destroy(pool);
+
+	if (!shared && jobs != NULL) {
+		for (i = 0; i < num_jobs; ++i) {
+			sqfs_destroy(jobs[i].data);
+			sqfs_destroy(jobs[i].cmp);
+		}
+	}
+
+	sqfs_destroy(data);
+	free(jobs);
+	return ret;
+}
+
+static int parse_list(const char *str, size_t *list, size_t *count)
+{
+	char *end;
+
+	for (*count = 0; *count < MAX_LIST; ++(*count)) {
+		list[*count] = strtoul(str, &end, 10);
+
+		if (end == str || list[*count] == 0)
+			break;
+
+		if (*end == '\0') {
+			*count += 1;
+			return 0;
+		}
+
+		if (*end != ',')
+			break;
+
+		str = end + 1;
+	}
+
+	fprintf(stderr, "Jobs: expected a comma separated list of at most "
+		"%d numbers > 0\n", MAX_LIST);
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	size_t jobs[MAX_LIST], num_jobs, i, reads = 10000, read_size = 4096;
+	bool run_shared = true, run_private = true;
+	int status = EXIT_FAILURE;
+	image_t img;
+
+	jobs[0] = 1;
+	jobs[1] = os_get_num_jobs();
+	num_jobs = jobs[1] > 1 ? 2 : 1;
+
+	for (;;) {
+		int i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'j':
+			if (parse_list(optarg, jobs, &num_jobs))
+				goto fail_arg;
+			break;
+		case 'n':
+			reads = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (parse_size("Read size", &read_size, optarg, 0))
+				return EXIT_FAILURE;
+			break;
+		case 'm':
+			if (strcmp(optarg, "shared") == 0) {
+				run_private = false;
+			} else if (strcmp(optarg, "private") == 0) {
+				run_shared = false;
+			} else {
+				fprintf(stderr, "Unknown mode '%s'\n", optarg);
+				goto fail_arg;
+			}
+			break;
+		case 'h':
+			fputs(help_string, stdout);
+			return EXIT_SUCCESS;
+		case 'V':
+			print_version("data_reader_benchmark");
+			return EXIT_SUCCESS;
+		default:
+			goto fail_arg;
+		}
+	}
+
+	if (optind >= argc) {
+		fputs("No image file specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (reads == 0 || read_size == 0 || read_size >= 0x7FFFFFFF) {
+		fputs("Invalid read count or size.\n", stderr);
+		goto fail_arg;
+	}
+
+	memset(&img, 0, sizeof(img));
+	if (open_image(&img, argv[optind]))
+		goto out;
+
+	puts("mode,threads,reads,bytes,wall_s,mib_per_s,reads_per_s,"
+	     "peak_rss_kib");
+
+	for (i = 0; i < num_jobs; ++i) {
+		if (run_shared && run(&img, true, jobs[i], reads, read_size))
+			goto out;
+
+		if (run_private && run(&img, false, jobs[i], reads, read_size))
+			goto out;
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	close_image(&img);
+	return status;
+fail_arg:
+	fputs("Try `data_reader_benchmark --help' for more information.\n",
+	      stderr);
+	return EXIT_FAILURE;
+}
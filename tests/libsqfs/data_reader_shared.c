@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * data_reader_shared.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "threadpool.h"
+#include "../test.h"
+
+#include "sqfs/data_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#define BLK_SIZE (4096)
+#define NUM_BLOCKS (40)
+#define TAIL_SIZE (1000)
+#define FRAG_OFFSET (300)
+#define FILE_SIZE (NUM_BLOCKS * BLK_SIZE + TAIL_SIZE)
+
+#define SPARSE_BLOCK (7)
+
+/* data blocks, followed by the fragment block and the fragment table */
+#define FRAG_LOC (NUM_BLOCKS * BLK_SIZE)
+#define META_LOC (FRAG_LOC + BLK_SIZE)
+#define INDEX_LOC (META_LOC + 2 + sizeof(sqfs_fragment_t))
+#define IMAGE_SIZE (INDEX_LOC + sizeof(sqfs_u64))
+
+#define NUM_JOBS (16)
+#define READS_PER_JOB (500)
+
+static sqfs_u8 image[IMAGE_SIZE];
+static sqfs_u8 file_data[FILE_SIZE];
+static sqfs_inode_generic_t *inode;
+static sqfs_data_reader_t *data;
+
+/* "compressed" blocks are stored inverted */
+static sqfs_s32 dummy_do_block(sqfs_compressor_t *cmp, const sqfs_u8 *in,
+			       sqfs_u32 size, sqfs_u8 *out, sqfs_u32 outsize)
+{
+	sqfs_u32 i;
+	(void)cmp;
+
+	if (size > outsize)
+		return 0;
+
+	for (i = 0; i < size; ++i)
+		out[i] = ~in[i];
+
+	return size;
+}
+
+static sqfs_object_t *dummy_copy(const sqfs_object_t *obj)
+{
+	sqfs_compressor_t *cmp = malloc(sizeof(*cmp));
+
+	if (cmp != NULL)
+		memcpy(cmp, obj, sizeof(*cmp));
+
+	return (sqfs_object_t *)cmp;
+}
+
+static void dummy_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(image) || size > (sizeof(image) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, image + offset, size);
+	return 0;
+}
+
+static sqfs_compressor_t dummy_compressor = {
+	{ dummy_destroy, dummy_copy },
+	NULL,
+	NULL,
+	NULL,
+	dummy_do_block,
+};
+
+static sqfs_file_t dummy_file = {
+	{ NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static void init_image(sqfs_super_t *super)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	sqfs_fragment_t frag;
+	sqfs_u16 hdr;
+	sqfs_u64 idx;
+	size_t i, j;
+
+	for (i = 0; i < FILE_SIZE; ++i) {
+		seed = seed * 1103515245 + 12345;
+		file_data[i] = (seed >> 16) & 0xFF;
+	}
+
+	memset(file_data + SPARSE_BLOCK * BLK_SIZE, 0, BLK_SIZE);
+
+	inode = calloc(1, sizeof(*inode) + NUM_BLOCKS * sizeof(sqfs_u32));
+	TEST_NOT_NULL(inode);
+
+	inode->base.type = SQFS_INODE_FILE;
+	inode->payload_bytes_available = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->payload_bytes_used = NUM_BLOCKS * sizeof(sqfs_u32);
+	inode->data.file.blocks_start = 0;
+	inode->data.file.file_size = FILE_SIZE;
+	inode->data.file.fragment_index = 0;
+	inode->data.file.fragment_offset = FRAG_OFFSET;
+
+	/* every other block is "compressed", the sparse one isn't stored */
+	for (i = 0, j = 0; i < NUM_BLOCKS; ++i) {
+		if (i == SPARSE_BLOCK) {
+			inode->extra[i] = 0;
+			continue;
+		}
+
+		if (i % 2) {
+			memcpy(image + j, file_data + i * BLK_SIZE, BLK_SIZE);
+			inode->extra[i] = BLK_SIZE | (1 << 24);
+		} else {
+			dummy_do_block(NULL, file_data + i * BLK_SIZE,
+				       BLK_SIZE, image + j, BLK_SIZE);
+			inode->extra[i] = BLK_SIZE;
+		}
+
+		j += BLK_SIZE;
+	}
+
+	/* the tail end, somewhere inside a compressed fragment block */
+	memcpy(image + FRAG_LOC + FRAG_OFFSET,
+	       file_data + NUM_BLOCKS * BLK_SIZE, TAIL_SIZE);
+	dummy_do_block(NULL, image + FRAG_LOC, BLK_SIZE,
+		       image + FRAG_LOC, BLK_SIZE);
+
+	hdr = htole16(0x8000 | sizeof(frag));
+	memcpy(image + META_LOC, &hdr, sizeof(hdr));
+
+	frag.start_offset = htole64(FRAG_LOC);
+	frag.size = htole32(BLK_SIZE);
+	frag.pad0 = 0;
+	memcpy(image + META_LOC + 2, &frag, sizeof(frag));
+
+	idx = htole64(META_LOC);
+	memcpy(image + INDEX_LOC, &idx, sizeof(idx));
+
+	memset(super, 0, sizeof(*super));
+	super->block_size = BLK_SIZE;
+	super->bytes_used = IMAGE_SIZE;
+	super->fragment_entry_count = 1;
+	super->directory_table_start = META_LOC;
+	super->fragment_table_start = INDEX_LOC;
+	super->id_table_start = IMAGE_SIZE - 1;
+	super->export_table_start = 0xFFFFFFFFFFFFFFFFUL;
+}
+
+static void check_read(sqfs_u64 offset, sqfs_u32 size)
+{
+	sqfs_u8 buffer[3 * BLK_SIZE];
+	sqfs_s32 ret;
+
+	ret = sqfs_data_reader_read(data, inode, offset, buffer, size);
+
+	if (offset >= FILE_SIZE) {
+		TEST_EQUAL_I(ret, 0);
+		return;
+	}
+
+	if (size > FILE_SIZE - offset)
+		size = FILE_SIZE - offset;
+
+	TEST_EQUAL_I(ret, size);
+	TEST_ASSERT(memcmp(buffer, file_data + offset, size) == 0);
+}
+
+static int read_job(void *user, void *item)
+{
+	sqfs_u32 seed = *((sqfs_u32 *)item), size;
+	sqfs_u64 offset;
+	size_t i;
+	(void)user;
+
+	for (i = 0; i < READS_PER_JOB; ++i) {
+		seed = seed * 1103515245 + 12345;
+		offset = (seed >> 8) % (FILE_SIZE + 100);
+
+		seed = seed * 1103515245 + 12345;
+		size = (seed >> 8) % (3 * BLK_SIZE);
+
+		check_read(offset, size);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_u32 seeds[NUM_JOBS];
+	sqfs_data_reader_t *copy;
+	sqfs_super_t super;
+	thread_pool_t *pool;
+	size_t i, size;
+	sqfs_u8 *out;
+	(void)argc; (void)argv;
+
+	init_image(&super);
+
+	TEST_NULL(sqfs_data_reader_create(&dummy_file, BLK_SIZE,
+					  &dummy_compressor, 0x80000000));
+
+	data = sqfs_data_reader_create(&dummy_file, BLK_SIZE,
+				       &dummy_compressor,
+				       SQFS_DATA_READER_SHARED);
+	TEST_NOT_NULL(data);
+	TEST_EQUAL_I(sqfs_data_reader_load_fragment_table(data, &super), 0);
+
+	/* simple reads across blocks, the sparse block and the tail */
+	check_read(0, 100);
+	check_read(BLK_SIZE - 10, 20);
+	check_read(SPARSE_BLOCK * BLK_SIZE - 10, BLK_SIZE + 20);
+	check_read(NUM_BLOCKS * BLK_SIZE - 50, 2 * BLK_SIZE);
+	check_read(FILE_SIZE, 10);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_fragment(data, inode, &size, &out),
+		     0);
+	TEST_EQUAL_UI(size, TAIL_SIZE);
+	TEST_ASSERT(memcmp(out, file_data + NUM_BLOCKS * BLK_SIZE,
+			   TAIL_SIZE) == 0);
+	free(out);
+
+	TEST_EQUAL_I(sqfs_data_reader_get_block(data, inode, 2, &size, &out),
+		     0);
+	TEST_EQUAL_UI(size, BLK_SIZE);
+	TEST_ASSERT(memcmp(out, file_data + 2 * BLK_SIZE, BLK_SIZE) == 0);
+	free(out);
+
+	/* many threads reading from the same object at random */
+	pool = thread_pool_create(NUM_JOBS, read_job);
+	TEST_NOT_NULL(pool);
+
+	for (i = 0; i < NUM_JOBS; ++i) {
+		seeds[i] = 0x1234 * (i + 1);
+		TEST_EQUAL_I(pool->submit(pool, seeds + i), 0);
+	}
+
+	for (i = 0; i < NUM_JOBS; ++i)
+		TEST_NOT_NULL(pool->dequeue(pool));
+
+	TEST_EQUAL_I(pool->get_status(pool), 0);
+	pool->destroy(pool);
+
+	/* a copy shares the cache and still works after the original is gone */
+	copy = sqfs_copy(data);
+	TEST_NOT_NULL(copy);
+	sqfs_destroy(data);
+
+	data = copy;
+	check_read(3 * BLK_SIZE + 7, 2 * BLK_SIZE);
+	check_read(NUM_BLOCKS * BLK_SIZE + 10, 100);
+
+	sqfs_destroy(data);
+	free(inode);
+	return EXIT_SUCCESS;
+}
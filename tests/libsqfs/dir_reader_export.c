@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * dir_reader_export.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "../test.h"
+
+#include "sqfs/dir_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/super.h"
+#include "sqfs/inode.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+/* enough inodes to need more than one block of export table entries */
+#define NUM_INODES (1500)
+#define INODE_SIZE (sizeof(sqfs_inode_t) + sizeof(sqfs_inode_ipc_t))
+
+#define META_DISK_SIZE (SQFS_META_BLOCK_SIZE + 2)
+#define META_BLOCKS(size) \
+	(((size) + SQFS_META_BLOCK_SIZE - 1) / SQFS_META_BLOCK_SIZE)
+#define META_TOTAL(size) (META_BLOCKS(size) * 2 + (size))
+
+#define INODE_BYTES (NUM_INODES * INODE_SIZE)
+#define EXPORT_BYTES (NUM_INODES * sizeof(sqfs_u64))
+
+/* inode table, export table blocks, export table index */
+#define DIR_LOC META_TOTAL(INODE_BYTES)
+#define INDEX_LOC (DIR_LOC + META_TOTAL(EXPORT_BYTES))
+#define IMAGE_SIZE (INDEX_LOC + META_BLOCKS(EXPORT_BYTES) * sizeof(sqfs_u64))
+
+static sqfs_u8 image[IMAGE_SIZE];
+static size_t read_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(image) || size > (sizeof(image) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, image + offset, size);
+	read_count += 1;
+	return 0;
+}
+
+static sqfs_file_t dummy_file = {
+	{ NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static sqfs_compressor_t dummy_compressor = {
+	{ NULL, NULL },
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+/* write a stream of data as a sequence of uncompressed meta data blocks */
+static void write_meta(sqfs_u64 location, const sqfs_u8 *data, size_t size,
+		       sqfs_u64 *block_locations)
+{
+	size_t diff, i = 0;
+	sqfs_u16 hdr;
+
+	while (size > 0) {
+		diff = size > SQFS_META_BLOCK_SIZE ? SQFS_META_BLOCK_SIZE : size;
+		hdr = htole16(0x8000 | diff);
+
+		if (block_locations != NULL)
+			block_locations[i++] = htole64(location);
+
+		memcpy(image + location, &hdr, sizeof(hdr));
+		memcpy(image + location + 2, data, diff);
+
+		location += diff + 2;
+		data += diff;
+		size -= diff;
+	}
+}
+
+static void init_image(sqfs_super_t *super)
+{
+	static sqfs_u8 inodes[INODE_BYTES];
+	static sqfs_u64 refs[NUM_INODES];
+	sqfs_u64 index[META_BLOCKS(EXPORT_BYTES)];
+	sqfs_inode_ipc_t ipc;
+	sqfs_inode_t base;
+	size_t i, offset;
+	sqfs_u32 inum;
+
+	/* inodes are stored in reverse order of their numbers */
+	for (i = 0; i < NUM_INODES; ++i) {
+		inum = NUM_INODES - i;
+		offset = i * INODE_SIZE;
+
+		memset(&base, 0, sizeof(base));
+		base.type = htole16(SQFS_INODE_FIFO);
+		base.mode = htole16(0644);
+		base.mod_time = htole32(inum * 3);
+		base.inode_number = htole32(inum);
+
+		ipc.nlink = htole32(1);
+
+		memcpy(inodes + offset, &base, sizeof(base));
+		memcpy(inodes + offset + sizeof(base), &ipc, sizeof(ipc));
+
+		refs[inum - 1] = htole64((sqfs_u64)((offset /
+						     SQFS_META_BLOCK_SIZE) *
+						    META_DISK_SIZE) << 16 |
+					 (offset % SQFS_META_BLOCK_SIZE));
+	}
+
+	write_meta(0, inodes, sizeof(inodes), NULL);
+	write_meta(DIR_LOC, (const sqfs_u8 *)refs, sizeof(refs), index);
+	memcpy(image + INDEX_LOC, index, sizeof(index));
+
+	memset(super, 0, sizeof(*super));
+	super->inode_count = NUM_INODES;
+	super->block_size = 4096;
+	super->bytes_used = IMAGE_SIZE;
+	super->flags = SQFS_FLAG_EXPORTABLE;
+	super->inode_table_start = 0;
+	super->directory_table_start = DIR_LOC;
+	super->fragment_table_start = IMAGE_SIZE;
+	super->id_table_start = IMAGE_SIZE;
+	super->export_table_start = INDEX_LOC;
+	super->xattr_id_table_start = 0xFFFFFFFFFFFFFFFFUL;
+}
+
+static void check_inode(sqfs_dir_reader_t *rd, sqfs_u32 inum)
+{
+	sqfs_inode_generic_t *inode;
+
+	TEST_EQUAL_I(sqfs_dir_reader_get_inode_by_number(rd, inum, &inode), 0);
+	TEST_NOT_NULL(inode);
+	TEST_EQUAL_UI(inode->base.type, SQFS_INODE_FIFO);
+	TEST_EQUAL_UI(inode->base.inode_number, inum);
+	TEST_EQUAL_UI(inode->base.mod_time, inum * 3);
+	free(inode);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_inode_generic_t *inode;
+	sqfs_dir_reader_t *rd, *copy;
+	sqfs_super_t super;
+	size_t i, count;
+	sqfs_u32 seed;
+	(void)argc; (void)argv;
+
+	init_image(&super);
+
+	/* without the flag, the image has no export table */
+	super.flags = 0;
+	rd = sqfs_dir_reader_create(&super, &dummy_compressor, &dummy_file, 0);
+	TEST_NOT_NULL(rd);
+	TEST_EQUAL_I(sqfs_dir_reader_get_inode_by_number(rd, 1, &inode),
+		     SQFS_ERROR_UNSUPPORTED);
+	sqfs_destroy(rd);
+
+	super.flags = SQFS_FLAG_EXPORTABLE;
+	rd = sqfs_dir_reader_create(&super, &dummy_compressor, &dummy_file, 0);
+	TEST_NOT_NULL(rd);
+
+	/* nothing is loaded before the first lookup */
+	TEST_EQUAL_UI(read_count, 0);
+
+	TEST_EQUAL_I(sqfs_dir_reader_get_inode_by_number(rd, 0, &inode),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	TEST_EQUAL_I(sqfs_dir_reader_get_inode_by_number(rd, NUM_INODES + 1,
+							 &inode),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+
+	check_inode(rd, 1);
+	check_inode(rd, NUM_INODES);
+
+	seed = 0xDEADBEEF;
+
+	for (i = 0; i < NUM_INODES; ++i) {
+		seed = seed * 1103515245 + 12345;
+		check_inode(rd, (seed >> 8) % NUM_INODES + 1);
+	}
+
+	/* only the inode table is read, the export table stays in memory */
+	count = read_count;
+
+	for (i = 1; i <= NUM_INODES; ++i) {
+		TEST_EQUAL_I(sqfs_dir_reader_get_inode_by_number(rd, i,
+								 &inode), 0);
+		free(inode);
+	}
+
+	TEST_ASSERT((read_count - count) < NUM_INODES / 10);
+
+	/* a copy works independently of the original */
+	copy = sqfs_copy(rd);
+	TEST_NOT_NULL(copy);
+	sqfs_destroy(rd);
+
+	check_inode(copy, 42);
+	check_inode(copy, NUM_INODES - 42);
+
+	sqfs_destroy(copy);
+	return EXIT_SUCCESS;
+}
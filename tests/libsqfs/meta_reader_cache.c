@@ -0,0 +1,180 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_reader_cache.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "../test.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#define NUM_BLOCKS (4)
+#define BLOCK_DISK_SIZE (SQFS_META_BLOCK_SIZE + 2)
+
+static sqfs_u8 file_data[NUM_BLOCKS * BLOCK_DISK_SIZE];
+static size_t read_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	read_count += 1;
+	return 0;
+}
+
+static sqfs_file_t dummy_file = {
+	{ NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static sqfs_compressor_t dummy_compressor = {
+	{ NULL, NULL },
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static void init_file(void)
+{
+	sqfs_u16 hdr;
+	size_t i, j;
+
+	hdr = htole16(0x8000 | SQFS_META_BLOCK_SIZE);
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		sqfs_u8 *blk = file_data + i * BLOCK_DISK_SIZE;
+
+		memcpy(blk, &hdr, sizeof(hdr));
+
+		for (j = 0; j < SQFS_META_BLOCK_SIZE; ++j)
+			blk[2 + j] = (i * 31 + j) & 0xFF;
+	}
+}
+
+static void check_read(sqfs_meta_reader_t *m, size_t blk, size_t offset)
+{
+	sqfs_u8 value;
+	int ret;
+
+	ret = sqfs_meta_reader_seek(m, blk * BLOCK_DISK_SIZE, offset);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_meta_reader_read(m, &value, 1);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(value, ((blk * 31 + offset) & 0xFF));
+}
+
+int main(int argc, char **argv)
+{
+	const sqfs_meta_reader_stats_t *stats;
+	sqfs_meta_reader_t *m, *copy;
+	size_t i;
+	(void)argc; (void)argv;
+
+	init_file();
+
+	/* without cache, every block switch goes to disk */
+	m = sqfs_meta_reader_create(&dummy_file, &dummy_compressor,
+				    0, sizeof(file_data));
+	TEST_NOT_NULL(m);
+
+	for (i = 0; i < 3; ++i) {
+		check_read(m, 0, 10);
+		check_read(m, 1, 20);
+	}
+
+	stats = sqfs_meta_reader_get_stats(m);
+	TEST_EQUAL_UI(stats->size, sizeof(*stats));
+	TEST_EQUAL_UI(stats->blocks_loaded, 6);
+	TEST_EQUAL_UI(stats->cache_hits, 0);
+	TEST_EQUAL_UI(read_count, 12);
+
+	/* with a cache, ping-ponging between blocks is served from memory */
+	TEST_EQUAL_I(sqfs_meta_reader_enable_cache(m, 2), 0);
+	read_count = 0;
+
+	for (i = 0; i < 3; ++i) {
+		check_read(m, 0, 10);
+		check_read(m, 1, 20);
+	}
+
+	TEST_EQUAL_UI(stats->blocks_loaded, 8);
+	TEST_EQUAL_UI(stats->cache_misses, 2);
+	TEST_EQUAL_UI(stats->cache_hits, 4);
+	TEST_EQUAL_UI(stats->cache_evictions, 0);
+	TEST_EQUAL_UI(read_count, 4);
+
+	/* loading a third block evicts the least recently used one */
+	check_read(m, 2, 30);
+	TEST_EQUAL_UI(stats->cache_evictions, 1);
+
+	read_count = 0;
+	check_read(m, 1, 40);
+	TEST_EQUAL_UI(read_count, 0);
+
+	check_read(m, 0, 50);
+	TEST_EQUAL_UI(read_count, 2);
+	TEST_EQUAL_UI(stats->cache_evictions, 2);
+
+	/* reading across block boundaries goes through the cache as well */
+	check_read(m, 3, 0);
+	TEST_EQUAL_I(sqfs_meta_reader_seek(m, 0, SQFS_META_BLOCK_SIZE - 1), 0);
+	read_count = 0;
+	{
+		sqfs_u8 buffer[2];
+
+		TEST_EQUAL_I(sqfs_meta_reader_read(m, buffer, 2), 0);
+		TEST_EQUAL_UI(buffer[0], ((SQFS_META_BLOCK_SIZE - 1) & 0xFF));
+		TEST_EQUAL_UI(buffer[1], 31);
+	}
+	TEST_EQUAL_UI(read_count, 2);
+
+	/* a copy shares the cache */
+	copy = sqfs_copy(m);
+	TEST_NOT_NULL(copy);
+
+	read_count = 0;
+	check_read(copy, 0, 60);
+	check_read(copy, 1, 70);
+	check_read(m, 0, 80);
+	TEST_EQUAL_UI(read_count, 0);
+
+	/* the cache survives the original */
+	sqfs_destroy(m);
+
+	check_read(copy, 0, 90);
+	check_read(copy, 1, 100);
+	TEST_EQUAL_UI(read_count, 0);
+
+	/* out of bounds offsets are still rejected for cached blocks */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(copy, 0, SQFS_META_BLOCK_SIZE),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+	check_read(copy, 1, 110);
+	TEST_EQUAL_UI(read_count, 0);
+
+	/* disabling the cache works */
+	TEST_EQUAL_I(sqfs_meta_reader_enable_cache(copy, 0), 0);
+	check_read(copy, 0, 120);
+	TEST_EQUAL_UI(read_count, 2);
+
+	sqfs_destroy(copy);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * meta_reader_preload.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "../test.h"
+
+#include "sqfs/meta_reader.h"
+#include "sqfs/compressor.h"
+#include "sqfs/error.h"
+#include "sqfs/block.h"
+#include "sqfs/io.h"
+
+#define NUM_BLOCKS (300)
+#define LAST_BLOCK_SIZE (100)
+#define BLOCK_DISK_SIZE (SQFS_META_BLOCK_SIZE + 2)
+#define TRAILER_SIZE (16)
+
+#define FILE_SIZE ((NUM_BLOCKS - 1) * BLOCK_DISK_SIZE + \
+		   LAST_BLOCK_SIZE + 2 + TRAILER_SIZE)
+
+static sqfs_u8 file_data[FILE_SIZE];
+static size_t read_count = 0;
+
+static int dummy_read_at(sqfs_file_t *file, sqfs_u64 offset,
+			 void *buffer, size_t size)
+{
+	(void)file;
+
+	if (offset >= sizeof(file_data))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	if (size > (sizeof(file_data) - offset))
+		return SQFS_ERROR_OUT_OF_BOUNDS;
+
+	memcpy(buffer, file_data + offset, size);
+	read_count += 1;
+	return 0;
+}
+
+static sqfs_file_t dummy_file = {
+	{ NULL, NULL },
+	dummy_read_at,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static size_t dummy_copy_cmp_count = 0;
+
+static sqfs_object_t *dummy_copy(const sqfs_object_t *obj)
+{
+	sqfs_compressor_t *copy = malloc(sizeof(*copy));
+
+	if (copy != NULL) {
+		memcpy(copy, obj, sizeof(*copy));
+		++dummy_copy_cmp_count;
+	}
+
+	return (sqfs_object_t *)copy;
+}
+
+static void dummy_destroy(sqfs_object_t *obj)
+{
+	free(obj);
+}
+
+static sqfs_compressor_t dummy_compressor = {
+	{ dummy_destroy, dummy_copy },
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static sqfs_u8 expected(size_t blk, size_t offset)
+{
+	return (blk * 31 + offset) & 0xFF;
+}
+
+static void init_file(void)
+{
+	size_t i, j, size;
+	sqfs_u8 *blk;
+	sqfs_u16 hdr;
+
+	blk = file_data;
+
+	for (i = 0; i < NUM_BLOCKS; ++i) {
+		size = (i == NUM_BLOCKS - 1) ? LAST_BLOCK_SIZE :
+			SQFS_META_BLOCK_SIZE;
+
+		hdr = htole16(0x8000 | size);
+		memcpy(blk, &hdr, sizeof(hdr));
+
+		for (j = 0; j < size; ++j)
+			blk[2 + j] = expected(i, j);
+
+		blk += size + 2;
+	}
+
+	/* something that is not a meta data block, e.g. a table index */
+	memset(blk, 0xFF, TRAILER_SIZE);
+}
+
+static void check_read(sqfs_meta_reader_t *m, size_t blk, size_t offset)
+{
+	sqfs_u8 value;
+	int ret;
+
+	ret = sqfs_meta_reader_seek(m, blk * BLOCK_DISK_SIZE, offset);
+	TEST_EQUAL_I(ret, 0);
+
+	ret = sqfs_meta_reader_read(m, &value, 1);
+	TEST_EQUAL_I(ret, 0);
+	TEST_EQUAL_UI(value, expected(blk, offset));
+}
+
+static void run_test(size_t num_jobs)
+{
+	const sqfs_meta_reader_stats_t *stats;
+	sqfs_meta_reader_t *m, *copy;
+	sqfs_u8 buffer[4];
+	sqfs_u64 block;
+	size_t i, offset;
+	int ret;
+
+	m = sqfs_meta_reader_create(&dummy_file, &dummy_compressor,
+				    0, sizeof(file_data));
+	TEST_NOT_NULL(m);
+
+	read_count = 0;
+	TEST_EQUAL_I(sqfs_meta_reader_preload(m, num_jobs), 0);
+	TEST_EQUAL_UI(read_count, 1);
+
+	stats = sqfs_meta_reader_get_stats(m);
+	TEST_EQUAL_UI(stats->blocks_loaded, NUM_BLOCKS);
+
+	/* random access to preloaded blocks never touches the file */
+	for (i = 0; i < NUM_BLOCKS - 1; ++i) {
+		check_read(m, NUM_BLOCKS - 2 - i, i % SQFS_META_BLOCK_SIZE);
+		check_read(m, i, (i * 7) % SQFS_META_BLOCK_SIZE);
+	}
+
+	check_read(m, NUM_BLOCKS - 1, LAST_BLOCK_SIZE - 1);
+
+	TEST_EQUAL_I(sqfs_meta_reader_seek(m, (NUM_BLOCKS - 1) *
+					   BLOCK_DISK_SIZE, LAST_BLOCK_SIZE),
+		     SQFS_ERROR_OUT_OF_BOUNDS);
+
+	/* reading across block boundaries */
+	TEST_EQUAL_I(sqfs_meta_reader_seek(m, 5 * BLOCK_DISK_SIZE,
+					   SQFS_META_BLOCK_SIZE - 2), 0);
+	TEST_EQUAL_I(sqfs_meta_reader_read(m, buffer, 4), 0);
+	TEST_EQUAL_UI(buffer[0], expected(5, SQFS_META_BLOCK_SIZE - 2));
+	TEST_EQUAL_UI(buffer[1], expected(5, SQFS_META_BLOCK_SIZE - 1));
+	TEST_EQUAL_UI(buffer[2], expected(6, 0));
+	TEST_EQUAL_UI(buffer[3], expected(6, 1));
+
+	sqfs_meta_reader_get_position(m, &block, &offset);
+	TEST_EQUAL_UI(block, 6 * BLOCK_DISK_SIZE);
+	TEST_EQUAL_UI(offset, 2);
+
+	TEST_EQUAL_UI(read_count, 1);
+
+	/* the trailer is not a block and is still read on demand */
+	ret = sqfs_meta_reader_seek(m, sizeof(file_data) - TRAILER_SIZE, 0);
+	TEST_EQUAL_I(ret, SQFS_ERROR_CORRUPTED);
+	TEST_ASSERT(read_count > 1);
+
+	/* a copy shares the preloaded data and survives the original */
+	check_read(m, 10, 10);
+	copy = sqfs_copy(m);
+	TEST_NOT_NULL(copy);
+	sqfs_destroy(m);
+
+	read_count = 0;
+	TEST_EQUAL_I(sqfs_meta_reader_read(copy, buffer, 1), 0);
+	TEST_EQUAL_UI(buffer[0], expected(10, 11));
+	check_read(copy, 20, 20);
+	check_read(copy, 0, 0);
+	TEST_EQUAL_UI(read_count, 0);
+
+	sqfs_destroy(copy);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argc; (void)argv;
+
+	init_file();
+
+	run_test(1);
+	run_test(4);
+
+	TEST_ASSERT(dummy_copy_cmp_count > 1);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,689 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * pipeline_benchmark.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+#include "compat.h"
+#include "common.h"
+#include "util.h"
+#include "compress_cli.h"
+#include "simple_writer.h"
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+#include <sys/resource.h>
+#endif
+
+static struct option long_opts[] = {
+	{ "compressor", required_argument, NULL, 'c' },
+	{ "corpus", required_argument, NULL, 'C' },
+	{ "input", required_argument, NULL, 'i' },
+	{ "size", required_argument, NULL, 's' },
+	{ "block-size", required_argument, NULL, 'b' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "queue-backlog", required_argument, NULL, 'Q' },
+	{ "repeat", required_argument, NULL, 'r' },
+	{ "json", no_argument, NULL, 'J' },
+	{ "version", no_argument, NULL, 'V' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static const char *short_opts = "c:C:i:s:b:j:Q:r:JhV";
+
+static const char *help_string =
+"Usage: pipeline_benchmark [OPTIONS...]\n"
+"\n"
+"Feeds synthetic, deterministically generated file sets through the\n"
+"libsquashfs block processor, for every combination of compressor, worker\n"
+"count and queue backlog, and prints one line of CSV per run.\n"
+"\n"
+"Possible options:\n"
+"\n"
+"  --compressor, -c <name>      Only benchmark the specified compressor. The\n"
+"                               default is to try all available ones.\n"
+"  --corpus, -C <list>          A comma separated list of generated data\n"
+"                               sets to use. The default is all of them:\n"
+"                               text, binary, random, small, sparse.\n"
+"  --input, -i <file>           Use the contents of a file as a single,\n"
+"                               additional input file, e.g. the tarball\n"
+"                               from tests/corpus/cantrbry.tar.xz after\n"
+"                               uncompressing it.\n"
+"  --size, -s <size>            Size of each generated data set. The\n"
+"                               default is 32M.\n"
+"  --block-size, -b <size>      The block size to use. Default is 128k.\n"
+"  --jobs, -j <list>            A comma separated list of worker counts.\n"
+"                               The default is 1 and the number of CPUs.\n"
+"  --queue-backlog, -Q <list>   A comma separated list of backlog sizes,\n"
+"                               as a multiple of the worker count. The\n"
+"                               default is 10.\n"
+"  --repeat, -r <count>         Run every combination this many times and\n"
+"                               report the fastest run. Default is 3.\n"
+"  --json, -J                   Print a JSON array instead of CSV.\n"
+"\n"
+"The peak RSS reported is that of the whole process so far.\n"
+"\n";
+
+#define MAX_LIST (16)
+
+typedef struct {
+	const char *name;
+	sqfs_u8 *data;
+	size_t size;
+
+	size_t *files;
+	size_t num_files;
+} corpus_t;
+
+typedef struct {
+	sqfs_u64 input_bytes;
+	sqfs_u64 output_bytes;
+	sqfs_u64 wall_ns;
+	double cpu_s;
+} result_t;
+
+/*****************************************************************************/
+
+static sqfs_u32 next_rand(sqfs_u32 *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static void gen_text(sqfs_u8 *data, size_t size, sqfs_u32 *seed)
+{
+	static const char *words[] = {
+		"squashfs", "block", "fragment", "inode", "directory",
+		"compressor", "xattr", "table", "super", "data", " ", "\n",
+		"the", "of", "a", "to",
+	};
+	size_t i, len;
+
+	for (i = 0; i < size; i += len) {
+		const char *w = words[next_rand(seed) % 16];
+
+		len = strlen(w);
+		if (len > size - i)
+			len = size - i;
+
+		memcpy(data + i, w, len);
+	}
+}
+
+/* resembles machine code: a skewed opcode distribution with call targets */
+static void gen_binary(sqfs_u8 *data, size_t size, sqfs_u32 *seed)
+{
+	static const sqfs_u8 opcodes[] = {
+		0x48, 0x89, 0x8B, 0x0F, 0x85, 0x84, 0xC3, 0x31, 0xC0, 0x83,
+		0x74, 0x75, 0xFF, 0x00, 0x00, 0x00,
+	};
+	sqfs_u32 target;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		if ((next_rand(seed) % 16) == 0 && (size - i) > 5) {
+			target = 0x1000 + (next_rand(seed) % 64) * 16 - i;
+
+			data[i++] = 0xE8;
+			data[i++] = target & 0xFF;
+			data[i++] = (target >> 8) & 0xFF;
+			data[i++] = (target >> 16) & 0xFF;
+			data[i] = (target >> 24) & 0xFF;
+		} else {
+			data[i] = opcodes[next_rand(seed) % sizeof(opcodes)];
+		}
+	}
+}
+
+static void gen_random(sqfs_u8 *data, size_t size, sqfs_u32 *seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		data[i] = next_rand(seed) & 0xFF;
+}
+
+static int add_file(corpus_t *corpus, size_t size)
+{
+	size_t *new;
+
+	if ((corpus->num_files % 256) == 0) {
+		new = realloc(corpus->files,
+			      (corpus->num_files + 256) * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+		corpus->files = new;
+	}
+
+	corpus->files[corpus->num_files++] = size;
+	return 0;
+}
+
+/* split the data into files with sizes in [min, max) */
+static int split_files(corpus_t *corpus, size_t min, size_t max,
+		       sqfs_u32 *seed)
+{
+	size_t used = 0, size;
+
+	while (used < corpus->size) {
+		size = min + next_rand(seed) % (max - min);
+		if (size > corpus->size - used)
+			size = corpus->size - used;
+
+		if (add_file(corpus, size))
+			return -1;
+
+		used += size;
+	}
+
+	return 0;
+}
+
+static int gen_corpus(corpus_t *corpus, const char *name, size_t size,
+		      size_t block_size)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i;
+
+	memset(corpus, 0, sizeof(*corpus));
+	corpus->name = name;
+	corpus->size = size;
+	corpus->data = malloc(size);
+
+	if (corpus->data == NULL)
+		goto fail;
+
+	if (strcmp(name, "text") == 0) {
+		gen_text(corpus->data, size, &seed);
+		return split_files(corpus, 64 * 1024, 1024 * 1024, &seed);
+	}
+
+	if (strcmp(name, "binary") == 0) {
+		gen_binary(corpus->data, size, &seed);
+		return split_files(corpus, 256 * 1024, 4096 * 1024, &seed);
+	}
+
+	if (strcmp(name, "random") == 0) {
+		gen_random(corpus->data, size, &seed);
+		return split_files(corpus, 256 * 1024, 4096 * 1024, &seed);
+	}
+
+	if (strcmp(name, "small") == 0) {
+		gen_text(corpus->data, size, &seed);
+		return split_files(corpus, 100, 4096, &seed);
+	}
+
+	if (strcmp(name, "sparse") == 0) {
+		gen_text(corpus->data, size, &seed);
+
+		for (i = 0; i < size; i += 2 * block_size) {
+			memset(corpus->data + i, 0,
+			       block_size < (size - i) ? block_size :
+			       (size - i));
+		}
+
+		return split_files(corpus, 1024 * 1024, 8192 * 1024, &seed);
+	}
+
+	fprintf(stderr, "Unknown data set '%s'\n", name);
+	return -1;
+fail:
+	perror(name);
+	return -1;
+}
+
+static int load_corpus(corpus_t *corpus, const char *path)
+{
+	long size;
+	FILE *fp;
+
+	memset(corpus, 0, sizeof(*corpus));
+	corpus->name = path;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		goto fail;
+
+	if (fseek(fp, 0, SEEK_END) != 0)
+		goto fail_fp;
+
+	size = ftell(fp);
+	if (size < 0)
+		goto fail_fp;
+
+	corpus->size = size;
+	rewind(fp);
+
+	corpus->data = malloc(corpus->size ? corpus->size : 1);
+	if (corpus->data == NULL)
+		goto fail_fp;
+
+	if (fread(corpus->data, 1, corpus->size, fp) != corpus->size)
+		goto fail_fp;
+
+	fclose(fp);
+	return add_file(corpus, corpus->size);
+fail_fp:
+	fclose(fp);
+fail:
+	perror(path);
+	return -1;
+}
+
+static void corpus_cleanup(corpus_t *corpus)
+{
+	free(corpus->data);
+	free(corpus->files);
+	memset(corpus, 0, sizeof(*corpus));
+}
+
+/*****************************************************************************/
+
+typedef struct {
+	sqfs_block_writer_t base;
+	sqfs_u64 offset;
+	sqfs_u64 count;
+} null_writer_t;
+
+static int null_write_data_block(sqfs_block_writer_t *base, void *user,
+				 sqfs_u32 size, sqfs_u32 checksum,
+				 sqfs_u32 flags, const sqfs_u8 *data,
+				 sqfs_u64 *location)
+{
+	null_writer_t *wr = (null_writer_t *)base;
+	(void)user; (void)checksum; (void)data;
+
+	*location = wr->offset;
+
+	if (size != 0 && !(flags & SQFS_BLK_IS_SPARSE)) {
+		wr->offset += size;
+		wr->count += 1;
+	}
+	return 0;
+}
+
+static sqfs_u64 null_get_block_count(const sqfs_block_writer_t *base)
+{
+	return ((const null_writer_t *)base)->count;
+}
+
+static int run_once(const corpus_t *corpus, sqfs_compressor_t *cmp,
+		    size_t block_size, size_t jobs, size_t backlog,
+		    result_t *out)
+{
+	sqfs_inode_generic_t **inodes = NULL;
+	sqfs_block_processor_desc_t desc;
+	const sqfs_u8 *ptr = corpus->data;
+	sqfs_block_processor_t *proc;
+	sqfs_frag_table_t *tbl;
+	null_writer_t wr;
+	sqfs_u64 start;
+	clock_t cstart;
+	size_t i;
+	int ret;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.base.write_data_block = null_write_data_block;
+	wr.base.get_block_count = null_get_block_count;
+
+	inodes = calloc(corpus->num_files, sizeof(inodes[0]));
+	tbl = sqfs_frag_table_create(0);
+
+	if (inodes == NULL || tbl == NULL) {
+		ret = SQFS_ERROR_ALLOC;
+		goto out;
+	}
+
+	memset(&desc, 0, sizeof(desc));
+	desc.size = sizeof(desc);
+	desc.max_block_size = block_size;
+	desc.num_workers = jobs;
+	desc.max_backlog = backlog * jobs;
+	desc.cmp = cmp;
+	desc.wr = (sqfs_block_writer_t *)&wr;
+	desc.tbl = tbl;
+	desc.probe_threshold = SQFS_WRITER_TYPICAL_PROBE_THRESHOLD;
+	desc.flags = SQFS_BLOCK_PROCESSOR_EARLY_DEDUP;
+
+	start = get_time_ns();
+	cstart = clock();
+
+	ret = sqfs_block_processor_create_ex(&desc, &proc);
+	if (ret != 0)
+		goto out;
+
+	for (i = 0; i < corpus->num_files; ++i) {
+		ret = sqfs_block_processor_begin_file(proc, inodes + i,
+						      NULL, 0);
+		if (ret == 0) {
+			ret = sqfs_block_processor_append(proc, ptr,
+							  corpus->files[i]);
+		}
+
+		if (ret == 0)
+			ret = sqfs_block_processor_end_file(proc);
+
+		if (ret != 0)
+			goto out_proc;
+
+		ptr += corpus->files[i];
+	}
+
+	ret = sqfs_block_processor_finish(proc);
+	if (ret != 0)
+		goto out_proc;
+
+	out->wall_ns = get_time_ns() - start;
+	out->cpu_s = (double)(clock() - cstart) / CLOCKS_PER_SEC;
+	out->output_bytes = wr.offset;
+	out->input_bytes =
+		sqfs_block_processor_get_stats(proc)->input_bytes_read;
+out_proc:
+	sqfs_destroy(proc);
+out:
+	if (inodes != NULL) {
+		for (i = 0; i < corpus->num_files; ++i)
+			free(inodes[i]);
+	}
+
+	if (tbl != NULL)
+		sqfs_destroy(tbl);
+
+	free(inodes);
+	return ret;
+}
+
+/*****************************************************************************/
+
+static long peak_rss_kib(void)
+{
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+#endif
+	return -1;
+}
+
+static void print_result(const corpus_t *corpus, const char *comp,
+			 size_t jobs, size_t backlog, const result_t *res,
+			 bool json, bool first)
+{
+	double secs = res->wall_ns > 0 ? res->wall_ns / 1e9 : 1e-9;
+	double ratio = 1.0;
+
+	if (res->input_bytes > 0)
+		ratio = (double)res->output_bytes / (double)res->input_bytes;
+
+	if (json) {
+		printf("%s\n  {\"corpus\": \"%s\", \"compressor\": \"%s\", "
+		       "\"workers\": %u, \"backlog\": %u, "
+		       "\"input_bytes\": " PRI_U64 ", "
+		       "\"output_bytes\": " PRI_U64 ", \"ratio\": %.4f, "
+		       "\"wall_s\": %.4f, \"cpu_s\": %.4f, "
+		       "\"mib_per_s\": %.2f, \"peak_rss_kib\": %ld}",
+		       first ? "" : ",", corpus->name, comp,
+		       (unsigned int)jobs, (unsigned int)backlog,
+		       res->input_bytes, res->output_bytes, ratio, secs,
+		       res->cpu_s, res->input_bytes / secs / (1024 * 1024),
+		       peak_rss_kib());
+	} else {
+		printf("%s,%s,%u,%u," PRI_U64 "," PRI_U64 ",%.4f,%.4f,%.4f,"
+		       "%.2f,%ld\n", corpus->name, comp, (unsigned int)jobs,
+		       (unsigned int)backlog, res->input_bytes,
+		       res->output_bytes, ratio, secs, res->cpu_s,
+		       res->input_bytes / secs / (1024 * 1024),
+		       peak_rss_kib());
+	}
+
+	fflush(stdout);
+}
+
+static int parse_list(const char *what, const char *str, size_t *list,
+		      size_t *count)
+{
+	char *end;
+
+	for (*count = 0; *count < MAX_LIST; ++(*count)) {
+		list[*count] = strtoul(str, &end, 10);
+
+		if (end == str || list[*count] == 0)
+			break;
+
+		if (*end == '\0') {
+			*count += 1;
+			return 0;
+		}
+
+		if (*end != ',')
+			break;
+
+		str = end + 1;
+	}
+
+	fprintf(stderr, "%s: expected a comma separated list of at most "
+		"%d numbers > 0\n", what, MAX_LIST);
+	return -1;
+}
+
+static int parse_corpus_list(char *str, const char **list, size_t *count)
+{
+	char *tok;
+
+	*count = 0;
+
+	for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (*count >= MAX_LIST) {
+			fputs("Too many data sets specified.\n", stderr);
+			return -1;
+		}
+
+		list[(*count)++] = tok;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *all_corpora[] = {
+		"text", "binary", "random", "small", "sparse",
+	};
+	size_t jobs[MAX_LIST], backlogs[MAX_LIST], num_jobs, num_backlogs;
+	size_t i, c, j, q, corpus_size = 32 * 1024 * 1024;
+	size_t block_size = SQFS_DEFAULT_BLOCK_SIZE, num_corpora;
+	const char *corpora[MAX_LIST + 1], *input = NULL, *name;
+	int id = -1, status = EXIT_FAILURE, ret;
+	sqfs_compressor_config_t cfg;
+	sqfs_compressor_t *cmp;
+	bool json = false, first = true;
+	result_t res, best;
+	long n, repeat = 3;
+	corpus_t corpus;
+
+	num_corpora = sizeof(all_corpora) / sizeof(all_corpora[0]);
+	for (i = 0; i < num_corpora; ++i)
+		corpora[i] = all_corpora[i];
+
+	jobs[0] = 1;
+	jobs[1] = os_get_num_jobs();
+	num_jobs = jobs[1] > 1 ? 2 : 1;
+
+	backlogs[0] = 10;
+	num_backlogs = 1;
+
+	for (;;) {
+		int i = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (i == -1)
+			break;
+
+		switch (i) {
+		case 'c':
+			id = sqfs_compressor_id_from_name(optarg);
+			if (id < 0) {
+				fprintf(stderr, "Unsupported compressor '%s'\n",
+					optarg);
+				goto fail_arg;
+			}
+			break;
+		case 'C':
+			if (parse_corpus_list(optarg, corpora, &num_corpora))
+				goto fail_arg;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 's':
+			if (parse_size("Data set size", &corpus_size,
+				       optarg, 0)) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			if (parse_size("Block size", &block_size, optarg, 0))
+				return EXIT_FAILURE;
+			break;
+		case 'j':
+			if (parse_list("Jobs", optarg, jobs, &num_jobs))
+				goto fail_arg;
+			break;
+		case 'Q':
+			if (parse_list("Backlog", optarg, backlogs,
+				       &num_backlogs)) {
+				goto fail_arg;
+			}
+			break;
+		case 'r':
+			repeat = strtol(optarg, NULL, 0);
+			break;
+		case 'J':
+			json = true;
+			break;
+		case 'h':
+			fputs(help_string, stdout);
+			return EXIT_SUCCESS;
+		case 'V':
+			print_version("pipeline_benchmark");
+			return EXIT_SUCCESS;
+		default:
+			goto fail_arg;
+		}
+	}
+
+	if (repeat <= 0) {
+		fputs("A repeat count > 0 must be specified.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (block_size < SQFS_MIN_BLOCK_SIZE ||
+	    block_size > SQFS_MAX_BLOCK_SIZE) {
+		fputs("Block size out of range.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (corpus_size == 0) {
+		fputs("The data set size must not be zero.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (input != NULL)
+		corpora[num_corpora++] = input;
+
+	if (json) {
+		fputs("[", stdout);
+	} else {
+		puts("corpus,compressor,workers,backlog,input_bytes,"
+		     "output_bytes,ratio,wall_s,cpu_s,mib_per_s,peak_rss_kib");
+	}
+
+	for (c = 0; c < num_corpora; ++c) {
+		if (input != NULL && c == num_corpora - 1) {
+			ret = load_corpus(&corpus, input);
+		} else {
+			ret = gen_corpus(&corpus, corpora[c], corpus_size,
+					 block_size);
+		}
+
+		if (ret != 0) {
+			corpus_cleanup(&corpus);
+			goto out;
+		}
+
+		for (i = SQFS_COMP_MIN; i <= SQFS_COMP_MAX; ++i) {
+			if (id >= 0 && i != (size_t)id)
+				continue;
+
+			if (compressor_cfg_init_options(&cfg, i, block_size,
+							NULL)) {
+				continue;
+			}
+
+			ret = sqfs_compressor_create(&cfg, &cmp);
+#ifdef WITH_LZO
+			if (i == SQFS_COMP_LZO && ret != 0)
+				ret = lzo_compressor_create(&cfg, &cmp);
+#endif
+			if (ret != 0)
+				continue;
+
+			name = sqfs_compressor_name_from_id(i);
+
+			for (j = 0; j < num_jobs; ++j) {
+				for (q = 0; q < num_backlogs; ++q) {
+					for (n = 0; n < repeat; ++n) {
+						ret = run_once(&corpus, cmp,
+							       block_size,
+							       jobs[j],
+							       backlogs[q],
+							       &res);
+						if (ret != 0)
+							break;
+
+						if (n == 0 ||
+						    res.wall_ns < best.wall_ns)
+							best = res;
+					}
+
+					if (ret != 0)
+						break;
+
+					print_result(&corpus, name, jobs[j],
+						     backlogs[q], &best, json,
+						     first);
+					first = false;
+				}
+
+				if (ret != 0)
+					break;
+			}
+
+			sqfs_destroy(cmp);
+
+			if (ret != 0) {
+				sqfs_perror(corpus.name, name, ret);
+				corpus_cleanup(&corpus);
+				goto out;
+			}
+		}
+
+		corpus_cleanup(&corpus);
+	}
+
+	status = EXIT_SUCCESS;
+out:
+	if (json)
+		fputs("\n]\n", stdout);
+	return status;
+fail_arg:
+	fputs("Try `pipeline_benchmark --help' for more information.\n",
+	      stderr);
+	return EXIT_FAILURE;
+}
@@ -15,16 +15,22 @@
 #include <getopt.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+#include <sys/resource.h>
+#endif
 
 static struct option long_opts[] = {
 	{ "block-count", required_argument, NULL, 'b' },
 	{ "groups-size", required_argument, NULL, 'g' },
+	{ "value-size", required_argument, NULL, 's' },
 	{ "version", no_argument, NULL, 'V' },
 	{ "help", no_argument, NULL, 'h' },
 	{ NULL, 0, NULL, 0 },
 };
 
-static const char *short_opts = "g:b:hV";
+static const char *short_opts = "g:b:s:hV";
 
 static const char *help_string =
 "Usage: xattr_benchmark [OPTIONS...]\n"
@@ -34,13 +40,35 @@ static const char *help_string =
 "  --block-count, -b <count>  How many unique xattr blocks to generate.\n"
 "  --group-size, -g <count>   Number of key-value pairs to generate for each\n"
 "                             xattr block.\n"
+"  --value-size, -s <bytes>   If set, generate random binary values of this\n"
+"                             size (e.g. capability or SELinux label like\n"
+"                             blobs) instead of short text strings.\n"
+"\n"
+"After generating the blocks, the CPU time spent and the peak memory usage\n"
+"are printed to stdout.\n"
 "\n";
 
+static void print_stats(clock_t start, clock_t end)
+{
+	printf("CPU time: %.3f s\n", (double)(end - start) / CLOCKS_PER_SEC);
+#if !defined(_WIN32) && !defined(__WINDOWS__)
+	{
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			printf("Peak RSS: %ld KiB\n", usage.ru_maxrss);
+	}
+#endif
+}
+
 int main(int argc, char **argv)
 {
-	long blkidx, grpidx, block_count = 0, group_size = 0;
+	long blkidx, grpidx, block_count = 0, group_size = 0, value_size = 0;
+	sqfs_u32 id, seed = 0xDEADBEEF;
 	sqfs_xattr_writer_t *xwr;
-	sqfs_u32 id;
+	sqfs_u8 *blob = NULL;
+	clock_t start;
+	long i;
 	int ret;
 
 	for (;;) {
@@ -55,6 +83,9 @@ int main(int argc, char **argv)
 		case 'g':
 			group_size = strtol(optarg, NULL, 0);
 			break;
+		case 's':
+			value_size = strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 			fputs(help_string, stdout);
 			return EXIT_SUCCESS;
@@ -76,8 +107,28 @@ int main(int argc, char **argv)
 		goto fail_arg;
 	}
 
+	if (value_size < 0 || value_size > 0xFFFF) {
+		fputs("The value size must be between 0 and 65535.\n", stderr);
+		goto fail_arg;
+	}
+
+	if (value_size > 0) {
+		blob = malloc(value_size);
+		if (blob == NULL) {
+			perror("allocating value buffer");
+			return EXIT_FAILURE;
+		}
+	}
+
 	/* setup writer */
+	start = clock();
+
 	xwr = sqfs_xattr_writer_create(0);
+	if (xwr == NULL) {
+		perror("creating xattr writer");
+		free(blob);
+		return EXIT_FAILURE;
+	}
 
 	/* generate blocks */
 	for (blkidx = 0; blkidx < block_count; ++blkidx) {
@@ -93,11 +144,21 @@ int main(int argc, char **argv)
 			snprintf(key, sizeof(key), "user.group%ld.key%ld",
 				 blkidx, grpidx);
 
-			snprintf(value, sizeof(value), "group%ld/value%ld",
-				 blkidx, grpidx);
+			if (blob != NULL) {
+				for (i = 0; i < value_size; ++i) {
+					seed = seed * 1103515245 + 12345;
+					blob[i] = (seed >> 16) & 0xFF;
+				}
 
-			ret = sqfs_xattr_writer_add(xwr, key, value,
-						    strlen(value));
+				ret = sqfs_xattr_writer_add(xwr, key, blob,
+							    value_size);
+			} else {
+				snprintf(value, sizeof(value),
+					 "group%ld/value%ld", blkidx, grpidx);
+
+				ret = sqfs_xattr_writer_add(xwr, key, value,
+							    strlen(value));
+			}
 
 			if (ret < 0) {
 				sqfs_perror(NULL, "add to xattr block", ret);
@@ -112,11 +173,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	print_stats(start, clock());
+
 	/* cleanup */
 	sqfs_destroy(xwr);
+	free(blob);
 	return EXIT_SUCCESS;
 fail:
 	sqfs_destroy(xwr);
+	free(blob);
 	return EXIT_FAILURE;
 fail_arg:
 	fputs("Try `xattr_benchmark --help' for more information.\n", stderr);
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * blob_table.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "blob_table.h"
+#include "compat.h"
+#include "../test.h"
+
+#define NUM_BLOBS 500
+
+static sqfs_u8 blobs[NUM_BLOBS][64];
+static size_t blob_sizes[NUM_BLOBS];
+
+static void gen_blobs(void)
+{
+	sqfs_u32 seed = 0xDEADBEEF;
+	size_t i, j;
+
+	for (i = 0; i < NUM_BLOBS; ++i) {
+		blob_sizes[i] = 2 + i % (sizeof(blobs[i]) - 2);
+
+		for (j = 0; j < blob_sizes[i]; ++j) {
+			seed = seed * 1103515245 + 12345;
+			blobs[i][j] = (j % 3 == 0) ? 0 : ((seed >> 16) & 0xFF);
+		}
+
+		/* make sure no two blobs of equal size are identical */
+		blobs[i][0] = i & 0xFF;
+		blobs[i][1] = (i >> 8) & 0xFF;
+	}
+}
+
+static void check_blob(const blob_table_t *table, size_t idx, size_t ref)
+{
+	const void *data;
+	size_t size;
+
+	data = blob_table_get_blob(table, idx, &size);
+	TEST_NOT_NULL(data);
+	TEST_ASSERT(data != blobs[ref]);
+	TEST_EQUAL_UI(size, blob_sizes[ref]);
+	TEST_ASSERT(memcmp(data, blobs[ref], size) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	blob_table_t table, copy;
+	size_t i, j, idx, size;
+	(void)argc; (void)argv;
+
+	gen_blobs();
+
+	TEST_ASSERT(blob_table_init(&table) == 0);
+
+	for (i = 0; i < NUM_BLOBS; ++i) {
+		TEST_ASSERT(blob_table_get_index(&table, blobs[i],
+						 blob_sizes[i], &idx) == 0);
+		TEST_EQUAL_UI(idx, i);
+
+		for (j = 0; j <= i; ++j)
+			check_blob(&table, j, j);
+
+		for (; j < NUM_BLOBS; ++j)
+			TEST_NULL(blob_table_get_blob(&table, j, &size));
+	}
+
+	TEST_EQUAL_UI(blob_table_count(&table), NUM_BLOBS);
+
+	for (i = 0; i < NUM_BLOBS; ++i) {
+		TEST_ASSERT(blob_table_get_index(&table, blobs[i],
+						 blob_sizes[i], &idx) == 0);
+		TEST_EQUAL_UI(idx, i);
+		check_blob(&table, i, i);
+
+		blob_table_add_ref(&table, i);
+		blob_table_add_ref(&table, i);
+		blob_table_del_ref(&table, i);
+		TEST_EQUAL_UI(blob_table_get_ref_count(&table, i), 1);
+	}
+
+	/* a prefix of an existing blob is a different blob */
+	TEST_ASSERT(blob_table_get_index(&table, blobs[NUM_BLOBS - 1],
+					 blob_sizes[NUM_BLOBS - 1] - 1,
+					 &idx) == 0);
+	TEST_EQUAL_UI(idx, NUM_BLOBS);
+
+	/* empty blobs are valid too */
+	TEST_ASSERT(blob_table_get_index(&table, blobs[0], 0, &idx) == 0);
+	TEST_EQUAL_UI(idx, NUM_BLOBS + 1);
+	TEST_ASSERT(blob_table_get_index(&table, blobs[1], 0, &idx) == 0);
+	TEST_EQUAL_UI(idx, NUM_BLOBS + 1);
+
+	TEST_ASSERT(blob_table_copy(&copy, &table) == 0);
+	blob_table_cleanup(&table);
+
+	TEST_EQUAL_UI(blob_table_count(&copy), NUM_BLOBS + 2);
+
+	for (i = 0; i < NUM_BLOBS; ++i) {
+		check_blob(&copy, i, i);
+		TEST_EQUAL_UI(blob_table_get_ref_count(&copy, i), 1);
+
+		TEST_ASSERT(blob_table_get_index(&copy, blobs[i],
+						 blob_sizes[i], &idx) == 0);
+		TEST_EQUAL_UI(idx, i);
+	}
+
+	blob_table_cleanup(&copy);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * sha256.c
+ *
+ * Copyright (C) 2022 David Oberhollenzer <goliath@infraroot.at>
+ */
+#include "config.h"
+
+#include "util.h"
+#include "../test.h"
+
+static const struct {
+	const char *plaintext;
+	const char *digest;
+} test_vectors[] = {
+	{
+		.plaintext = "",
+		.digest = "e3b0c44298fc1c149afbf4c8996fb924"
+		"27ae41e4649b934ca495991b7852b855",
+	},
+	{
+		.plaintext = "abc",
+		.digest = "ba7816bf8f01cfea414140de5dae2223"
+		"b00361a396177a9cb410ff61f20015ad",
+	},
+	{
+		.plaintext = "abcdbcdecdefdefgefghfghighijhijk"
+		"ijkljklmklmnlmnomnopnopq",
+		.digest = "248d6a61d20638b8e5c026930c3e6039"
+		"a33ce45964ff2167f6ecedd419db06c1",
+	},
+};
+
+static void to_hex(const sqfs_u8 *digest, char *out)
+{
+	size_t i;
+
+	for (i = 0; i < SHA256_SIZE; ++i)
+		sprintf(out + i * 2, "%02x", digest[i]);
+}
+
+int main(int argc, char **argv)
+{
+	sqfs_u8 digest[SHA256_SIZE];
+	char hex[SHA256_SIZE * 2 + 1];
+	char *buffer;
+	size_t i;
+	(void)argc; (void)argv;
+
+	for (i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); ++i) {
+		sha256(test_vectors[i].plaintext,
+		       strlen(test_vectors[i].plaintext), digest);
+		to_hex(digest, hex);
+
+		TEST_STR_EQUAL(hex, test_vectors[i].digest);
+	}
+
+	/* one million times 'a' */
+	buffer = malloc(1000000);
+	TEST_NOT_NULL(buffer);
+	memset(buffer, 'a', 1000000);
+
+	sha256(buffer, 1000000, digest);
+	to_hex(digest, hex);
+	free(buffer);
+
+	TEST_STR_EQUAL(hex, "cdc76e5c9914fb9281a1c7e284d73e67"
+		       "f1809a48a497200e046d39ccc7112cd0");
+	return EXIT_SUCCESS;
+}